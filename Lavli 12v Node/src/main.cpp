@@ -1,18 +1,37 @@
 #include <Arduino.h>
 #include <driver/twai.h>
+#include <soc/gpio_reg.h>
+#include <esp_timer.h>
+#include <driver/ledc.h>
+#include <driver/gpio.h>
+#include <LavliProfiler.h>
+#include <LavliBoot.h>
+#include <LavliLog.h>
+#include <LavliCanFilter.h>
+#include <LavliCanIds.h>
+#include <LavliCanHeartbeat.h>
+#include <LavliCanIsoTp.h>
+#include <LavliCanOta.h>
 
 // #define DC_12V_BOARD
 #define AC_120V_BOARD
 
+#define FIRMWARE_VERSION_MAJOR 1
+#define FIRMWARE_VERSION_MINOR 0
+
 // CAN pins - using valid ESP32-S3 GPIO pins
 #define CAN_TX_PIN GPIO_NUM_4
 #define CAN_RX_PIN GPIO_NUM_5
 
-// Device CAN address - Change this for each device on your network
-#define MY_CAN_ADDRESS 0x543
+// loop() waits this long for a frame instead of sleeping, then handles up
+// to CAN_RX_BATCH frames so firmware updates are not held to one per pass
+#define CAN_RX_WAIT_MS 10
+#define CAN_RX_BATCH   8
+
 
 // Port pin definitions - Map port numbers to GPIO pins
 #ifdef DC_12V_BOARD
+#define MY_NODE_ID LAVLI_NODE_OUTPUT_12V
 #define MAX_PORTS 3
 #define PORT_1_PIN GPIO_NUM_14
 #define PORT_2_PIN GPIO_NUM_15
@@ -28,6 +47,7 @@ const int port_pins[MAX_PORTS + 1] = {
 #endif
 
 #ifdef AC_120V_BOARD
+#define MY_NODE_ID LAVLI_NODE_OUTPUT_120V
 #define MAX_PORTS 2
 #define PORT_1_PIN GPIO_NUM_18
 #define PORT_2_PIN GPIO_NUM_17
@@ -51,52 +71,193 @@ const int port_pins[MAX_PORTS + 1] = {
 // Message command definitions
 #define ACTIVATE_CMD   0x01
 #define DEACTIVATE_CMD 0x02
+#define SET_OUTPUTS_CMD 0x07  // [0x07, mask, value]; bit n = port n, bit 0 unused
+#define PULSE_CMD      0x0D   // [0x0D, mask, ms x 3]: ports in mask on for ms, then off
+#define SEQUENCE_CMD   0x0E   // Bulk: [0x0E, mask, runs, (value, ms x 2) x n], then off
+#define PWM_CONFIG_CMD 0x0F   // DC board: [0x0F, port, freq Hz x 2, duty x 2, ramp ms x 2]
+#define PWM_STATUS_CMD 0x14   // DC board: [0x14, port]
 
 // Response command definitions
 #define ACK_ACTIVATE   0x10
 #define ACK_DEACTIVATE 0x11
+#define ACK_OUTPUTS    0x12   // [0x12, port state, status], same bit layout
+#define ACK_TIMED_DONE 0x13   // [0x13, kind, mask, status, port state, elapsed ms x 3]
+#define ACK_PWM_CONFIG 0x15   // [0x15, port, status]
+#define PWM_STATUS_DATA 0x16  // [0x16, port, flags, duty x 2, current duty x 2]
 #define ERROR_RESPONSE 0xFF
 
+// Timed outputs: pulses and sequences run on the node's own clock. A pulse
+// or sequence owns the ports in its mask until it ends, when they go off;
+// any later command that touches one of them cancels it first.
+#define TIMED_MAX_PROGRAMS 4
+#define TIMED_MAX_STEPS    16
+#define TIMED_MAX_MS       0xFFFFFF  // Longest pulse, ~4.6 h
+#define TIMED_SLACK_US     50        // Steps due this close together switch in one wake
+#define TIMED_COMPLETE     0x00
+#define TIMED_CANCELLED    0x01
+#define TIMED_NO_SLOT      0x04      // ACK_OUTPUTS status: too many programs running
+
+// PWM on the DC ports. A port given a frequency is handed to its own LEDC
+// timer and channel; "on" then means its configured duty, reached over the
+// soft-start ramp by the LEDC hardware fade, and "off" is immediate. A
+// frequency of 0 puts the port back to plain on/off. A new frequency is
+// refused with PWM_BUSY while a ramp is running. Duties are in permille
+// of full on. Big-endian fields, like the rest of the protocol.
+#define PWM_DUTY_FULL      1000
+#define PWM_MIN_FREQ_HZ    10
+#define PWM_MAX_FREQ_HZ    40000
+#define PWM_SRC_CLK_HZ     80000000  // APB, the LEDC clock
+#define PWM_MAX_RES_BITS   14        // Widest LEDC timer on the S3
+#define PWM_FADE_MARGIN_US 2000      // Past the ramp before the fade is surely done
+#define PWM_BUSY           0x06      // ACK_PWM_CONFIG status: new frequency during a fade
+#define PWM_FLAG_ENABLED   0x01
+#define PWM_FLAG_ON        0x02
+#define PWM_FLAG_RAMPING   0x04
+
 // Function prototypes
 bool initializeCAN();
 void initializePorts();
 bool activatePort(int port_number);
 bool deactivatePort(int port_number);
-void receiveCANMessages();
+void deactivateAllPorts();
+bool setOutputs(uint8_t mask, uint8_t value);
+uint8_t outputState();
+bool outputsBusy();
+bool sendOutputsAck(uint8_t status);
+bool initializeTimedOutputs();
+uint8_t startTimedOutputs(uint8_t kind, uint8_t mask, uint8_t runs, const struct TimedStep* steps, uint8_t count);
+void cancelTimedOutputs(uint8_t mask);
+void serviceTimedOutputs();
+bool sendTimedDone(uint8_t kind, uint8_t mask, uint8_t status, uint32_t elapsed_ms);
+void handlePulse(const uint8_t* data, uint8_t length);
+void handleSequence(const uint8_t* data, uint16_t length);
+bool initializePwm();
+uint8_t configurePwm(int port_number, uint16_t freq_hz, uint16_t duty, uint16_t ramp_ms);
+void syncPwmOutputs();
+void stopPwmOutputs();
+void syncPwmOutputsFromTimer();
+bool pwmSyncPending();
+bool sendPwmStatus(uint8_t port);
+void receiveCANMessages(TickType_t wait);
 void processReceivedMessage(twai_message_t* message);
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length);
 bool sendResponse(uint8_t command, uint8_t port, uint8_t status);
 int getGPIOForPort(int port_number);
+void checkSerialCommands();
 
 
 
 // Port status tracking
 bool port_status[MAX_PORTS + 1] = {false}; // All ports start deactivated
 
+// Port bitmask to output register bits, per GPIO bank; built once from
+// port_pins so setOutputs() is a single register write per bank
+uint32_t port_reg_bits[MAX_PORTS + 1][2];
+portMUX_TYPE output_lock = portMUX_INITIALIZER_UNLOCKED;
+
+struct TimedStep {
+  uint8_t value;          // Port bits, within the program's mask
+  uint32_t ms;
+};
+
+struct TimedProgram {
+  bool running;
+  bool finished;          // Ended; its ACK_TIMED_DONE has not gone out yet
+  uint8_t kind;           // PULSE_CMD or SEQUENCE_CMD
+  uint8_t mask;
+  uint8_t status;         // TIMED_COMPLETE or TIMED_CANCELLED
+  uint8_t step_count;
+  uint8_t step;
+  uint8_t runs_left;      // Passes through the steps after this one
+  TimedStep steps[TIMED_MAX_STEPS];
+  int64_t started_us;
+  int64_t due_us;         // When the current step ends
+  int64_t ended_us;
+};
+
+// Shared with the esp_timer task; guarded by output_lock
+TimedProgram timed[TIMED_MAX_PROGRAMS];
+esp_timer_handle_t timed_timer = NULL;
+
+#ifdef DC_12V_BOARD
+struct PwmPort {
+  uint16_t freq_hz;       // 0 = plain on/off output
+  uint16_t duty;          // Permille while on
+  uint16_t ramp_ms;       // Soft-start from off to duty
+  uint8_t bits;           // LEDC duty resolution for freq_hz
+  bool driven;            // LEDC output running
+  uint16_t driven_duty;   // Duty it was last sent towards
+  int64_t fade_until_us;  // A hardware fade may still be running until then
+};
+
+// Port n uses LEDC timer and channel n - 1. LEDC calls that can wait
+// (channel setup, duty updates, fades) are only made from the loop. The
+// esp_timer task only stops channels, which takes nothing but the LEDC
+// spinlock; pwm_lock keeps both sides' view of `driven` in step.
+PwmPort pwm_ports[MAX_PORTS + 1];
+portMUX_TYPE pwm_lock = portMUX_INITIALIZER_UNLOCKED;
+volatile bool pwm_sync_pending = false;  // Starts left to the loop by the timer
+#endif
+
 // CAN configuration
 twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_PIN, TWAI_MODE_NORMAL);
 twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();  // 500kbps
 twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
+// Multicast groups this node belongs to
+const uint8_t my_groups[] = { LAVLI_GROUP_ACTUATORS };
+
+// IDs this node listens to; everything else is rejected by the controller.
+// Deactivate is also accepted on the safety class so stops win arbitration;
+// group and broadcast stops arrive on the safety class too, DISCOVER on
+// status and firmware updates on bulk
+const uint16_t subscribed_ids[] = {
+  canRequestId(CAN_CLASS_SAFETY, MY_NODE_ID),
+  canRequestId(CAN_CLASS_CONTROL, MY_NODE_ID),
+  canRequestId(CAN_CLASS_BULK, MY_NODE_ID),
+  canRequestId(CAN_CLASS_SAFETY, LAVLI_GROUP_ACTUATORS),
+  canRequestId(CAN_CLASS_SAFETY, LAVLI_NODE_BROADCAST),
+  canRequestId(CAN_CLASS_STATUS, LAVLI_NODE_BROADCAST),
+};
+
+// No fixed delays: every output is off and the node is on the bus within
+// a few milliseconds of setup() starting. Prints go through the async log
+// so a slow or absent USB host cannot hold up the boot.
 void setup() {
+  bootPhase("start");
   Serial.begin(115200);
-  Serial.printf("CAN Receiver Device - Address: 0x%03X\n", MY_CAN_ADDRESS);
+  logBegin(Serial);
+  LOG_INFO("CAN Receiver Device - Node: 0x%02X", MY_NODE_ID);
 
-  delay(5000);
-
-  for(int i = 0; i < 10; i++){
-    Serial.println("Test");
-    delay(100);
-  }
-  
-  // // Initialize port pins
+  // Outputs to a known OFF state before anything can switch them
   initializePorts();
+  if (!initializeTimedOutputs()) {
+    LOG_ERROR("Timed output timer failed to start");
+  }
+  if (!initializePwm()) {
+    LOG_ERROR("PWM fade service failed to start");
+  }
+  bootPhase("ports");
   
-  // // Initialize CAN
   if (initializeCAN()) {
-    Serial.println("CAN initialized successfully");
-    Serial.println("Ready to receive commands...");
+#ifdef DC_12V_BOARD
+    heartbeatBegin(MY_NODE_ID, LAVLI_TYPE_OUTPUT, FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR,
+                   LAVLI_CAP_OUTPUTS | LAVLI_CAP_PWM | LAVLI_CAP_OTA, MAX_PORTS);
+#else
+    heartbeatBegin(MY_NODE_ID, LAVLI_TYPE_OUTPUT, FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR,
+                   LAVLI_CAP_OUTPUTS | LAVLI_CAP_OTA, MAX_PORTS);
+#endif
+    bootPhase("can");
+    bootCanReady();
+    isoTpBeginNode(MY_NODE_ID, onBulkMessage);
+    otaBegin(outputsBusy);
+    // Up on the bus: keep this firmware if it was just updated
+    otaConfirmBoot();
+    bootPhase("ota");
+    heartbeatBootReport(bootResetReason(), bootCanReadyMs(), bootSetupMs());
+    LOG_INFO("Ready: CAN at %d ms, setup done at %d ms", bootCanReadyMs(), bootSetupMs());
   } else {
-    Serial.println("CAN initialization failed");
+    LOG_ERROR("CAN initialization failed");
   }
 }
 
@@ -104,9 +265,29 @@ void loop() {
   // Serial.println("Looping...");
   // delay(1000);
 
-  // Continuously listen for CAN messages
-  receiveCANMessages();
-  delay(10); // Small delay to prevent overwhelming the CPU
+  // Wait for a CAN message instead of sleeping between passes, unless a
+  // bulk transfer has frames ready to go
+  receiveCANMessages(isoTpTxReady() || pwmSyncPending() ? 0 : pdMS_TO_TICKS(CAN_RX_WAIT_MS));
+
+  {
+    PROFILE_SCOPE("loop");
+
+    // "profile" / "profile_reset" / "ota" / "boot" over USB serial
+    checkSerialCommands();
+
+    // Acks for pulses and sequences the timer has finished
+    serviceTimedOutputs();
+
+    // Soft-starts from the timer, or that had to wait for an earlier fade
+    syncPwmOutputs();
+
+    // Presence heartbeat to the master
+    heartbeatService();
+
+    // Bulk transfers and firmware updates
+    isoTpService();
+    otaService();
+  }
 
   // digitalWrite(PORT_1_PIN, HIGH);
   // digitalWrite(PORT_2_PIN, HIGH);
@@ -131,25 +312,25 @@ void loop() {
 }
 
 bool initializeCAN() {
+  f_config = canFilterForIds(subscribed_ids, sizeof(subscribed_ids) / sizeof(subscribed_ids[0]));
+
   // Install TWAI driver
   if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK) {
-    Serial.println("Failed to install TWAI driver");
+    LOG_ERROR("[CAN] Failed to install TWAI driver");
     return false;
   }
   
   // Start TWAI driver
   if (twai_start() != ESP_OK) {
-    Serial.println("Failed to start TWAI driver");
+    LOG_ERROR("[CAN] Failed to start TWAI driver");
     return false;
   }
   
-  Serial.println("TWAI driver installed and started");
+  LOG_INFO("[CAN] TWAI driver installed and started");
   return true;
 }
 
 void initializePorts() {
-  Serial.println("Initializing port pins...");
-  
   for (int port = 1; port <= MAX_PORTS; port++) {
     int gpio_pin = getGPIOForPort(port);
     if (gpio_pin != -1) {
@@ -157,11 +338,11 @@ void initializePorts() {
       
       digitalWrite(gpio_pin, LOW); // Start with all ports OFF
       port_status[port] = false;
-      Serial.printf("Port %d -> GPIO %d initialized (OFF)\n", port, gpio_pin);
+      port_reg_bits[port][0] = gpio_pin < 32 ? 1UL << gpio_pin : 0;
+      port_reg_bits[port][1] = gpio_pin < 32 ? 0 : 1UL << (gpio_pin - 32);
+      LOG_DEBUG("Port %d -> GPIO %d initialized (OFF)", port, gpio_pin);
     }
   }
-  
-  Serial.println("Port initialization complete");
 }
 
 int getGPIOForPort(int port_number) {
@@ -172,75 +353,546 @@ int getGPIOForPort(int port_number) {
 }
 
 bool activatePort(int port_number) {
-  Serial.println("ACTIVATE PORT");
-
   int gpio_pin = getGPIOForPort(port_number);
   
   if (gpio_pin == -1) {
-    Serial.printf("ERROR: Invalid port number %d\n", port_number);
+    LOG_ERROR("Invalid port number %d", port_number);
     return false;
   }
   
-  digitalWrite(gpio_pin, HIGH);
+  setOutputs(1 << port_number, 0xFF);
   // Serial.println(gpio_pin + " set to HIGH");
-  port_status[port_number] = true;
-  Serial.printf("Port %d (GPIO %d) ACTIVATED\n", port_number, gpio_pin);
+  LOG_INFO("Port %d (GPIO %d) ACTIVATED", port_number, gpio_pin);
   return true;
 }
 
 bool deactivatePort(int port_number) {
-  Serial.println("DEACTIVATE PORT");
-
   int gpio_pin = getGPIOForPort(port_number);
   
   if (gpio_pin == -1) {
-    Serial.printf("ERROR: Invalid port number %d\n", port_number);
+    LOG_ERROR("Invalid port number %d", port_number);
     return false;
   }
   
-  digitalWrite(gpio_pin, LOW);
+  setOutputs(1 << port_number, 0x00);
   // Serial.println(gpio_pin + " set to LOW");
-  port_status[port_number] = false;
-  Serial.printf("Port %d (GPIO %d) DEACTIVATED\n", port_number, gpio_pin);
+  LOG_INFO("Port %d (GPIO %d) DEACTIVATED", port_number, gpio_pin);
   return true;
 }
 
-void receiveCANMessages() {
+// All ports off in the same instant
+void deactivateAllPorts() {
+  setOutputs(0xFF, 0x00);
+  LOG_INFO("All ports DEACTIVATED");
+}
+
+// Applies value to the ports selected by mask with one write to the output
+// register, so every edge in the batch happens together. Ports on the same
+// bank (all of them on both boards) switch simultaneously; a second bank,
+// if a board ever used one, follows a few cycles later. Caller holds
+// output_lock.
+void applyOutputs(uint8_t mask, uint8_t value) {
+  uint32_t clear[2] = {0, 0};
+  uint32_t set[2] = {0, 0};
+  for (int port = 1; port <= MAX_PORTS; port++) {
+    if (!(mask & (1 << port))) continue;
+    for (int bank = 0; bank < 2; bank++) {
+      clear[bank] |= port_reg_bits[port][bank];
+      if (value & (1 << port)) set[bank] |= port_reg_bits[port][bank];
+    }
+  }
+
+  if (clear[0]) REG_WRITE(GPIO_OUT_REG, (REG_READ(GPIO_OUT_REG) & ~clear[0]) | set[0]);
+  if (clear[1]) REG_WRITE(GPIO_OUT1_REG, (REG_READ(GPIO_OUT1_REG) & ~clear[1]) | set[1]);
+
+  for (int port = 1; port <= MAX_PORTS; port++) {
+    if (mask & (1 << port)) port_status[port] = (value & (1 << port)) != 0;
+  }
+}
+
+// PWM ports follow on from syncPwmOutputs(), outside the lock
+bool setOutputs(uint8_t mask, uint8_t value) {
+  portENTER_CRITICAL(&output_lock);
+  applyOutputs(mask, value);
+  portEXIT_CRITICAL(&output_lock);
+  syncPwmOutputs();
+  return true;
+}
+
+uint8_t outputState() {
+  uint8_t state = 0;
+  for (int port = 1; port <= MAX_PORTS; port++) {
+    if (port_status[port]) state |= 1 << port;
+  }
+  return state;
+}
+
+// ---- Timed outputs ----
+// One esp_timer serves every program, armed for whichever step ends first.
+// The edges are made in the timer task, so a pulse is as long as asked
+// whatever the loop and the bus are doing; the loop only sends the acks.
+
+// Caller holds output_lock
+void armTimedLocked() {
+  int64_t next = INT64_MAX;
+  for (int i = 0; i < TIMED_MAX_PROGRAMS; i++) {
+    if (timed[i].running && timed[i].due_us < next) next = timed[i].due_us;
+  }
+  esp_timer_stop(timed_timer);
+  if (next != INT64_MAX) {
+    int64_t wait = next - esp_timer_get_time();
+    esp_timer_start_once(timed_timer, wait > 0 ? wait : 0);
+  }
+}
+
+// Caller holds output_lock. Ports in off_mask go off.
+void finishTimedLocked(TimedProgram& program, uint8_t status, uint8_t off_mask, int64_t now) {
+  applyOutputs(off_mask, 0x00);
+  program.running = false;
+  program.finished = true;
+  program.status = status;
+  program.ended_us = now;
+}
+
+void onTimedOutputs(void*) {
+  portENTER_CRITICAL(&output_lock);
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < TIMED_MAX_PROGRAMS; i++) {
+    TimedProgram& p = timed[i];
+    // Steps follow on from when the last one was due, not from when the
+    // timer woke, so wake-up latency does not add up over a sequence
+    while (p.running && p.due_us <= now + TIMED_SLACK_US) {
+      int64_t at = p.due_us;
+      if (++p.step >= p.step_count) {
+        if (p.runs_left == 0) {
+          finishTimedLocked(p, TIMED_COMPLETE, p.mask, now);
+          break;
+        }
+        p.runs_left--;
+        p.step = 0;
+      }
+      applyOutputs(p.mask, p.steps[p.step].value);
+      p.due_us = at + p.steps[p.step].ms * 1000LL;
+    }
+  }
+  armTimedLocked();
+  portEXIT_CRITICAL(&output_lock);
+  syncPwmOutputsFromTimer();
+}
+
+bool initializeTimedOutputs() {
+  memset(timed, 0, sizeof(timed));
+  esp_timer_create_args_t args = {};
+  args.callback = onTimedOutputs;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "timed_out";
+  return esp_timer_create(&args, &timed_timer) == ESP_OK;
+}
+
+// Programs owning any port in mask end as cancelled. Their other ports go
+// off; the ones in mask are left for the command that cancelled them.
+void cancelTimedOutputs(uint8_t mask) {
+  portENTER_CRITICAL(&output_lock);
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < TIMED_MAX_PROGRAMS; i++) {
+    if (timed[i].running && (timed[i].mask & mask)) {
+      finishTimedLocked(timed[i], TIMED_CANCELLED, timed[i].mask & ~mask, now);
+    }
+  }
+  armTimedLocked();
+  portEXIT_CRITICAL(&output_lock);
+  syncPwmOutputs();
+}
+
+// Returns an ACK_OUTPUTS status
+uint8_t startTimedOutputs(uint8_t kind, uint8_t mask, uint8_t runs, const TimedStep* steps, uint8_t count) {
+  cancelTimedOutputs(mask);
+  // Acks for whatever was cancelled go first, and free their slots
+  serviceTimedOutputs();
+
+  portENTER_CRITICAL(&output_lock);
+  TimedProgram* program = NULL;
+  for (int i = 0; i < TIMED_MAX_PROGRAMS && program == NULL; i++) {
+    if (!timed[i].running && !timed[i].finished) program = &timed[i];
+  }
+  if (program == NULL) {
+    portEXIT_CRITICAL(&output_lock);
+    return TIMED_NO_SLOT;
+  }
+  program->kind = kind;
+  program->mask = mask;
+  program->step_count = count;
+  program->step = 0;
+  program->runs_left = runs - 1;
+  for (uint8_t i = 0; i < count; i++) {
+    program->steps[i].value = steps[i].value & mask;
+    program->steps[i].ms = steps[i].ms;
+  }
+  program->started_us = esp_timer_get_time();
+  program->due_us = program->started_us + program->steps[0].ms * 1000LL;
+  program->running = true;
+  applyOutputs(mask, program->steps[0].value);
+  armTimedLocked();
+  portEXIT_CRITICAL(&output_lock);
+  syncPwmOutputs();
+  return 0x00;
+}
+
+// A restart drops every output and any pulse or sequence with no
+// ACK_TIMED_DONE, so updates wait until everything is off
+bool outputsBusy() {
+  if (outputState() != 0) return true;
+  for (int i = 0; i < TIMED_MAX_PROGRAMS; i++) {
+    if (timed[i].running) return true;
+  }
+  return false;
+}
+
+// Sends ACK_TIMED_DONE for every program that has ended
+void serviceTimedOutputs() {
+  for (int i = 0; i < TIMED_MAX_PROGRAMS; i++) {
+    portENTER_CRITICAL(&output_lock);
+    if (!timed[i].finished) {
+      portEXIT_CRITICAL(&output_lock);
+      continue;
+    }
+    uint8_t kind = timed[i].kind;
+    uint8_t mask = timed[i].mask;
+    uint8_t status = timed[i].status;
+    int64_t elapsed_us = timed[i].ended_us - timed[i].started_us;
+    timed[i].finished = false;
+    portEXIT_CRITICAL(&output_lock);
+
+    uint32_t elapsed_ms = (uint32_t)min(elapsed_us / 1000, (int64_t)TIMED_MAX_MS);
+    LOG_INFO("Timed 0x%02X on mask 0x%02X %s after %d ms", kind, mask,
+             status == TIMED_COMPLETE ? "done" : "cancelled", elapsed_ms);
+    sendTimedDone(kind, mask, status, elapsed_ms);
+  }
+}
+
+uint8_t validPortMask() {
+  return ((1 << (MAX_PORTS + 1)) - 1) & ~1;
+}
+
+// [0x0D, mask, ms (3 bytes, big endian)]
+void handlePulse(const uint8_t* data, uint8_t length) {
+  if (length < 5) {
+    sendOutputsAck(0x01); // Error: Invalid message length
+    return;
+  }
+  TimedStep step;
+  step.value = data[1];
+  step.ms = ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | data[4];
+  if (data[1] == 0 || (data[1] & ~validPortMask()) || step.ms == 0) {
+    sendOutputsAck(0x02); // Error: no ports, a port this board lacks, or no duration
+    return;
+  }
+  sendOutputsAck(startTimedOutputs(PULSE_CMD, data[1], 1, &step, 1));
+}
+
+// [0x0E, mask, runs, (value, ms (2 bytes, big endian)) x n], over ISO-TP
+// since a useful sequence does not fit one frame
+void handleSequence(const uint8_t* data, uint16_t length) {
+  uint16_t count = length >= 3 ? (length - 3) / 3 : 0;
+  if (length < 6 || (length - 3) % 3 != 0 || count > TIMED_MAX_STEPS) {
+    sendOutputsAck(0x01); // Error: Invalid message length
+    return;
+  }
+  uint8_t mask = data[1];
+  uint8_t runs = data[2];
+  bool valid = mask != 0 && !(mask & ~validPortMask()) && runs != 0;
+
+  TimedStep steps[TIMED_MAX_STEPS];
+  for (uint16_t i = 0; i < count; i++) {
+    const uint8_t* in = data + 3 + i * 3;
+    steps[i].value = in[0];
+    steps[i].ms = ((uint32_t)in[1] << 8) | in[2];
+    if (steps[i].ms == 0) valid = false;
+  }
+  if (!valid) {
+    sendOutputsAck(0x02); // Error: bad ports, no runs or an empty step
+    return;
+  }
+  sendOutputsAck(startTimedOutputs(SEQUENCE_CMD, mask, runs, steps, count));
+}
+
+// ---- PWM (DC board) ----
+
+#ifdef DC_12V_BOARD
+bool initializePwm() {
+  memset(pwm_ports, 0, sizeof(pwm_ports));
+  return ledc_fade_func_install(0) == ESP_OK;
+}
+
+uint32_t pwmHardwareDuty(const PwmPort& pwm, uint16_t duty) {
+  return ((uint32_t)duty << pwm.bits) / PWM_DUTY_FULL;
+}
+
+// Returns an ACK_PWM_CONFIG status. Loop only.
+uint8_t configurePwm(int port_number, uint16_t freq_hz, uint16_t duty, uint16_t ramp_ms) {
+  int gpio_pin = getGPIOForPort(port_number);
+  if (gpio_pin == -1) return 0x02; // Error: Invalid port
+  if (duty > PWM_DUTY_FULL || (freq_hz != 0 && (freq_hz < PWM_MIN_FREQ_HZ || freq_hz > PWM_MAX_FREQ_HZ))) {
+    return 0x04; // Error: Out of range
+  }
+
+  ledc_channel_t channel = (ledc_channel_t)(port_number - 1);
+  ledc_timer_t timer = (ledc_timer_t)(port_number - 1);
+  PwmPort& pwm = pwm_ports[port_number];
+
+  if (freq_hz == 0) {
+    // Back to the GPIO output register, which has tracked the port all along
+    portENTER_CRITICAL(&pwm_lock);
+    bool was_pwm = pwm.freq_hz != 0;
+    if (was_pwm) ledc_stop(LEDC_LOW_SPEED_MODE, channel, 0);
+    pwm.freq_hz = 0;
+    pwm.driven = false;
+    pwm.driven_duty = 0;
+    pwm.duty = duty;
+    pwm.ramp_ms = ramp_ms;
+    portEXIT_CRITICAL(&pwm_lock);
+    if (was_pwm) gpio_set_direction((gpio_num_t)gpio_pin, GPIO_MODE_OUTPUT);
+    return 0x00;
+  }
+
+  if (freq_hz != pwm.freq_hz) {
+    // Setting up the channel waits for a fade in progress to finish
+    if (esp_timer_get_time() < pwm.fade_until_us) return PWM_BUSY;
+
+    // Finest resolution the frequency leaves room for
+    uint8_t bits = 1;
+    while (bits < PWM_MAX_RES_BITS && ((uint32_t)freq_hz << (bits + 1)) <= PWM_SRC_CLK_HZ) bits++;
+
+    ledc_timer_config_t timer_config = {};
+    timer_config.speed_mode = LEDC_LOW_SPEED_MODE;
+    timer_config.duty_resolution = (ledc_timer_bit_t)bits;
+    timer_config.timer_num = timer;
+    timer_config.freq_hz = freq_hz;
+    timer_config.clk_cfg = LEDC_AUTO_CLK;
+
+    // The channel starts at 0 and soft-starts from there if the port is on
+    ledc_channel_config_t channel_config = {};
+    channel_config.gpio_num = gpio_pin;
+    channel_config.speed_mode = LEDC_LOW_SPEED_MODE;
+    channel_config.channel = channel;
+    channel_config.intr_type = LEDC_INTR_DISABLE;
+    channel_config.timer_sel = timer;
+    channel_config.duty = 0;
+    channel_config.hpoint = 0;
+
+    if (ledc_timer_config(&timer_config) != ESP_OK || ledc_channel_config(&channel_config) != ESP_OK) {
+      return 0x05; // Error: LEDC rejected the setting
+    }
+    portENTER_CRITICAL(&pwm_lock);
+    pwm.bits = bits;
+    pwm.driven = true;
+    pwm.driven_duty = 0;
+    portEXIT_CRITICAL(&pwm_lock);
+  }
+
+  portENTER_CRITICAL(&pwm_lock);
+  pwm.freq_hz = freq_hz;
+  pwm.duty = duty;
+  pwm.ramp_ms = ramp_ms;
+  portEXIT_CRITICAL(&pwm_lock);
+
+  syncPwmOutputs();
+  return 0x00;
+}
+
+// Stops the LEDC channel of every PWM port that is now off. Never waits:
+// ledc_stop() only takes the driver's spinlock, so this is what turns PWM
+// ports off from the esp_timer task and for STOP_ALL.
+void stopPwmOutputs() {
+  portENTER_CRITICAL(&pwm_lock);
+  for (int port = 1; port <= MAX_PORTS; port++) {
+    PwmPort& pwm = pwm_ports[port];
+    if (pwm.freq_hz == 0 || !pwm.driven || port_status[port]) continue;
+    ledc_stop(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(port - 1), 0);
+    pwm.driven = false;
+    pwm.driven_duty = 0;
+  }
+  portEXIT_CRITICAL(&pwm_lock);
+}
+
+// The esp_timer task's part of a sync: ports that went off stop now, ports
+// that went on are started by the loop, since starting one can wait
+void syncPwmOutputsFromTimer() {
+  stopPwmOutputs();
+  pwm_sync_pending = true;
+}
+
+bool pwmSyncPending() {
+  return pwm_sync_pending;
+}
+
+// Brings every PWM port's LEDC channel in line with its on/off state. Loop
+// only. Turning off is immediate. A soft-start, or a duty change while on,
+// is a hardware fade over the port's ramp; one asked for while an earlier
+// fade is still running waits for it (the LEDC driver would block), and
+// the loop's next pass starts it. A start without a ramp sets the duty and
+// latches it, without ledc_set_duty_and_update(), which waits for the end
+// of the PWM period.
+void syncPwmOutputs() {
+  pwm_sync_pending = false;
+  stopPwmOutputs();
+
+  int64_t now = esp_timer_get_time();
+  for (int port = 1; port <= MAX_PORTS; port++) {
+    PwmPort& pwm = pwm_ports[port];
+    ledc_channel_t channel = (ledc_channel_t)(port - 1);
+
+    portENTER_CRITICAL(&pwm_lock);
+    bool start = pwm.freq_hz != 0 && port_status[port] && !(pwm.driven && pwm.driven_duty == pwm.duty);
+    bool restart = !pwm.driven;
+    portEXIT_CRITICAL(&pwm_lock);
+    if (!start || now < pwm.fade_until_us) continue;
+
+    if (restart) {
+      // ledc_stop() left the output idle; restart it from zero
+      ledc_set_duty(LEDC_LOW_SPEED_MODE, channel, 0);
+      ledc_update_duty(LEDC_LOW_SPEED_MODE, channel);
+    }
+    uint32_t target = pwmHardwareDuty(pwm, pwm.duty);
+    if (pwm.ramp_ms > 0) {
+      ledc_set_fade_time_and_start(LEDC_LOW_SPEED_MODE, channel, target, pwm.ramp_ms, LEDC_FADE_NO_WAIT);
+      pwm.fade_until_us = now + pwm.ramp_ms * 1000LL + PWM_FADE_MARGIN_US;
+    } else {
+      ledc_set_duty(LEDC_LOW_SPEED_MODE, channel, target);
+      ledc_update_duty(LEDC_LOW_SPEED_MODE, channel);
+    }
+
+    portENTER_CRITICAL(&pwm_lock);
+    if (port_status[port]) {
+      pwm.driven = true;
+      pwm.driven_duty = pwm.duty;
+    } else {
+      // The timer turned it off while it was starting
+      ledc_stop(LEDC_LOW_SPEED_MODE, channel, 0);
+    }
+    portEXIT_CRITICAL(&pwm_lock);
+  }
+}
+
+// Reads the duty back from the LEDC hardware, so a soft-start in progress
+// shows where the ramp has got to
+bool sendPwmStatus(uint8_t port) {
+  twai_message_t response;
+  response.identifier = canResponseId(CAN_CLASS_STATUS, MY_NODE_ID);
+  response.extd = 0;
+  response.rtr = 0;
+  response.data_length_code = 7;
+  response.data[0] = PWM_STATUS_DATA;
+  response.data[1] = port;
+
+  portENTER_CRITICAL(&pwm_lock);
+  const PwmPort& pwm = pwm_ports[port];
+  uint8_t flags = 0;
+  uint16_t current = 0;
+  if (pwm.freq_hz != 0) {
+    flags |= PWM_FLAG_ENABLED;
+    if (pwm.driven) {
+      uint32_t raw = ledc_get_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(port - 1));
+      current = (raw * PWM_DUTY_FULL + (1UL << (pwm.bits - 1))) >> pwm.bits;
+    }
+    if (esp_timer_get_time() < pwm.fade_until_us) flags |= PWM_FLAG_RAMPING;
+  } else {
+    current = port_status[port] ? PWM_DUTY_FULL : 0;
+  }
+  if (port_status[port]) flags |= PWM_FLAG_ON;
+  uint16_t duty = pwm.freq_hz != 0 ? pwm.duty : PWM_DUTY_FULL;
+  portEXIT_CRITICAL(&pwm_lock);
+
+  response.data[2] = flags;
+  response.data[3] = (duty >> 8) & 0xFF;
+  response.data[4] = duty & 0xFF;
+  response.data[5] = (current >> 8) & 0xFF;
+  response.data[6] = current & 0xFF;
+
+  if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
+    LOG_CAN_TX(response);
+    return true;
+  }
+  LOG_ERROR("Failed to send response");
+  return false;
+}
+#else
+// The 120V board switches relays; there is nothing to modulate
+bool initializePwm() { return true; }
+void syncPwmOutputs() {}
+void stopPwmOutputs() {}
+void syncPwmOutputsFromTimer() {}
+bool pwmSyncPending() { return false; }
+#endif
+
+void receiveCANMessages(TickType_t wait) {
   twai_message_t message;
   
-  // Check for incoming messages (non-blocking)
-  if (twai_receive(&message, 0) == ESP_OK) {
-    // Only process messages addressed to this device
-    if (message.identifier == MY_CAN_ADDRESS) {
-      Serial.printf("Received message for my address (0x%03X): ", message.identifier);
-      
-      for (int i = 0; i < message.data_length_code; i++) {
-        Serial.printf("0x%02X ", message.data[i]);
-      }
-      Serial.println();
+  // Block for the first frame only, then take whatever else is queued
+  for (int i = 0; i < CAN_RX_BATCH && twai_receive(&message, i == 0 ? wait : 0) == ESP_OK; i++) {
+    // The acceptance filter already drops other nodes' traffic; keep the
+    // check in case the filter has to accept a superset of our IDs
+    if (canIdIsRequestForAny(message.identifier, MY_NODE_ID, my_groups, sizeof(my_groups))) {
+      LOG_CAN_RX(message);
       
       // Process the received message
       processReceivedMessage(&message);
     }
-    // Optionally log messages for other devices (for debugging)
-    else {
-      Serial.printf("Message for other device (0x%03X) - ignoring\n", message.identifier);
-    }
   }
 }
 
 void processReceivedMessage(twai_message_t* message) {
+  PROFILE_SCOPE("can_handle");
+  if (isoTpHandleFrame(message->identifier, message->data, message->data_length_code)) return;
+  if (message->data_length_code >= 1 && message->data[0] == LAVLI_CMD_STOP_ALL) {
+    cancelTimedOutputs(0xFF);
+    deactivateAllPorts();
+    sendResponse(ACK_DEACTIVATE, 0, 0x00); // Port 0 = all ports
+    return;
+  }
+  if (message->data_length_code >= 1 && message->data[0] == LAVLI_CMD_DISCOVER) {
+    heartbeatAnnounce();
+    return;
+  }
+
+  // No other group commands apply to output boards, and errors are never
+  // sent back to a group address
+  if (canIdNode(message->identifier) != MY_NODE_ID) return;
+
   if (message->data_length_code < 2) {
-    Serial.println("ERROR: Message too short");
+    LOG_ERROR("Message too short");
     sendResponse(ERROR_RESPONSE, 0, 0x01); // Error: Invalid message length
     return;
   }
   
   uint8_t command = message->data[0];
   uint8_t port = message->data[1];
+
+  if (command == PULSE_CMD) {
+    handlePulse(message->data, message->data_length_code);
+    return;
+  }
+
+  if (command == SET_OUTPUTS_CMD) {
+    uint8_t mask = message->data[1];
+    if (message->data_length_code < 3 || (mask & ~validPortMask())) {
+      sendOutputsAck(0x02); // Error: short frame or a port this board lacks
+      return;
+    }
+    cancelTimedOutputs(mask);
+    setOutputs(mask, message->data[2]);
+    LOG_INFO("Outputs mask 0x%02X value 0x%02X -> state 0x%02X", mask, message->data[2], outputState());
+    sendOutputsAck(0x00);
+    return;
+  }
   
-  Serial.printf("Processing command 0x%02X for port %d\n", command, port);
+  LOG_DEBUG("Processing command 0x%02X for port %d", command, port);
   
+  // A manual command takes the port over from any pulse or sequence
+  if ((command == ACTIVATE_CMD || command == DEACTIVATE_CMD) && getGPIOForPort(port) != -1) {
+    cancelTimedOutputs(1 << port);
+  }
+
   switch (command) {
     case ACTIVATE_CMD:
       if (activatePort(port)) {
@@ -258,18 +910,47 @@ void processReceivedMessage(twai_message_t* message) {
       }
       break;
       
+#ifdef DC_12V_BOARD
+    case PWM_CONFIG_CMD: {
+      if (message->data_length_code < 8) {
+        sendResponse(ERROR_RESPONSE, port, 0x01); // Error: Invalid message length
+        break;
+      }
+      uint16_t freq_hz = (message->data[2] << 8) | message->data[3];
+      uint16_t duty = (message->data[4] << 8) | message->data[5];
+      uint16_t ramp_ms = (message->data[6] << 8) | message->data[7];
+      uint8_t status = configurePwm(port, freq_hz, duty, ramp_ms);
+      if (status == 0x00) {
+        LOG_INFO("Port %d PWM %d Hz, duty %d/1000, ramp %d ms", port, freq_hz, duty, ramp_ms);
+      } else {
+        LOG_ERROR("Port %d PWM setting rejected, status 0x%02X", port, status);
+      }
+      sendResponse(ACK_PWM_CONFIG, port, status);
+      break;
+    }
+
+    case PWM_STATUS_CMD:
+      if (getGPIOForPort(port) == -1) {
+        sendResponse(ERROR_RESPONSE, port, 0x02); // Error: Invalid port
+      } else {
+        sendPwmStatus(port);
+      }
+      break;
+#endif
+
     default:
-      Serial.printf("ERROR: Unknown command 0x%02X\n", command);
+      LOG_ERROR("Unknown command 0x%02X", command);
       sendResponse(ERROR_RESPONSE, port, 0x03); // Error: Unknown command
       break;
   }
 }
 
 bool sendResponse(uint8_t command, uint8_t port, uint8_t status) {
+  PROFILE_SCOPE("can_tx");
   twai_message_t response;
   
   // Configure response message
-  response.identifier = MY_CAN_ADDRESS; // Response from this device's address
+  response.identifier = canResponseId(CAN_CLASS_STATUS, MY_NODE_ID);
   response.extd = 0;           // Standard frame (11-bit ID)
   response.rtr = 0;            // Data frame, not remote request
   response.data_length_code = 3; // 3 bytes of data
@@ -281,11 +962,88 @@ bool sendResponse(uint8_t command, uint8_t port, uint8_t status) {
   
   // Send response
   if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-    Serial.printf("Response sent: Command=0x%02X, Port=%d, Status=0x%02X\n", 
-                  command, port, status);
+    LOG_CAN_TX(response);
+    LOG_DEBUG("Response sent: Command=0x%02X, Port=%d, Status=0x%02X",
+              command, port, status);
     return true;
   } else {
-    Serial.printf("Failed to send response\n");
+    LOG_ERROR("Failed to send response");
     return false;
   }
-}
\ No newline at end of file
+}
+
+// One ack for the whole batch, carrying the state of every port
+bool sendOutputsAck(uint8_t status) {
+  PROFILE_SCOPE("can_tx");
+  twai_message_t response;
+
+  response.identifier = canResponseId(CAN_CLASS_STATUS, MY_NODE_ID);
+  response.extd = 0;
+  response.rtr = 0;
+  response.data_length_code = 3;
+  response.data[0] = ACK_OUTPUTS;
+  response.data[1] = outputState();
+  response.data[2] = status;
+
+  if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
+    LOG_CAN_TX(response);
+    return true;
+  }
+  LOG_ERROR("Failed to send response");
+  return false;
+}
+
+// Sent when a pulse or sequence ends, on its own or cancelled
+bool sendTimedDone(uint8_t kind, uint8_t mask, uint8_t status, uint32_t elapsed_ms) {
+  PROFILE_SCOPE("can_tx");
+  twai_message_t response;
+
+  response.identifier = canResponseId(CAN_CLASS_STATUS, MY_NODE_ID);
+  response.extd = 0;
+  response.rtr = 0;
+  response.data_length_code = 8;
+  response.data[0] = ACK_TIMED_DONE;
+  response.data[1] = kind;
+  response.data[2] = mask;
+  response.data[3] = status;
+  response.data[4] = outputState();
+  response.data[5] = (elapsed_ms >> 16) & 0xFF;
+  response.data[6] = (elapsed_ms >> 8) & 0xFF;
+  response.data[7] = elapsed_ms & 0xFF;
+
+  if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
+    LOG_CAN_TX(response);
+    return true;
+  }
+  LOG_ERROR("Failed to send response");
+  return false;
+}
+
+void checkSerialCommands() {
+  if (!Serial.available()) return;
+
+  String command = Serial.readStringUntil('\n');
+  command.trim();
+
+  if (command == "profile") {
+    profilerPrint(Serial);
+  } else if (command == "profile_reset") {
+    profilerReset();
+    Serial.println("Profile statistics reset");
+  } else if (command == "ota") {
+    otaPrint(Serial);
+  } else if (command == "boot") {
+    bootPrint(Serial);
+    canFilterPrint(Serial, f_config);
+  }
+}
+
+// Reassembled bulk payloads from the master
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length) {
+  if (otaHandleMessage(data, length)) return;
+  if (length >= 1 && data[0] == SEQUENCE_CMD) {
+    handleSequence(data, length);
+    return;
+  }
+  LOG_WARN("Unhandled bulk message 0x%02X (%d bytes)", data[0], length);
+}
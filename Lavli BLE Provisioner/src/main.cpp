@@ -18,11 +18,27 @@ NimBLEAdvertising*    g_advertising   = nullptr;
 NimBLECharacteristic* gStatusChar     = nullptr;
 
 volatile bool g_connectRequested = false;
+volatile bool g_abortRequested   = false;
 volatile bool g_bleActive        = true;
 
+// Connect attempt, driven by WiFi events instead of polling
+enum ConnectState { CONNECT_IDLE, CONNECT_ASSOCIATING, CONNECT_WAITING_IP, CONNECT_DONE };
+const uint32_t CONNECT_BACKSTOP_MS = 30000;   // Only if the driver never reports back
+
+ConnectState g_connectState = CONNECT_IDLE;
+uint32_t     g_connectStart = 0;
+
+// Set from the WiFi event task, consumed in loop()
+volatile bool    g_evAssociated   = false;
+volatile bool    g_evGotIp        = false;
+volatile bool    g_evDisconnected = false;
+volatile uint8_t g_evReason       = 0;
+
 const int LED = 2;
 
 // ----------- Helpers -------------
+void shutdownBLE();
+
 void setLed(bool on) {
   pinMode(LED, OUTPUT);
   digitalWrite(LED, on ? HIGH : LOW);
@@ -36,33 +52,90 @@ void notifyStatus(const char* msg) {
   }
 }
 
-bool connectWiFiBlocking(const String& ssid, const String& pass, uint32_t timeoutMs = 20000) {
-  if (ssid.isEmpty()) {
-    notifyStatus("SSID empty");
-    return false;
+const char* reasonText(uint8_t reason) {
+  switch (reason) {
+    case WIFI_REASON_NO_AP_FOUND:            return "network not found";
+    case WIFI_REASON_AUTH_FAIL:              return "wrong password";
+    case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+    case WIFI_REASON_HANDSHAKE_TIMEOUT:      return "wrong password (handshake timeout)";
+    case WIFI_REASON_ASSOC_FAIL:             return "access point refused";
+    case WIFI_REASON_BEACON_TIMEOUT:         return "access point lost";
+    default:                                 return "disconnected";
   }
-  WiFi.mode(WIFI_STA);
-  WiFi.disconnect(true, true);
-  delay(200);
+}
+
+// Runs in the WiFi event task; only records what happened
+void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  switch (event) {
+    case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+      g_evAssociated = true;
+      break;
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+      g_evGotIp = true;
+      break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      // Our own disconnect() when aborting is not a failure
+      if (info.wifi_sta_disconnected.reason == WIFI_REASON_ASSOC_LEAVE) break;
+      g_evReason = info.wifi_sta_disconnected.reason;
+      g_evDisconnected = true;
+      break;
+    default:
+      break;
+  }
+}
+
+void abortConnect(const char* why) {
+  if (g_connectState == CONNECT_IDLE || g_connectState == CONNECT_DONE) return;
+  WiFi.disconnect();
+  g_connectState = CONNECT_IDLE;
+  setLed(false);
+  notifyStatus(why);
+}
 
+// Starts an attempt and returns; serviceConnect() follows it through
+void startConnect(const String& ssid, const String& pass) {
+  abortConnect("Previous attempt aborted");
+  g_evAssociated = false;
+  g_evGotIp = false;
+  g_evDisconnected = false;
+
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);   // A failure should reach us, not be retried quietly
   notifyStatus(("WiFi begin: " + ssid).c_str());
   WiFi.begin(ssid.c_str(), pass.isEmpty() ? nullptr : pass.c_str());
+  g_connectState = CONNECT_ASSOCIATING;
+  g_connectStart = millis();
+}
 
-  uint32_t start = millis();
-  while (WiFi.status() != WL_CONNECTED && (millis() - start) < timeoutMs) {
-    delay(200);
-    Serial.print(".");
-    setLed(((millis() / 200) % 2) == 0);
-  }
-  setLed(false);
+void serviceConnect() {
+  if (g_connectState == CONNECT_IDLE || g_connectState == CONNECT_DONE) return;
+  setLed(((millis() / 200) % 2) == 0);
 
-  if (WiFi.status() == WL_CONNECTED) {
-    String ok = "WiFi connected: " + WiFi.localIP().toString();
+  if (g_evDisconnected) {
+    g_evDisconnected = false;
+    String msg = String("WiFi failed: ") + reasonText(g_evReason) + " (" + String(g_evReason) + ")";
+    abortConnect(msg.c_str());
+    notifyStatus("Retry credentials or send CONNECT again");
+    return;
+  }
+  if (g_evAssociated && g_connectState == CONNECT_ASSOCIATING) {
+    g_evAssociated = false;
+    g_connectState = CONNECT_WAITING_IP;
+    notifyStatus(("WiFi associated, " + String(millis() - g_connectStart) + " ms; waiting for IP").c_str());
+  }
+  if (g_evGotIp) {
+    g_evGotIp = false;
+    g_connectState = CONNECT_DONE;
+    setLed(false);
+    WiFi.setAutoReconnect(true);
+    String ok = "WiFi connected: " + WiFi.localIP().toString() + ", " + String(millis() - g_connectStart) + " ms";
     notifyStatus(ok.c_str());
-    return true;
-  } else {
-    notifyStatus("WiFi failed");
-    return false;
+    shutdownBLE();
+    // Now do your main online work...
+    return;
+  }
+  if (millis() - g_connectStart > CONNECT_BACKSTOP_MS) {
+    abortConnect("WiFi failed: no answer from the driver");
   }
 }
 
@@ -106,6 +179,7 @@ class ControlWriteCallback : public NimBLECharacteristicCallbacks {
     } else if (cmd == "CLEAR") {
       g_ssid = "";
       g_pass = "";
+      g_abortRequested = true;
       notifyStatus("Credentials cleared");
     } else {
       notifyStatus("Unknown command");
@@ -166,6 +240,7 @@ void setup() {
   delay(200);
   setLed(false);
 
+  WiFi.onEvent(onWiFiEvent);
   startBLE();
 
   notifyStatus("Write SSID/PASS, then write 'CONNECT' to CONTROL");
@@ -173,31 +248,30 @@ void setup() {
 }
 
 void loop() {
+  if (g_abortRequested) {
+    g_abortRequested = false;
+    abortConnect("Attempt aborted");
+  }
+
+  // A new CONNECT replaces an attempt in flight, so a typo costs one write
   if (g_connectRequested) {
     g_connectRequested = false;
 
     if (g_ssid.length() == 0) {
       notifyStatus("No SSID set");
-      return;
-    }
-
-    bool ok = connectWiFiBlocking(g_ssid, g_pass);
-    if (ok) {
-      shutdownBLE();
-      // Now do your main online work...
     } else {
-      notifyStatus("Retry credentials or send CONNECT again");
+      startConnect(g_ssid, g_pass);
     }
   }
 
+  serviceConnect();
+
   static uint32_t lastCheck = 0;
-  if (millis() - lastCheck > 5000) {
+  if (g_connectState == CONNECT_DONE && millis() - lastCheck > 5000) {
     lastCheck = millis();
-    if (WiFi.getMode() == WIFI_MODE_STA) {
-      if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("[WiFi] disconnected, retrying...");
-        WiFi.reconnect();
-      }
+    if (WiFi.status() != WL_CONNECTED) {
+      Serial.println("[WiFi] disconnected, retrying...");
+      WiFi.reconnect();
     }
   }
 
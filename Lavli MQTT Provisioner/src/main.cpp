@@ -3,6 +3,8 @@
 #include <WiFiManager.h>
 #include <WiFiClientSecure.h>
 #include <PubSubClient.h>
+#include <LavliLog.h>
+#include <LavliWiFiCache.h>
 
 #define USE_PROVISIONING false
 
@@ -15,6 +17,7 @@
 
 #define WIFI_SSID "Verizon_ZK3NRK"
 #define WIFI_PASSWORD "farm9scope3eddy"
+#define WIFI_CONNECT_TIMEOUT_MS 30000
 
 WiFiClientSecure espClient;
 PubSubClient mqttClient(espClient);
@@ -30,9 +33,7 @@ void setup() {
   Serial.begin(115200);
   Serial.println("\n=== Lavli MQTT Provisioner Starting ===");
   Serial.println("[SETUP] Serial initialized at 115200 baud");
-  
-  Serial.println("[SETUP] Waiting 1 second before starting...");
-  delay(1000);
+  logBegin(Serial);
   
   Serial.println("[SETUP] Starting WiFi setup...");
   setupWiFi();
@@ -84,23 +85,27 @@ void setupWiFi() {
     Serial.println(WIFI_SSID);
     Serial.println("[WIFI] Starting WiFi connection...");
     
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    Serial.print("[WIFI] Connecting to ");
-    Serial.print(WIFI_SSID);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED) {
-      delay(500);
-      Serial.print(".");
-      attempts++;
-      if (attempts > 60) {
-        Serial.println("");
+    // Goes to the cached access point first, then falls back to a scan
+    unsigned long start = millis();
+    wifiCacheBegin(WIFI_SSID, WIFI_PASSWORD);
+    while (!wifiCacheService()) {
+      delay(10);
+      if (millis() - start > WIFI_CONNECT_TIMEOUT_MS) {
         Serial.println("[WIFI] ERROR: Connection timeout after 30 seconds");
         Serial.println("[WIFI] Restarting ESP32...");
+        logFlush();
         ESP.restart();
       }
     }
-    Serial.println("");
+    
+    WiFiConnectTimes times = wifiCacheTimes();
+    Serial.print("[WIFI] Connected via ");
+    Serial.print(times.fast ? "cached access point" : "scan");
+    Serial.print(": associated in ");
+    Serial.print(times.associated_ms);
+    Serial.print(" ms, IP in ");
+    Serial.print(times.ip_ms);
+    Serial.println(" ms");
   }
   
   Serial.println("[WIFI] WiFi connected successfully!");
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Status ring animation engine
+//
+// The ring is composed from layers, bottom to top; a layer that is on
+// covers the ones below it:
+//
+//   base      solid colour; a new one crossfades from the old over fadeMs
+//   progress  the first N pixels in a colour, with the edge pixel dimmed
+//             by the fractional part so the bar moves smoothly
+//   pulse     a colour breathing over the frame, for "waiting" states
+//   flash     a colour blinking a number of times, then gone (errors)
+//
+// Callers only set layer parameters; each setter is cheap and ignores a
+// call that changes nothing, so it can be made every scheduler pass. The
+// frames themselves are composed by an esp_timer callback every
+// ANIM_FRAME_PERIOD_MS and handed to the LED renderer (leds.h), which sends
+// only frames that differ.
+//
+// There is no floating point: time runs as 16-bit fractions (0..65535),
+// easing curves are integer polynomials and intensities go through a
+// gamma table built at compile time, so a fade looks linear to the eye.
+// Gamma applies to intensities (fades, pulses, the progress edge), not to
+// the layer colours, which are shown as given.
+
+#define ANIM_FRAME_PERIOD_MS  33      // ~30 fps, matches LEDS_MAX_FPS
+#define ANIM_PULSE_FLOOR      64      // Dimmest point of a pulse before gamma, of 255
+#define ANIM_PROGRESS_ONE     65535   // animSetProgress() fraction for a full ring
+
+bool animBegin(uint16_t pixelCount);
+void animSetBase(uint32_t color, uint16_t fadeMs);
+// fraction is 0..ANIM_PROGRESS_ONE of the ring
+void animSetProgress(uint32_t color, uint16_t fraction);
+void animClearProgress();
+void animSetPulse(uint32_t color, uint16_t periodMs);
+void animClearPulse();
+void animFlash(uint32_t color, uint8_t times, uint16_t periodMs);
+void animPrint(Print& out);
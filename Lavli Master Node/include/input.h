@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Front panel input events
+//
+// Nothing is polled. The encoder is counted by a PCNT unit whose limits sit
+// INPUT_ENCODER_COUNTS_PER_STEP either side of zero; reaching one raises a
+// PCNT interrupt, which queues a step and lets the hardware reset the
+// count. The switch raises a GPIO interrupt on both edges; the first edge
+// is reported and edges for INPUT_DEBOUNCE_MS after it are ignored, so a
+// press is timestamped when it happened, not when the loop got round to
+// looking. Each edge also (re)arms a one-shot timer that samples the pin
+// INPUT_DEBOUNCE_MS after the bouncing stops and reports the level if it
+// differs, so the release of a tap inside the window is not lost.
+//
+// Events wait in a FreeRTOS queue until the UI task takes them, so a
+// press during a TLS handshake is handled late rather than missed. Run the
+// consumer as a scheduler event task with inputPending() as its source.
+
+#define INPUT_QUEUE_LENGTH            16
+#define INPUT_ENCODER_COUNTS_PER_STEP 4     // Matches the old count / 4
+#define INPUT_DEBOUNCE_MS             50
+#define INPUT_GLITCH_FILTER_CYCLES    1000  // APB cycles (12.5 us) a PCNT input must hold
+
+enum InputEventType {
+  INPUT_ENCODER_CW,
+  INPUT_ENCODER_CCW,
+  INPUT_SWITCH_PRESS,
+  INPUT_SWITCH_RELEASE,
+};
+
+struct InputEvent {
+  uint8_t type;         // InputEventType
+  uint32_t at_ms;       // When the interrupt fired
+};
+
+bool inputBegin(gpio_num_t encoderA, gpio_num_t encoderB, gpio_num_t switchPin);
+bool inputPending();
+// Takes the oldest event; false when the queue is empty
+bool inputNext(InputEvent& event);
+uint32_t inputDroppedCount();
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+
+// WS2812 ring renderer
+//
+// Pixels are composed into a RAM frame with ledsSetPixel()/ledsFill() and
+// ledsShow() decides whether the strip needs it: the frame is scaled by the
+// brightness, converted to GRB and compared with the last one sent. An
+// identical frame costs a memcmp and nothing goes on the wire. A changed
+// one goes out through the RMT peripheral, which clocks the bitstream
+// itself (refilled from its interrupt), so ledsShow() returns immediately
+// and interrupts stay enabled for CAN and WiFi.
+//
+// Frames are pushed at most LEDS_MAX_FPS times a second. A change that
+// arrives too early (or while the previous frame is still on the wire) is
+// not lost: the next ledsShow() still sees the difference and sends it.
+
+#define LEDS_MAX_COUNT   64
+#define LEDS_MAX_FPS     30
+
+struct LedStats {
+  uint32_t shows;       // ledsShow() calls
+  uint32_t pushed;      // Frames sent to the strip
+  uint32_t unchanged;   // Identical to the last frame, skipped
+  uint32_t deferred;    // Held back by the frame cap or a busy RMT
+};
+
+bool ledsBegin(gpio_num_t pin, uint16_t count);
+inline uint32_t ledsColor(uint8_t r, uint8_t g, uint8_t b) {
+  return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+}
+void ledsSetPixel(uint16_t index, uint32_t color);
+void ledsFill(uint32_t color);
+void ledsSetBrightness(uint8_t brightness);
+// Sends the frame if it changed; returns true if it went out
+bool ledsShow();
+LedStats ledsStats();
+void ledsPrint(Print& out);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Master firmware update
+//
+// An update is started over MQTT with the image URL and its SHA-256:
+//
+//   {"url":"https://example.com/lavli-master.bin", "sha256":"9f86d0...", "size":1034512}
+//   {"abort":true}
+//
+// The TLS handshake and the GET run in a short-lived FreeRTOS task, since
+// they block for seconds. The image is then read by a scheduler task and
+// written straight into the inactive app partition as it arrives; nothing
+// larger than one chunk is ever held in RAM. Each run reads at most MASTER_OTA_CHUNK_BYTES
+// and stops after MASTER_OTA_BUDGET_US, so a download costs the control
+// tasks one flash sector erase per run at worst. The hash from the control
+// message (which arrives over the broker's TLS session) is what makes the
+// image trusted, so the download itself does not need a pinned certificate.
+//
+// After the hash and esp_ota_end()'s own image checks pass, the new
+// partition is made the boot partition and the update is marked pending in
+// NVS. The new image has to reach the broker and call masterOtaConfirm()
+// within MASTER_OTA_CONFIRM_TIMEOUT_MS of time on WiFi and
+// MASTER_OTA_MAX_BOOTS boots, or the previous partition is booted again.
+// Time with WiFi down does not count, so an outage cannot roll back a good
+// image. This does not rely on the bootloader's
+// rollback support, which the stock Arduino bootloader leaves disabled.
+//
+// Progress and results go to the status callback as JSON, for example
+//   {"state":"downloading","bytes":524288,"total":1034512,"progress":50}
+
+#define MASTER_OTA_CHUNK_BYTES         4096    // Read and flashed per run, one sector
+#define MASTER_OTA_BUDGET_US           8000    // Stop reading early if a run takes longer
+#define MASTER_OTA_SERVICE_PERIOD_MS   20      // Caps the download at ~200 KB/s
+#define MASTER_OTA_STALL_TIMEOUT_MS    30000   // No data from the server
+#define MASTER_OTA_PROGRESS_STEP       10      // Status update every 10 %
+#define MASTER_OTA_RESTART_DELAY_MS    1000    // Lets the final status reach the broker
+#define MASTER_OTA_CONFIRM_TIMEOUT_MS  300000  // Time on WiFi the new image gets to reach the broker
+#define MASTER_OTA_MAX_BOOTS           3       // Unconfirmed boots before rolling back
+#define MASTER_OTA_URL_LEN             192
+#define MASTER_OTA_CONNECT_STACK       8192
+#define MASTER_OTA_CONNECT_PRIORITY    1       // Same as the loop task; it mostly waits on the network
+
+// Publishes a status JSON document
+typedef bool (*MasterOtaStatusFn)(const char* json);
+// True while restarting would interrupt something (a running program)
+typedef bool (*MasterOtaBusyFn)();
+
+// Call early in setup(); counts boots of an unconfirmed image and rolls back
+void masterOtaBegin(MasterOtaStatusFn onStatus, MasterOtaBusyFn busy);
+bool masterOtaHandleControl(const uint8_t* json, size_t length);
+bool masterOtaStart(const char* url, const char* sha256, uint32_t size);
+void masterOtaAbort(const char* reason);
+// Call once the running image has proven itself (connected to the broker)
+void masterOtaConfirm();
+// Periodic; the period is what throttles the download
+void masterOtaService();
+bool masterOtaActive();
+void masterOtaPrint();
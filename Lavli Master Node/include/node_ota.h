@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LavliCanOta.h>
+
+// Node firmware update
+//
+// Only the master has WiFi, so node images come through it: the image is
+// uploaded over MQTT into NODE_OTA_IMAGE_PATH on LittleFS, checked against
+// the CRC given when the upload started, and then streamed to the node over
+// CAN (see LavliCanOta.h). A flashed image stays on LittleFS, so the same
+// file can be sent to another node of the same kind with nodeOtaStart().
+//
+// Control messages on /lavli/node_ota (JSON):
+//
+//   {"node":"0x04", "size":412336, "crc":"0x1c291ca3"}   start an upload
+//   {"node":"0x04", "flash":true}                        send the stored image
+//   {"abort":true}
+//
+// Image data on /lavli/node_ota/data (binary): [offset x 4, big endian, data].
+// Chunks must arrive in order and fit the MQTT buffer; when the last one is
+// in and the CRC matches, the transfer to the node starts by itself.
+//
+// Blocks go out as soon as the bulk transfer layer can take them, with up
+// to OTA_WINDOW unacknowledged, so the bus runs close to saturation while
+// every other class still wins arbitration. A node that stops acking gets
+// the unacknowledged blocks again after NODE_OTA_ACK_TIMEOUT_MS.
+
+#define NODE_OTA_IMAGE_PATH        "/node_fw.bin"
+#define NODE_OTA_ACK_TIMEOUT_MS    2000
+#define NODE_OTA_END_TIMEOUT_MS    10000  // esp_ota_end() reads back the whole image
+#define NODE_OTA_MAX_RETRIES       8      // Timeouts or NAKs in a row before giving up
+#define NODE_OTA_SERVICE_PERIOD_MS 100
+
+// Reports "node_ota_start", "node_ota_done" and "node_ota_failed"
+typedef bool (*NodeOtaEventFn)(const char* event, const char* detail);
+
+void nodeOtaBegin(NodeOtaEventFn onEvent);
+// MQTT control and data messages
+bool nodeOtaHandleControl(const uint8_t* json, size_t length);
+bool nodeOtaUploadChunk(const uint8_t* data, size_t length);
+// Streams the stored image to a node
+bool nodeOtaStart(uint8_t node);
+void nodeOtaAbort(const char* reason);
+// Feed reassembled bulk payloads; returns true if it was an OTA ack
+bool nodeOtaHandleMessage(uint8_t node, const uint8_t* data, uint16_t length);
+void nodeOtaService();
+// True when a block can be handed to the bulk transfer layer right now
+bool nodeOtaReady();
+bool nodeOtaActive();
+void nodeOtaPrint();
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LavliCanHeartbeat.h>
+
+// Node presence table
+//
+// Built from the ANNOUNCE and HEARTBEAT frames each node sends (see
+// LavliCanHeartbeat.h). A node is online from its first frame until
+// PRESENCE_TIMEOUT_MS passes without one; each transition is reported once
+// through the event callback so main.cpp can publish join/leave events.
+// Recipe commands and sensor polls check presenceIsOnline() first, so an absent
+// node costs nothing instead of a blocked transmit.
+//
+// A heartbeat from a node that never announced (e.g. the master rebooted
+// while the nodes kept running) triggers a broadcast DISCOVER, rate limited
+// to one per PRESENCE_DISCOVER_MS.
+//
+// The BOOT frame a node sends after setup() is kept with its entry and
+// passed to the boot callback, so slow starts and brownout resets are
+// visible from the master.
+
+#define PRESENCE_MAX_NODES      16
+#define PRESENCE_TIMEOUT_MS     3500    // Three missed heartbeats
+#define PRESENCE_DISCOVER_MS    5000
+#define PRESENCE_CHECK_PERIOD_MS 500
+
+struct NodePresence {
+  uint8_t node;             // 0 = unused slot
+  uint8_t type;
+  uint8_t version_major;
+  uint8_t version_minor;
+  uint8_t capabilities;
+  uint8_t channels;
+  uint8_t status;           // Last heartbeat status, 0 = healthy
+  bool announced;
+  bool online;
+  uint16_t uptime_s;
+  unsigned long first_seen;
+  unsigned long last_seen;
+  uint32_t heartbeats;
+  uint32_t restarts;        // Uptime went backwards
+  uint8_t reset_reason;     // From the last BOOT frame, esp_reset_reason_t
+  uint16_t can_ready_ms;    // Application start to accepting commands
+  uint16_t setup_ms;        // Application start to the end of setup()
+};
+
+// Called when a node comes online (joined = true) or times out
+typedef void (*PresenceEventFn)(const NodePresence& node, bool joined);
+// Called when a node reports a boot
+typedef void (*PresenceBootFn)(const NodePresence& node);
+// Sends a broadcast DISCOVER
+typedef bool (*PresenceDiscoverFn)();
+
+void presenceBegin(PresenceEventFn onEvent, PresenceDiscoverFn discover, PresenceBootFn onBoot = NULL);
+// Feed every response frame; returns true if it was a presence frame
+bool presenceHandleFrame(uint8_t node, const uint8_t* data, uint8_t length);
+// Expires silent nodes; run periodically
+void presenceService();
+bool presenceIsOnline(uint8_t node);
+const NodePresence* presenceGet(uint8_t node);
+uint8_t presenceOnlineCount();
+void presencePrint();
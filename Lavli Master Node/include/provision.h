@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+#include "provision_step.h"
+
+// WiFi credentials and BLE provisioning
+//
+// Credentials live in NVS. A master that has them connects straight away and
+// releases the BLE controller memory once WiFi has come up. One that has none,
+// or whose stored ones keep failing (see WIFI_BLE_FALLBACK_ATTEMPTS in
+// main.cpp), advertises the same GATT service as the standalone BLE
+// Provisioner project, so the phone flow is unchanged:
+//
+//   write SSID, write PASS, write "CONNECT" to CONTROL ("CLEAR" resets them)
+//   progress comes back as text notifications on STATUS
+//
+// Nothing blocks. The connect attempt goes through LavliWiFiCache from
+// provisionService(), so CAN control and the front panel keep running while
+// waiting for a phone. When WiFi comes up the credentials are stored, a last
+// status is notified and the BLE stack is deinitialised to give its heap
+// back. A failed attempt goes back to advertising. When stored credentials
+// exist they are retried every PROVISION_STORED_RETRY_MS of advertising, so a
+// master that fell back while its router was down still rejoins on its own.
+//
+// Changing network later means clearing the credentials and restarting
+// (the "wifi_provision" serial command), since released controller memory
+// cannot be reclaimed for BLE without a reboot.
+
+#define PROVISION_SSID_LEN            33
+#define PROVISION_PASS_LEN            65
+
+// Copies the stored credentials; false if there are none
+bool provisionLoadCredentials(char* ssid, char* password);
+bool provisionSaveCredentials(const char* ssid, const char* password);
+void provisionClearCredentials();
+// True after provisionClearCredentials(), until new ones are saved
+bool provisionCredentialsCleared();
+
+// Starts advertising under the given name
+bool provisionStart(const char* deviceName);
+// Frees the BLE controller memory for good; call once WiFi is known to work
+void provisionReleaseBle();
+// Runs the state machine; call periodically while active
+void provisionService();
+bool provisionActive();
+ProvisionState provisionState();
+void provisionPrint(Print& out);
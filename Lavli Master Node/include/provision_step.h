@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+// Transitions of the BLE provisioning state machine (provision.h), kept free
+// of BLE, WiFi and timers so PythonUtils/provision_check.py can build and
+// check them on the host. provisionService() gathers the inputs, asks
+// provisionNextStep() what to do, then carries the action out.
+
+#define PROVISION_CONNECT_TIMEOUT_MS  20000   // Per CONNECT, scan included
+#define PROVISION_SHUTDOWN_DELAY_MS   500     // Lets the last notification go out
+#define PROVISION_STORED_RETRY_MS     120000  // Advertising this long retries the stored credentials
+
+enum ProvisionState {
+  PROVISION_OFF,
+  PROVISION_ADVERTISING,    // Waiting for credentials and CONNECT
+  PROVISION_CONNECTING,
+  PROVISION_SHUTTING_DOWN,  // Connected, BLE going away
+};
+
+enum ProvisionAction {
+  PROVISION_NONE,
+  PROVISION_REJECT,          // CONNECT before an SSID was written
+  PROVISION_CONNECT_NEW,     // Try what the phone wrote
+  PROVISION_CONNECT_STORED,  // Retry the stored credentials
+  PROVISION_ABORT,           // CLEAR or a corrected CONNECT mid-attempt
+  PROVISION_CONNECTED,       // Save new credentials, notify
+  PROVISION_TIMEOUT,         // Attempt gave up, back to advertising
+  PROVISION_SHUTDOWN,        // Deinitialise BLE
+};
+
+struct ProvisionInputs {
+  bool connectRequested;     // Phone wrote CONNECT
+  bool abortRequested;       // Phone wrote CLEAR
+  bool haveSsid;             // Phone wrote an SSID
+  bool haveStored;           // Stored credentials to fall back to
+  bool wifiUp;               // Only looked at while connecting
+  uint32_t inStateMs;        // Time since the state was entered
+};
+
+struct ProvisionStep {
+  ProvisionState next;
+  ProvisionAction action;
+};
+
+ProvisionStep provisionNextStep(ProvisionState state, const ProvisionInputs& in);
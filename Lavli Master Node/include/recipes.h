@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Wash/dry recipe engine
+//
+// A program is a named table of timed steps. Each step sets the drum speed
+// and direction (optionally ramping from the previous speed), switches the
+// 120V outputs, and ends after its duration or earlier when an optional
+// sensor condition is met. recipeService() is ticked by the scheduler and
+// advances the state machine a little at a time, so a running program never
+// blocks CAN or MQTT work. A command a node could not take (offline, TX
+// queue full) is sent again on later passes until it goes out.
+//
+// Recipes are downloaded as JSON (see recipeLoadJson) and persisted to
+// LittleFS; built-in "wash" and "dry" defaults apply until replaced.
+//
+//   {"name":"wash","steps":[
+//     {"ms":240000,"rpm":50,"dir":"cw","ramp_ms":3000,"outputs":[2]},
+//     {"ms":60000,"rpm":0,"outputs":[],
+//      "until":{"dev":"0x04","pin":0,"analog":true,"below":800}}]}
+
+#define RECIPE_DIR             "/recipes"
+#define RECIPE_MAX_RECIPES     6
+#define RECIPE_MAX_STEPS       16
+#define RECIPE_NAME_LEN        16
+#define RECIPE_MAX_JSON        2048
+#define RECIPE_RAMP_INTERVAL_MS 250    // Speed update cadence while ramping
+#define RECIPE_SENSOR_POLL_MS   500    // Sensor request cadence for steps with an exit condition
+#define RECIPE_RETRY_MS         1000   // Resend cadence for direction/outputs a node missed
+
+enum RecipeExitType : uint8_t {
+  RECIPE_EXIT_NONE,
+  RECIPE_EXIT_ABOVE,     // Reading >= threshold
+  RECIPE_EXIT_BELOW      // Reading <= threshold
+};
+
+struct RecipeStep {
+  uint32_t duration_ms;   // Step length; the upper bound when an exit condition is set
+  uint16_t rpm;
+  bool clockwise;
+  uint32_t ramp_ms;       // Time to reach rpm from the previous step's speed
+  uint8_t outputs;        // Bit n set = 120V output port n on
+
+  uint8_t exit_type;
+  bool exit_analog;
+  uint8_t exit_pin;
+  uint16_t exit_device;
+  uint16_t exit_threshold;
+};
+
+struct Recipe {
+  char name[RECIPE_NAME_LEN];
+  uint8_t step_count;
+  RecipeStep steps[RECIPE_MAX_STEPS];
+};
+
+// Actuators and sensors the engine drives; provided by main.cpp
+struct RecipeHooks {
+  bool (*setMotorRPM)(uint16_t rpm);
+  bool (*setMotorDirection)(bool clockwise);
+  // Ports in mask take their bit from value, all in one command
+  bool (*setOutputs)(uint8_t mask, uint8_t value);
+  void (*requestSensor)(uint16_t device, uint8_t pin, bool analog);
+  // Returns false if no valid reading is stored
+  bool (*readSensor)(uint16_t device, uint8_t pin, bool analog, uint16_t* value, unsigned long* timestamp);
+  // Called once when the last step of a program ends
+  void (*onComplete)(const char* name);
+};
+
+void recipesBegin(const RecipeHooks& hooks);
+bool recipeLoadJson(const uint8_t* json, size_t length, bool persist);
+bool recipeStart(const char* name);
+void recipeStop();
+void recipeService();
+bool recipeIsRunning();
+const char* recipeActiveName();
+uint32_t recipeTotalMs();
+uint32_t recipeRemainingMs();
+void recipePrintList();
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Local sensor rules
+//
+// Rules react to sensor readings on the master itself instead of waiting for
+// the cloud: each rule watches one device/pin, and when the reading crosses
+// its threshold the rule's CAN frame is sent straight to the bus. Rules are
+// edge triggered and fire once per crossing; a rule re-arms only after the
+// reading moves back past the threshold by the hysteresis band, so a noisy
+// sensor sitting at the threshold does not flood the bus.
+//
+// The rule set arrives as JSON on MQTT and is compiled into a table sorted by
+// (device, pin, type). rulesEvaluate() is called for every stored reading and
+// binary-searches to the rules for that input, so the cost per reading is a
+// few compares when no rule matches.
+//
+// rulesEvaluate() runs in the CAN receive path, so it only latches the rule
+// and queues a copy; rulesService() sends the frame and reports the firing.
+// Run it as a scheduler event task with rulesPending() as its source.
+//
+// 'dev' is the node ID of the sensor and the action 'address' is a full frame
+// ID (see LavliCanIds.h); 0x001 below is a safety-class request to the 120V node.
+//
+//   {"rules":[{"name":"heater_cut","dev":"0x04","pin":2,"analog":true,
+//              "above":3000,"hyst":100,"can":{"address":"0x001","data":[2,1]}}]}
+
+#define RULES_PATH      "/rules.json"
+#define RULES_MAX       32
+#define RULES_NAME_LEN  16
+#define RULES_MAX_JSON  2048
+#define RULES_QUEUE_LEN 8
+
+enum RuleCondition : uint8_t {
+  RULE_ABOVE,     // Fires when reading >= threshold
+  RULE_BELOW      // Fires when reading <= threshold
+};
+
+struct Rule {
+  uint32_t key;             // (device << 9) | (pin << 1) | analog, the sort key
+  char name[RULES_NAME_LEN];
+  uint8_t condition;
+  uint16_t threshold;
+  uint16_t hysteresis;
+
+  // Action: one raw CAN frame
+  uint16_t address;
+  uint8_t length;
+  uint8_t data[8];
+
+  // Runtime state
+  bool latched;             // Fired and waiting to re-arm
+  uint32_t fire_count;
+  unsigned long last_fired;
+};
+
+// Sends the rule's frame; returns false if it could not be queued
+typedef bool (*RuleSendFn)(uint16_t address, uint8_t* data, uint8_t length);
+// Notified after a rule fires (e.g. to publish an event)
+typedef void (*RuleFiredFn)(const Rule& rule);
+
+void rulesBegin(RuleSendFn send, RuleFiredFn fired);
+bool rulesLoadJson(const uint8_t* json, size_t length, bool persist);
+void rulesEvaluate(uint16_t device, uint8_t pin, bool analog, uint16_t value);
+bool rulesPending();
+void rulesService();
+void rulesPrint();
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LavliProfiler.h>
+
+// Cooperative task scheduler
+//
+// Each subsystem registers a task with a period, an event source, or both.
+// schedulerRunOnce() is called from loop(): event tasks run as soon as their
+// source reports work, periodic tasks run when due, and when nothing is due
+// the idle hook blocks until the next deadline (or an earlier wake-up such as
+// a CAN RX alert) instead of sleeping a fixed amount.
+
+#define SCHEDULER_MAX_TASKS   16
+#define SCHEDULER_MAX_IDLE_MS 2    // Longest idle wait, bounds polling latency of event sources
+
+typedef void (*SchedulerTaskFn)();
+typedef bool (*SchedulerReadyFn)();
+typedef void (*SchedulerIdleFn)(uint32_t max_wait_ms);
+
+struct SchedulerTask {
+  const char* name;
+  SchedulerTaskFn run;
+  SchedulerReadyFn ready;     // Event source, NULL for purely periodic tasks
+  uint32_t period_ms;         // 0 for purely event-driven tasks
+  unsigned long next_due;
+  uint8_t profile_id;
+
+  // Runtime statistics
+  uint32_t runs;
+  uint32_t deadline_misses;   // Started more than one period late
+  uint32_t last_us;
+  uint32_t max_us;
+  uint64_t total_us;
+};
+
+int schedulerAddPeriodic(const char* name, SchedulerTaskFn run, uint32_t period_ms);
+int schedulerAddEvent(const char* name, SchedulerTaskFn run, SchedulerReadyFn ready, uint32_t period_ms = 0);
+void schedulerSetIdleHook(SchedulerIdleFn idle);
+void schedulerRunOnce();
+void schedulerResetStats();
+void schedulerPrintStats();
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Offline publish spool
+//
+// Anything the master wants to publish while WiFi or the broker is down is
+// appended to a log-structured spool on LittleFS (the "spiffs" partition in
+// default.csv). The spool is a chain of append-only segment files; the oldest
+// segment is dropped whole when the size bound is reached, so flash is only
+// ever appended to or erased a segment at a time.
+//
+// Once MQTT is back, spoolService() replays records oldest-first in small,
+// rate-limited bursts from loop(), so control work keeps running while the
+// backlog drains.
+
+#define SPOOL_DIR                 "/spool"
+#define SPOOL_SEGMENT_BYTES       (16 * 1024)  // Roll to a new segment at this size
+#define SPOOL_MAX_SEGMENTS        16           // 256 KB bound, oldest segment evicted first
+#define SPOOL_MAX_TOPIC           64
+#define SPOOL_MAX_PAYLOAD         512
+#define SPOOL_FLUSH_INTERVAL_MS   1000         // Batch flash commits instead of flushing every record
+#define SPOOL_REPLAY_INTERVAL_MS  20           // Replay burst period
+#define SPOOL_REPLAY_BURST        4            // Records per burst (~200 msg/s ceiling)
+#define SPOOL_REPLAY_BUDGET_US    3000         // Stop a burst early if it runs longer than this
+#define SPOOL_CURSOR_SAVE_RECORDS 32           // Persist the replay cursor every N records
+
+// Publishes one record; must return false if the record was not handed to the
+// broker so the cursor is not advanced past it.
+typedef bool (*SpoolPublishFn)(const char* topic, const uint8_t* payload, size_t length);
+
+struct SpoolStats {
+  uint32_t segments;
+  uint32_t pending_bytes;
+  uint32_t appended;
+  uint32_t replayed;
+  uint32_t evicted_segments;
+  uint32_t corrupt_records;
+  uint32_t last_replay_rate;   // records/s over the last completed drain
+};
+
+bool spoolBegin();
+bool spoolAppend(const char* topic, const uint8_t* payload, size_t length);
+bool spoolIsEmpty();
+void spoolService(bool online, SpoolPublishFn publish);
+SpoolStats spoolGetStats();
+void spoolPrintStatus();
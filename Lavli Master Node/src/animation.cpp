@@ -0,0 +1,225 @@
+#include "animation.h"
+#include "leds.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <LavliLog.h>
+
+// ---- Gamma table ----
+// x^2.2 approximated as 0.8 x^2 + 0.2 x^3 (within 2 counts of the real
+// curve), written as a single constexpr expression so the table below is
+// filled by the compiler.
+constexpr uint8_t gammaOf(uint32_t i) {
+  return (uint8_t)((4 * i * i * 255 + i * i * i) / (5 * 255 * 255));
+}
+
+#define G4(i)   gammaOf(i), gammaOf(i + 1), gammaOf(i + 2), gammaOf(i + 3)
+#define G16(i)  G4(i), G4(i + 4), G4(i + 8), G4(i + 12)
+#define G64(i)  G16(i), G16(i + 16), G16(i + 32), G16(i + 48)
+
+static constexpr uint8_t GAMMA[256] = {G64(0), G64(64), G64(128), G64(192)};
+
+static_assert(gammaOf(0) == 0 && gammaOf(255) == 255, "gamma table must span the full range");
+
+// ---- Fixed-point helpers ----
+// Time fractions are 0..65535
+
+static uint16_t fractionOf(uint32_t elapsed, uint32_t duration) {
+  if (duration == 0 || elapsed >= duration) return 65535;
+  return (uint16_t)(((uint64_t)elapsed * 65535) / duration);
+}
+
+static uint16_t easeInOutQuad(uint16_t t) {
+  if (t < 32768) return (uint16_t)(((uint32_t)t * t) >> 15);
+  uint32_t r = 65535 - t;
+  return (uint16_t)(65535 - ((r * r) >> 15));
+}
+
+// 0 -> 1 -> 0 over one period, eased at both ends
+static uint16_t easeTriangle(uint16_t t) {
+  uint16_t rise = t < 32768 ? t * 2 : (65535 - t) * 2;
+  return easeInOutQuad(rise);
+}
+
+// alpha 255 lands exactly on `to`
+static uint32_t blend(uint32_t from, uint32_t to, uint8_t alpha) {
+  uint32_t weight = alpha + (alpha >> 7);
+  uint32_t out = 0;
+  for (int shift = 0; shift <= 16; shift += 8) {
+    uint32_t a = (from >> shift) & 0xFF;
+    uint32_t b = (to >> shift) & 0xFF;
+    out |= (((a * (256 - weight) + b * weight) >> 8) & 0xFF) << shift;
+  }
+  return out;
+}
+
+static uint32_t scale(uint32_t color, uint8_t level) {
+  return blend(0, color, level);
+}
+
+// ---- Layers ----
+
+struct AnimLayers {
+  uint32_t baseFrom, baseTo;
+  uint32_t baseStart;
+  uint16_t baseFadeMs;
+
+  bool progressOn;
+  uint32_t progressColor;
+  uint16_t progress;
+
+  bool pulseOn;
+  uint32_t pulseColor;
+  uint32_t pulseStart;
+  uint16_t pulsePeriodMs;
+
+  uint8_t flashCount;
+  uint32_t flashColor;
+  uint32_t flashStart;
+  uint16_t flashPeriodMs;
+};
+
+// Setters run in the scheduler task, frames in the esp_timer task
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static AnimLayers layers;
+static uint32_t displayedBase = 0;    // Base colour as last rendered
+static uint16_t count = 0;
+static esp_timer_handle_t timer = NULL;
+
+static uint32_t frames = 0;
+static uint32_t renderUsMax = 0;
+static uint64_t renderUsTotal = 0;
+
+static void renderFrame(void*) {
+  int64_t start = esp_timer_get_time();
+  uint32_t now = millis();
+
+  AnimLayers l;
+  portENTER_CRITICAL(&lock);
+  l = layers;
+  portEXIT_CRITICAL(&lock);
+
+  uint8_t fade = GAMMA[fractionOf(now - l.baseStart, l.baseFadeMs) >> 8];
+  uint32_t base = blend(l.baseFrom, l.baseTo, fade);
+  displayedBase = base;
+  ledsFill(base);
+
+  if (l.progressOn) {
+    // Whole pixels lit, plus the edge at its fractional brightness
+    uint32_t position = (uint32_t)l.progress * count;
+    uint16_t full = position >> 16;
+    uint8_t edge = GAMMA[(position >> 8) & 0xFF];
+    for (uint16_t i = 0; i < count; i++) {
+      if (i < full) {
+        ledsSetPixel(i, l.progressColor);
+      } else if (i == full) {
+        ledsSetPixel(i, scale(l.progressColor, edge));
+      } else {
+        ledsSetPixel(i, 0);
+      }
+    }
+  }
+
+  if (l.pulseOn) {
+    uint16_t t = fractionOf((now - l.pulseStart) % l.pulsePeriodMs, l.pulsePeriodMs);
+    uint8_t level = ANIM_PULSE_FLOOR + (((uint32_t)(255 - ANIM_PULSE_FLOOR) * easeTriangle(t)) >> 16);
+    ledsFill(scale(l.pulseColor, GAMMA[level]));
+  }
+
+  if (l.flashCount > 0) {
+    uint32_t elapsed = now - l.flashStart;
+    uint32_t cycle = elapsed / l.flashPeriodMs;
+    if (cycle >= l.flashCount) {
+      portENTER_CRITICAL(&lock);
+      if (layers.flashStart == l.flashStart) layers.flashCount = 0;
+      portEXIT_CRITICAL(&lock);
+    } else if (elapsed % l.flashPeriodMs < l.flashPeriodMs / 2) {
+      ledsFill(l.flashColor);
+    }
+  }
+
+  ledsShow();
+
+  uint32_t took = esp_timer_get_time() - start;
+  frames++;
+  renderUsTotal += took;
+  if (took > renderUsMax) renderUsMax = took;
+}
+
+bool animBegin(uint16_t pixelCount) {
+  count = pixelCount;
+  memset(&layers, 0, sizeof(layers));
+
+  esp_timer_create_args_t args = {};
+  args.callback = renderFrame;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "anim";
+  args.skip_unhandled_events = true;
+  if (esp_timer_create(&args, &timer) != ESP_OK ||
+      esp_timer_start_periodic(timer, ANIM_FRAME_PERIOD_MS * 1000ULL) != ESP_OK) {
+    LOG_ERROR("[ANIM] Frame timer failed to start");
+    return false;
+  }
+  return true;
+}
+
+void animSetBase(uint32_t color, uint16_t fadeMs) {
+  portENTER_CRITICAL(&lock);
+  if (color != layers.baseTo) {
+    layers.baseFrom = displayedBase;    // Crossfade from wherever it is now
+    layers.baseTo = color;
+    layers.baseStart = millis();
+    layers.baseFadeMs = fadeMs;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void animSetProgress(uint32_t color, uint16_t fraction) {
+  portENTER_CRITICAL(&lock);
+  layers.progressOn = true;
+  layers.progressColor = color;
+  layers.progress = fraction;
+  portEXIT_CRITICAL(&lock);
+}
+
+void animClearProgress() {
+  portENTER_CRITICAL(&lock);
+  layers.progressOn = false;
+  portEXIT_CRITICAL(&lock);
+}
+
+void animSetPulse(uint32_t color, uint16_t periodMs) {
+  if (periodMs == 0) return;
+  portENTER_CRITICAL(&lock);
+  if (!layers.pulseOn || layers.pulseColor != color || layers.pulsePeriodMs != periodMs) {
+    layers.pulseOn = true;
+    layers.pulseColor = color;
+    layers.pulsePeriodMs = periodMs;
+    layers.pulseStart = millis();
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void animClearPulse() {
+  portENTER_CRITICAL(&lock);
+  layers.pulseOn = false;
+  portEXIT_CRITICAL(&lock);
+}
+
+void animFlash(uint32_t color, uint8_t times, uint16_t periodMs) {
+  if (periodMs == 0) return;
+  portENTER_CRITICAL(&lock);
+  layers.flashColor = color;
+  layers.flashCount = times;
+  layers.flashPeriodMs = periodMs;
+  layers.flashStart = millis();
+  portEXIT_CRITICAL(&lock);
+}
+
+void animPrint(Print& out) {
+  out.printf("\n=== Animation: %lu frames every %d ms ===\n", (unsigned long)frames, ANIM_FRAME_PERIOD_MS);
+  out.printf("  Render %lu us average, %lu us max\n", frames ? (unsigned long)(renderUsTotal / frames) : 0UL,
+             (unsigned long)renderUsMax);
+  out.printf("  Layers: progress %s, pulse %s, flash %s\n", layers.progressOn ? "on" : "off",
+             layers.pulseOn ? "on" : "off", layers.flashCount ? "on" : "off");
+  out.println("=========================================\n");
+}
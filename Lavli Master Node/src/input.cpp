@@ -0,0 +1,160 @@
+#include "input.h"
+#include <driver/pcnt.h>
+#include <driver/gpio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>
+#include <LavliLog.h>
+
+#define ENCODER_UNIT PCNT_UNIT_0
+
+static QueueHandle_t queue = NULL;
+static gpio_num_t switchGpio = GPIO_NUM_NC;
+static volatile int switchLevel = 1;          // Last reported level, idle high
+static volatile int64_t switchEdgeUs = 0;
+static volatile uint32_t dropped = 0;
+static esp_timer_handle_t settleTimer = NULL;
+// The edge interrupt and the settle timer both commit switchLevel
+static portMUX_TYPE switchLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR pushFromIsr(uint8_t type, BaseType_t* woken) {
+  InputEvent event;
+  event.type = type;
+  event.at_ms = (uint32_t)(esp_timer_get_time() / 1000);
+  if (xQueueSendFromISR(queue, &event, woken) != pdTRUE) dropped++;
+}
+
+// The counter resets to zero by itself at either limit
+static void IRAM_ATTR onEncoderLimit(void*) {
+  uint32_t status = 0;
+  pcnt_get_event_status(ENCODER_UNIT, &status);
+  BaseType_t woken = pdFALSE;
+  if (status & PCNT_EVT_H_LIM) pushFromIsr(INPUT_ENCODER_CW, &woken);
+  if (status & PCNT_EVT_L_LIM) pushFromIsr(INPUT_ENCODER_CCW, &woken);
+  if (woken) portYIELD_FROM_ISR(woken);
+}
+
+static void IRAM_ATTR onSwitchEdge(void*) {
+  int level = gpio_get_level(switchGpio);
+  int64_t now = esp_timer_get_time();
+
+  // Every edge pushes the settle check back, so it samples once bouncing stops
+  esp_timer_stop(settleTimer);
+  esp_timer_start_once(settleTimer, INPUT_DEBOUNCE_MS * 1000ULL);
+
+  portENTER_CRITICAL_ISR(&switchLock);
+  bool report = level != switchLevel && now - switchEdgeUs >= INPUT_DEBOUNCE_MS * 1000LL;
+  if (report) {
+    switchLevel = level;
+    switchEdgeUs = now;
+  }
+  portEXIT_CRITICAL_ISR(&switchLock);
+  if (!report) return;
+
+  BaseType_t woken = pdFALSE;
+  pushFromIsr(level == 0 ? INPUT_SWITCH_PRESS : INPUT_SWITCH_RELEASE, &woken);
+  if (woken) portYIELD_FROM_ISR(woken);
+}
+
+// INPUT_DEBOUNCE_MS after the last edge; reports a level the edge handler
+// skipped, such as the release of a tap shorter than the debounce window
+static void onSwitchSettled(void*) {
+  int level = gpio_get_level(switchGpio);
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL(&switchLock);
+  bool report = level != switchLevel;
+  if (report) {
+    switchLevel = level;
+    switchEdgeUs = now;
+  }
+  portEXIT_CRITICAL(&switchLock);
+  if (!report) return;
+
+  InputEvent event;
+  event.type = level == 0 ? INPUT_SWITCH_PRESS : INPUT_SWITCH_RELEASE;
+  event.at_ms = (uint32_t)(now / 1000);
+  if (xQueueSend(queue, &event, 0) != pdTRUE) dropped++;
+}
+
+static bool setupEncoder(gpio_num_t a, gpio_num_t b) {
+  // Half quadrature: both edges of A counted, B sets the direction
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = a;
+  config.ctrl_gpio_num = b;
+  config.unit = ENCODER_UNIT;
+  config.channel = PCNT_CHANNEL_0;
+  config.pos_mode = PCNT_COUNT_DEC;
+  config.neg_mode = PCNT_COUNT_INC;
+  config.lctrl_mode = PCNT_MODE_REVERSE;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = INPUT_ENCODER_COUNTS_PER_STEP;
+  config.counter_l_lim = -INPUT_ENCODER_COUNTS_PER_STEP;
+  if (pcnt_unit_config(&config) != ESP_OK) return false;
+
+  // The PCNT pins have no pull-ups of their own
+  gpio_set_pull_mode(a, GPIO_PULLUP_ONLY);
+  gpio_set_pull_mode(b, GPIO_PULLUP_ONLY);
+
+  pcnt_set_filter_value(ENCODER_UNIT, INPUT_GLITCH_FILTER_CYCLES);
+  pcnt_filter_enable(ENCODER_UNIT);
+  pcnt_event_enable(ENCODER_UNIT, PCNT_EVT_H_LIM);
+  pcnt_event_enable(ENCODER_UNIT, PCNT_EVT_L_LIM);
+  pcnt_counter_pause(ENCODER_UNIT);
+  pcnt_counter_clear(ENCODER_UNIT);
+
+  esp_err_t result = pcnt_isr_service_install(0);
+  if (result != ESP_OK && result != ESP_ERR_INVALID_STATE) return false;
+  if (pcnt_isr_handler_add(ENCODER_UNIT, onEncoderLimit, NULL) != ESP_OK) return false;
+  return pcnt_counter_resume(ENCODER_UNIT) == ESP_OK;
+}
+
+static bool setupSwitch(gpio_num_t pin) {
+  switchGpio = pin;
+  esp_timer_create_args_t args = {};
+  args.callback = onSwitchSettled;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "switch";
+  if (esp_timer_create(&args, &settleTimer) != ESP_OK) return false;
+
+  gpio_config_t config = {};
+  config.pin_bit_mask = 1ULL << pin;
+  config.mode = GPIO_MODE_INPUT;
+  config.pull_up_en = GPIO_PULLUP_ENABLE;
+  config.intr_type = GPIO_INTR_ANYEDGE;
+  if (gpio_config(&config) != ESP_OK) return false;
+  switchLevel = gpio_get_level(pin);
+
+  // Already installed if anything used attachInterrupt()
+  esp_err_t result = gpio_install_isr_service(0);
+  if (result != ESP_OK && result != ESP_ERR_INVALID_STATE) return false;
+  return gpio_isr_handler_add(pin, onSwitchEdge, NULL) == ESP_OK;
+}
+
+bool inputBegin(gpio_num_t encoderA, gpio_num_t encoderB, gpio_num_t switchPin) {
+  queue = xQueueCreate(INPUT_QUEUE_LENGTH, sizeof(InputEvent));
+  if (queue == NULL) return false;
+
+  bool ok = true;
+  if (!setupEncoder(encoderA, encoderB)) {
+    LOG_ERROR("[INPUT] Encoder setup failed");
+    ok = false;
+  }
+  if (!setupSwitch(switchPin)) {
+    LOG_ERROR("[INPUT] Switch setup failed");
+    ok = false;
+  }
+  return ok;
+}
+
+bool inputPending() {
+  return queue != NULL && uxQueueMessagesWaiting(queue) > 0;
+}
+
+bool inputNext(InputEvent& event) {
+  return queue != NULL && xQueueReceive(queue, &event, 0) == pdTRUE;
+}
+
+uint32_t inputDroppedCount() {
+  return dropped;
+}
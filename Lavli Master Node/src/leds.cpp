@@ -0,0 +1,141 @@
+#include "leds.h"
+#include <driver/rmt.h>
+#include <LavliLog.h>
+
+#define LEDS_RMT_CHANNEL   RMT_CHANNEL_0
+#define LEDS_RMT_CLK_DIV   2          // 80 MHz APB / 2 = 25 ns per tick
+#define LEDS_RMT_BLOCKS    2          // Two 48-item blocks: fewer refill interrupts per frame
+
+// WS2812 bit timings in 25 ns ticks
+#define WS2812_T0H  14    // 350 ns
+#define WS2812_T0L  34    // 850 ns
+#define WS2812_T1H  28    // 700 ns
+#define WS2812_T1L  24    // 600 ns
+
+#define FRAME_INTERVAL_MS (1000 / LEDS_MAX_FPS)
+// The animation timer hands frames over at the same rate, so a push that
+// lands a millisecond or two early must still go out, or every other frame
+// is dropped
+#define FRAME_JITTER_MS   2
+
+static uint16_t count = 0;
+static uint8_t brightness = 255;
+static uint32_t pixels[LEDS_MAX_COUNT];       // Composed frame, 0x00RRGGBB
+static uint8_t sent[LEDS_MAX_COUNT * 3];      // Last frame on the wire, GRB; read by the RMT driver
+static unsigned long lastPush = 0;
+static bool transmitting = false;
+static bool ready = false;
+static LedStats stats;
+
+// Expands bytes into RMT items, MSB first; called from the RMT interrupt
+static void IRAM_ATTR ws2812Translate(const void* src, rmt_item32_t* dest, size_t srcSize, size_t wanted,
+                                      size_t* translated, size_t* items) {
+  if (src == NULL || dest == NULL) {
+    *translated = 0;
+    *items = 0;
+    return;
+  }
+  const rmt_item32_t bit0 = {{{WS2812_T0H, 1, WS2812_T0L, 0}}};
+  const rmt_item32_t bit1 = {{{WS2812_T1H, 1, WS2812_T1L, 0}}};
+  const uint8_t* in = (const uint8_t*)src;
+  size_t size = 0;
+  size_t num = 0;
+  while (size < srcSize && num + 8 <= wanted) {
+    for (int bit = 7; bit >= 0; bit--) {
+      dest[num++].val = (in[size] & (1 << bit)) ? bit1.val : bit0.val;
+    }
+    size++;
+  }
+  *translated = size;
+  *items = num;
+}
+
+bool ledsBegin(gpio_num_t pin, uint16_t ledCount) {
+  count = min(ledCount, (uint16_t)LEDS_MAX_COUNT);
+
+  rmt_config_t config = {};
+  config.rmt_mode = RMT_MODE_TX;
+  config.channel = LEDS_RMT_CHANNEL;
+  config.gpio_num = pin;
+  config.clk_div = LEDS_RMT_CLK_DIV;
+  config.mem_block_num = LEDS_RMT_BLOCKS;
+  config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+  config.tx_config.idle_output_en = true;
+
+  if (rmt_config(&config) != ESP_OK || rmt_driver_install(LEDS_RMT_CHANNEL, 0, 0) != ESP_OK ||
+      rmt_translator_init(LEDS_RMT_CHANNEL, ws2812Translate) != ESP_OK) {
+    LOG_ERROR("[LEDS] RMT setup failed");
+    return false;
+  }
+  ready = true;
+
+  // Blank the strip once so the diff starts from what it actually shows
+  memset(pixels, 0, sizeof(pixels));
+  memset(sent, 0, sizeof(sent));
+  transmitting = rmt_write_sample(LEDS_RMT_CHANNEL, sent, count * 3, false) == ESP_OK;
+  lastPush = millis();
+  return true;
+}
+
+void ledsSetPixel(uint16_t index, uint32_t color) {
+  if (index < count) pixels[index] = color;
+}
+
+void ledsFill(uint32_t color) {
+  for (uint16_t i = 0; i < count; i++) pixels[i] = color;
+}
+
+void ledsSetBrightness(uint8_t value) {
+  brightness = value;
+}
+
+bool ledsShow() {
+  stats.shows++;
+  if (!ready) return false;
+
+  uint8_t frame[LEDS_MAX_COUNT * 3];
+  uint16_t scale = brightness + 1;
+  for (uint16_t i = 0; i < count; i++) {
+    uint32_t c = pixels[i];
+    frame[i * 3] = (((c >> 8) & 0xFF) * scale) >> 8;     // G
+    frame[i * 3 + 1] = (((c >> 16) & 0xFF) * scale) >> 8; // R
+    frame[i * 3 + 2] = ((c & 0xFF) * scale) >> 8;         // B
+  }
+
+  size_t length = count * 3;
+  if (memcmp(frame, sent, length) == 0) {
+    stats.unchanged++;
+    return false;
+  }
+
+  // The driver reads `sent` while the frame is on the wire
+  if (transmitting) {
+    if (rmt_wait_tx_done(LEDS_RMT_CHANNEL, 0) != ESP_OK) {
+      stats.deferred++;
+      return false;
+    }
+    transmitting = false;
+  }
+  if (millis() - lastPush < FRAME_INTERVAL_MS - FRAME_JITTER_MS) {
+    stats.deferred++;
+    return false;
+  }
+
+  memcpy(sent, frame, length);
+  if (rmt_write_sample(LEDS_RMT_CHANNEL, sent, length, false) != ESP_OK) return false;
+  transmitting = true;
+  lastPush = millis();
+  stats.pushed++;
+  return true;
+}
+
+LedStats ledsStats() {
+  return stats;
+}
+
+void ledsPrint(Print& out) {
+  out.printf("\n=== LEDs: %u pixels, brightness %u, cap %d fps ===\n", count, brightness, LEDS_MAX_FPS);
+  out.printf("  Shows %lu, pushed %lu, unchanged %lu, deferred %lu\n", (unsigned long)stats.shows,
+             (unsigned long)stats.pushed, (unsigned long)stats.unchanged, (unsigned long)stats.deferred);
+  out.println("=====================================\n");
+}
@@ -1,12 +1,31 @@
 #include <Arduino.h>
 #include <driver/twai.h>
-#include <Adafruit_NeoPixel.h>
-#include <ESP32Encoder.h>
 #include <WiFi.h>
 #include <WiFiManager.h>
 #include <WiFiClientSecure.h>
+#include <LavliWiFiCache.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
+#include <LavliProfiler.h>
+#include <LavliBoot.h>
+#include <LavliLog.h>
+#include <LavliCanIds.h>
+#include <LavliCanTime.h>
+#include <LavliCanIsoTp.h>
+#include <esp_timer.h>
+#include "spool.h"
+#include "scheduler.h"
+#include "recipes.h"
+#include "rules.h"
+#include "presence.h"
+#include "node_ota.h"
+#include "master_ota.h"
+#include "broker_ca.h"
+#include "provision.h"
+#include "leds.h"
+#include "animation.h"
+#include "input.h"
 
 // MQTT Configuration
 #define USE_PROVISIONING false
@@ -15,15 +34,45 @@
 #define MQTT_USERNAME "admin"
 #define MQTT_PASSWORD "lavlidevbroker!321"
 #define AP_NAME "Lavli-CAN-Master"
+#define BLE_NAME "Lavli Master"
 
+// Seed credentials, copied into NVS on a master that has never stored any.
+// Without them a fresh master waits for BLE provisioning (see provision.h).
 #define WIFI_SSID "PKFLetsKickIt"
 #define WIFI_PASSWORD "ClarkIsACat"
+// Failed connects with the stored credentials, before WiFi has worked once
+// this boot, after which the master falls back to BLE provisioning
+#define WIFI_BLE_FALLBACK_ATTEMPTS 4
+// Optional fixed address; otherwise the last DHCP lease is reused (LavliWiFiCache.h)
+// #define WIFI_STATIC_IP      192, 168, 1, 60
+// #define WIFI_STATIC_GATEWAY 192, 168, 1, 1
+// #define WIFI_STATIC_SUBNET  255, 255, 255, 0
 
 // MQTT Topics
 #define TOPIC_DRY "/lavli/dry"
 #define TOPIC_WASH "/lavli/wash"
 #define TOPIC_STOP "/lavli/stop"
 #define TOPIC_CAN_CONTROL "/lavli/can"
+#define TOPIC_TELEMETRY "/lavli/telemetry"
+#define TOPIC_EVENTS "/lavli/events"
+#define TOPIC_DIAG_REQUEST "/lavli/diag"
+#define TOPIC_DIAG_PROFILE "/lavli/diag/profile"
+#define TOPIC_RECIPE "/lavli/recipe"
+#define TOPIC_RULES "/lavli/rules"
+#define TOPIC_NODE_OTA "/lavli/node_ota"
+#define TOPIC_NODE_OTA_DATA "/lavli/node_ota/data"
+#define TOPIC_OTA "/lavli/ota"
+#define TOPIC_OTA_STATUS "/lavli/ota/status"
+
+#define MQTT_RECONNECT_INTERVAL_MS 5000
+#define MQTT_VERIFY_BROKER 1             // Check the broker certificate against BROKER_CA_CERT
+#define MQTT_KEEPALIVE_S 60              // PINGREQ only after a minute of silence; telemetry usually beats it
+#define MQTT_SOCKET_TIMEOUT_S 5          // Longest a read may hold the scheduler; CONNECT waits in its own task
+#define MQTT_HANDSHAKE_TIMEOUT_S 10      // TLS handshake limit (library default is 120 s)
+#define MQTT_CONNECT_STACK 8192          // Connect task: TLS handshake, CONNECT, subscribes
+#define MQTT_CONNECT_PRIORITY 1          // Same as the loop task; it mostly waits on the network
+#define MQTT_BUFFER_SIZE (RECIPE_MAX_JSON + 256)  // Room for a full recipe or rule set download
+#define TELEMETRY_QUEUE_LEN 32           // Readings waiting between CAN RX and the spool task
 
 // Interface Setup
 #define LED_PIN GPIO_NUM_6
@@ -31,28 +80,44 @@
 #define ENCODER_A GPIO_NUM_7
 #define ENCODER_B GPIO_NUM_8
 #define ENCODER_SWITCH GPIO_NUM_9
-#define DEBOUNCE_DELAY 50
 
-// Program Timer Configuration
-#define PROGRAM_DURATION_MS (10 * 60 * 1000)  // 10 minutes in milliseconds
-Adafruit_NeoPixel strip(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
-ESP32Encoder encoder;
+// Scheduler task periods
+#define MQTT_SERVICE_PERIOD_MS 10     // Keepalive/reconnect cadence; incoming data is handled as it arrives
+#define WIFI_SERVICE_PERIOD_MS 500
+#define PROGRAM_TIMER_PERIOD_MS 100
+#define LED_UPDATE_PERIOD_MS 100      // Layer parameters only; frames come from the animation timer
+#define CAN_RX_BATCH 8                // Max frames handled per CAN task run
+#define ISOTP_SERVICE_PERIOD_MS 100  // Transfer timeouts; frames go out as soon as ready
+#define TIME_SYNC_PERIOD_MS 1000     // Nodes fit drift over the last few rounds
 
-int lastEncoderValue = 0;
 int brightness = 50;
-bool lastSwitchState = HIGH;
-unsigned long lastDebounceTime = 0;
 
-// Program timing variables
-unsigned long programStartTime = 0;
-unsigned long programDurationMs = PROGRAM_DURATION_MS;
 bool fadeInActive = false;
-unsigned long fadeStartTime = 0;
 #define FADE_DURATION_MS 2000
+#define LED_CROSSFADE_MS 150
+#define LED_PULSE_PERIOD_MS 2000
+#define LED_FLASH_PERIOD_MS 300
+#define LED_FLASH_COUNT 3
 
 // WiFi and MQTT clients
 WiFiClientSecure espClient;
 PubSubClient mqttClient(espClient);
+
+// Cost of the last broker connect; each one is a full TLS handshake
+struct MqttConnectStats {
+  uint32_t connects;
+  uint32_t failures;
+  uint32_t tls_ms;          // TCP connect + TLS handshake
+  uint32_t mqtt_ms;         // CONNECT to CONNACK
+  uint32_t heap_before;
+  uint32_t heap_after;
+  uint32_t heap_min;        // Lowest free heap since boot, usually set during a handshake
+  unsigned long connected_at;
+};
+MqttConnectStats mqttStats;
+// Set while the connect task owns espClient and mqttClient (connectToMQTT)
+TaskHandle_t mqttConnectTask = NULL;
+volatile bool mqttConnectDone = false;
 WiFiManager wifiManager;
 
 // MQTT Command Variables
@@ -77,9 +142,9 @@ struct GenericCANCommand {
 
 GenericCANCommand genericCANCommand = {false, 0, {0}, 0, 0};
 
-// CAN IDs of Controllers
-#define CONTROLLER_120V_ADDRESS 0x543
-#define CONTROLLER_MOTOR_ADDRESS 0x311
+// CAN node IDs of controllers; frame IDs are built with canRequestId()
+#define CONTROLLER_120V_NODE LAVLI_NODE_OUTPUT_120V
+#define CONTROLLER_MOTOR_NODE LAVLI_NODE_MOTOR
 
 // CAN pins
 #define CAN_TX_PIN GPIO_NUM_4
@@ -88,6 +153,12 @@ GenericCANCommand genericCANCommand = {false, 0, {0}, 0, 0};
 // Command definitions for output control
 #define ACTIVATE_CMD   0x01
 #define DEACTIVATE_CMD 0x02
+#define SET_OUTPUTS_CMD 0x07  // [0x07, mask, value]; bit n = port n, applied in one register write
+#define PULSE_CMD      0x0D   // [0x0D, mask, ms x 3]; timed by the node, off when done
+#define SEQUENCE_CMD   0x0E   // Bulk: [0x0E, mask, runs, (value, ms x 2) x n]
+#define SEQUENCE_MAX_STEPS 16
+#define PWM_CONFIG_CMD 0x0F   // DC board: [0x0F, port, freq Hz x 2, duty permille x 2, ramp ms x 2]
+#define PWM_STATUS_CMD 0x14   // DC board: [0x14, port]
 
 // New command definitions for sensor requests
 #define READ_ANALOG_CMD   0x03
@@ -104,9 +175,13 @@ GenericCANCommand genericCANCommand = {false, 0, {0}, 0, 0};
 // Response command definitions
 #define ACK_ACTIVATE      0x10
 #define ACK_DEACTIVATE    0x11
+#define ACK_OUTPUTS       0x12    // [0x12, port state, status]
+#define ACK_TIMED_DONE    0x13    // [0x13, kind, mask, status, port state, elapsed ms x 3]
+#define ACK_PWM_CONFIG    0x15    // [0x15, port, status]
+#define PWM_STATUS_DATA   0x16    // [0x16, port, flags, duty x 2, current duty x 2]
 #define ANALOG_DATA       0x20
 #define DIGITAL_DATA      0x21
-#define ALL_ANALOG_DATA   0x22
+#define ALL_ANALOG_DATA   0x22    // Bulk: [0x22, stamp x 4, (pin, high, low) x n]
 #define ALL_DIGITAL_DATA  0x23
 #define ACK_MOTOR_RPM         0x40
 #define ACK_MOTOR_DIRECTION   0x41
@@ -120,6 +195,7 @@ struct SensorReading {
   bool digital_value;
   bool valid;
   unsigned long timestamp;
+  int64_t sample_us;        // Acquisition time on the master's esp_timer clock
 };
 
 // Storage for sensor readings from different devices
@@ -134,29 +210,60 @@ twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
 twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
 // Function prototypes
-void setupWiFi();
+void setupScheduler();
+void setupRecipes();
+void onRuleFired(const Rule& rule);
+void onNodePresence(const NodePresence& node, bool joined);
+void onNodeBoot(const NodePresence& node);
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length);
+bool sendDiscover();
+void startWiFi();
+void serviceWiFi();
+void printHelp();
 void configModeCallback(WiFiManager *myWiFiManager);
 void saveConfigCallback();
-void connectToMQTT();
+bool connectToMQTT();
+void finishMQTTConnect();
+bool mqttReady();
+void printMqttStats();
 void onMqttMessage(char* topic, byte* payload, unsigned int length);
 void processMQTTCommands();
+bool publishMessage(const char* topic, const char* payload);
+void beginPublishSequence();
+bool publishEvent(const char* event, const char* detail);
+bool publishOtaStatus(const char* json);
+void publishSensorTelemetry(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog, int64_t sample_us);
+void queueSensorTelemetry(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog, int64_t sample_us);
+void serviceTelemetry();
+void printTelemetryQueue();
+bool publishProfileSnapshot();
 bool parseGenericCANCommand(String jsonMessage);
 bool sendGenericCANMessage(uint16_t address, uint8_t* data, uint8_t data_length);
 
 bool initializeCAN();
 void initializeSensorStorage();
-bool sendOutputCommand(uint16_t device_address, uint8_t command, uint8_t port);
-bool requestAnalogReading(uint16_t device_address, uint8_t pin);
-bool requestDigitalReading(uint16_t device_address, uint8_t pin);
-bool requestAllAnalogReadings(uint16_t device_address);
-bool requestAllDigitalReadings(uint16_t device_address);
-bool sendMotorRPM(uint16_t device_address, uint16_t rpm);
-bool sendMotorDirection(uint16_t device_address, bool clockwise);
-bool sendMotorStop(uint16_t device_address);
-bool requestMotorStatus(uint16_t device_address);
+bool sendOutputCommand(uint8_t node, uint8_t command, uint8_t port);
+bool sendSetOutputs(uint8_t node, uint8_t mask, uint8_t value);
+bool sendPulse(uint8_t node, uint8_t mask, uint32_t ms);
+bool sendPwmConfig(uint8_t node, uint8_t port, uint16_t freq_hz, uint16_t duty, uint16_t ramp_ms);
+bool requestPwmStatus(uint8_t node, uint8_t port);
+bool sendSequence(uint8_t node, uint8_t mask, uint8_t runs, const uint8_t* values, const uint16_t* ms, uint8_t count);
+bool requestAnalogReading(uint8_t node, uint8_t pin);
+bool requestDigitalReading(uint8_t node, uint8_t pin);
+bool requestAllAnalogReadings(uint8_t node);
+bool requestAllDigitalReadings(uint8_t node);
+bool sendMotorRPM(uint8_t node, uint16_t rpm);
+bool sendMotorDirection(uint8_t node, bool clockwise);
+bool sendMotorStop(uint8_t node);
+bool requestMotorStatus(uint8_t node);
+bool sendStopAll();
+void sendTimeSync();
+bool requestSensorSnapshot();
 void receiveCANMessages();
+bool canFramesPending();
 void processReceivedMessage(twai_message_t* message);
-void storeSensorReading(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog);
+uint32_t getStamp(const uint8_t* data);
+void storeSensorReading(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog, uint32_t stamp);
 SensorReading getAnalogReading(uint16_t device_address, uint8_t pin);
 SensorReading getDigitalReading(uint16_t device_address, uint8_t pin);
 void printSensorData(uint16_t device_address);
@@ -176,236 +283,331 @@ MachineState currentState = STATE_IDLE;
 
 void startWash()
 {
-    sendMotorRPM(CONTROLLER_MOTOR_ADDRESS, 50);
-    programStartTime = millis();
+    if (!recipeStart("wash")) {
+      animFlash(ledsColor(255, 0, 0), LED_FLASH_COUNT, LED_FLASH_PERIOD_MS);
+      return;
+    }
     currentState = STATE_WASHING;
+    publishEvent("program_start", "wash");
 }
 
 void startDry()
 {
-    sendOutputCommand(CONTROLLER_120V_ADDRESS, ACTIVATE_CMD, 0);
-    sendMotorRPM(CONTROLLER_MOTOR_ADDRESS, 50);
-    programStartTime = millis();
+    if (!recipeStart("dry")) {
+      animFlash(ledsColor(255, 0, 0), LED_FLASH_COUNT, LED_FLASH_PERIOD_MS);
+      return;
+    }
     currentState = STATE_DRYING;
+    publishEvent("program_start", "dry");
 }
 
 void stopAll()
 {
-    sendMotorRPM(CONTROLLER_MOTOR_ADDRESS, 0);
-    sendOutputCommand(CONTROLLER_120V_ADDRESS, DEACTIVATE_CMD, 0);
-    sendOutputCommand(CONTROLLER_120V_ADDRESS, DEACTIVATE_CMD, 1);
-    programStartTime = 0;
+    recipeStop();
+    // One safety-class frame to the actuator group, however many nodes there are
+    if (!sendStopAll()) {
+        LOG_ERROR("[CAN] Failed to send stop to actuator group");
+    }
     currentState = STATE_IDLE;
+    publishEvent("program_stop", "");
+}
+
+void onRecipeComplete(const char* name) {
+    Serial.printf("[RECIPE] %s completed, stopping all operations\n", name);
+    publishEvent("program_complete", name);
+    stopAll();
+}
+
+// Recipe engine bindings to the CAN controllers. Absent nodes are skipped
+// rather than waited on; the engine resends speed on its next pass and
+// direction and outputs every RECIPE_RETRY_MS until they go out.
+bool recipeSetMotorRPM(uint16_t rpm) {
+    if (!presenceIsOnline(CONTROLLER_MOTOR_NODE)) return false;
+    return sendMotorRPM(CONTROLLER_MOTOR_NODE, rpm);
+}
+
+bool recipeSetMotorDirection(bool clockwise) {
+    if (!presenceIsOnline(CONTROLLER_MOTOR_NODE)) return false;
+    return sendMotorDirection(CONTROLLER_MOTOR_NODE, clockwise);
 }
 
-bool isProgramTimeElapsed() {
-    if (programStartTime == 0) return false;
-    return (millis() - programStartTime) >= programDurationMs;
+bool recipeSetOutputs(uint8_t mask, uint8_t value) {
+    const NodePresence* node = presenceGet(CONTROLLER_120V_NODE);
+    if (node == NULL || !node->online) return false;
+    // The node rejects a mask naming ports it lacks; it reports how many it has
+    mask &= ((1 << (node->channels + 1)) - 1) & ~1;
+    if (mask == 0) return true;
+    return sendSetOutputs(CONTROLLER_120V_NODE, mask, value);
 }
 
-void checkProgramTimer() {
-    if ((currentState == STATE_WASHING || currentState == STATE_DRYING) && isProgramTimeElapsed()) {
-        Serial.println("[TIMER] Program duration completed, stopping all operations");
-        stopAll();
+void recipeRequestSensor(uint16_t device, uint8_t pin, bool analog) {
+    if (!presenceIsOnline(device)) return;
+    if (analog) {
+        requestAnalogReading(device, pin);
+    } else {
+        requestDigitalReading(device, pin);
     }
 }
 
+bool recipeReadSensor(uint16_t device, uint8_t pin, bool analog, uint16_t* value, unsigned long* timestamp) {
+    SensorReading reading = analog ? getAnalogReading(device, pin) : getDigitalReading(device, pin);
+    if (!reading.valid) return false;
+    *value = analog ? reading.analog_value : reading.digital_value;
+    *timestamp = reading.timestamp;
+    return true;
+}
+
+void setupRecipes() {
+    RecipeHooks hooks = {
+        recipeSetMotorRPM,
+        recipeSetMotorDirection,
+        recipeSetOutputs,
+        recipeRequestSensor,
+        recipeReadSensor,
+        onRecipeComplete,
+    };
+    recipesBegin(hooks);
+}
+
 
 void setupInterface()
 {
-  strip.begin();
-  strip.show();
-  strip.setBrightness(brightness);
+  ledsBegin(LED_PIN, LED_COUNT);
+  ledsSetBrightness(brightness);
   
-  ESP32Encoder::useInternalWeakPullResistors = puType::UP;
-  encoder.attachHalfQuad(ENCODER_A, ENCODER_B);
-  encoder.clearCount();
-
-  pinMode(ENCODER_SWITCH, INPUT_PULLUP);
-
-  for(int i = 0; i < LED_COUNT; i++){
-    strip.setPixelColor(i, strip.Color(0, 0, 255));
+  if (!inputBegin(ENCODER_A, ENCODER_B, ENCODER_SWITCH)) {
+    LOG_ERROR("[SETUP] Front panel input unavailable");
   }
-  strip.show();
+
+  animBegin(LED_COUNT);
+  animSetBase(ledsColor(0, 0, 255), 0);
 }
 
 void handleSwitchPress() {
-  bool switchReading = digitalRead(ENCODER_SWITCH);
-  
-  if ((millis() - lastDebounceTime) > DEBOUNCE_DELAY) {
-    if (switchReading != lastSwitchState) {
-      if (switchReading == LOW) {
-        // TODO: Do Switch functions in here
-        Serial.println("[SWITCH] Button pressed");
-
-        if(currentState == STATE_OFF) {
-          currentState = STATE_IDLE;
-          fadeInActive = true;
-          fadeStartTime = millis();
-        }
-        else if(currentState == STATE_SELECT_WASH){
-          startWash();
-        }
-        else if(currentState == STATE_SELECT_DRY){
-          startDry();
-        }
-        else if(currentState == STATE_WASHING || currentState == STATE_DRYING){
-          stopAll();
-        }
+  Serial.println("[SWITCH] Button pressed");
 
-      }
-      lastSwitchState = switchReading;
-    }
-    lastDebounceTime = millis();
-  }
-}
-
-void drawLEDs() {
-  // Handle fade-in animation
-  if (fadeInActive) {
-    unsigned long fadeElapsed = millis() - fadeStartTime;
-    if (fadeElapsed >= FADE_DURATION_MS) {
-      fadeInActive = false;
-    } else {
-      float fadeProgress = (float)fadeElapsed / FADE_DURATION_MS;
-      uint8_t alpha = (uint8_t)(255 * fadeProgress);
-      
-      for(int i = 0; i < LED_COUNT; i++){
-        strip.setPixelColor(i, strip.Color(alpha, alpha, alpha));
-      }
-      strip.show();
-      return;
-    }
-  }
-  
   if(currentState == STATE_OFF) {
-    for(int i = 0; i < LED_COUNT; i++){
-      strip.setPixelColor(i, strip.Color(0, 0, 0));
-    }
-  }
-  else if(currentState == STATE_IDLE){
-    for(int i = 0; i < LED_COUNT; i++){
-      strip.setPixelColor(i, strip.Color(255, 255, 255));
-    }
+    currentState = STATE_IDLE;
+    fadeInActive = true;
   }
   else if(currentState == STATE_SELECT_WASH){
-    for(int i = 0; i < LED_COUNT; i++){
-      strip.setPixelColor(i, strip.Color(0, 255, 0));
-    }
+    startWash();
   }
   else if(currentState == STATE_SELECT_DRY){
-    for(int i = 0; i < LED_COUNT; i++){
-      strip.setPixelColor(i, strip.Color(255, 0, 0));
-    }
+    startDry();
   }
-  else if(currentState == STATE_DRYING || currentState == STATE_WASHING){
-    // Calculate remaining time and LEDs to show
-    if (programStartTime > 0) {
-      unsigned long elapsed = millis() - programStartTime;
-      unsigned long remaining = (elapsed >= programDurationMs) ? 0 : (programDurationMs - elapsed);
-      float remainingPercent = (float)remaining / programDurationMs;
-      int ledsToShow = (int)(LED_COUNT * remainingPercent);
-      
-      // Set color based on program type
-      uint32_t color;
-      if (currentState == STATE_DRYING) {
-        color = strip.Color(255, 100, 0); // Orange for drying
-      } else {
-        color = strip.Color(0, 100, 255); // Blue for washing
-      }
-      
-      // Light up LEDs for remaining time
-      for(int i = 0; i < LED_COUNT; i++){
-        if (i < ledsToShow) {
-          strip.setPixelColor(i, color);
-        } else {
-          strip.setPixelColor(i, strip.Color(0, 0, 0));
-        }
-      }
-    }
+  else if(currentState == STATE_WASHING || currentState == STATE_DRYING){
+    stopAll();
   }
+}
 
-  strip.show();
+void handleEncoderStep() {
+  if(currentState == STATE_IDLE || currentState == STATE_SELECT_DRY){
+    currentState = STATE_SELECT_WASH;
+  }
+  else if(currentState == STATE_SELECT_WASH){
+    currentState = STATE_SELECT_DRY;
+  }
 }
 
-void readEncoder(){
-  int newValue = encoder.getCount();
-  newValue = newValue /4;
-  if (newValue != lastEncoderValue) {
-    
-    if(currentState == STATE_IDLE || currentState == STATE_SELECT_DRY){
-      currentState = STATE_SELECT_WASH;
+// Drains the panel events queued by the encoder and switch interrupts
+void handleInput() {
+  InputEvent event;
+  while (inputNext(event)) {
+    switch (event.type) {
+      case INPUT_SWITCH_PRESS:
+        handleSwitchPress();
+        break;
+      case INPUT_ENCODER_CW:
+      case INPUT_ENCODER_CCW:
+        handleEncoderStep();
+        break;
+      default:
+        break;
     }
-    else if(currentState == STATE_SELECT_WASH){
-      currentState = STATE_SELECT_DRY;
+  }
+}
+
+// Maps the machine state onto animation layers; the animation timer draws
+// the frames and the renderer only sends the ones that change
+void drawLEDs() {
+  uint16_t fadeMs = LED_CROSSFADE_MS;
+  if (fadeInActive) {
+    fadeInActive = false;
+    fadeMs = FADE_DURATION_MS;
+  }
+
+  if (currentState == STATE_DRYING || currentState == STATE_WASHING) {
+    // Ring shows the time remaining
+    uint32_t total = recipeTotalMs();
+    uint32_t color = currentState == STATE_DRYING ? ledsColor(255, 100, 0)   // Orange for drying
+                                                  : ledsColor(0, 100, 255);  // Blue for washing
+    if (total > 0) {
+      animSetProgress(color, (uint64_t)ANIM_PROGRESS_ONE * recipeRemainingMs() / total);
     }
+  } else {
+    animClearProgress();
+    uint32_t base = 0;
+    if (currentState == STATE_IDLE) {
+      base = ledsColor(255, 255, 255);
+    } else if (currentState == STATE_SELECT_WASH) {
+      base = ledsColor(0, 255, 0);
+    } else if (currentState == STATE_SELECT_DRY) {
+      base = ledsColor(255, 0, 0);
+    }
+    animSetBase(base, fadeMs);
+  }
 
-    lastEncoderValue = newValue;
+  // Waiting for a phone to provision WiFi
+  if (provisionActive()) {
+    animSetPulse(ledsColor(0, 0, 255), LED_PULSE_PERIOD_MS);
+  } else {
+    animClearPulse();
   }
 }
 
 void setup() {
+  bootPhase("start");
   Serial.begin(115200);
-  Serial.println("\n=== Lavli CAN Master with MQTT Starting ===");
-  Serial.println("[SETUP] Serial initialized at 115200 baud");
-  
-  delay(2000);
+  logBegin(Serial);
+  LOG_INFO("=== Lavli CAN Master starting ===");
 
-  setupInterface();
-  Serial.println("[SETUP] Interface initialized");
-  
-  // Initialize sensor data storage
-  initializeSensorStorage();
-  Serial.println("[SETUP] Sensor storage initialized");
-  
-  // Initialize CAN
+  // First, so an image that crashes later in setup still counts its boots
+  masterOtaBegin(publishOtaStatus, recipeIsRunning);
+  bootPhase("serial");
+
+  // CAN first: nodes can be told to stop before anything slower runs.
+  // Presence frames are only handled once the scheduler runs, after the
+  // spool is mounted, so node events can already be published.
   if (initializeCAN()) {
-    Serial.println("[SETUP] CAN initialized successfully");
+    LOG_INFO("[SETUP] CAN initialized successfully");
+    // Ask nodes that booted before us to announce themselves
+    presenceBegin(onNodePresence, sendDiscover, onNodeBoot);
+    isoTpBeginMaster(onBulkMessage);
+    nodeOtaBegin(publishEvent);
   } else {
-    Serial.println("[SETUP] CAN initialization failed");
+    LOG_ERROR("[SETUP] CAN initialization failed");
   }
-  
-  Serial.println("[SETUP] Starting WiFi setup...");
-  setupWiFi();
-  Serial.println("[SETUP] WiFi setup complete");
-  
-  Serial.println("[SETUP] Configuring TLS client (insecure mode)");
+  bootPhase("can");
+  bootCanReady();
+
+  setupInterface();
+  initializeSensorStorage();
+  bootPhase("interface");
+
+  // Mount the offline publish spool before anything can publish
+  beginPublishSequence();
+  if (!spoolBegin()) {
+    LOG_WARN("[SETUP] Offline spool unavailable");
+  }
+  bootPhase("spool");
+
+  // Programs come from the recipe table (built-ins plus any stored on flash)
+  setupRecipes();
+
+  // Local sensor rules fire CAN actions without a cloud round trip
+  rulesBegin(sendGenericCANMessage, onRuleFired);
+  bootPhase("recipes");
+
+  // WiFi and MQTT come up in the background; serviceWiFi() and serviceMQTT()
+  // take it from here, so control never waits for the network
+  startWiFi();
+#if MQTT_VERIFY_BROKER
+  espClient.setCACert(BROKER_CA_CERT);
+#else
   espClient.setInsecure();
-  
-  Serial.print("[SETUP] Setting MQTT server: ");
-  Serial.print(MQTT_BROKER);
-  Serial.print(":");
-  Serial.println(MQTT_PORT);
+#endif
+  espClient.setHandshakeTimeout(MQTT_HANDSHAKE_TIMEOUT_S);
+  mqttClient.setKeepAlive(MQTT_KEEPALIVE_S);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
   mqttClient.setServer(MQTT_BROKER, MQTT_PORT);
-  
-  Serial.println("[SETUP] Setting MQTT callback function");
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE);
   mqttClient.setCallback(onMqttMessage);
-  
-  Serial.println("[SETUP] Attempting initial MQTT connection...");
-  connectToMQTT();
-  
-  Serial.println("[SETUP] Setup complete!");
+  bootPhase("network");
+
+  setupScheduler();
+  bootPhase("setup");
+
+  LOG_INFO("[SETUP] Ready: CAN at %d ms, setup done at %d ms. Type 'help' for commands", bootCanReadyMs(),
+           bootSetupMs());
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%s reset, can %lu ms, setup %lu ms",
+           bootResetReasonName(bootResetReason()), (unsigned long)bootCanReadyMs(),
+           (unsigned long)bootSetupMs());
+  publishEvent("boot", detail);
+}
+
+// Printed on request only; writing it at boot held up setup()
+void printHelp() {
   Serial.println("Commands:");
-  Serial.println("  activate <addr> <port>    - Activate output port");
-  Serial.println("  deactivate <addr> <port>  - Deactivate output port");
-  Serial.println("  analog <addr> <pin>       - Read analog pin");
-  Serial.println("  digital <addr> <pin>      - Read digital pin");
-  Serial.println("  all_analog <addr>         - Read all analog pins");
-  Serial.println("  all_digital <addr>        - Read all digital pins");
-  Serial.println("  status <addr>             - Show sensor data for device");
-  Serial.println("  motor_rpm <addr> <rpm>    - Set motor RPM (0-1500)");
-  Serial.println("  motor_direction <addr> <0|1> - Set motor direction (0=CCW, 1=CW)");
-  Serial.println("  motor_stop <addr>         - Stop motor");
-  Serial.println("  motor_status <addr>       - Request motor status");
+  Serial.println("  activate <node> <port>    - Activate output port");
+  Serial.println("  deactivate <node> <port>  - Deactivate output port");
+  Serial.println("  outputs <node> <mask> <value> - Set several ports at once (hex, bit n = port n)");
+  Serial.println("  pulse <node> <mask> <ms>  - Ports on for ms, timed by the node (hex node/mask)");
+  Serial.println("  sequence <node> <mask> <runs> <value>:<ms> ... - Run a sequence on the node");
+  Serial.println("  pwm <node> <port> <hz> <duty> <ramp_ms> - PWM a DC port (duty in 1/1000, hz 0 = on/off)");
+  Serial.println("  pwm_status <node> <port> - Read back a DC port's duty");
+  Serial.println("  analog <node> <pin>       - Read analog pin");
+  Serial.println("  digital <node> <pin>      - Read digital pin");
+  Serial.println("  all_analog <node>         - Read all analog pins");
+  Serial.println("  all_digital <node>        - Read all digital pins");
+  Serial.println("  status <node>             - Show sensor data for node");
+  Serial.println("  motor_rpm <node> <rpm>    - Set motor RPM (0-1500)");
+  Serial.println("  motor_direction <node> <0|1> - Set motor direction (0=CCW, 1=CW)");
+  Serial.println("  motor_stop <node>         - Stop motor");
+  Serial.println("  motor_status <node>       - Request motor status");
+  Serial.println("  recipes                   - List wash/dry recipes");
+  Serial.println("  rules                     - List sensor rules and fire counts");
+  Serial.println("  nodes                     - List CAN nodes and their presence");
+  Serial.println("  discover                  - Ask every node to announce itself");
+  Serial.println("  isotp                     - Show segmented transfer status");
+  Serial.println("  node_ota <node>           - Flash the stored node image to a node");
+  Serial.println("  node_ota_status           - Show node firmware update progress");
+  Serial.println("  node_ota_abort            - Stop a node firmware update");
+  Serial.println("  ota_status                - Show master firmware update status");
+  Serial.println("  ota_abort                 - Stop a master firmware download");
+  Serial.println("  spool                     - Show offline spool status");
+  Serial.println("  tasks                     - Show scheduler task timing");
+  Serial.println("  tasks_reset               - Reset scheduler task timing");
+  Serial.println("  profile                   - Show section latency histograms");
+  Serial.println("  profile_reset             - Reset section latency histograms");
+  Serial.println("  stop_all                  - Stop every actuator with one group frame");
+  Serial.println("  snapshot                  - Ask every sensor node for all inputs");
+  Serial.println("  time_sync                 - Run one time sync round on the bus");
+  Serial.println("  boot                      - Show boot phase timing");
+  Serial.println("  mqtt                      - Show broker connection and TLS handshake cost");
+  Serial.println("  leds                      - Show animation and LED frame statistics");
+  Serial.println("  wifi                      - Show WiFi connect timing and cached AP");
+  Serial.println("  wifi_forget               - Clear the cached AP (next connect scans)");
+  Serial.println("  wifi_provision            - Forget WiFi credentials and restart into BLE provisioning");
+  Serial.println("  provision                 - Show BLE provisioning state");
+  Serial.println("  help                      - Show this list");
   Serial.println("MQTT Topics subscribed:");
   Serial.println("  " + String(TOPIC_DRY) + " - Dry command");
   Serial.println("  " + String(TOPIC_WASH) + " - Wash command");
   Serial.println("  " + String(TOPIC_STOP) + " - Stop command");
   Serial.println("  " + String(TOPIC_CAN_CONTROL) + " - Generic CAN control (JSON)");
+  Serial.println("  " + String(TOPIC_DIAG_REQUEST) + " - Diagnostics request (\"profile\", \"snapshot\")");
+  Serial.println("  " + String(TOPIC_RECIPE) + " - Recipe download (JSON)");
+  Serial.println("  " + String(TOPIC_RULES) + " - Sensor rule set (JSON)");
+  Serial.println("  " + String(TOPIC_NODE_OTA) + " - Node firmware update control (JSON)");
+  Serial.println("  " + String(TOPIC_NODE_OTA_DATA) + " - Node firmware image chunks (binary)");
+  Serial.println("  " + String(TOPIC_OTA) + " - Master firmware update (JSON url, sha256)");
+  Serial.println("MQTT Topics published (spooled while offline):");
+  Serial.println("  " + String(TOPIC_TELEMETRY) + " - Sensor readings");
+  Serial.println("  " + String(TOPIC_EVENTS) + " - Program events");
+  Serial.println("  " + String(TOPIC_DIAG_PROFILE) + " - Profile snapshot (live only)");
+  Serial.println("  " + String(TOPIC_OTA_STATUS) + " - Master firmware update progress (live, retained)");
   Serial.println();
   Serial.println("Generic CAN JSON format:");
-  Serial.println("  {\"address\":\"0x311\", \"data\":[\"0x30\", 50, 0]}");
-  Serial.println("  {\"address\":785, \"data\":[1, 2]}");
+  Serial.println("  {\"address\":\"0x203\", \"data\":[\"0x30\", 50, 0]}   (control class, motor node)");
+  Serial.println("  {\"address\":513, \"data\":[1, 2]}             (control class, 120V node)");
+  Serial.println("Rule JSON format:");
+  Serial.println("  {\"rules\":[{\"name\":\"heater_cut\", \"dev\":\"0x04\", \"pin\":2, \"analog\":true, \"above\":3000, \"hyst\":100,");
+  Serial.println("    \"can\":{\"address\":\"0x001\", \"data\":[2, 1]}}]}");
+  Serial.println("Recipe JSON format:");
+  Serial.println("  {\"name\":\"wash\", \"steps\":[{\"ms\":60000, \"rpm\":50, \"dir\":\"cw\", \"ramp_ms\":2000, \"outputs\":[1],");
+  Serial.println("    \"until\":{\"dev\":\"0x04\", \"pin\":0, \"analog\":true, \"below\":800}}]}");
   Serial.println();
 }
 
@@ -414,6 +616,182 @@ void doSerialControl()
   if (Serial.available()) {
     String command = Serial.readStringUntil('\n');
     command.trim();
+
+    if (command == "help") {
+      printHelp();
+      return;
+    }
+    if (command == "boot") {
+      bootPrint(Serial);
+      return;
+    }
+    if (command == "leds") {
+      animPrint(Serial);
+      ledsPrint(Serial);
+      return;
+    }
+    if (command == "mqtt") {
+      printMqttStats();
+      return;
+    }
+    if (command == "wifi") {
+      wifiCachePrint(Serial);
+      return;
+    }
+    if (command == "wifi_provision") {
+      provisionClearCredentials();
+      wifiCacheClear();
+      Serial.println("[WIFI] Credentials cleared, restarting into BLE provisioning");
+      logFlush();
+      ESP.restart();
+      return;
+    }
+    if (command == "provision") {
+      provisionPrint(Serial);
+      return;
+    }
+    if (command == "wifi_forget") {
+      wifiCacheClear();
+      Serial.println("[WIFI] Cached access point cleared");
+      return;
+    }
+    if (command == "rules") {
+      rulesPrint();
+      return;
+    }
+    if (command == "nodes") {
+      presencePrint();
+      return;
+    }
+    if (command == "discover") {
+      Serial.println(sendDiscover() ? "Discover sent" : "Failed to send discover");
+      return;
+    }
+    if (command == "isotp") {
+      isoTpPrint(Serial);
+      return;
+    }
+    if (command == "node_ota_status") {
+      nodeOtaPrint();
+      return;
+    }
+    if (command == "node_ota_abort") {
+      nodeOtaAbort("aborted");
+      return;
+    }
+    if (command == "ota_status") {
+      masterOtaPrint();
+      return;
+    }
+    if (command == "ota_abort") {
+      masterOtaAbort("aborted");
+      return;
+    }
+    if (command == "recipes") {
+      recipePrintList();
+      return;
+    }
+    if (command == "spool") {
+      spoolPrintStatus();
+      printTelemetryQueue();
+      return;
+    }
+    if (command == "tasks") {
+      schedulerPrintStats();
+      return;
+    }
+    if (command == "tasks_reset") {
+      schedulerResetStats();
+      Serial.println("Scheduler statistics reset");
+      return;
+    }
+    if (command == "profile") {
+      profilerPrint(Serial);
+      return;
+    }
+    if (command == "stop_all") {
+      Serial.println(sendStopAll() ? "Stop sent to actuator group" : "Failed to send stop");
+      return;
+    }
+    if (command == "snapshot") {
+      Serial.println(requestSensorSnapshot() ? "Snapshot requested from sensor group" : "Failed to request snapshot");
+      return;
+    }
+    if (command == "time_sync") {
+      sendTimeSync();
+      Serial.println("Time sync round sent");
+      return;
+    }
+    if (command == "profile_reset") {
+      profilerReset();
+      Serial.println("Profile statistics reset");
+      return;
+    }
+    if (command.startsWith("outputs ")) {
+      unsigned node, mask, value;
+      if (sscanf(command.c_str(), "outputs %x %x %x", &node, &mask, &value) == 3) {
+        Serial.printf("Setting outputs on node 0x%02X: mask 0x%02X, value 0x%02X\n", node, mask, value);
+        sendSetOutputs(node, mask, value);
+      } else {
+        Serial.println("Usage: outputs <node> <mask> <value>  (hex, bit n = port n)");
+      }
+      return;
+    }
+    if (command.startsWith("pulse ")) {
+      unsigned node, mask;
+      unsigned long ms;
+      if (sscanf(command.c_str(), "pulse %x %x %lu", &node, &mask, &ms) == 3) {
+        Serial.printf("Pulsing mask 0x%02X on node 0x%02X for %lu ms\n", mask, node, ms);
+        sendPulse(node, mask, ms);
+      } else {
+        Serial.println("Usage: pulse <node> <mask> <ms>  (node and mask in hex)");
+      }
+      return;
+    }
+    if (command.startsWith("pwm ")) {
+      unsigned node, port, freq, duty, ramp;
+      if (sscanf(command.c_str(), "pwm %x %u %u %u %u", &node, &port, &freq, &duty, &ramp) == 5) {
+        Serial.printf("PWM node 0x%02X port %u: %u Hz, duty %u/1000, ramp %u ms\n", node, port, freq, duty, ramp);
+        sendPwmConfig(node, port, freq, duty, ramp);
+      } else {
+        Serial.println("Usage: pwm <node> <port> <hz> <duty> <ramp_ms>  (node in hex, duty 0-1000)");
+      }
+      return;
+    }
+    if (command.startsWith("pwm_status ")) {
+      unsigned node, port;
+      if (sscanf(command.c_str(), "pwm_status %x %u", &node, &port) == 2) {
+        requestPwmStatus(node, port);
+      } else {
+        Serial.println("Usage: pwm_status <node> <port>  (node in hex)");
+      }
+      return;
+    }
+    if (command.startsWith("sequence ")) {
+      unsigned node, mask, runs;
+      int offset = 0;
+      uint8_t values[SEQUENCE_MAX_STEPS];
+      uint16_t durations[SEQUENCE_MAX_STEPS];
+      uint8_t count = 0;
+      if (sscanf(command.c_str(), "sequence %x %x %u%n", &node, &mask, &runs, &offset) == 3) {
+        const char* rest = command.c_str() + offset;
+        unsigned value, ms;
+        int used = 0;
+        while (count < SEQUENCE_MAX_STEPS && sscanf(rest, " %x:%u%n", &value, &ms, &used) == 2) {
+          values[count] = value;
+          durations[count] = ms;
+          count++;
+          rest += used;
+        }
+      }
+      if (count > 0) {
+        Serial.printf("Sending %d step sequence to node 0x%02X\n", count, node);
+        sendSequence(node, mask, runs, values, durations, count);
+      } else {
+        Serial.println("Usage: sequence <node> <mask> <runs> <value>:<ms> ...  (node, mask, value in hex)");
+      }
+      return;
+    }
     
     // Parse command
     int space1 = command.indexOf(' ');
@@ -424,78 +802,81 @@ void doSerialControl()
       String addr_str = command.substring(space1 + 1, space2 > space1 ? space2 : command.length());
       String param_str = space2 > space1 ? command.substring(space2 + 1) : "";
       
-      uint16_t device_addr = strtol(addr_str.c_str(), NULL, 16);
+      uint8_t node = strtol(addr_str.c_str(), NULL, 16);
       uint8_t param = param_str.length() > 0 ? param_str.toInt() : 0;
       
       // Execute commands
       if (cmd == "activate") {
         if (param_str.length() > 0) {
-          Serial.printf("Sending activate command to 0x%03X, port %d\n", device_addr, param);
-          sendOutputCommand(device_addr, ACTIVATE_CMD, param);
+          Serial.printf("Sending activate command to node 0x%02X, port %d\n", node, param);
+          sendOutputCommand(node, ACTIVATE_CMD, param);
         } else {
-          Serial.println("Usage: activate <addr> <port>");
+          Serial.println("Usage: activate <node> <port>");
         }
       }
       else if (cmd == "deactivate") {
         if (param_str.length() > 0) {
-          Serial.printf("Sending deactivate command to 0x%03X, port %d\n", device_addr, param);
-          sendOutputCommand(device_addr, DEACTIVATE_CMD, param);
+          Serial.printf("Sending deactivate command to node 0x%02X, port %d\n", node, param);
+          sendOutputCommand(node, DEACTIVATE_CMD, param);
         } else {
-          Serial.println("Usage: deactivate <addr> <port>");
+          Serial.println("Usage: deactivate <node> <port>");
         }
       }
       else if (cmd == "analog") {
         if (param_str.length() > 0) {
-          Serial.printf("Requesting analog reading from 0x%03X, pin %d\n", device_addr, param);
-          requestAnalogReading(device_addr, param);
+          Serial.printf("Requesting analog reading from node 0x%02X, pin %d\n", node, param);
+          requestAnalogReading(node, param);
         } else {
-          Serial.println("Usage: analog <addr> <pin>");
+          Serial.println("Usage: analog <node> <pin>");
         }
       }
       else if (cmd == "digital") {
         if (param_str.length() > 0) {
-          Serial.printf("Requesting digital reading from 0x%03X, pin %d\n", device_addr, param);
-          requestDigitalReading(device_addr, param);
+          Serial.printf("Requesting digital reading from node 0x%02X, pin %d\n", node, param);
+          requestDigitalReading(node, param);
         } else {
-          Serial.println("Usage: digital <addr> <pin>");
+          Serial.println("Usage: digital <node> <pin>");
         }
       }
       else if (cmd == "all_analog") {
-        Serial.printf("Requesting all analog readings from 0x%03X\n", device_addr);
-        requestAllAnalogReadings(device_addr);
+        Serial.printf("Requesting all analog readings from node 0x%02X\n", node);
+        requestAllAnalogReadings(node);
       }
       else if (cmd == "all_digital") {
-        Serial.printf("Requesting all digital readings from 0x%03X\n", device_addr);
-        requestAllDigitalReadings(device_addr);
+        Serial.printf("Requesting all digital readings from node 0x%02X\n", node);
+        requestAllDigitalReadings(node);
       }
       else if (cmd == "status") {
-        printSensorData(device_addr);
+        printSensorData(node);
       }
       else if (cmd == "motor_rpm") {
         if (param_str.length() > 0) {
-          Serial.printf("Setting motor RPM to %d on device 0x%03X\n", param, device_addr);
-          sendMotorRPM(device_addr, param);
+          Serial.printf("Setting motor RPM to %d on node 0x%02X\n", param, node);
+          sendMotorRPM(node, param);
         } else {
-          Serial.println("Usage: motor_rpm <addr> <rpm>");
+          Serial.println("Usage: motor_rpm <node> <rpm>");
         }
       }
       else if (cmd == "motor_direction") {
         if (param_str.length() > 0) {
           bool clockwise = (param != 0);
-          Serial.printf("Setting motor direction to %s on device 0x%03X\n", 
-                        clockwise ? "CW" : "CCW", device_addr);
-          sendMotorDirection(device_addr, clockwise);
+          Serial.printf("Setting motor direction to %s on node 0x%02X\n", 
+                        clockwise ? "CW" : "CCW", node);
+          sendMotorDirection(node, clockwise);
         } else {
-          Serial.println("Usage: motor_direction <addr> <0=CCW|1=CW>");
+          Serial.println("Usage: motor_direction <node> <0=CCW|1=CW>");
         }
       }
       else if (cmd == "motor_stop") {
-        Serial.printf("Stopping motor on device 0x%03X\n", device_addr);
-        sendMotorStop(device_addr);
+        Serial.printf("Stopping motor on node 0x%02X\n", node);
+        sendMotorStop(node);
       }
       else if (cmd == "motor_status") {
-        Serial.printf("Requesting motor status from device 0x%03X\n", device_addr);
-        requestMotorStatus(device_addr);
+        Serial.printf("Requesting motor status from node 0x%02X\n", node);
+        requestMotorStatus(node);
+      }
+      else if (cmd == "node_ota") {
+        nodeOtaStart(node);
       }
       else {
         Serial.println("Unknown command");
@@ -504,35 +885,92 @@ void doSerialControl()
   }
 }
 
-void loop() {
-  // Handle MQTT connection
-  if (!mqttClient.connected()) {
-    Serial.println("[LOOP] MQTT disconnected, attempting reconnection...");
-    connectToMQTT();
+void serviceMQTT() {
+  // Handle MQTT connection without stalling control while offline
+  static unsigned long lastReconnectAttempt = 0;
+  static bool attempted = false;
+  if (mqttConnectTask != NULL) {
+    // The connect task has the clients; commands already received still run
+    if (mqttConnectDone) finishMQTTConnect();
+    processMQTTCommands();
+    return;
+  }
+  if (!mqttClient.connected() && WiFi.status() == WL_CONNECTED) {
+    // First attempt as soon as WiFi is up, then at the reconnect interval
+    if (!attempted || millis() - lastReconnectAttempt >= MQTT_RECONNECT_INTERVAL_MS) {
+      attempted = true;
+      lastReconnectAttempt = millis();
+      Serial.println("[LOOP] MQTT disconnected, attempting reconnection...");
+      connectToMQTT();
+    }
   }
   mqttClient.loop();
-  
+
   // Process MQTT commands
   processMQTTCommands();
+}
 
-  // Handle serial commands
-  doSerialControl();
+bool mqttDataPending() {
+  if (mqttConnectTask != NULL) return mqttConnectDone;
+  return mqttClient.connected() && espClient.available() > 0;
+}
 
-  // Process incoming CAN messages
-  receiveCANMessages();
+void serviceSpool() {
+  // Readings from CAN RX first, so they queue behind older spooled records
+  serviceTelemetry();
 
-  // Check program timer
-  checkProgramTimer();
+  // Replay anything published while offline, oldest first
+  spoolService(mqttReady(), [](const char* topic, const uint8_t* payload, size_t length) {
+    return mqttClient.publish(topic, payload, length);
+  });
+}
 
-  handleSwitchPress();
-  readEncoder();
-  drawLEDs();
-  delay(10);
+bool serialPending() {
+  return Serial.available() > 0;
 }
 
-void setupWiFi() {
-  Serial.println("[WIFI] Setting up WiFi...");
-  
+// Idle until the next task is due, waking early when a CAN frame arrives
+void waitForCANOrTimeout(uint32_t max_wait_ms) {
+  uint32_t alerts;
+  esp_err_t result = twai_read_alerts(&alerts, pdMS_TO_TICKS(max_wait_ms));
+  if (result != ESP_OK && result != ESP_ERR_TIMEOUT) {
+    // CAN driver not running; fall back to a plain sleep
+    vTaskDelay(pdMS_TO_TICKS(max_wait_ms));
+  }
+}
+
+void setupScheduler() {
+  // Registration order is run order within a pass: bus traffic first
+  schedulerAddEvent("can_rx", receiveCANMessages, canFramesPending);
+  schedulerAddEvent("isotp", isoTpService, isoTpTxReady, ISOTP_SERVICE_PERIOD_MS);
+  schedulerAddEvent("node_ota", nodeOtaService, nodeOtaReady, NODE_OTA_SERVICE_PERIOD_MS);
+  // Periodic rather than event-driven: the period is the download throttle
+  schedulerAddPeriodic("ota", masterOtaService, MASTER_OTA_SERVICE_PERIOD_MS);
+  schedulerAddPeriodic("wifi", serviceWiFi, WIFI_SERVICE_PERIOD_MS);
+  schedulerAddEvent("mqtt", serviceMQTT, mqttDataPending, MQTT_SERVICE_PERIOD_MS);
+  schedulerAddPeriodic("spool", serviceSpool, SPOOL_REPLAY_INTERVAL_MS);
+  schedulerAddEvent("serial", doSerialControl, serialPending);
+  schedulerAddEvent("rules", rulesService, rulesPending);
+  schedulerAddPeriodic("program", recipeService, PROGRAM_TIMER_PERIOD_MS);
+  schedulerAddPeriodic("time_sync", sendTimeSync, TIME_SYNC_PERIOD_MS);
+  schedulerAddPeriodic("presence", presenceService, PRESENCE_CHECK_PERIOD_MS);
+  schedulerAddEvent("input", handleInput, inputPending);
+  schedulerAddPeriodic("leds", drawLEDs, LED_UPDATE_PERIOD_MS);
+  schedulerSetIdleHook(waitForCANOrTimeout);
+}
+
+void loop() {
+  schedulerRunOnce();
+}
+
+// Starts connecting and returns; serviceWiFi() reports the outcome. With
+// stored credentials BLE is only started if they keep failing; without them
+// the master advertises for a phone to provision it. The WiFiManager portal
+// still blocks, since nothing works until it is done.
+void startWiFi() {
+  static char ssid[PROVISION_SSID_LEN];
+  static char password[PROVISION_PASS_LEN];
+
   if (USE_PROVISIONING) {
     Serial.println("[WIFI] Using WiFiManager provisioning mode");
     wifiManager.setAPCallback(configModeCallback);
@@ -545,38 +983,78 @@ void setupWiFi() {
       ESP.restart();
     }
   } else {
-    Serial.println("[WIFI] Using hardcoded credentials mode");
-    Serial.print("[WIFI] SSID: ");
-    Serial.println(WIFI_SSID);
-    Serial.println("[WIFI] Starting WiFi connection...");
-    
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    Serial.print("[WIFI] Connecting to ");
-    Serial.print(WIFI_SSID);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED) {
-      delay(500);
-      Serial.print(".");
-      attempts++;
-      if (attempts > 60) {
-        Serial.println("");
-        Serial.println("[WIFI] ERROR: Connection timeout after 30 seconds");
-        Serial.println("[WIFI] Restarting ESP32...");
-        ESP.restart();
-      }
+#ifdef WIFI_STATIC_IP
+    wifiCacheSetStaticIp(IPAddress(WIFI_STATIC_IP), IPAddress(WIFI_STATIC_GATEWAY), IPAddress(WIFI_STATIC_SUBNET),
+                         IPAddress(WIFI_STATIC_GATEWAY));
+#endif
+    bool stored = provisionLoadCredentials(ssid, password);
+#ifdef WIFI_SSID
+    // Not after "wifi_provision", which asked for BLE on purpose
+    if (!stored && !provisionCredentialsCleared()) {
+      LOG_INFO("[WIFI] Storing the built-in credentials");
+      stored = provisionSaveCredentials(WIFI_SSID, WIFI_PASSWORD);
+      strlcpy(ssid, WIFI_SSID, sizeof(ssid));
+      strlcpy(password, WIFI_PASSWORD, sizeof(password));
+    }
+#endif
+    if (!stored) {
+      LOG_INFO("[WIFI] No credentials stored, starting BLE provisioning");
+      provisionStart(BLE_NAME);
+      return;
     }
-    Serial.println("");
+    // BLE memory is kept until these prove to work (serviceWiFi)
+    wifiCacheBegin(ssid, password);
   }
-  
-  Serial.println("[WIFI] WiFi connected successfully!");
-  Serial.print("[WIFI] IP address: ");
-  Serial.println(WiFi.localIP());
-  Serial.print("[WIFI] MAC address: ");
-  Serial.println(WiFi.macAddress());
-  Serial.print("[WIFI] Signal strength (RSSI): ");
+}
+
+// Reports connection changes; reconnecting is left to LavliWiFiCache. Losing
+// WiFi no longer restarts the master: CAN control carries on and publishes
+// go to the spool until the network is back. Stored credentials that have
+// not worked once this boot, a wrong seed or a changed router, hand over to
+// BLE provisioning after WIFI_BLE_FALLBACK_ATTEMPTS.
+void serviceWiFi() {
+  static bool connected = false;
+  static bool everConnected = false;
+
+  if (provisionActive()) {
+    provisionService();
+    // It only finishes once connected, and has released BLE by then
+    if (!provisionActive()) everConnected = true;
+    return;
+  }
+
+  bool up = USE_PROVISIONING ? WiFi.status() == WL_CONNECTED : wifiCacheService();
+  if (!USE_PROVISIONING && !everConnected && !up && wifiCacheTimes().attempts >= WIFI_BLE_FALLBACK_ATTEMPTS) {
+    LOG_WARN("[WIFI] Stored credentials failed %d times, starting BLE provisioning", WIFI_BLE_FALLBACK_ATTEMPTS);
+    wifiCacheEnd();
+    provisionStart(BLE_NAME);
+    return;
+  }
+  if (up == connected) return;
+  connected = up;
+  if (!connected) return;
+
+  if (!everConnected) {
+    everConnected = true;
+    provisionReleaseBle();
+  }
+
+  Serial.print("[WIFI] Connected at ");
+  Serial.print(millis());
+  Serial.print(" ms, IP address: ");
+  Serial.print(WiFi.localIP());
+  Serial.print(", RSSI: ");
   Serial.print(WiFi.RSSI());
   Serial.println(" dBm");
+
+  if (!USE_PROVISIONING) {
+    // Queued in the spool until MQTT is up
+    WiFiConnectTimes times = wifiCacheTimes();
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%s, associated %lu ms, ip %lu ms", times.fast ? "cached" : "scan",
+             (unsigned long)times.associated_ms, (unsigned long)times.ip_ms);
+    publishEvent("wifi_connected", detail);
+  }
 }
 
 void configModeCallback(WiFiManager *myWiFiManager) {
@@ -589,128 +1067,320 @@ void saveConfigCallback() {
   Serial.println("[WIFI] WiFi configuration saved");
 }
 
-void connectToMQTT() {
-  int attempts = 0;
-  while (!mqttClient.connected()) {
-    attempts++;
-    Serial.print("[MQTT] Attempt #");
-    Serial.print(attempts);
-    Serial.print(" - Connecting to ");
-    Serial.print(MQTT_BROKER);
-    Serial.print(":");
-    Serial.println(MQTT_PORT);
-    
-    String clientId = "LavliCANMaster-" + String(random(0xffff), HEX);
-    Serial.print("[MQTT] Client ID: ");
-    Serial.println(clientId);
-    Serial.print("[MQTT] Username: ");
-    Serial.println(MQTT_USERNAME);
-    Serial.println("[MQTT] Establishing TLS connection...");
-    
-    if (mqttClient.connect(clientId.c_str(), MQTT_USERNAME, MQTT_PASSWORD)) {
-      Serial.println("[MQTT] ✓ Connected successfully!");
-      
-      // Subscribe to all command topics
-      Serial.print("[MQTT] Subscribing to topics...");
-      bool allSubscribed = true;
-      
-      if (mqttClient.subscribe(TOPIC_DRY)) {
-        Serial.print(" " + String(TOPIC_DRY) + " ✓");
-      } else {
-        Serial.print(" " + String(TOPIC_DRY) + " ✗");
-        allSubscribed = false;
-      }
-      
-      if (mqttClient.subscribe(TOPIC_WASH)) {
-        Serial.print(" " + String(TOPIC_WASH) + " ✓");
-      } else {
-        Serial.print(" " + String(TOPIC_WASH) + " ✗");
-        allSubscribed = false;
-      }
-      
-      if (mqttClient.subscribe(TOPIC_STOP)) {
-        Serial.print(" " + String(TOPIC_STOP) + " ✓");
-      } else {
-        Serial.print(" " + String(TOPIC_STOP) + " ✗");
-        allSubscribed = false;
-      }
-      
-      if (mqttClient.subscribe(TOPIC_CAN_CONTROL)) {
-        Serial.print(" " + String(TOPIC_CAN_CONTROL) + " ✓");
-      } else {
-        Serial.print(" " + String(TOPIC_CAN_CONTROL) + " ✗");
-        allSubscribed = false;
-      }
-      
-      Serial.println();
-      
-      if (allSubscribed) {
-        Serial.println("[MQTT] ✓ Successfully subscribed to all topics!");
-        Serial.println("[MQTT] Ready to receive commands!");
-      } else {
-        Serial.println("[MQTT] ✗ Failed to subscribe to some topics");
-      }
-    } else {
-      Serial.print("[MQTT] ✗ Connection failed, error code: ");
-      Serial.print(mqttClient.state());
-      Serial.println(" (see PubSubClient.h for error codes)");
-      Serial.println("[MQTT] Retrying in 5 seconds...");
-      delay(5000);
+// The TLS handshake and CONNECT block for up to MQTT_HANDSHAKE_TIMEOUT_S
+// plus MQTT_SOCKET_TIMEOUT_S, so they run in their own task, like the
+// master OTA connect. The task owns espClient and mqttClient until
+// mqttConnectDone is set; until then mqttReady() is false and nothing else
+// touches them. finishMQTTConnect() reports the outcome from the scheduler.
+static bool mqttTlsOk = false;
+static bool mqttConnectOk = false;
+static const char* mqttUnsubscribed = NULL;   // First topic that failed to subscribe
+static char mqttTlsError[96];
+static char mqttClientId[32];
+
+static const char* const mqttTopics[] = {
+  TOPIC_DRY, TOPIC_WASH, TOPIC_STOP, TOPIC_CAN_CONTROL, TOPIC_DIAG_REQUEST,
+  TOPIC_RECIPE, TOPIC_RULES, TOPIC_NODE_OTA, TOPIC_NODE_OTA_DATA, TOPIC_OTA,
+};
+
+bool mqttReady() {
+  return mqttConnectTask == NULL && mqttClient.connected();
+}
+
+static void mqttConnectTaskMain(void*) {
+  // The TLS session is opened here rather than inside PubSubClient so
+  // the handshake and the MQTT CONNECT can be timed separately
+  int64_t start = esp_timer_get_time();
+  mqttTlsOk = espClient.connect(MQTT_BROKER, MQTT_PORT);
+  int64_t handshakeDone = esp_timer_get_time();
+  mqttStats.tls_ms = (handshakeDone - start) / 1000;
+  mqttConnectOk = false;
+  mqttUnsubscribed = NULL;
+
+  if (!mqttTlsOk) {
+    espClient.lastError(mqttTlsError, sizeof(mqttTlsError));
+  } else if (mqttClient.connect(mqttClientId, MQTT_USERNAME, MQTT_PASSWORD)) {
+    mqttStats.mqtt_ms = (esp_timer_get_time() - handshakeDone) / 1000;
+    mqttConnectOk = true;
+    for (size_t i = 0; i < sizeof(mqttTopics) / sizeof(mqttTopics[0]); i++) {
+      if (!mqttClient.subscribe(mqttTopics[i]) && mqttUnsubscribed == NULL) mqttUnsubscribed = mqttTopics[i];
     }
+  } else {
+    espClient.stop();
+  }
+  mqttConnectDone = true;
+  vTaskDelete(NULL);
+}
+
+// Starts a connect attempt in the background; false if one could not start
+bool connectToMQTT() {
+  static int attempts = 0;
+  if (mqttConnectTask != NULL || mqttClient.connected()) return false;
+
+  attempts++;
+  snprintf(mqttClientId, sizeof(mqttClientId), "LavliCANMaster-%lx", (unsigned long)random(0xffff));
+  Serial.printf("[MQTT] Attempt #%d - Connecting to %s:%d as %s (user %s)\n", attempts, MQTT_BROKER, MQTT_PORT,
+                mqttClientId, MQTT_USERNAME);
+
+  mqttStats.heap_before = ESP.getFreeHeap();
+  mqttConnectDone = false;
+  if (xTaskCreate(mqttConnectTaskMain, "mqtt_connect", MQTT_CONNECT_STACK, NULL, MQTT_CONNECT_PRIORITY,
+                  &mqttConnectTask) != pdPASS) {
+    mqttConnectTask = NULL;
+    mqttStats.failures++;
+    LOG_ERROR("[MQTT] No memory for the connect task");
+    return false;
+  }
+  return true;
+}
+
+// Runs once the connect task has finished; hands the client back
+void finishMQTTConnect() {
+  mqttConnectTask = NULL;
+
+  if (!mqttTlsOk) {
+    mqttStats.failures++;
+    Serial.printf("[MQTT] ✗ TLS connection failed after %lu ms: %s\n", (unsigned long)mqttStats.tls_ms,
+                  mqttTlsError);
+    Serial.printf("[MQTT] Retrying in %d seconds, publishing to offline spool\n", MQTT_RECONNECT_INTERVAL_MS / 1000);
+    return;
+  }
+  if (!mqttConnectOk) {
+    mqttStats.failures++;
+    Serial.printf("[MQTT] ✗ Connection failed, error code: %d (see PubSubClient.h for error codes)\n",
+                  mqttClient.state());
+    Serial.printf("[MQTT] Retrying in %d seconds, publishing to offline spool\n", MQTT_RECONNECT_INTERVAL_MS / 1000);
+    return;
+  }
+
+  mqttStats.heap_after = ESP.getFreeHeap();
+  mqttStats.heap_min = ESP.getMinFreeHeap();
+  mqttStats.connects++;
+  mqttStats.connected_at = millis();
+  Serial.printf("[MQTT] ✓ Connected successfully! TLS %lu ms, CONNACK %lu ms, heap %lu -> %lu (min %lu)\n",
+                (unsigned long)mqttStats.tls_ms, (unsigned long)mqttStats.mqtt_ms,
+                (unsigned long)mqttStats.heap_before, (unsigned long)mqttStats.heap_after,
+                (unsigned long)mqttStats.heap_min);
+  if (mqttUnsubscribed == NULL) {
+    Serial.println("[MQTT] ✓ Successfully subscribed to all topics!");
+    Serial.println("[MQTT] Ready to receive commands!");
+  } else {
+    Serial.printf("[MQTT] ✗ Failed to subscribe to some topics, first %s\n", mqttUnsubscribed);
+  }
+
+  // Reaching the broker is what proves a freshly updated image
+  masterOtaConfirm();
+
+  char detail[64];
+  snprintf(detail, sizeof(detail), "tls %lu ms, connack %lu ms, heap min %lu", (unsigned long)mqttStats.tls_ms,
+           (unsigned long)mqttStats.mqtt_ms, (unsigned long)mqttStats.heap_min);
+  publishEvent("mqtt_connected", detail);
+}
+
+void printMqttStats() {
+  const char* status = mqttConnectTask != NULL ? "connecting" : mqttClient.connected() ? "connected" : "disconnected";
+  Serial.printf("\n=== MQTT: %s ===\n", status);
+  Serial.printf("  Broker %s:%d, certificate %s\n", MQTT_BROKER, MQTT_PORT,
+                MQTT_VERIFY_BROKER ? "verified" : "not verified");
+  Serial.printf("  Keepalive %d s, socket timeout %d s\n", MQTT_KEEPALIVE_S, MQTT_SOCKET_TIMEOUT_S);
+  Serial.printf("  Connects %lu, failures %lu\n", (unsigned long)mqttStats.connects,
+                (unsigned long)mqttStats.failures);
+  if (mqttStats.connects > 0) {
+    Serial.printf("  Last: TLS %lu ms, CONNACK %lu ms, up %lu s\n", (unsigned long)mqttStats.tls_ms,
+                  (unsigned long)mqttStats.mqtt_ms, (millis() - mqttStats.connected_at) / 1000);
+    Serial.printf("  Heap: %lu before, %lu after, %lu lowest since boot\n", (unsigned long)mqttStats.heap_before,
+                  (unsigned long)mqttStats.heap_after, (unsigned long)mqttStats.heap_min);
+  }
+  Serial.printf("  Free heap now %lu\n", (unsigned long)ESP.getFreeHeap());
+  Serial.println("======================\n");
+}
+
+// Publishes live when the broker is reachable and nothing older is waiting;
+// otherwise appends to the offline spool so ordering is preserved.
+bool publishMessage(const char* topic, const char* payload) {
+  size_t length = strlen(payload);
+
+  if (mqttReady() && spoolIsEmpty()) {
+    if (mqttClient.publish(topic, (const uint8_t*)payload, length)) {
+      return true;
+    }
+  }
+
+  if (!spoolAppend(topic, (const uint8_t*)payload, length)) {
+    Serial.printf("[MQTT] Dropped message for %s (spool unavailable)\n", topic);
+    return false;
+  }
+  return true;
+}
+
+// Records carry {"boot", "seq"}: seq restarts at 0 on every boot and boot
+// counts boots in NVS, so consumers order spooled records across a reboot
+// by the pair. One NVS write per boot; the sequence itself stays in RAM.
+static uint32_t publishBoot = 0;
+static uint32_t publishSequence = 0;
+
+void beginPublishSequence() {
+  Preferences prefs;
+  if (!prefs.begin("publish", false)) {
+    LOG_WARN("[MQTT] Boot counter unavailable, records go out with boot 0");
+    return;
   }
+  publishBoot = prefs.getUInt("boot", 0) + 1;
+  prefs.putUInt("boot", publishBoot);
+  prefs.end();
+}
+
+bool publishEvent(const char* event, const char* detail) {
+  char payload[192];
+  snprintf(payload, sizeof(payload),
+           "{\"boot\":%lu,\"seq\":%lu,\"t\":%lu,\"event\":\"%s\",\"detail\":\"%s\"}",
+           (unsigned long)publishBoot, (unsigned long)publishSequence++, millis(), event, detail);
+  return publishMessage(TOPIC_EVENTS, payload);
+}
+
+// Progress is only meaningful live; retained so a dashboard sees the last state
+bool publishOtaStatus(const char* json) {
+  if (!mqttReady()) return false;
+  return mqttClient.publish(TOPIC_OTA_STATUS, json, true);
+}
+
+// Diagnostics are only meaningful live, so they bypass the offline spool.
+// Streamed with beginPublish() since the snapshot exceeds the MQTT buffer.
+bool publishProfileSnapshot() {
+  static char snapshot[2048];
+  size_t length = profilerToJson(snapshot, sizeof(snapshot));
+  if (length == 0 || !mqttReady()) return false;
+
+  if (!mqttClient.beginPublish(TOPIC_DIAG_PROFILE, length, false)) return false;
+  mqttClient.write((const uint8_t*)snapshot, length);
+  return mqttClient.endPublish() == 1;
+}
+
+void publishSensorTelemetry(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog, int64_t sample_us) {
+  char payload[192];
+  snprintf(payload, sizeof(payload),
+           "{\"boot\":%lu,\"seq\":%lu,\"t\":%lu,\"sample_us\":%llu,\"addr\":%u,\"pin\":%u,\"type\":\"%s\","
+           "\"value\":%u}",
+           (unsigned long)publishBoot, (unsigned long)publishSequence++, millis(), (unsigned long long)sample_us,
+           device_address, pin, is_analog ? "analog" : "digital", value);
+  publishMessage(TOPIC_TELEMETRY, payload);
+}
+
+// Readings handled in the CAN RX path wait here; publishing them can mean a
+// TLS write or a spool append, and a flash stall there would hold up STOP
+// and the other frames behind it. serviceTelemetry() publishes them from
+// the spool task.
+struct PendingReading {
+  uint16_t device_address;
+  uint8_t pin;
+  bool is_analog;
+  uint16_t value;
+  int64_t sample_us;
+};
+
+static PendingReading pendingReadings[TELEMETRY_QUEUE_LEN];
+static uint8_t pendingHead = 0;
+static uint8_t pendingCount = 0;
+static uint32_t pendingDropped = 0;
+
+void queueSensorTelemetry(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog, int64_t sample_us) {
+  if (pendingCount == TELEMETRY_QUEUE_LEN) {
+    pendingDropped++;
+    LOG_WARN("[MQTT] Telemetry queue full, reading from 0x%02X pin %d dropped", device_address, pin);
+    return;
+  }
+  PendingReading& entry = pendingReadings[(pendingHead + pendingCount) % TELEMETRY_QUEUE_LEN];
+  entry.device_address = device_address;
+  entry.pin = pin;
+  entry.is_analog = is_analog;
+  entry.value = value;
+  entry.sample_us = sample_us;
+  pendingCount++;
+}
+
+// Publishes queued readings in arrival order
+void serviceTelemetry() {
+  while (pendingCount > 0) {
+    const PendingReading& entry = pendingReadings[pendingHead];
+    publishSensorTelemetry(entry.device_address, entry.pin, entry.value, entry.is_analog, entry.sample_us);
+    pendingHead = (pendingHead + 1) % TELEMETRY_QUEUE_LEN;
+    pendingCount--;
+  }
+}
+
+void printTelemetryQueue() {
+  Serial.printf("Telemetry queue: %d waiting, %lu dropped\n", pendingCount, (unsigned long)pendingDropped);
 }
 
 void onMqttMessage(char* topic, byte* payload, unsigned int length) {
-  Serial.println("\n[MQTT] ===== MESSAGE RECEIVED =====");
-  Serial.print("[MQTT] Topic: ");
-  Serial.println(topic);
-  Serial.print("[MQTT] Length: ");
-  Serial.print(length);
-  Serial.println(" bytes");
-  Serial.print("[MQTT] Data: ");
+  // Firmware chunks go straight to flash; no logging or string copies
+  if (strcmp(topic, TOPIC_NODE_OTA_DATA) == 0) {
+    nodeOtaUploadChunk(payload, length);
+    return;
+  }
+
+  // topic points into the client's buffer, so only the payload bytes are logged
+  LOG_HEX("[MQTT] Message received", payload, length);
   
   // Convert payload to string
   String message = "";
+  message.reserve(length);
   for (int i = 0; i < length; i++) {
     message += (char)payload[i];
-    Serial.print((char)payload[i]);
   }
-  Serial.println();
   
   // Parse the numeric value from the message
   int value = message.toInt();
-  Serial.print("[MQTT] Parsed value: ");
-  Serial.println(value);
+  LOG_DEBUG("[MQTT] Parsed value: %d", value);
   
   // Store the command based on topic
   if (strcmp(topic, TOPIC_DRY) == 0) {
     dryCommand.received = true;
     dryCommand.value = value;
     dryCommand.timestamp = millis();
-    Serial.println("[MQTT] Dry command received");
+    LOG_INFO("[MQTT] Dry command received");
   }
   else if (strcmp(topic, TOPIC_WASH) == 0) {
     washCommand.received = true;
     washCommand.value = value;
     washCommand.timestamp = millis();
-    Serial.println("[MQTT] Wash command received");
+    LOG_INFO("[MQTT] Wash command received");
   }
   else if (strcmp(topic, TOPIC_STOP) == 0) {
     stopCommand.received = true;
     stopCommand.value = value;
     stopCommand.timestamp = millis();
-    Serial.println("[MQTT] Stop command received");
+    LOG_INFO("[MQTT] Stop command received");
   }
   else if (strcmp(topic, TOPIC_CAN_CONTROL) == 0) {
-    Serial.println("[MQTT] Generic CAN command received");
+    LOG_INFO("[MQTT] Generic CAN command received");
     if (parseGenericCANCommand(message)) {
-      Serial.println("[MQTT] CAN command parsed successfully");
+      LOG_INFO("[MQTT] CAN command parsed successfully");
     } else {
-      Serial.println("[MQTT] Failed to parse CAN command");
+      LOG_ERROR("[MQTT] Failed to parse CAN command");
+    }
+  }
+  else if (strcmp(topic, TOPIC_RECIPE) == 0) {
+    recipeLoadJson(payload, length, true);
+  }
+  else if (strcmp(topic, TOPIC_RULES) == 0) {
+    rulesLoadJson(payload, length, true);
+  }
+  else if (strcmp(topic, TOPIC_NODE_OTA) == 0) {
+    nodeOtaHandleControl(payload, length);
+  }
+  else if (strcmp(topic, TOPIC_OTA) == 0) {
+    masterOtaHandleControl(payload, length);
+  }
+  else if (strcmp(topic, TOPIC_DIAG_REQUEST) == 0) {
+    if (message == "profile") {
+      Serial.println(publishProfileSnapshot() ? "[MQTT] Profile snapshot published"
+                                              : "[MQTT] Failed to publish profile snapshot");
+    } else if (message == "snapshot") {
+      // Readings come back through the normal telemetry path
+      requestSensorSnapshot();
     }
   }
-  
-  Serial.println("[MQTT] ========================\n");
 }
 
 
@@ -720,7 +1390,7 @@ void processMQTTCommands() {
   if (dryCommand.received) {
     Serial.println("[COMMAND] Processing DRY command");
     Serial.printf("[COMMAND] Dry value: %d\n", dryCommand.value);
-    Serial.printf("[COMMAND] Starting dry cycle for %lu minutes\n", programDurationMs / 60000);
+    Serial.println("[COMMAND] Starting dry recipe");
     
     startDry();
     
@@ -732,7 +1402,7 @@ void processMQTTCommands() {
   if (washCommand.received) {
     Serial.println("[COMMAND] Processing WASH command");
     Serial.printf("[COMMAND] Wash value: %d\n", washCommand.value);
-    Serial.printf("[COMMAND] Starting wash cycle for %lu minutes\n", programDurationMs / 60000);
+    Serial.println("[COMMAND] Starting wash recipe");
     
     startWash();
     
@@ -755,11 +1425,7 @@ void processMQTTCommands() {
   if (genericCANCommand.received) {
     Serial.println("[COMMAND] Processing GENERIC CAN command");
     Serial.printf("[COMMAND] Address: 0x%03X, Data Length: %d\n", genericCANCommand.address, genericCANCommand.data_length);
-    Serial.print("[COMMAND] Data: ");
-    for (int i = 0; i < genericCANCommand.data_length; i++) {
-      Serial.printf("0x%02X ", genericCANCommand.data[i]);
-    }
-    Serial.println();
+    LOG_HEX("[COMMAND] Data", genericCANCommand.data, genericCANCommand.data_length);
     
     sendGenericCANMessage(genericCANCommand.address, genericCANCommand.data, genericCANCommand.data_length);
     
@@ -769,6 +1435,9 @@ void processMQTTCommands() {
 }
 
 bool initializeCAN() {
+  // RX alerts let the scheduler sleep until a frame arrives
+  g_config.alerts_enabled = TWAI_ALERT_RX_DATA;
+
   if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK) {
     Serial.println("Failed to install TWAI driver");
     return false;
@@ -788,18 +1457,22 @@ void initializeSensorStorage() {
       analog_readings[dev][pin].valid = false;
       analog_readings[dev][pin].analog_value = 0;
       analog_readings[dev][pin].timestamp = 0;
+      analog_readings[dev][pin].sample_us = 0;
       
       digital_readings[dev][pin].valid = false;
       digital_readings[dev][pin].digital_value = false;
       digital_readings[dev][pin].timestamp = 0;
+      digital_readings[dev][pin].sample_us = 0;
     }
   }
 }
 
-bool sendOutputCommand(uint16_t device_address, uint8_t command, uint8_t port) {
+// Turning an output off only moves the node toward its safe state, so it
+// goes on the safety class and wins arbitration over other traffic
+bool sendOutputCommand(uint8_t node, uint8_t command, uint8_t port) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(command == DEACTIVATE_CMD ? CAN_CLASS_SAFETY : CAN_CLASS_CONTROL, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 2;
@@ -809,10 +1482,95 @@ bool sendOutputCommand(uint16_t device_address, uint8_t command, uint8_t port) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool requestAnalogReading(uint16_t device_address, uint8_t pin) {
+// Several ports in one frame, switched together by the node. A batch that
+// only turns ports off goes on the safety class like a single deactivate.
+bool sendSetOutputs(uint8_t node, uint8_t mask, uint8_t value) {
+  twai_message_t message;
+
+  message.identifier = canRequestId((value & mask) == 0 ? CAN_CLASS_SAFETY : CAN_CLASS_CONTROL, node);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 3;
+  message.data[0] = SET_OUTPUTS_CMD;
+  message.data[1] = mask;
+  message.data[2] = value;
+
+  return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
+}
+
+// The node times the pulse itself and sends ACK_TIMED_DONE when it ends
+bool sendPulse(uint8_t node, uint8_t mask, uint32_t ms) {
+  twai_message_t message;
+
+  message.identifier = canRequestId(CAN_CLASS_CONTROL, node);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 5;
+  message.data[0] = PULSE_CMD;
+  message.data[1] = mask;
+  message.data[2] = (ms >> 16) & 0xFF;
+  message.data[3] = (ms >> 8) & 0xFF;
+  message.data[4] = ms & 0xFF;
+
+  return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
+}
+
+// Frequency 0 returns the port to plain on/off. The ramp is the soft-start
+// from off to duty; turning off is always immediate.
+bool sendPwmConfig(uint8_t node, uint8_t port, uint16_t freq_hz, uint16_t duty, uint16_t ramp_ms) {
+  twai_message_t message;
+
+  message.identifier = canRequestId(CAN_CLASS_CONTROL, node);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 8;
+  message.data[0] = PWM_CONFIG_CMD;
+  message.data[1] = port;
+  message.data[2] = (freq_hz >> 8) & 0xFF;
+  message.data[3] = freq_hz & 0xFF;
+  message.data[4] = (duty >> 8) & 0xFF;
+  message.data[5] = duty & 0xFF;
+  message.data[6] = (ramp_ms >> 8) & 0xFF;
+  message.data[7] = ramp_ms & 0xFF;
+
+  return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
+}
+
+// Output nodes only listen for their own requests on the safety, control
+// and bulk classes, so the readback goes on control
+bool requestPwmStatus(uint8_t node, uint8_t port) {
+  twai_message_t message;
+
+  message.identifier = canRequestId(CAN_CLASS_CONTROL, node);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 2;
+  message.data[0] = PWM_STATUS_CMD;
+  message.data[1] = port;
+
+  return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
+}
+
+// Steps apply values[i] to the ports in mask for ms[i]; the whole list
+// runs `runs` times, then the ports go off
+bool sendSequence(uint8_t node, uint8_t mask, uint8_t runs, const uint8_t* values, const uint16_t* ms, uint8_t count) {
+  if (count == 0 || count > SEQUENCE_MAX_STEPS) return false;
+  uint8_t payload[3 + SEQUENCE_MAX_STEPS * 3];
+  payload[0] = SEQUENCE_CMD;
+  payload[1] = mask;
+  payload[2] = runs;
+  for (uint8_t i = 0; i < count; i++) {
+    payload[3 + i * 3] = values[i];
+    payload[4 + i * 3] = (ms[i] >> 8) & 0xFF;
+    payload[5 + i * 3] = ms[i] & 0xFF;
+  }
+  return isoTpSend(node, payload, 3 + count * 3);
+}
+
+bool requestAnalogReading(uint8_t node, uint8_t pin) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_TELEMETRY, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 2;
@@ -822,10 +1580,10 @@ bool requestAnalogReading(uint16_t device_address, uint8_t pin) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool requestDigitalReading(uint16_t device_address, uint8_t pin) {
+bool requestDigitalReading(uint8_t node, uint8_t pin) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_TELEMETRY, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 2;
@@ -835,10 +1593,10 @@ bool requestDigitalReading(uint16_t device_address, uint8_t pin) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool requestAllAnalogReadings(uint16_t device_address) {
+bool requestAllAnalogReadings(uint8_t node) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_TELEMETRY, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 1;
@@ -847,10 +1605,10 @@ bool requestAllAnalogReadings(uint16_t device_address) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool requestAllDigitalReadings(uint16_t device_address) {
+bool requestAllDigitalReadings(uint8_t node) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_TELEMETRY, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 1;
@@ -862,45 +1620,93 @@ bool requestAllDigitalReadings(uint16_t device_address) {
 void receiveCANMessages() {
   twai_message_t message;
   
-  if (twai_receive(&message, 0) == ESP_OK) {
-    Serial.printf("Received from 0x%03X: ", message.identifier);
-    for (int i = 0; i < message.data_length_code; i++) {
-      Serial.printf("0x%02X ", message.data[i]);
-    }
-    Serial.println();
-    
+  for (int frames = 0; frames < CAN_RX_BATCH && twai_receive(&message, 0) == ESP_OK; frames++) {
+    LOG_CAN_RX(message);
     processReceivedMessage(&message);
   }
 }
 
+bool canFramesPending() {
+  twai_status_info_t status;
+  return twai_get_status_info(&status) == ESP_OK && status.msgs_to_rx > 0;
+}
+
 void processReceivedMessage(twai_message_t* message) {
+  PROFILE_SCOPE("can_dispatch");
   if (message->data_length_code < 1) return;
+  if (isoTpHandleFrame(message->identifier, message->data, message->data_length_code)) return;
+  // Only node responses carry data for us; requests are the master's own
+  if (!canIdIsResponse(message->identifier)) return;
   
+  uint8_t node = canIdNode(message->identifier);
+  if (presenceHandleFrame(node, message->data, message->data_length_code)) return;
+
   uint8_t response_type = message->data[0];
   
   switch (response_type) {
     case ACK_ACTIVATE:
     case ACK_DEACTIVATE:
       if (message->data_length_code >= 3) {
-        Serial.printf("Output command acknowledged: Port %d, Status 0x%02X\n", 
-                      message->data[1], message->data[2]);
+        LOG_DEBUG("Output command acknowledged: Port %d, Status 0x%02X",
+                  message->data[1], message->data[2]);
+      }
+      break;
+
+    case ACK_OUTPUTS:
+      if (message->data_length_code >= 3) {
+        if (message->data[2] != 0) {
+          LOG_WARN("Node 0x%02X rejected outputs command, status 0x%02X", node, message->data[2]);
+        }
+        LOG_DEBUG("Node 0x%02X outputs now 0x%02X", node, message->data[1]);
       }
       break;
       
+    case ACK_PWM_CONFIG:
+      // Status 0x06: a new frequency while a ramp runs; send it again once it ends
+      if (message->data_length_code >= 3 && message->data[2] != 0) {
+        LOG_WARN("Node 0x%02X rejected PWM setting for port %d, status 0x%02X", node, message->data[1],
+                 message->data[2]);
+      }
+      break;
+
+    case PWM_STATUS_DATA:
+      if (message->data_length_code >= 7) {
+        uint16_t duty = (message->data[3] << 8) | message->data[4];
+        uint16_t current = (message->data[5] << 8) | message->data[6];
+        // Flags: 0x01 PWM enabled, 0x02 on, 0x04 ramping
+        LOG_INFO("PWM port %d: flags 0x%02X, duty %d/1000, now %d/1000", message->data[1], message->data[2],
+                 duty, current);
+      }
+      break;
+
+    case ACK_TIMED_DONE:
+      if (message->data_length_code >= 8) {
+        uint32_t elapsed = ((uint32_t)message->data[5] << 16) | (message->data[6] << 8) | message->data[7];
+        if (message->data[3] == 0) {
+          LOG_INFO("Node 0x%02X timed 0x%02X on mask 0x%02X done after %d ms", node, message->data[1],
+                   message->data[2], elapsed);
+        } else {
+          LOG_WARN("Node 0x%02X timed 0x%02X on mask 0x%02X cancelled after %d ms", node, message->data[1],
+                   message->data[2], elapsed);
+        }
+      }
+      break;
+
     case ACK_MOTOR_RPM:
       if (message->data_length_code >= 4) {
         uint16_t confirmed_speed = (message->data[1] << 8) | message->data[2];
-        Serial.printf("Motor speed command acknowledged: Speed %d, Status 0x%02X\n", 
-                      confirmed_speed, message->data[3]);
+        LOG_DEBUG("Motor speed command acknowledged: Speed %d, Status 0x%02X",
+                  confirmed_speed, message->data[3]);
       }
       break;
       
     case ANALOG_DATA:
-      if (message->data_length_code >= 5) {
+      if (message->data_length_code >= 4) {
         uint8_t pin = message->data[1];
         uint16_t value = (message->data[2] << 8) | message->data[3];
-        Serial.printf("Analog pin %d: %d (%.2fV)\n", pin, value, value * 3.3 / 4095.0);
-        storeSensorReading(message->identifier, pin, value, true);
+        uint32_t stamp = message->data_length_code >= 8 ? getStamp(&message->data[4]) : 0;
+        LOG_DEBUG("Analog pin %d: %d (%d mV)", pin, value, value * 3300 / 4095);
+        storeSensorReading(node, pin, value, true, stamp);
       }
       break;
       
@@ -908,59 +1714,123 @@ void processReceivedMessage(twai_message_t* message) {
       if (message->data_length_code >= 3) {
         uint8_t pin = message->data[1];
         bool value = message->data[2] != 0;
-        Serial.printf("Digital pin %d: %s\n", pin, value ? "HIGH" : "LOW");
-        storeSensorReading(message->identifier, pin, value ? 1 : 0, false);
+        uint32_t stamp = message->data_length_code >= 7 ? getStamp(&message->data[3]) : 0;
+        LOG_DEBUG("Digital pin %d: %s", pin, value ? "HIGH" : "LOW");
+        storeSensorReading(node, pin, value ? 1 : 0, false, stamp);
       }
       break;
-      
-    case ALL_ANALOG_DATA:
-      // Process multiple analog readings in one message
-      for (int i = 1; i < message->data_length_code; i += 3) {
-        if (i + 2 < message->data_length_code) {
-          uint8_t pin = message->data[i];
-          uint16_t value = (message->data[i+1] << 8) | message->data[i+2];
-          Serial.printf("Analog pin %d: %d (%.2fV)\n", pin, value, value * 3.3 / 4095.0);
-          storeSensorReading(message->identifier, pin, value, true);
-        }
-      }
-      break;
-      
+
     case ALL_DIGITAL_DATA:
       // Process multiple digital readings packed in bytes
       if (message->data_length_code >= 2) {
         uint8_t digital_data = message->data[1];
+        uint32_t stamp = message->data_length_code >= 6 ? getStamp(&message->data[2]) : 0;
         for (int pin = 0; pin < 8; pin++) {
           bool value = (digital_data >> pin) & 1;
-          Serial.printf("Digital pin %d: %s\n", pin, value ? "HIGH" : "LOW");
-          storeSensorReading(message->identifier, pin, value ? 1 : 0, false);
+          LOG_DEBUG("Digital pin %d: %s", pin, value ? "HIGH" : "LOW");
+          storeSensorReading(node, pin, value ? 1 : 0, false, stamp);
         }
       }
       break;
       
     case ERROR_RESPONSE:
       if (message->data_length_code >= 3) {
-        Serial.printf("Error response: Port/Pin %d, Error code 0x%02X\n", 
-                      message->data[1], message->data[2]);
+        LOG_WARN("Error response from node 0x%02X: Port/Pin %d, Error code 0x%02X",
+                 node, message->data[1], message->data[2]);
       }
       break;
   }
 }
 
-void storeSensorReading(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog) {
+// Sample stamps: low 32 bits of master time in us, big endian (LavliCanTime.h)
+uint32_t getStamp(const uint8_t* data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+void storeSensorReading(uint16_t device_address, uint8_t pin, uint16_t value, bool is_analog, uint32_t stamp) {
   uint8_t dev_index = getDeviceIndex(device_address);
   if (dev_index >= MAX_DEVICES || pin >= MAX_PINS) return;
+
+  // A node that is not synced yet sends 0; fall back to the receive time
+  int64_t now_us = esp_timer_get_time();
+  int64_t sample_us = stamp != 0 ? timeSyncExpandStamp(stamp, now_us) : now_us;
   
   if (is_analog) {
     analog_readings[dev_index][pin].analog_value = value;
     analog_readings[dev_index][pin].valid = true;
-    analog_readings[dev_index][pin].timestamp = millis();
+    analog_readings[dev_index][pin].timestamp = sample_us / 1000;
+    analog_readings[dev_index][pin].sample_us = sample_us;
   } else {
     digital_readings[dev_index][pin].digital_value = (value != 0);
     digital_readings[dev_index][pin].valid = true;
-    digital_readings[dev_index][pin].timestamp = millis();
+    digital_readings[dev_index][pin].timestamp = sample_us / 1000;
+    digital_readings[dev_index][pin].sample_us = sample_us;
+  }
+
+  // React locally first; publishing waits for the spool task
+  rulesEvaluate(device_address, pin, is_analog, value);
+  queueSensorTelemetry(device_address, pin, value, is_analog, sample_us);
+}
+
+void onRuleFired(const Rule& rule) {
+  publishEvent("rule_fired", rule.name);
+}
+
+// Reassembled bulk payloads; data[0] is the response code as in a frame
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length) {
+  if (nodeOtaHandleMessage(node, data, length)) return;
+
+  switch (data[0]) {
+    case ALL_ANALOG_DATA:
+      // One acquisition time for the whole set, then (pin, high, low) triplets
+      if (length >= 5) {
+        uint32_t stamp = getStamp(&data[1]);
+        for (int i = 5; i + 2 < length; i += 3) {
+          uint8_t pin = data[i];
+          uint16_t value = (data[i+1] << 8) | data[i+2];
+          LOG_DEBUG("Analog pin %d: %d (%d mV)", pin, value, value * 3300 / 4095);
+          storeSensorReading(node, pin, value, true, stamp);
+        }
+      }
+      break;
+
+    default:
+      LOG_WARN("[ISOTP] Unhandled bulk message 0x%02X (%d bytes) from node 0x%02X", data[0], length, node);
+      break;
   }
 }
 
+void onNodePresence(const NodePresence& node, bool joined) {
+  char detail[48];
+  if (node.announced) {
+    snprintf(detail, sizeof(detail), "0x%02X %s %d.%d", node.node, heartbeatTypeName(node.type),
+             node.version_major, node.version_minor);
+  } else {
+    snprintf(detail, sizeof(detail), "0x%02X", node.node);
+  }
+  publishEvent(joined ? "node_join" : "node_leave", detail);
+  if (!joined) animFlash(ledsColor(255, 0, 0), LED_FLASH_COUNT, LED_FLASH_PERIOD_MS);
+}
+
+void onNodeBoot(const NodePresence& node) {
+  char detail[64];
+  snprintf(detail, sizeof(detail), "0x%02X %s reset, can %u ms, setup %u ms", node.node,
+           bootResetReasonName(node.reset_reason), node.can_ready_ms, node.setup_ms);
+  publishEvent("node_boot", detail);
+}
+
+bool sendDiscover() {
+  twai_message_t message;
+  
+  message.identifier = canRequestId(CAN_CLASS_STATUS, LAVLI_NODE_BROADCAST);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 1;
+  message.data[0] = LAVLI_CMD_DISCOVER;
+  
+  return twai_transmit(&message, 0) == ESP_OK;
+}
+
 SensorReading getAnalogReading(uint16_t device_address, uint8_t pin) {
   uint8_t dev_index = getDeviceIndex(device_address);
   if (dev_index < MAX_DEVICES && pin < MAX_PINS) {
@@ -986,7 +1856,7 @@ void printSensorData(uint16_t device_address) {
     return;
   }
   
-  Serial.printf("\n=== Sensor Data for Device 0x%03X ===\n", device_address);
+  Serial.printf("\n=== Sensor Data for Node 0x%02X ===\n", device_address);
   
   Serial.println("Analog Pins:");
   bool found_analog = false;
@@ -1021,14 +1891,15 @@ void printSensorData(uint16_t device_address) {
 }
 
 uint8_t getDeviceIndex(uint16_t device_address) {
-  // Simple mapping - you might want a more sophisticated approach
+  // Node IDs below MAX_DEVICES map one to one; see LavliCanIds.h
   return device_address % MAX_DEVICES;
 }
 
-bool sendMotorRPM(uint16_t device_address, uint16_t rpm) {
+// RPM 0 is a stop with the node's normal deceleration, so it is sent as safety
+bool sendMotorRPM(uint8_t node, uint16_t rpm) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(rpm == 0 ? CAN_CLASS_SAFETY : CAN_CLASS_CONTROL, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 3;
@@ -1039,10 +1910,10 @@ bool sendMotorRPM(uint16_t device_address, uint16_t rpm) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool sendMotorDirection(uint16_t device_address, bool clockwise) {
+bool sendMotorDirection(uint8_t node, bool clockwise) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_CONTROL, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 2;
@@ -1052,10 +1923,10 @@ bool sendMotorDirection(uint16_t device_address, bool clockwise) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool sendMotorStop(uint16_t device_address) {
+bool sendMotorStop(uint8_t node) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_SAFETY, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 1;
@@ -1064,10 +1935,10 @@ bool sendMotorStop(uint16_t device_address) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
-bool requestMotorStatus(uint16_t device_address) {
+bool requestMotorStatus(uint8_t node) {
   twai_message_t message;
   
-  message.identifier = device_address;
+  message.identifier = canRequestId(CAN_CLASS_STATUS, node);
   message.extd = 0;
   message.rtr = 0;
   message.data_length_code = 1;
@@ -1076,6 +1947,40 @@ bool requestMotorStatus(uint16_t device_address) {
   return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
 }
 
+bool sendStopAll() {
+  twai_message_t message;
+  
+  message.identifier = canRequestId(CAN_CLASS_SAFETY, LAVLI_GROUP_ACTUATORS);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 1;
+  message.data[0] = LAVLI_CMD_STOP_ALL;
+  
+  return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
+}
+
+void sendTimeSync() {
+  // Nobody to sync; skip the bus time
+  if (presenceOnlineCount() == 0) return;
+
+  // Runs from the scheduler; a busy TX queue just skips this round
+  if (!timeSyncSendRound(LAVLI_NODE_BROADCAST)) {
+    LOG_DEBUG("[TIME] Sync round skipped");
+  }
+}
+
+bool requestSensorSnapshot() {
+  twai_message_t message;
+  
+  message.identifier = canRequestId(CAN_CLASS_TELEMETRY, LAVLI_GROUP_SENSORS);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 1;
+  message.data[0] = LAVLI_CMD_SNAPSHOT;
+  
+  return twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
+}
+
 bool parseGenericCANCommand(String jsonMessage) {
   StaticJsonDocument<256> doc;
   DeserializationError error = deserializeJson(doc, jsonMessage);
@@ -1086,7 +1991,7 @@ bool parseGenericCANCommand(String jsonMessage) {
     return false;
   }
   
-  // Parse address (supports hex strings like "0x311" or decimal)
+  // Parse address (supports hex strings like "0x203" or decimal)
   if (!doc.containsKey("address")) {
     Serial.println("[JSON] Missing 'address' field");
     return false;
@@ -1158,13 +2063,9 @@ bool sendGenericCANMessage(uint16_t address, uint8_t* data, uint8_t data_length)
   bool result = twai_transmit(&message, pdMS_TO_TICKS(1000)) == ESP_OK;
   
   if (result) {
-    Serial.printf("[CAN] Generic message sent to 0x%03X: ", address);
-    for (uint8_t i = 0; i < data_length; i++) {
-      Serial.printf("0x%02X ", data[i]);
-    }
-    Serial.println();
+    LOG_CAN_TX(message);
   } else {
-    Serial.printf("[CAN] Failed to send message to 0x%03X\n", address);
+    LOG_ERROR("[CAN] Failed to send message to 0x%03X", address);
   }
   
   return result;
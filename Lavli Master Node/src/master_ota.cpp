@@ -0,0 +1,470 @@
+#include "master_ota.h"
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <ArduinoJson.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <LavliLog.h>
+
+#define NVS_NAMESPACE "master_ota"
+
+enum MasterOtaState {
+  MASTER_OTA_IDLE,
+  MASTER_OTA_CONNECTING,    // Handshake and GET running in the connect task
+  MASTER_OTA_DOWNLOADING,
+  MASTER_OTA_RESTARTING,    // Image verified, waiting for a quiet moment
+};
+
+static MasterOtaStatusFn onStatus = NULL;
+static MasterOtaBusyFn isBusy = NULL;
+static MasterOtaState state = MASTER_OTA_IDLE;
+
+static WiFiClientSecure client;
+static HTTPClient http;
+static mbedtls_sha256_context sha;
+static esp_ota_handle_t handle = 0;
+static const esp_partition_t* partition = NULL;
+
+static char url[MASTER_OTA_URL_LEN];
+static uint8_t expectedHash[32];
+static uint32_t expectedSize = 0;
+static uint32_t imageSize = 0;
+static uint32_t received = 0;
+static uint8_t lastProgress = 0;
+static unsigned long lastData = 0;
+static unsigned long startTime = 0;
+static unsigned long restartRequested = 0;
+
+// The connect task owns `client` and `http` until connectDone is set
+static TaskHandle_t connectTask = NULL;
+static volatile bool connectDone = false;
+static volatile int connectCode = 0;      // HTTP status, or an HTTPClient error (< 0)
+static volatile int connectLength = 0;
+static const char* abortReason = NULL;    // Abort asked for while the task ran
+
+// Rollback bookkeeping for an image that has not confirmed itself yet
+static bool confirmPending = false;
+static unsigned long confirmOnlineMs = 0;   // Time spent on WiFi without reaching the broker
+static unsigned long lastConfirmCheck = 0;
+
+static uint8_t buffer[MASTER_OTA_CHUNK_BYTES];
+
+// Logs plain status updates; callers passing a detail log their own line,
+// since the detail may be a stack buffer the logger cannot keep
+static void publishStatus(const char* status, const char* detail) {
+  char json[160];
+  if (detail) {
+    snprintf(json, sizeof(json), "{\"state\":\"%s\",\"detail\":\"%s\"}", status, detail);
+  } else if (imageSize > 0) {
+    snprintf(json, sizeof(json), "{\"state\":\"%s\",\"bytes\":%lu,\"total\":%lu,\"progress\":%u}", status,
+             (unsigned long)received, (unsigned long)imageSize,
+             (unsigned)((uint64_t)received * 100 / imageSize));
+  } else {
+    snprintf(json, sizeof(json), "{\"state\":\"%s\"}", status);
+  }
+  if (!detail && imageSize > 0) LOG_INFO("[OTA] %s, %u of %u bytes", status, received, imageSize);
+  if (onStatus) onStatus(json);
+}
+
+static bool parseHash(const char* hex, uint8_t* hash) {
+  if (!hex || strlen(hex) != 64) return false;
+  for (int i = 0; i < 32; i++) {
+    char byte[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+    char* end;
+    hash[i] = strtoul(byte, &end, 16);
+    if (*end != 0) return false;
+  }
+  return true;
+}
+
+static void closeDownload() {
+  if (state == MASTER_OTA_DOWNLOADING) {
+    esp_ota_abort(handle);
+    mbedtls_sha256_free(&sha);
+  }
+  if (state == MASTER_OTA_DOWNLOADING || state == MASTER_OTA_CONNECTING) {
+    http.end();
+  }
+  handle = 0;
+}
+
+// reason must be a literal; it is logged after this returns
+static void fail(const char* reason) {
+  LOG_WARN("[OTA] Failed: %s", reason);
+  closeDownload();
+  state = MASTER_OTA_IDLE;
+  publishStatus("failed", reason);
+}
+
+// Boots the partition the update came from again
+static void rollBack(const char* reason) {
+  Preferences prefs;
+  prefs.begin(NVS_NAMESPACE, false);
+  char previous[17] = "";
+  prefs.getString("previous", previous, sizeof(previous));
+  prefs.putBool("pending", false);
+  prefs.putString("result", reason);
+  prefs.end();
+
+  const esp_partition_t* target = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, previous);
+  if (!target || esp_ota_set_boot_partition(target) != ESP_OK) {
+    LOG_ERROR("[OTA] Cannot roll back, previous partition not bootable");
+    confirmPending = false;
+    return;
+  }
+  LOG_WARN("[OTA] Rolling back to the previous image: %s", reason);
+  logFlush();
+  ESP.restart();
+}
+
+void masterOtaBegin(MasterOtaStatusFn status, MasterOtaBusyFn busy) {
+  onStatus = status;
+  isBusy = busy;
+
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) return;
+  if (!prefs.getBool("pending", false)) {
+    prefs.end();
+    return;
+  }
+
+  char previous[17] = "";
+  prefs.getString("previous", previous, sizeof(previous));
+  uint8_t boots = prefs.getUChar("boots", 0) + 1;
+  prefs.putUChar("boots", boots);
+  prefs.end();
+
+  // The bootloader may already have fallen back if the image did not start
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  if (running && strcmp(running->label, previous) == 0) {
+    prefs.begin(NVS_NAMESPACE, false);
+    prefs.putBool("pending", false);
+    prefs.putString("result", "new image did not boot");
+    prefs.end();
+    return;
+  }
+
+  if (boots > MASTER_OTA_MAX_BOOTS) {
+    rollBack("new image kept restarting");
+    return;
+  }
+  confirmPending = true;
+  confirmOnlineMs = 0;
+  lastConfirmCheck = millis();
+  LOG_WARN("[OTA] Running unconfirmed image, boot %d of %d", boots, MASTER_OTA_MAX_BOOTS);
+}
+
+void masterOtaConfirm() {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) return;
+
+  // Report how the last update ended, once, now that the broker is reachable
+  char result[48] = "";
+  prefs.getString("result", result, sizeof(result));
+  if (result[0]) {
+    LOG_WARN("[OTA] Last update was rolled back");
+    prefs.remove("result");
+    publishStatus("rolled_back", result);
+  }
+
+  if (confirmPending) {
+    confirmPending = false;
+    prefs.putBool("pending", false);
+    prefs.remove("boots");
+    // Also settles the bootloader's state on builds with rollback enabled
+    esp_ota_mark_app_valid_cancel_rollback();
+    LOG_INFO("[OTA] New image confirmed");
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    publishStatus("confirmed", running ? running->label : NULL);
+  }
+  prefs.end();
+}
+
+bool masterOtaHandleControl(const uint8_t* json, size_t length) {
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, json, length);
+  if (error) {
+    // c_str() points into ArduinoJson's table of constant messages
+    LOG_WARN("[OTA] Parse failed: %s", error.c_str());
+    return false;
+  }
+
+  if (doc["abort"] | false) {
+    masterOtaAbort("aborted");
+    return true;
+  }
+  return masterOtaStart(doc["url"] | "", doc["sha256"] | "", doc["size"] | 0);
+}
+
+bool masterOtaStart(const char* imageUrl, const char* sha256, uint32_t size) {
+  if (state != MASTER_OTA_IDLE) {
+    LOG_WARN("[OTA] Update already in progress");
+    return false;
+  }
+  if (strncmp(imageUrl, "https://", 8) != 0 || strlen(imageUrl) >= sizeof(url)) {
+    fail("url must be https and shorter than 192 chars");
+    return false;
+  }
+  if (!parseHash(sha256, expectedHash)) {
+    fail("sha256 must be 64 hex digits");
+    return false;
+  }
+
+  strlcpy(url, imageUrl, sizeof(url));
+  expectedSize = size;
+  imageSize = 0;
+  received = 0;
+  startTime = millis();
+  state = MASTER_OTA_CONNECTING;
+  LOG_INFO("[OTA] Update requested, %u bytes expected", expectedSize);
+  return true;
+}
+
+void masterOtaAbort(const char* reason) {
+  if (state == MASTER_OTA_IDLE) return;
+  if (connectTask != NULL) {
+    // The handshake cannot be interrupted; finished off when the task returns
+    abortReason = reason;
+    return;
+  }
+  if (state == MASTER_OTA_RESTARTING) {
+    // The new image is already the boot partition; keep it for the next restart
+    LOG_INFO("[OTA] Image already installed, restart cancelled");
+    state = MASTER_OTA_IDLE;
+    return;
+  }
+  fail(reason);
+}
+
+// The TLS handshake and response headers take seconds and block, so they
+// run in their own task; the scheduler only polls connectDone
+static void connectTaskMain(void*) {
+  client.setInsecure();   // Trust comes from the hash, see master_ota.h
+  http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+  http.setTimeout(MASTER_OTA_STALL_TIMEOUT_MS);
+  if (!http.begin(client, url)) {
+    connectCode = 0;
+  } else {
+    connectCode = http.GET();
+    connectLength = connectCode == HTTP_CODE_OK ? http.getSize() : 0;
+  }
+  connectDone = true;
+  vTaskDelete(NULL);
+}
+
+static void startConnect() {
+  if (WiFi.status() != WL_CONNECTED) {
+    fail("wifi down");
+    return;
+  }
+  connectDone = false;
+  abortReason = NULL;
+  if (xTaskCreate(connectTaskMain, "ota_connect", MASTER_OTA_CONNECT_STACK, NULL, MASTER_OTA_CONNECT_PRIORITY,
+                  &connectTask) != pdPASS) {
+    connectTask = NULL;
+    fail("no memory for connect task");
+  }
+}
+
+// Runs once the connect task has finished
+static void startDownload() {
+  connectTask = NULL;
+  if (abortReason) {
+    fail(abortReason);
+    return;
+  }
+  if (connectCode == 0) {
+    fail("bad url");
+    return;
+  }
+  if (connectCode != HTTP_CODE_OK) {
+    // Not through fail(): the detail is a stack buffer the logger cannot keep
+    LOG_WARN("[OTA] Failed: GET returned %d", connectCode);
+    char detail[48];
+    snprintf(detail, sizeof(detail), "http %d", connectCode);
+    closeDownload();
+    state = MASTER_OTA_IDLE;
+    publishStatus("failed", detail);
+    return;
+  }
+
+  int length = connectLength;
+  if (length <= 0 || (expectedSize && (uint32_t)length != expectedSize)) {
+    fail("missing or wrong content length");
+    return;
+  }
+  partition = esp_ota_get_next_update_partition(NULL);
+  if (!partition || (uint32_t)length > partition->size) {
+    fail("image does not fit the update partition");
+    return;
+  }
+  // Sequential writes erase sector by sector instead of the whole partition up front
+  if (esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+    fail("esp_ota_begin failed");
+    return;
+  }
+
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  imageSize = length;
+  lastProgress = 0;
+  lastData = millis();
+  state = MASTER_OTA_DOWNLOADING;
+  LOG_INFO("[OTA] Writing %u bytes to the partition at 0x%X", imageSize, partition->address);
+  publishStatus("downloading", NULL);
+}
+
+static void finishDownload() {
+  uint8_t hash[32];
+  mbedtls_sha256_finish(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  http.end();
+
+  if (memcmp(hash, expectedHash, sizeof(hash)) != 0) {
+    esp_ota_abort(handle);
+    state = MASTER_OTA_IDLE;
+    LOG_WARN("[OTA] Failed: sha256 mismatch");
+    publishStatus("failed", "sha256 mismatch");
+    return;
+  }
+  // esp_ota_end() checks the image header, segments and appended hash
+  esp_err_t result = esp_ota_end(handle);
+  state = MASTER_OTA_IDLE;
+  if (result != ESP_OK) {
+    LOG_WARN("[OTA] Failed: image rejected");
+    publishStatus("failed", "image rejected");
+    return;
+  }
+
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  Preferences prefs;
+  prefs.begin(NVS_NAMESPACE, false);
+  prefs.putString("previous", running ? running->label : "");
+  prefs.putUChar("boots", 0);
+  prefs.putBool("pending", true);
+  prefs.end();
+
+  if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+    prefs.begin(NVS_NAMESPACE, false);
+    prefs.putBool("pending", false);
+    prefs.end();
+    LOG_WARN("[OTA] Failed: cannot set boot partition");
+    publishStatus("failed", "cannot set boot partition");
+    return;
+  }
+
+  char detail[48];
+  unsigned long elapsed = millis() - startTime;
+  LOG_INFO("[OTA] Image verified, %u bytes in %u ms", imageSize, elapsed);
+  snprintf(detail, sizeof(detail), "%lu bytes in %lu.%lu s", (unsigned long)imageSize, elapsed / 1000,
+           (elapsed % 1000) / 100);
+  publishStatus("verified", detail);
+  state = MASTER_OTA_RESTARTING;
+  restartRequested = millis();
+}
+
+static void download() {
+  WiFiClient* stream = http.getStreamPtr();
+  if (!stream || (!stream->connected() && stream->available() == 0)) {
+    fail("connection closed");
+    return;
+  }
+
+  // Fill one chunk from whatever has arrived, bounded in time
+  unsigned long start = micros();
+  size_t filled = 0;
+  size_t wanted = imageSize - received;
+  if (wanted > sizeof(buffer)) wanted = sizeof(buffer);
+  while (filled < wanted && micros() - start < MASTER_OTA_BUDGET_US) {
+    int available = stream->available();
+    if (available <= 0) break;
+    size_t count = wanted - filled;
+    if ((size_t)available < count) count = available;
+    int n = stream->read(&buffer[filled], count);
+    if (n <= 0) break;
+    filled += n;
+  }
+
+  if (filled == 0) {
+    if (millis() - lastData > MASTER_OTA_STALL_TIMEOUT_MS) fail("download stalled");
+    return;
+  }
+  lastData = millis();
+
+  if (esp_ota_write(handle, buffer, filled) != ESP_OK) {
+    fail("flash write failed");
+    return;
+  }
+  mbedtls_sha256_update(&sha, buffer, filled);
+  received += filled;
+
+  uint8_t progress = (uint64_t)received * 100 / imageSize;
+  if (progress / MASTER_OTA_PROGRESS_STEP != lastProgress / MASTER_OTA_PROGRESS_STEP) {
+    lastProgress = progress;
+    if (received < imageSize) publishStatus("downloading", NULL);
+  }
+  if (received >= imageSize) finishDownload();
+}
+
+void masterOtaService() {
+  if (confirmPending) {
+    // Only time on WiFi counts: an image cannot be blamed for a network
+    // that is down, and a crashing one is caught by the boot count
+    unsigned long now = millis();
+    if (WiFi.status() == WL_CONNECTED) confirmOnlineMs += now - lastConfirmCheck;
+    lastConfirmCheck = now;
+    if (confirmOnlineMs >= MASTER_OTA_CONFIRM_TIMEOUT_MS) {
+      rollBack("new image never reached the broker");
+    }
+  }
+
+  switch (state) {
+    case MASTER_OTA_CONNECTING:
+      if (connectTask == NULL) {
+        startConnect();
+      } else if (connectDone) {
+        startDownload();
+      }
+      break;
+    case MASTER_OTA_DOWNLOADING:
+      download();
+      break;
+    case MASTER_OTA_RESTARTING:
+      // Never restart in the middle of a program; the new image waits until idle
+      if (millis() - restartRequested < MASTER_OTA_RESTART_DELAY_MS) break;
+      if (isBusy && isBusy()) break;
+      LOG_INFO("[OTA] Restarting into the new image");
+      logFlush();
+      ESP.restart();
+      break;
+    default:
+      break;
+  }
+}
+
+bool masterOtaActive() {
+  return state != MASTER_OTA_IDLE;
+}
+
+void masterOtaPrint() {
+  static const char* names[] = {"idle", "connecting", "downloading", "restart pending"};
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  Serial.printf("\n=== Master OTA: %s ===\n", names[state]);
+  Serial.printf("  Running from %s%s\n", running ? running->label : "?",
+                confirmPending ? " (unconfirmed)" : "");
+  if (state == MASTER_OTA_DOWNLOADING) {
+    unsigned long elapsed = millis() - startTime;
+    Serial.printf("  %lu of %lu bytes, %lu B/s\n", (unsigned long)received, (unsigned long)imageSize,
+                  elapsed ? (unsigned long)((uint64_t)received * 1000 / elapsed) : 0UL);
+  }
+  if (confirmPending) {
+    unsigned long left = confirmOnlineMs < MASTER_OTA_CONFIRM_TIMEOUT_MS ? MASTER_OTA_CONFIRM_TIMEOUT_MS - confirmOnlineMs : 0;
+    Serial.printf("  Rolls back after %lu more s on WiFi unless the broker is reached\n", left / 1000);
+  }
+  Serial.println("=========================\n");
+}
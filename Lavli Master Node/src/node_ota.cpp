@@ -0,0 +1,391 @@
+#include "node_ota.h"
+#include "presence.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <esp_rom_crc.h>
+#include <LavliCanIsoTp.h>
+#include <LavliLog.h>
+
+enum NodeOtaState {
+  NODE_OTA_IDLE,
+  NODE_OTA_UPLOADING,   // Image arriving over MQTT
+  NODE_OTA_STARTING,    // BEGIN sent, waiting for the node
+  NODE_OTA_STREAMING,
+  NODE_OTA_FINISHING,   // END sent, node verifying
+};
+
+static NodeOtaEventFn onEvent = NULL;
+static NodeOtaState state = NODE_OTA_IDLE;
+static uint8_t target = 0;
+static File image;
+
+static uint32_t imageSize = 0;
+static uint32_t imageCrc = 0;
+static uint32_t uploaded = 0;
+static uint32_t uploadCrc = 0;
+
+static uint32_t sentOffset = 0;     // Next block to hand to the transfer layer
+static uint32_t ackedOffset = 0;    // Everything below is on the node
+static uint32_t rewindOffset = 0;
+static bool rewound = false;        // Already went back to rewindOffset
+static bool requestPending = false; // BEGIN or END still to be queued
+static uint8_t retries = 0;
+static unsigned long lastProgress = 0;
+static unsigned long startTime = 0;
+
+static uint8_t block[OTA_HEADER_BYTES + OTA_BLOCK_BYTES];
+
+static uint32_t parseNumber(JsonVariant value) {
+  if (value.is<const char*>()) {
+    return strtoul(value.as<const char*>(), NULL, 0);
+  }
+  return value.as<uint32_t>();
+}
+
+static void putU32(uint8_t* data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static void report(const char* event, const char* reason) {
+  char detail[64];
+  if (reason) {
+    snprintf(detail, sizeof(detail), "0x%02X %s", target, reason);
+  } else {
+    snprintf(detail, sizeof(detail), "0x%02X", target);
+  }
+  Serial.printf("[NODE_OTA] %s %s\n", event, detail);
+  if (onEvent) onEvent(event, detail);
+}
+
+static void finish() {
+  if (image) image.close();
+  state = NODE_OTA_IDLE;
+}
+
+static void fail(const char* reason) {
+  if (state >= NODE_OTA_STARTING) {
+    uint8_t abort = LAVLI_OTA_ABORT;
+    isoTpSend(target, &abort, 1);
+  }
+  report("node_ota_failed", reason);
+  finish();
+}
+
+// BEGIN and END are single-frame payloads; queue them, retrying on a busy TX
+static void sendRequest() {
+  uint8_t request[9];
+  uint8_t length = 1;
+  if (state == NODE_OTA_STARTING) {
+    request[0] = LAVLI_OTA_BEGIN;
+    putU32(&request[1], imageSize);
+    putU32(&request[5], imageCrc);
+    length = 9;
+  } else {
+    request[0] = LAVLI_OTA_END;
+  }
+  if (isoTpSend(target, request, length)) {
+    requestPending = false;
+    lastProgress = millis();
+  }
+}
+
+static bool sendNextBlock() {
+  uint32_t size = imageSize - sentOffset;
+  if (size > OTA_BLOCK_BYTES) size = OTA_BLOCK_BYTES;
+
+  if (!image.seek(sentOffset) || image.read(&block[OTA_HEADER_BYTES], size) != size) {
+    fail("image read error");
+    return false;
+  }
+  block[0] = LAVLI_OTA_BLOCK;
+  putU32(&block[1], sentOffset);
+  putU32(&block[5], esp_rom_crc32_le(0, &block[OTA_HEADER_BYTES], size));
+
+  if (!isoTpSend(target, block, OTA_HEADER_BYTES + size)) return false;
+  sentOffset += size;
+  return true;
+}
+
+// Checks the stored image and returns its size and CRC
+static bool scanImage(uint32_t* size, uint32_t* crc) {
+  File f = LittleFS.open(NODE_OTA_IMAGE_PATH, FILE_READ);
+  if (!f) return false;
+  *size = f.size();
+  *crc = 0;
+  while (f.available()) {
+    size_t n = f.read(block, sizeof(block));
+    if (n == 0) break;
+    *crc = esp_rom_crc32_le(*crc, block, n);
+  }
+  f.close();
+  return *size > 0;
+}
+
+void nodeOtaBegin(NodeOtaEventFn event) {
+  onEvent = event;
+}
+
+static bool uploadBegin(uint8_t node, uint32_t size, uint32_t crc) {
+  if (state != NODE_OTA_IDLE && state != NODE_OTA_UPLOADING) {
+    Serial.println("[NODE_OTA] Update in progress, upload refused");
+    return false;
+  }
+  finish();
+  LittleFS.remove(NODE_OTA_IMAGE_PATH);
+
+  if (size == 0 || size > LittleFS.totalBytes() - LittleFS.usedBytes()) {
+    Serial.printf("[NODE_OTA] No room for a %lu byte image\n", (unsigned long)size);
+    return false;
+  }
+  image = LittleFS.open(NODE_OTA_IMAGE_PATH, FILE_WRITE);
+  if (!image) {
+    Serial.println("[NODE_OTA] Cannot create image file");
+    return false;
+  }
+
+  target = node;
+  imageSize = size;
+  imageCrc = crc;
+  uploaded = 0;
+  uploadCrc = 0;
+  state = NODE_OTA_UPLOADING;
+  Serial.printf("[NODE_OTA] Receiving %lu byte image for node 0x%02X\n", (unsigned long)size, node);
+  return true;
+}
+
+bool nodeOtaHandleControl(const uint8_t* json, size_t length) {
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, json, length);
+  if (error) {
+    Serial.printf("[NODE_OTA] Parse failed: %s\n", error.c_str());
+    return false;
+  }
+
+  if (doc["abort"] | false) {
+    nodeOtaAbort("aborted");
+    return true;
+  }
+
+  uint8_t node = parseNumber(doc["node"]);
+  if (node == LAVLI_NODE_BROADCAST || node >= LAVLI_NODE_GROUP_BASE) {
+    Serial.println("[NODE_OTA] 'node' must be a single node ID");
+    return false;
+  }
+  if (doc["flash"] | false) {
+    return nodeOtaStart(node);
+  }
+  return uploadBegin(node, parseNumber(doc["size"]), parseNumber(doc["crc"]));
+}
+
+bool nodeOtaUploadChunk(const uint8_t* data, size_t length) {
+  if (state != NODE_OTA_UPLOADING || length <= 4) return false;
+
+  uint32_t offset = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+  const uint8_t* chunk = &data[4];
+  size_t size = length - 4;
+
+  if (offset != uploaded || uploaded + size > imageSize) {
+    Serial.printf("[NODE_OTA] Chunk at %lu out of order (expected %lu), upload dropped\n",
+                  (unsigned long)offset, (unsigned long)uploaded);
+    finish();
+    return false;
+  }
+  if (image.write(chunk, size) != size) {
+    Serial.println("[NODE_OTA] Image write failed, upload dropped");
+    finish();
+    return false;
+  }
+  uploaded += size;
+  uploadCrc = esp_rom_crc32_le(uploadCrc, chunk, size);
+  if (uploaded < imageSize) return true;
+
+  finish();
+  if (uploadCrc != imageCrc) {
+    Serial.println("[NODE_OTA] Uploaded image CRC mismatch, discarded");
+    LittleFS.remove(NODE_OTA_IMAGE_PATH);
+    return false;
+  }
+  Serial.println("[NODE_OTA] Image stored");
+  return nodeOtaStart(target);
+}
+
+bool nodeOtaStart(uint8_t node) {
+  if (state != NODE_OTA_IDLE) {
+    Serial.println("[NODE_OTA] Update already in progress");
+    return false;
+  }
+  const NodePresence* presence = presenceGet(node);
+  if (!presence || !presence->online || !(presence->capabilities & LAVLI_CAP_OTA)) {
+    Serial.printf("[NODE_OTA] Node 0x%02X is offline or cannot update over CAN\n", node);
+    return false;
+  }
+  if (!scanImage(&imageSize, &imageCrc)) {
+    Serial.println("[NODE_OTA] No stored image");
+    return false;
+  }
+  image = LittleFS.open(NODE_OTA_IMAGE_PATH, FILE_READ);
+  if (!image) return false;
+
+  target = node;
+  sentOffset = 0;
+  ackedOffset = 0;
+  rewound = false;
+  retries = 0;
+  startTime = millis();
+  state = NODE_OTA_STARTING;
+  requestPending = true;
+  sendRequest();
+  Serial.printf("[NODE_OTA] Updating node 0x%02X with %lu bytes, crc 0x%08lX\n", node,
+                (unsigned long)imageSize, (unsigned long)imageCrc);
+  return true;
+}
+
+void nodeOtaAbort(const char* reason) {
+  if (state == NODE_OTA_IDLE) return;
+  if (state == NODE_OTA_UPLOADING) {
+    Serial.println("[NODE_OTA] Upload dropped");
+    finish();
+    return;
+  }
+  fail(reason);
+}
+
+bool nodeOtaHandleMessage(uint8_t node, const uint8_t* data, uint16_t length) {
+  if (length < 1 || data[0] != LAVLI_OTA_ACK) return false;
+  if (length < 6 || node != target || state < NODE_OTA_STARTING) return true;
+
+  uint8_t status = data[1];
+  uint32_t next = ((uint32_t)data[2] << 24) | ((uint32_t)data[3] << 16) | ((uint32_t)data[4] << 8) | data[5];
+
+  switch (state) {
+    case NODE_OTA_STARTING:
+      if (status != LAVLI_OTA_OK) {
+        fail(otaStatusName(status));
+        break;
+      }
+      state = NODE_OTA_STREAMING;
+      lastProgress = millis();
+      report("node_ota_start", NULL);
+      break;
+
+    case NODE_OTA_STREAMING:
+      if (status == LAVLI_OTA_OK) {
+        if (next > ackedOffset) {
+          // Log every 64 KB
+          if ((next >> 16) != (ackedOffset >> 16)) {
+            LOG_INFO("[NODE_OTA] %d%% (%d bytes)", (int)((uint64_t)next * 100 / imageSize), next);
+          }
+          ackedOffset = next;
+          lastProgress = millis();
+          retries = 0;
+        }
+        if (next > rewindOffset) rewound = false;
+      } else if (status == LAVLI_OTA_BAD_CRC || status == LAVLI_OTA_BAD_OFFSET) {
+        // Go back to where the node is; the other blocks in flight will be
+        // NAKed with the same offset, which needs no second rewind
+        if (rewound && next == rewindOffset) break;
+        if (++retries > NODE_OTA_MAX_RETRIES) {
+          fail(otaStatusName(status));
+          break;
+        }
+        ackedOffset = next;
+        sentOffset = next;
+        rewindOffset = next;
+        rewound = true;
+        lastProgress = millis();
+      } else {
+        fail(otaStatusName(status));
+      }
+      break;
+
+    case NODE_OTA_FINISHING:
+      if (status != LAVLI_OTA_OK) {
+        fail(otaStatusName(status));
+        break;
+      }
+      {
+        char detail[40];
+        unsigned long elapsed = millis() - startTime;
+        snprintf(detail, sizeof(detail), "%lu bytes in %lu.%lu s", (unsigned long)imageSize,
+                 elapsed / 1000, (elapsed % 1000) / 100);
+        report("node_ota_done", detail);
+      }
+      finish();
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+bool nodeOtaReady() {
+  if (state == NODE_OTA_STARTING || state == NODE_OTA_FINISHING) {
+    return requestPending && isoTpTxIdle(target);
+  }
+  if (state != NODE_OTA_STREAMING || !isoTpTxIdle(target)) return false;
+  // Image fully sent: ready once the node has all of it, to send END
+  if (sentOffset >= imageSize) return ackedOffset >= imageSize;
+  return sentOffset - ackedOffset < OTA_WINDOW * OTA_BLOCK_BYTES;
+}
+
+void nodeOtaService() {
+  if (state < NODE_OTA_STARTING) return;
+
+  if (nodeOtaReady()) {
+    if (requestPending) {
+      sendRequest();
+    } else if (sentOffset < imageSize) {
+      sendNextBlock();
+    } else {
+      state = NODE_OTA_FINISHING;
+      requestPending = true;
+      sendRequest();
+    }
+  }
+  if (state < NODE_OTA_STARTING) return;   // sendNextBlock() may have failed
+
+  unsigned long timeout = state == NODE_OTA_FINISHING ? NODE_OTA_END_TIMEOUT_MS : NODE_OTA_ACK_TIMEOUT_MS;
+  if (requestPending || millis() - lastProgress <= timeout) return;
+
+  if (++retries > NODE_OTA_MAX_RETRIES) {
+    fail("no response");
+    return;
+  }
+  LOG_WARN("[NODE_OTA] No ack from node 0x%02X, retrying", target);
+  lastProgress = millis();
+  if (state == NODE_OTA_STREAMING) {
+    // Resend everything not acknowledged
+    sentOffset = ackedOffset;
+    rewound = false;
+  } else {
+    requestPending = true;
+  }
+}
+
+bool nodeOtaActive() {
+  return state != NODE_OTA_IDLE;
+}
+
+void nodeOtaPrint() {
+  static const char* names[] = {"idle", "uploading", "starting", "streaming", "finishing"};
+  Serial.printf("\n=== Node OTA: %s ===\n", names[state]);
+  if (state == NODE_OTA_UPLOADING) {
+    Serial.printf("  Upload for node 0x%02X: %lu of %lu bytes\n", target, (unsigned long)uploaded,
+                  (unsigned long)imageSize);
+  } else if (state != NODE_OTA_IDLE) {
+    unsigned long elapsed = millis() - startTime;
+    Serial.printf("  Node 0x%02X: %lu of %lu bytes acked, %lu sent, %lu B/s, %d retries\n", target,
+                  (unsigned long)ackedOffset, (unsigned long)imageSize, (unsigned long)sentOffset,
+                  elapsed ? (unsigned long)((uint64_t)ackedOffset * 1000 / elapsed) : 0UL, retries);
+  }
+  uint32_t size = 0;
+  uint32_t crc = 0;
+  if (state == NODE_OTA_IDLE && scanImage(&size, &crc)) {
+    Serial.printf("  Stored image: %lu bytes, crc 0x%08lX\n", (unsigned long)size, (unsigned long)crc);
+  }
+  Serial.println("=========================\n");
+}
@@ -0,0 +1,174 @@
+#include "presence.h"
+#include <LavliLog.h>
+#include <LavliBoot.h>
+
+static NodePresence nodes[PRESENCE_MAX_NODES];
+static PresenceEventFn onEvent = NULL;
+static PresenceBootFn onBootReport = NULL;
+static PresenceDiscoverFn sendDiscover = NULL;
+static unsigned long lastDiscover = 0;
+static bool discoverSent = false;
+
+static NodePresence* findNode(uint8_t node) {
+  for (uint8_t i = 0; i < PRESENCE_MAX_NODES; i++) {
+    if (nodes[i].node == node) return &nodes[i];
+  }
+  return NULL;
+}
+
+static NodePresence* findOrAddNode(uint8_t node) {
+  NodePresence* entry = findNode(node);
+  if (entry) return entry;
+  for (uint8_t i = 0; i < PRESENCE_MAX_NODES; i++) {
+    if (nodes[i].node == 0) {
+      memset(&nodes[i], 0, sizeof(NodePresence));
+      nodes[i].node = node;
+      nodes[i].first_seen = millis();
+      return &nodes[i];
+    }
+  }
+  return NULL;
+}
+
+static void requestDiscover() {
+  if (!sendDiscover) return;
+  if (discoverSent && millis() - lastDiscover < PRESENCE_DISCOVER_MS) return;
+  discoverSent = true;
+  lastDiscover = millis();
+  sendDiscover();
+}
+
+static void markSeen(NodePresence* entry) {
+  entry->last_seen = millis();
+  if (!entry->online) {
+    entry->online = true;
+    if (onEvent) onEvent(*entry, true);
+  }
+}
+
+void presenceBegin(PresenceEventFn event, PresenceDiscoverFn discover, PresenceBootFn boot) {
+  memset(nodes, 0, sizeof(nodes));
+  onEvent = event;
+  onBootReport = boot;
+  sendDiscover = discover;
+  // Nodes that booted before the master only send heartbeats; ask them all
+  requestDiscover();
+}
+
+bool presenceHandleFrame(uint8_t node, const uint8_t* data, uint8_t length) {
+  if (length < 1 || node == LAVLI_NODE_BROADCAST || node >= LAVLI_NODE_GROUP_BASE) return false;
+
+  if (data[0] == LAVLI_MSG_ANNOUNCE) {
+    if (length < 6) return true;
+    NodePresence* entry = findOrAddNode(node);
+    if (!entry) {
+      LOG_WARN("[NODES] Presence table full, ignoring node 0x%02X", node);
+      return true;
+    }
+    entry->type = data[1];
+    entry->version_major = data[2];
+    entry->version_minor = data[3];
+    entry->capabilities = data[4];
+    entry->channels = data[5];
+    entry->announced = true;
+    LOG_INFO("[NODES] Node 0x%02X announced: type %d, firmware %d.%d", node, entry->type,
+             entry->version_major, entry->version_minor);
+    markSeen(entry);
+    return true;
+  }
+
+  if (data[0] == LAVLI_MSG_HEARTBEAT) {
+    if (length < 4) return true;
+    NodePresence* entry = findOrAddNode(node);
+    if (!entry) return true;
+
+    uint16_t uptime = (data[2] << 8) | data[3];
+    if (entry->heartbeats > 0 && uptime < entry->uptime_s) {
+      // Rebooted between heartbeats; its announce may have been missed
+      entry->restarts++;
+      LOG_WARN("[NODES] Node 0x%02X restarted", node);
+    }
+    if (data[1] != entry->status && data[1] != 0) {
+      LOG_WARN("[NODES] Node 0x%02X reports status 0x%02X", node, data[1]);
+    }
+    entry->status = data[1];
+    entry->uptime_s = uptime;
+    entry->heartbeats++;
+    markSeen(entry);
+
+    if (!entry->announced) requestDiscover();
+    return true;
+  }
+
+  if (data[0] == LAVLI_MSG_BOOT) {
+    if (length < 6) return true;
+    NodePresence* entry = findOrAddNode(node);
+    if (!entry) return true;
+    entry->reset_reason = data[1];
+    entry->can_ready_ms = (data[2] << 8) | data[3];
+    entry->setup_ms = (data[4] << 8) | data[5];
+    LOG_INFO("[NODES] Node 0x%02X booted: CAN ready at %d ms, setup done at %d ms", node,
+             entry->can_ready_ms, entry->setup_ms);
+    markSeen(entry);
+    if (onBootReport) onBootReport(*entry);
+    return true;
+  }
+
+  return false;
+}
+
+void presenceService() {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < PRESENCE_MAX_NODES; i++) {
+    NodePresence& entry = nodes[i];
+    if (entry.node == 0 || !entry.online) continue;
+    if (now - entry.last_seen > PRESENCE_TIMEOUT_MS) {
+      entry.online = false;
+      LOG_WARN("[NODES] Node 0x%02X timed out", entry.node);
+      if (onEvent) onEvent(entry, false);
+    }
+  }
+}
+
+bool presenceIsOnline(uint8_t node) {
+  NodePresence* entry = findNode(node);
+  return entry && entry->online;
+}
+
+const NodePresence* presenceGet(uint8_t node) {
+  return findNode(node);
+}
+
+uint8_t presenceOnlineCount() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < PRESENCE_MAX_NODES; i++) {
+    if (nodes[i].node != 0 && nodes[i].online) count++;
+  }
+  return count;
+}
+
+void presencePrint() {
+  Serial.printf("\n=== Nodes (%d online) ===\n", presenceOnlineCount());
+  Serial.println("  Node  Type     Firmware  Caps  Ch  State    Status  Uptime  Last seen  Restarts  CAN ready");
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < PRESENCE_MAX_NODES; i++) {
+    const NodePresence& entry = nodes[i];
+    if (entry.node == 0) continue;
+    char firmware[8];
+    if (entry.announced) {
+      snprintf(firmware, sizeof(firmware), "%d.%d", entry.version_major, entry.version_minor);
+    } else {
+      strlcpy(firmware, "?", sizeof(firmware));
+    }
+    Serial.printf("  0x%02X  %-8s %-9s 0x%02X  %-3d %-8s 0x%02X    %-6u  %6lu ms  %-8lu  ",
+                  entry.node, heartbeatTypeName(entry.type), firmware, entry.capabilities,
+                  entry.channels, entry.online ? "online" : "offline", entry.status, entry.uptime_s,
+                  now - entry.last_seen, (unsigned long)entry.restarts);
+    if (entry.setup_ms) {
+      Serial.printf("%u ms (%s)\n", entry.can_ready_ms, bootResetReasonName(entry.reset_reason));
+    } else {
+      Serial.println("-");
+    }
+  }
+  Serial.println("========================\n");
+}
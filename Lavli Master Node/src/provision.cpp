@@ -0,0 +1,267 @@
+#include "provision.h"
+#include <NimBLEDevice.h>
+#include <Preferences.h>
+#include <esp_bt.h>
+#include <LavliLog.h>
+#include <LavliWiFiCache.h>
+
+#define NVS_NAMESPACE "wifi_creds"
+
+// Same UUIDs as the Lavli BLE Provisioner project
+static const char* SERVICE_UUID       = "7b1e0001-0d7a-4c80-9f31-7f9c18a2b001";
+static const char* SSID_CHAR_UUID     = "7b1e0002-0d7a-4c80-9f31-7f9c18a2b001"; // write
+static const char* PASS_CHAR_UUID     = "7b1e0003-0d7a-4c80-9f31-7f9c18a2b001"; // write (no read)
+static const char* CONTROL_CHAR_UUID  = "7b1e0004-0d7a-4c80-9f31-7f9c18a2b001"; // write "CONNECT"
+static const char* STATUS_CHAR_UUID   = "7b1e0005-0d7a-4c80-9f31-7f9c18a2b001"; // notify
+
+static ProvisionState state = PROVISION_OFF;
+static bool bleReleased = false;
+static NimBLECharacteristic* statusChar = NULL;
+static unsigned long stateSince = 0;
+static uint32_t heapBefore = 0;
+static uint32_t heapAfter = 0;
+static uint32_t attempts = 0;
+
+// Loaded by provisionStart(); retried while advertising as a fallback
+static bool haveStored = false;
+static bool attemptStored = false;
+static char storedSsid[PROVISION_SSID_LEN];
+static char storedPassword[PROVISION_PASS_LEN];
+
+// Written from the NimBLE host task; the main side only reads them once
+// CONNECT is requested, which the phone writes after both values
+static char pendingSsid[PROVISION_SSID_LEN];
+static char pendingPassword[PROVISION_PASS_LEN];
+static volatile bool connectRequested = false;
+static volatile bool abortRequested = false;
+
+// Handed to LavliWiFiCache, which keeps the pointers
+static char ssid[PROVISION_SSID_LEN];
+static char password[PROVISION_PASS_LEN];
+
+static void notifyStatus(const char* message) {
+  if (statusChar && state != PROVISION_OFF) {
+    statusChar->setValue((const uint8_t*)message, strlen(message));
+    statusChar->notify();
+  }
+}
+
+static void copyValue(NimBLECharacteristic* c, char* out, size_t size) {
+  std::string value = c->getValue();
+  strlcpy(out, value.c_str(), size);
+}
+
+class SsidWriteCallback : public NimBLECharacteristicCallbacks {
+  void onWrite(NimBLECharacteristic* c, NimBLEConnInfo& /*conn*/) override {
+    copyValue(c, pendingSsid, sizeof(pendingSsid));
+    notifyStatus("SSID set");
+  }
+};
+
+class PassWriteCallback : public NimBLECharacteristicCallbacks {
+  void onWrite(NimBLECharacteristic* c, NimBLEConnInfo& /*conn*/) override {
+    copyValue(c, pendingPassword, sizeof(pendingPassword));
+    notifyStatus("Password set");
+  }
+};
+
+class ControlWriteCallback : public NimBLECharacteristicCallbacks {
+  void onWrite(NimBLECharacteristic* c, NimBLEConnInfo& /*conn*/) override {
+    char command[16];
+    copyValue(c, command, sizeof(command));
+    if (strcasecmp(command, "CONNECT") == 0) {
+      connectRequested = true;
+      notifyStatus("CONNECT requested");
+    } else if (strcasecmp(command, "CLEAR") == 0) {
+      pendingSsid[0] = '\0';
+      pendingPassword[0] = '\0';
+      abortRequested = true;
+      notifyStatus("Credentials cleared");
+    } else {
+      notifyStatus("Unknown command");
+    }
+  }
+};
+
+static void enterState(ProvisionState next) {
+  state = next;
+  stateSince = millis();
+}
+
+static void shutdownBle() {
+  NimBLEDevice::getAdvertising()->stop();
+  NimBLEDevice::deinit(true);
+  statusChar = NULL;
+  provisionReleaseBle();
+  heapAfter = ESP.getFreeHeap();
+  LOG_INFO("[PROV] BLE off, free heap %d -> %d", heapBefore, heapAfter);
+}
+
+bool provisionLoadCredentials(char* ssidOut, char* passwordOut) {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true)) return false;
+  size_t length = prefs.getString("ssid", ssidOut, PROVISION_SSID_LEN);
+  prefs.getString("pass", passwordOut, PROVISION_PASS_LEN);
+  prefs.end();
+  return length > 1;    // Includes the terminator
+}
+
+bool provisionSaveCredentials(const char* ssidIn, const char* passwordIn) {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) return false;
+  bool ok = prefs.putString("ssid", ssidIn) > 0;
+  prefs.putString("pass", passwordIn);
+  prefs.remove("cleared");
+  prefs.end();
+  return ok;
+}
+
+void provisionClearCredentials() {
+  Preferences prefs;
+  if (prefs.begin(NVS_NAMESPACE, false)) {
+    prefs.clear();
+    prefs.putBool("cleared", true);
+    prefs.end();
+  }
+}
+
+bool provisionCredentialsCleared() {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true)) return false;
+  bool cleared = prefs.getBool("cleared", false);
+  prefs.end();
+  return cleared;
+}
+
+bool provisionStart(const char* deviceName) {
+  if (bleReleased || state != PROVISION_OFF) return false;
+  heapBefore = ESP.getFreeHeap();
+  haveStored = provisionLoadCredentials(storedSsid, storedPassword);
+
+  NimBLEDevice::init(deviceName);
+  NimBLEDevice::setPower(ESP_PWR_LVL_P9);
+  NimBLEDevice::setSecurityAuth(false, false, true); // no bonding/MITM
+
+  NimBLEServer* server = NimBLEDevice::createServer();
+  NimBLEService* service = server->createService(SERVICE_UUID);
+  service->createCharacteristic(SSID_CHAR_UUID, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR)
+      ->setCallbacks(new SsidWriteCallback());
+  service->createCharacteristic(PASS_CHAR_UUID, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR)
+      ->setCallbacks(new PassWriteCallback());
+  service->createCharacteristic(CONTROL_CHAR_UUID, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR)
+      ->setCallbacks(new ControlWriteCallback());
+  statusChar = service->createCharacteristic(STATUS_CHAR_UUID, NIMBLE_PROPERTY::NOTIFY);
+  service->start();
+
+  NimBLEAdvertising* advertising = NimBLEDevice::getAdvertising();
+  advertising->addServiceUUID(SERVICE_UUID);
+  NimBLEAdvertisementData scanResponse;
+  scanResponse.setName(deviceName);
+  advertising->setScanResponseData(scanResponse);
+  advertising->start();
+
+  enterState(PROVISION_ADVERTISING);
+  LOG_INFO("[PROV] BLE provisioning advertising, BLE took %d bytes of heap", heapBefore - ESP.getFreeHeap());
+  return true;
+}
+
+void provisionReleaseBle() {
+  if (bleReleased) return;
+  bleReleased = true;
+  esp_bt_controller_mem_release(ESP_BT_MODE_BLE);
+}
+
+void provisionService() {
+  if (state == PROVISION_OFF) return;
+
+  ProvisionInputs in;
+  in.connectRequested = connectRequested;
+  in.abortRequested = abortRequested;
+  in.haveSsid = pendingSsid[0] != '\0';
+  in.haveStored = haveStored;
+  in.wifiUp = state == PROVISION_CONNECTING && wifiCacheService();
+  in.inStateMs = millis() - stateSince;
+
+  // A CLEAR while advertising has nothing left to abort
+  if (state == PROVISION_ADVERTISING) abortRequested = false;
+
+  ProvisionStep step = provisionNextStep(state, in);
+  switch (step.action) {
+    case PROVISION_NONE:
+      return;
+
+    case PROVISION_REJECT:
+      connectRequested = false;
+      notifyStatus("No SSID set");
+      return;
+
+    case PROVISION_CONNECT_NEW:
+      connectRequested = false;
+      strlcpy(ssid, pendingSsid, sizeof(ssid));
+      strlcpy(password, pendingPassword, sizeof(password));
+      attemptStored = false;
+      attempts++;
+      notifyStatus("WiFi connecting");
+      LOG_INFO("[PROV] Connect attempt %d with new credentials", attempts);
+      wifiCacheBegin(ssid, password);
+      break;
+
+    case PROVISION_CONNECT_STORED:
+      strlcpy(ssid, storedSsid, sizeof(ssid));
+      strlcpy(password, storedPassword, sizeof(password));
+      attemptStored = true;
+      attempts++;
+      notifyStatus("WiFi retrying stored network");
+      LOG_INFO("[PROV] Connect attempt %d with the stored credentials", attempts);
+      wifiCacheBegin(ssid, password);
+      break;
+
+    case PROVISION_ABORT:
+      // A corrected CONNECT stays set and starts the next attempt
+      abortRequested = false;
+      wifiCacheEnd();
+      notifyStatus("Attempt aborted");
+      break;
+
+    case PROVISION_CONNECTED: {
+      char message[48];
+      snprintf(message, sizeof(message), "WiFi connected: %s", WiFi.localIP().toString().c_str());
+      notifyStatus(message);
+      if (!attemptStored && !provisionSaveCredentials(ssid, password)) {
+        LOG_ERROR("[PROV] Could not store the credentials");
+      }
+      break;
+    }
+
+    case PROVISION_TIMEOUT:
+      wifiCacheEnd();
+      notifyStatus("WiFi failed");
+      LOG_WARN("[PROV] Connect timed out, waiting for new credentials");
+      break;
+
+    case PROVISION_SHUTDOWN:
+      shutdownBle();
+      break;
+  }
+  enterState(step.next);
+}
+
+bool provisionActive() {
+  return state != PROVISION_OFF;
+}
+
+ProvisionState provisionState() {
+  return state;
+}
+
+void provisionPrint(Print& out) {
+  static const char* names[] = {"off", "advertising", "connecting", "shutting down"};
+  out.printf("\n=== Provisioning: %s ===\n", names[state]);
+  out.printf("  BLE memory %s\n", bleReleased ? "released" : "available");
+  if (state != PROVISION_OFF) out.printf("  Stored credentials %s\n", haveStored ? "retried while advertising" : "none");
+  out.printf("  Connect attempts %lu\n", (unsigned long)attempts);
+  if (heapAfter) {
+    out.printf("  Heap %lu before BLE, %lu after shutdown\n", (unsigned long)heapBefore, (unsigned long)heapAfter);
+  }
+  out.println("===============================\n");
+}
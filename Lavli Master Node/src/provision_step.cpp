@@ -0,0 +1,30 @@
+#include "provision_step.h"
+
+ProvisionStep provisionNextStep(ProvisionState state, const ProvisionInputs& in) {
+  switch (state) {
+    case PROVISION_ADVERTISING:
+      if (in.connectRequested) {
+        if (!in.haveSsid) return {PROVISION_ADVERTISING, PROVISION_REJECT};
+        return {PROVISION_CONNECTING, PROVISION_CONNECT_NEW};
+      }
+      // Started as a fallback: the old network may just have been down
+      if (in.haveStored && in.inStateMs >= PROVISION_STORED_RETRY_MS) {
+        return {PROVISION_CONNECTING, PROVISION_CONNECT_STORED};
+      }
+      return {PROVISION_ADVERTISING, PROVISION_NONE};
+
+    case PROVISION_CONNECTING:
+      if (in.abortRequested || in.connectRequested) return {PROVISION_ADVERTISING, PROVISION_ABORT};
+      if (in.wifiUp) return {PROVISION_SHUTTING_DOWN, PROVISION_CONNECTED};
+      if (in.inStateMs > PROVISION_CONNECT_TIMEOUT_MS) return {PROVISION_ADVERTISING, PROVISION_TIMEOUT};
+      return {PROVISION_CONNECTING, PROVISION_NONE};
+
+    case PROVISION_SHUTTING_DOWN:
+      if (in.inStateMs < PROVISION_SHUTDOWN_DELAY_MS) return {PROVISION_SHUTTING_DOWN, PROVISION_NONE};
+      return {PROVISION_OFF, PROVISION_SHUTDOWN};
+
+    case PROVISION_OFF:
+    default:
+      return {PROVISION_OFF, PROVISION_NONE};
+  }
+}
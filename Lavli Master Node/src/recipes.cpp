@@ -0,0 +1,411 @@
+#include "recipes.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <LavliLog.h>
+
+#define RECIPE_MAX_RPM   1500
+#define RECIPE_MAX_PORT  7
+#define RECIPE_PORT_MASK (((1 << (RECIPE_MAX_PORT + 1)) - 1) & ~1)
+
+enum RunState : uint8_t {
+  RUN_IDLE,
+  RUN_STEP_ENTER,     // Apply the next step's direction, outputs and speed
+  RUN_STEP_ACTIVE     // Ramp, poll the exit sensor and wait for the step to end
+};
+
+static Recipe recipes[RECIPE_MAX_RECIPES];
+static uint8_t recipeCount = 0;
+static RecipeHooks hooks = {};
+
+static const Recipe* active = NULL;
+static RunState runState = RUN_IDLE;
+static uint8_t stepIndex = 0;
+static unsigned long stepStartTime = 0;
+static unsigned long lastRampUpdate = 0;
+static unsigned long lastSensorPoll = 0;
+static unsigned long lastSync = 0;
+
+// What was last commanded, so steps only send what changes
+static uint16_t rampFromRpm = 0;
+static uint16_t commandedRpm = 0;
+static bool commandedClockwise = true;
+static bool directionKnown = false;
+static uint8_t commandedOutputs = 0;
+static bool outputsKnown = false;
+
+static char jsonBuffer[RECIPE_MAX_JSON];
+
+static Recipe* findRecipe(const char* name) {
+  for (uint8_t i = 0; i < recipeCount; i++) {
+    if (strcmp(recipes[i].name, name) == 0) return &recipes[i];
+  }
+  return NULL;
+}
+
+// Names become file names, so keep them short and plain
+static bool validName(const char* name) {
+  size_t length = strlen(name);
+  if (length == 0 || length >= RECIPE_NAME_LEN) return false;
+  for (size_t i = 0; i < length; i++) {
+    char c = name[i];
+    if (!isalnum((unsigned char)c) && c != '_' && c != '-') return false;
+  }
+  return true;
+}
+
+// Accepts 0x-prefixed hex strings like the generic CAN topic, or plain numbers
+static uint16_t parseAddress(JsonVariant value) {
+  if (value.is<const char*>()) {
+    return (uint16_t)strtol(value.as<const char*>(), NULL, 0);
+  }
+  return value.as<uint16_t>();
+}
+
+static uint32_t recipeDuration(const Recipe& recipe) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < recipe.step_count; i++) {
+    total += recipe.steps[i].duration_ms;
+  }
+  return total;
+}
+
+static bool storeRecipe(const Recipe& recipe) {
+  Recipe* slot = findRecipe(recipe.name);
+  if (slot == NULL) {
+    if (recipeCount >= RECIPE_MAX_RECIPES) {
+      Serial.printf("[RECIPE] Table full, cannot add %s\n", recipe.name);
+      return false;
+    }
+    slot = &recipes[recipeCount++];
+  }
+  memcpy(slot, &recipe, sizeof(Recipe));
+  return true;
+}
+
+static void persistRecipe(const char* name, const uint8_t* json, size_t length) {
+  char path[RECIPE_NAME_LEN + 16];
+  snprintf(path, sizeof(path), RECIPE_DIR "/%s.json", name);
+
+  File f = LittleFS.open(path, FILE_WRITE);
+  if (!f) {
+    Serial.printf("[RECIPE] Failed to save %s\n", path);
+    return;
+  }
+  f.write(json, length);
+  f.close();
+}
+
+static void loadDefaults() {
+  // Same behaviour as the original fixed programs: 10 minutes at 50 RPM,
+  // with the heater output on for dry
+  Recipe wash = {};
+  strcpy(wash.name, "wash");
+  wash.step_count = 1;
+  wash.steps[0].duration_ms = 10UL * 60 * 1000;
+  wash.steps[0].rpm = 50;
+  wash.steps[0].clockwise = true;
+  storeRecipe(wash);
+
+  Recipe dry = wash;
+  strcpy(dry.name, "dry");
+  dry.steps[0].outputs = 1 << 1;
+  storeRecipe(dry);
+}
+
+void recipesBegin(const RecipeHooks& recipeHooks) {
+  hooks = recipeHooks;
+  loadDefaults();
+
+  // Already mounted by the spool; begin() is a no-op then
+  if (!LittleFS.begin(true)) {
+    Serial.println("[RECIPE] LittleFS unavailable, using built-in recipes");
+    return;
+  }
+  if (!LittleFS.exists(RECIPE_DIR)) {
+    LittleFS.mkdir(RECIPE_DIR);
+  }
+
+  File dir = LittleFS.open(RECIPE_DIR);
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    size_t length = f.read((uint8_t*)jsonBuffer, sizeof(jsonBuffer));
+    f.close();
+    recipeLoadJson((const uint8_t*)jsonBuffer, length, false);
+  }
+  dir.close();
+
+  Serial.printf("[RECIPE] %d recipes loaded\n", recipeCount);
+}
+
+bool recipeLoadJson(const uint8_t* json, size_t length, bool persist) {
+  if (length > RECIPE_MAX_JSON) {
+    Serial.printf("[RECIPE] Recipe too large (%u bytes, max %d)\n", (unsigned)length, RECIPE_MAX_JSON);
+    return false;
+  }
+
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, json, length);
+  if (error) {
+    Serial.printf("[RECIPE] Parse failed: %s\n", error.c_str());
+    return false;
+  }
+
+  const char* name = doc["name"] | "";
+  if (!validName(name)) {
+    Serial.println("[RECIPE] Missing or invalid 'name' (1-15 chars of a-z, 0-9, _ or -)");
+    return false;
+  }
+
+  JsonArray steps = doc["steps"];
+  if (steps.isNull() || steps.size() == 0 || steps.size() > RECIPE_MAX_STEPS) {
+    Serial.printf("[RECIPE] %s: 'steps' must hold 1-%d steps\n", name, RECIPE_MAX_STEPS);
+    return false;
+  }
+
+  Recipe recipe = {};
+  strcpy(recipe.name, name);
+  recipe.step_count = steps.size();
+
+  for (uint8_t i = 0; i < recipe.step_count; i++) {
+    JsonObject source = steps[i];
+    RecipeStep& step = recipe.steps[i];
+
+    if ((source.containsKey("ms") && !source["ms"].is<uint32_t>()) ||
+        (source.containsKey("ramp_ms") && !source["ramp_ms"].is<uint32_t>())) {
+      Serial.printf("[RECIPE] %s: step %d 'ms' and 'ramp_ms' must be 0-%lu\n", name, i, (unsigned long)UINT32_MAX);
+      return false;
+    }
+    step.duration_ms = source["ms"] | 0;
+    step.rpm = source["rpm"] | 0;
+    step.ramp_ms = source["ramp_ms"] | 0;
+    step.clockwise = strcmp(source["dir"] | "cw", "ccw") != 0;
+
+    if (step.duration_ms == 0 || step.rpm > RECIPE_MAX_RPM) {
+      Serial.printf("[RECIPE] %s: step %d needs ms > 0 and rpm <= %d\n", name, i, RECIPE_MAX_RPM);
+      return false;
+    }
+
+    for (JsonVariant port : source["outputs"].as<JsonArray>()) {
+      uint8_t number = port.as<uint8_t>();
+      if (number < 1 || number > RECIPE_MAX_PORT) {
+        Serial.printf("[RECIPE] %s: step %d has invalid output port %d\n", name, i, number);
+        return false;
+      }
+      step.outputs |= 1 << number;
+    }
+
+    JsonObject until = source["until"];
+    if (!until.isNull()) {
+      step.exit_device = parseAddress(until["dev"]);
+      step.exit_pin = until["pin"] | 0;
+      step.exit_analog = until["analog"] | true;
+      if (until.containsKey("above")) {
+        step.exit_type = RECIPE_EXIT_ABOVE;
+        step.exit_threshold = until["above"];
+      } else if (until.containsKey("below")) {
+        step.exit_type = RECIPE_EXIT_BELOW;
+        step.exit_threshold = until["below"];
+      } else {
+        Serial.printf("[RECIPE] %s: step %d 'until' needs 'above' or 'below'\n", name, i);
+        return false;
+      }
+    }
+  }
+
+  // Swapping the table out from under a running program would change its timing
+  if (active != NULL && strcmp(active->name, name) == 0) {
+    Serial.printf("[RECIPE] %s is running, stop it before replacing\n", name);
+    return false;
+  }
+
+  if (!storeRecipe(recipe)) return false;
+  if (persist) persistRecipe(name, json, length);
+
+  Serial.printf("[RECIPE] Loaded %s (%d steps, %lu s)\n", name, recipe.step_count,
+                (unsigned long)(recipeDuration(recipe) / 1000));
+  return true;
+}
+
+bool recipeStart(const char* name) {
+  const Recipe* recipe = findRecipe(name);
+  if (recipe == NULL) {
+    Serial.printf("[RECIPE] Unknown recipe %s\n", name);
+    return false;
+  }
+
+  // A program started over a running one takes the drum at the speed it
+  // was left at. Outputs and direction are sent in full by the first step,
+  // so ports the old program left on and the new one doesn't name go off.
+  if (active == NULL) commandedRpm = 0;   // stopAll() left the drum stopped
+  outputsKnown = false;
+  directionKnown = false;
+
+  active = recipe;
+  stepIndex = 0;
+  runState = RUN_STEP_ENTER;
+
+  Serial.printf("[RECIPE] Starting %s\n", name);
+  return true;
+}
+
+void recipeStop() {
+  active = NULL;
+  runState = RUN_IDLE;
+}
+
+static void sendRpm(uint16_t rpm) {
+  if (hooks.setMotorRPM(rpm)) {
+    commandedRpm = rpm;
+  }
+  lastRampUpdate = millis();
+}
+
+// Sends the step's direction and outputs where they differ from what was
+// last commanded. A send that fails (node offline, TX queue full) leaves
+// the commanded state as it was, so the next call tries again.
+static void syncActuators(const RecipeStep& step) {
+  lastSync = millis();
+
+  if (!directionKnown || step.clockwise != commandedClockwise) {
+    if (hooks.setMotorDirection(step.clockwise)) {
+      commandedClockwise = step.clockwise;
+      directionKnown = true;
+    }
+  }
+
+  // Every output change in the step switches together; with the state
+  // unknown, every port is set
+  uint8_t changed = outputsKnown ? step.outputs ^ commandedOutputs : RECIPE_PORT_MASK;
+  if (changed && hooks.setOutputs(changed, step.outputs)) {
+    commandedOutputs = step.outputs;
+    outputsKnown = true;
+  }
+}
+
+static bool actuatorsInSync(const RecipeStep& step) {
+  return directionKnown && step.clockwise == commandedClockwise && outputsKnown &&
+         step.outputs == commandedOutputs;
+}
+
+static void enterStep() {
+  const RecipeStep& step = active->steps[stepIndex];
+  LOG_INFO("[RECIPE] Step %d/%d: %d rpm for %lu ms", stepIndex + 1, active->step_count, step.rpm, step.duration_ms);
+
+  syncActuators(step);
+
+  rampFromRpm = commandedRpm;
+  if (step.ramp_ms == 0 && step.rpm != commandedRpm) {
+    sendRpm(step.rpm);
+  }
+
+  stepStartTime = millis();
+  lastSensorPoll = 0;
+  runState = RUN_STEP_ACTIVE;
+}
+
+static void updateRamp(const RecipeStep& step, unsigned long elapsed) {
+  if (step.rpm == commandedRpm) return;
+
+  if (elapsed >= step.ramp_ms) {
+    sendRpm(step.rpm);
+    return;
+  }
+  if (millis() - lastRampUpdate < RECIPE_RAMP_INTERVAL_MS) return;
+
+  int32_t delta = (int32_t)step.rpm - rampFromRpm;
+  uint16_t rpm = rampFromRpm + (int64_t)delta * elapsed / step.ramp_ms;
+  if (rpm != commandedRpm) {
+    sendRpm(rpm);
+  }
+}
+
+static bool exitConditionMet(const RecipeStep& step) {
+  if (step.exit_type == RECIPE_EXIT_NONE) return false;
+
+  if (millis() - lastSensorPoll >= RECIPE_SENSOR_POLL_MS) {
+    lastSensorPoll = millis();
+    hooks.requestSensor(step.exit_device, step.exit_pin, step.exit_analog);
+  }
+
+  uint16_t value;
+  unsigned long timestamp;
+  if (!hooks.readSensor(step.exit_device, step.exit_pin, step.exit_analog, &value, &timestamp)) return false;
+  // Ignore readings taken before this step started
+  if ((long)(timestamp - stepStartTime) < 0) return false;
+
+  if (step.exit_type == RECIPE_EXIT_ABOVE) return value >= step.exit_threshold;
+  return value <= step.exit_threshold;
+}
+
+void recipeService() {
+  if (active == NULL) return;
+
+  if (runState == RUN_STEP_ENTER) {
+    enterStep();
+    return;
+  }
+
+  const RecipeStep& step = active->steps[stepIndex];
+  unsigned long elapsed = millis() - stepStartTime;
+
+  updateRamp(step, elapsed);
+  if (!actuatorsInSync(step) && millis() - lastSync >= RECIPE_RETRY_MS) {
+    syncActuators(step);
+  }
+
+  bool sensorExit = exitConditionMet(step);
+  if (!sensorExit && elapsed < step.duration_ms) return;
+
+  if (sensorExit) {
+    LOG_INFO("[RECIPE] Step %d exit condition met after %lu ms", stepIndex + 1, elapsed);
+  }
+
+  stepIndex++;
+  if (stepIndex < active->step_count) {
+    runState = RUN_STEP_ENTER;
+    return;
+  }
+
+  const char* name = active->name;
+  active = NULL;
+  runState = RUN_IDLE;
+  if (hooks.onComplete) hooks.onComplete(name);
+}
+
+bool recipeIsRunning() {
+  return active != NULL;
+}
+
+const char* recipeActiveName() {
+  return active ? active->name : "";
+}
+
+uint32_t recipeTotalMs() {
+  return active ? recipeDuration(*active) : 0;
+}
+
+uint32_t recipeRemainingMs() {
+  if (active == NULL) return 0;
+
+  uint32_t remaining = 0;
+  for (uint8_t i = stepIndex + 1; i < active->step_count; i++) {
+    remaining += active->steps[i].duration_ms;
+  }
+  if (runState == RUN_STEP_ACTIVE) {
+    uint32_t elapsed = millis() - stepStartTime;
+    uint32_t duration = active->steps[stepIndex].duration_ms;
+    remaining += elapsed >= duration ? 0 : duration - elapsed;
+  } else {
+    remaining += active->steps[stepIndex].duration_ms;
+  }
+  return remaining;
+}
+
+void recipePrintList() {
+  Serial.println("\n=== Recipes ===");
+  for (uint8_t i = 0; i < recipeCount; i++) {
+    const Recipe& recipe = recipes[i];
+    Serial.printf("  %-15s %2d steps  %lu s%s\n", recipe.name, recipe.step_count,
+                  (unsigned long)(recipeDuration(recipe) / 1000), &recipe == active ? "  (running)" : "");
+  }
+  Serial.println("===============\n");
+}
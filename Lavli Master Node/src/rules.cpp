@@ -0,0 +1,234 @@
+#include "rules.h"
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <LavliLog.h>
+#include <LavliProfiler.h>
+
+static Rule rules[RULES_MAX];
+static uint8_t ruleCount = 0;
+static Rule staging[RULES_MAX];
+static RuleSendFn sendFrame = NULL;
+static RuleFiredFn onFired = NULL;
+static char jsonBuffer[RULES_MAX_JSON];
+
+// Fired rules waiting for rulesService(); copies, since the table can be
+// reloaded in between
+struct FiredRule {
+  Rule rule;
+  uint8_t index;
+  uint16_t value;
+};
+static FiredRule fired[RULES_QUEUE_LEN];
+static uint8_t firedHead = 0;
+static uint8_t firedCount = 0;
+static uint32_t firedDropped = 0;
+
+static inline uint32_t ruleKey(uint16_t device, uint8_t pin, bool analog) {
+  return ((uint32_t)device << 9) | ((uint32_t)pin << 1) | (analog ? 1 : 0);
+}
+
+// Accepts 0x-prefixed hex strings like the generic CAN topic, or plain numbers
+static uint16_t parseNumber(JsonVariant value) {
+  if (value.is<const char*>()) {
+    return (uint16_t)strtol(value.as<const char*>(), NULL, 0);
+  }
+  return value.as<uint16_t>();
+}
+
+// Insertion sort; stable, so rules on the same input fire in the order given
+static void sortByKey(Rule* table, uint8_t count) {
+  for (uint8_t i = 1; i < count; i++) {
+    Rule rule = table[i];
+    int j = i - 1;
+    while (j >= 0 && table[j].key > rule.key) {
+      table[j + 1] = table[j];
+      j--;
+    }
+    table[j + 1] = rule;
+  }
+}
+
+static void persistRules(const uint8_t* json, size_t length) {
+  File f = LittleFS.open(RULES_PATH, FILE_WRITE);
+  if (!f) {
+    Serial.println("[RULES] Failed to save rule set");
+    return;
+  }
+  f.write(json, length);
+  f.close();
+}
+
+void rulesBegin(RuleSendFn send, RuleFiredFn fired) {
+  sendFrame = send;
+  onFired = fired;
+
+  // Already mounted by the spool; begin() is a no-op then
+  if (!LittleFS.begin(true) || !LittleFS.exists(RULES_PATH)) {
+    Serial.println("[RULES] No stored rule set");
+    return;
+  }
+
+  File f = LittleFS.open(RULES_PATH, FILE_READ);
+  size_t length = f.read((uint8_t*)jsonBuffer, sizeof(jsonBuffer));
+  f.close();
+  rulesLoadJson((const uint8_t*)jsonBuffer, length, false);
+}
+
+bool rulesLoadJson(const uint8_t* json, size_t length, bool persist) {
+  if (length > RULES_MAX_JSON) {
+    Serial.printf("[RULES] Rule set too large (%u bytes, max %d)\n", (unsigned)length, RULES_MAX_JSON);
+    return false;
+  }
+
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, json, length);
+  if (error) {
+    Serial.printf("[RULES] Parse failed: %s\n", error.c_str());
+    return false;
+  }
+
+  JsonArray source = doc["rules"];
+  if (source.isNull() || source.size() > RULES_MAX) {
+    Serial.printf("[RULES] 'rules' must be an array of at most %d rules\n", RULES_MAX);
+    return false;
+  }
+
+  // Compile into the staging table so a bad rule leaves the running set alone
+  uint8_t count = 0;
+  for (JsonObject item : source) {
+    Rule& rule = staging[count];
+    memset(&rule, 0, sizeof(rule));
+
+    strlcpy(rule.name, item["name"] | "", sizeof(rule.name));
+    uint16_t device = parseNumber(item["dev"]);
+    uint8_t pin = item["pin"] | 0;
+    bool analog = item["analog"] | true;
+    rule.key = ruleKey(device, pin, analog);
+    rule.hysteresis = item["hyst"] | 0;
+
+    if (item.containsKey("above")) {
+      rule.condition = RULE_ABOVE;
+      rule.threshold = item["above"];
+    } else if (item.containsKey("below")) {
+      rule.condition = RULE_BELOW;
+      rule.threshold = item["below"];
+    } else {
+      Serial.printf("[RULES] Rule %d needs 'above' or 'below'\n", count);
+      return false;
+    }
+
+    JsonObject action = item["can"];
+    JsonArray data = action["data"];
+    if (action.isNull() || data.isNull() || data.size() > 8) {
+      Serial.printf("[RULES] Rule %d needs a 'can' action with up to 8 data bytes\n", count);
+      return false;
+    }
+    rule.address = parseNumber(action["address"]);
+    rule.length = data.size();
+    for (uint8_t i = 0; i < rule.length; i++) {
+      rule.data[i] = (uint8_t)parseNumber(data[i]);
+    }
+    count++;
+  }
+
+  sortByKey(staging, count);
+  memcpy(rules, staging, sizeof(Rule) * count);
+  ruleCount = count;
+
+  if (persist) persistRules(json, length);
+  Serial.printf("[RULES] Loaded %d rules\n", ruleCount);
+  return true;
+}
+
+static void fire(uint8_t index, uint16_t value) {
+  Rule& rule = rules[index];
+  rule.latched = true;
+  rule.fire_count++;
+  rule.last_fired = millis();
+
+  if (firedCount == RULES_QUEUE_LEN) {
+    firedDropped++;
+    LOG_ERROR("[RULES] Action queue full, rule %d dropped", index);
+    return;
+  }
+  FiredRule& entry = fired[(firedHead + firedCount) % RULES_QUEUE_LEN];
+  entry.rule = rule;
+  entry.index = index;
+  entry.value = value;
+  firedCount++;
+}
+
+bool rulesPending() {
+  return firedCount > 0;
+}
+
+// Sends queued actions in the order they fired
+void rulesService() {
+  while (firedCount > 0) {
+    FiredRule& entry = fired[firedHead];
+    Rule& rule = entry.rule;
+    bool sent = sendFrame && sendFrame(rule.address, rule.data, rule.length);
+    // Names live in the reloadable table, so log the index rather than the string
+    LOG_INFO("[RULES] Rule %d fired at %d -> 0x%03X %s", entry.index, entry.value, rule.address,
+             sent ? "sent" : "FAILED");
+    if (onFired) onFired(rule);
+    firedHead = (firedHead + 1) % RULES_QUEUE_LEN;
+    firedCount--;
+  }
+}
+
+void rulesEvaluate(uint16_t device, uint8_t pin, bool analog, uint16_t value) {
+  PROFILE_SCOPE("rules_eval");
+  uint32_t key = ruleKey(device, pin, analog);
+
+  // Lower bound of key in the sorted table
+  uint8_t low = 0;
+  uint8_t high = ruleCount;
+  while (low < high) {
+    uint8_t mid = (low + high) / 2;
+    if (rules[mid].key < key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  for (uint8_t i = low; i < ruleCount && rules[i].key == key; i++) {
+    Rule& rule = rules[i];
+    if (rule.condition == RULE_ABOVE) {
+      if (!rule.latched && value >= rule.threshold) {
+        fire(i, value);
+      } else if (rule.latched && (int32_t)value < (int32_t)rule.threshold - rule.hysteresis) {
+        rule.latched = false;
+      }
+    } else {
+      if (!rule.latched && value <= rule.threshold) {
+        fire(i, value);
+      } else if (rule.latched && (int32_t)value > (int32_t)rule.threshold + rule.hysteresis) {
+        rule.latched = false;
+      }
+    }
+  }
+}
+
+void rulesPrint() {
+  Serial.printf("\n=== Rules (%d, %lu actions dropped) ===\n", ruleCount, (unsigned long)firedDropped);
+  Serial.println("  Name            Input          Condition     Action                  Fired  State");
+  for (uint8_t i = 0; i < ruleCount; i++) {
+    const Rule& rule = rules[i];
+    char input[16];
+    snprintf(input, sizeof(input), "0x%03lX:%lu%s", (unsigned long)(rule.key >> 9),
+             (unsigned long)((rule.key >> 1) & 0xFF), (rule.key & 1) ? "a" : "d");
+    char condition[16];
+    snprintf(condition, sizeof(condition), "%s%u/%u", rule.condition == RULE_ABOVE ? ">=" : "<=",
+             rule.threshold, rule.hysteresis);
+    char action[32];
+    int used = snprintf(action, sizeof(action), "0x%03X", rule.address);
+    for (uint8_t b = 0; b < rule.length && used < (int)sizeof(action) - 3; b++) {
+      used += snprintf(action + used, sizeof(action) - used, " %02X", rule.data[b]);
+    }
+    Serial.printf("  %-15s %-14s %-13s %-23s %-6lu %s\n", rule.name, input, condition, action,
+                  (unsigned long)rule.fire_count, rule.latched ? "latched" : "armed");
+  }
+  Serial.println("==================\n");
+}
@@ -0,0 +1,147 @@
+#include "scheduler.h"
+
+static SchedulerTask tasks[SCHEDULER_MAX_TASKS];
+static int taskCount = 0;
+static SchedulerIdleFn idleHook = NULL;
+static uint32_t passCount = 0;
+static uint64_t idleTotalUs = 0;
+static unsigned long statsStartTime = 0;
+
+static int addTask(const char* name, SchedulerTaskFn run, SchedulerReadyFn ready, uint32_t period_ms) {
+  if (taskCount >= SCHEDULER_MAX_TASKS) {
+    Serial.printf("[SCHED] Task table full, cannot add %s\n", name);
+    return -1;
+  }
+
+  SchedulerTask& task = tasks[taskCount];
+  memset(&task, 0, sizeof(task));
+  task.name = name;
+  task.run = run;
+  task.ready = ready;
+  task.period_ms = period_ms;
+  task.next_due = millis() + period_ms;
+  task.profile_id = PROFILE_REGISTER(name);
+  return taskCount++;
+}
+
+int schedulerAddPeriodic(const char* name, SchedulerTaskFn run, uint32_t period_ms) {
+  return addTask(name, run, NULL, period_ms);
+}
+
+int schedulerAddEvent(const char* name, SchedulerTaskFn run, SchedulerReadyFn ready, uint32_t period_ms) {
+  return addTask(name, run, ready, period_ms);
+}
+
+void schedulerSetIdleHook(SchedulerIdleFn idle) {
+  idleHook = idle;
+}
+
+static void runTask(SchedulerTask& task) {
+  unsigned long start = micros();
+  {
+    PROFILE_SCOPE_ID(task.profile_id);
+    task.run();
+  }
+  uint32_t elapsed = micros() - start;
+
+  task.runs++;
+  task.last_us = elapsed;
+  task.total_us += elapsed;
+  if (elapsed > task.max_us) task.max_us = elapsed;
+}
+
+// Runs every ready or due task once; returns true if an event source still has work
+static bool runPass() {
+  PROFILE_SCOPE("sched_pass");
+  bool eventPending = false;
+
+  for (int i = 0; i < taskCount; i++) {
+    SchedulerTask& task = tasks[i];
+
+    if (task.ready && task.ready()) {
+      runTask(task);
+      if (task.period_ms > 0) task.next_due = millis() + task.period_ms;
+      // Check again after the rest of the pass rather than sleeping
+      if (task.ready()) eventPending = true;
+      continue;
+    }
+
+    if (task.period_ms == 0) continue;
+
+    unsigned long now = millis();
+    if ((long)(now - task.next_due) >= 0) {
+      if (now - task.next_due > task.period_ms) {
+        task.deadline_misses++;
+      }
+      runTask(task);
+      // Keep the cadence, but don't try to catch up on missed periods
+      task.next_due += task.period_ms;
+      if ((long)(millis() - task.next_due) >= 0) {
+        task.next_due = millis() + task.period_ms;
+      }
+    }
+  }
+  return eventPending;
+}
+
+void schedulerRunOnce() {
+  if (statsStartTime == 0) statsStartTime = millis();
+  passCount++;
+
+  if (runPass()) return;
+
+  // Sleep until the nearest deadline, bounded so event sources stay responsive
+  unsigned long now = millis();
+  uint32_t wait = SCHEDULER_MAX_IDLE_MS;
+  for (int i = 0; i < taskCount; i++) {
+    if (tasks[i].period_ms == 0) continue;
+    long untilDue = (long)(tasks[i].next_due - now);
+    if (untilDue <= 0) return;
+    if ((uint32_t)untilDue < wait) wait = untilDue;
+  }
+
+  unsigned long idleStart = micros();
+  if (idleHook) {
+    idleHook(wait);
+  } else {
+    vTaskDelay(pdMS_TO_TICKS(wait));
+  }
+  idleTotalUs += micros() - idleStart;
+}
+
+void schedulerResetStats() {
+  for (int i = 0; i < taskCount; i++) {
+    tasks[i].runs = 0;
+    tasks[i].deadline_misses = 0;
+    tasks[i].last_us = 0;
+    tasks[i].max_us = 0;
+    tasks[i].total_us = 0;
+  }
+  passCount = 0;
+  idleTotalUs = 0;
+  statsStartTime = millis();
+}
+
+void schedulerPrintStats() {
+  unsigned long window = millis() - statsStartTime;
+
+  Serial.printf("\n=== Scheduler (%lu ms window, %lu passes) ===\n", window, (unsigned long)passCount);
+  Serial.println("  Task          Period   Runs     Misses  Avg us   Max us   Last us");
+  for (int i = 0; i < taskCount; i++) {
+    SchedulerTask& task = tasks[i];
+    uint32_t avg = task.runs ? (uint32_t)(task.total_us / task.runs) : 0;
+    char period[12];
+    if (task.period_ms > 0) {
+      snprintf(period, sizeof(period), "%lums", (unsigned long)task.period_ms);
+    } else {
+      snprintf(period, sizeof(period), "event");
+    }
+    Serial.printf("  %-13s %-8s %-8lu %-7lu %-8lu %-8lu %lu\n",
+                  task.name, period, (unsigned long)task.runs, (unsigned long)task.deadline_misses,
+                  (unsigned long)avg, (unsigned long)task.max_us, (unsigned long)task.last_us);
+  }
+  if (window > 0) {
+    Serial.printf("  Idle: %lu%%\n", (unsigned long)(idleTotalUs / 10 / window));
+  }
+  Serial.println("================================\n");
+}
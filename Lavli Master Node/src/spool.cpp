@@ -0,0 +1,390 @@
+#include "spool.h"
+#include <LittleFS.h>
+#include <LavliProfiler.h>
+
+#define SPOOL_RECORD_MAGIC 0xA5
+#define SPOOL_CURSOR_PATH  SPOOL_DIR "/cursor"
+
+// On-flash record: header, topic bytes, payload bytes
+struct __attribute__((packed)) SpoolRecordHeader {
+  uint8_t magic;
+  uint8_t topic_len;
+  uint16_t payload_len;
+  uint16_t crc;  // CRC16-CCITT over topic + payload
+};
+
+static bool spoolReady = false;
+static bool haveSegments = false;   // Segments [tailSeg, headSeg] exist on flash
+static uint32_t tailSeg = 0;        // Oldest segment, being replayed
+static uint32_t headSeg = 0;        // Newest segment, being appended
+static uint32_t tailOffset = 0;     // Replay cursor within tailSeg
+static uint32_t headBytes = 0;      // Bytes written to headSeg
+static uint32_t tailBytes = 0;      // Size of tailSeg when opened for replay
+
+static File writer;
+static File reader;
+static bool writerDirty = false;
+static unsigned long lastFlushTime = 0;
+static unsigned long lastReplayTime = 0;
+static uint32_t recordsSinceCursorSave = 0;
+
+// Drain rate measurement
+static bool draining = false;
+static unsigned long drainStartTime = 0;
+static uint32_t drainRecords = 0;
+
+static SpoolStats stats = {0, 0, 0, 0, 0, 0, 0};
+
+static char topicBuffer[SPOOL_MAX_TOPIC + 1];
+static uint8_t payloadBuffer[SPOOL_MAX_PAYLOAD];
+
+static void segmentPath(uint32_t segment, char* path, size_t size) {
+  snprintf(path, size, SPOOL_DIR "/%08lu.log", (unsigned long)segment);
+}
+
+static uint16_t crc16(uint16_t crc, const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void saveCursor() {
+  File f = LittleFS.open(SPOOL_CURSOR_PATH, FILE_WRITE);
+  if (f) {
+    f.write((const uint8_t*)&tailSeg, sizeof(tailSeg));
+    f.write((const uint8_t*)&tailOffset, sizeof(tailOffset));
+    f.close();
+  }
+  recordsSinceCursorSave = 0;
+}
+
+static void loadCursor() {
+  File f = LittleFS.open(SPOOL_CURSOR_PATH, FILE_READ);
+  if (!f) return;
+
+  uint32_t seg = 0;
+  uint32_t offset = 0;
+  if (f.read((uint8_t*)&seg, sizeof(seg)) == sizeof(seg) &&
+      f.read((uint8_t*)&offset, sizeof(offset)) == sizeof(offset) &&
+      seg == tailSeg) {
+    tailOffset = offset;
+  }
+  f.close();
+}
+
+static uint32_t segmentSize(uint32_t segment) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  File f = LittleFS.open(path, FILE_READ);
+  if (!f) return 0;
+  uint32_t size = f.size();
+  f.close();
+  return size;
+}
+
+// Drop the tail segment, whether fully replayed or evicted
+static void dropTailSegment() {
+  char path[32];
+
+  if (reader) reader.close();
+  if (tailSeg == headSeg && writer) {
+    writer.close();
+    writerDirty = false;
+  }
+
+  segmentPath(tailSeg, path, sizeof(path));
+  LittleFS.remove(path);
+
+  if (tailSeg == headSeg) {
+    haveSegments = false;
+    headSeg++;
+    tailSeg = headSeg;
+    headBytes = 0;
+  } else {
+    tailSeg++;
+  }
+  tailOffset = 0;
+  saveCursor();
+}
+
+bool spoolBegin() {
+  if (!LittleFS.begin(true)) {
+    Serial.println("[SPOOL] LittleFS mount failed, offline spool disabled");
+    return false;
+  }
+
+  if (!LittleFS.exists(SPOOL_DIR)) {
+    LittleFS.mkdir(SPOOL_DIR);
+  }
+
+  // Find the oldest and newest segments left from a previous run
+  File dir = LittleFS.open(SPOOL_DIR);
+  uint32_t minSeg = UINT32_MAX;
+  uint32_t maxSeg = 0;
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    const char* name = f.name();
+    const char* base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    if (strstr(base, ".log") != NULL) {
+      uint32_t seg = strtoul(base, NULL, 10);
+      if (seg < minSeg) minSeg = seg;
+      if (seg > maxSeg) maxSeg = seg;
+    }
+    f.close();
+  }
+  dir.close();
+
+  if (minSeg != UINT32_MAX) {
+    haveSegments = true;
+    tailSeg = minSeg;
+    loadCursor();
+    // Never append behind a record that may have been torn by a reset;
+    // new records always go to a fresh segment.
+    headSeg = maxSeg + 1;
+    headBytes = 0;
+  } else {
+    haveSegments = false;
+    tailSeg = headSeg = 0;
+  }
+
+  spoolReady = true;
+  Serial.printf("[SPOOL] Ready: %lu segment(s) pending\n",
+                haveSegments ? (unsigned long)(headSeg - tailSeg) : 0UL);
+  return true;
+}
+
+bool spoolIsEmpty() {
+  if (!haveSegments) return true;
+  return tailSeg == headSeg && tailOffset >= headBytes;
+}
+
+bool spoolAppend(const char* topic, const uint8_t* payload, size_t length) {
+  PROFILE_SCOPE("spool_append");
+  if (!spoolReady) return false;
+
+  size_t topicLength = strlen(topic);
+  if (topicLength == 0 || topicLength > SPOOL_MAX_TOPIC || length > SPOOL_MAX_PAYLOAD) {
+    return false;
+  }
+
+  uint32_t recordLength = sizeof(SpoolRecordHeader) + topicLength + length;
+
+  if (!haveSegments) {
+    haveSegments = true;
+    tailSeg = headSeg;
+    tailOffset = 0;
+    headBytes = 0;
+  } else if (headBytes > 0 && headBytes + recordLength > SPOOL_SEGMENT_BYTES) {
+    if (writer) writer.close();
+    writerDirty = false;
+    if (tailSeg == headSeg) tailBytes = headBytes;  // Reader's segment is now closed
+    headSeg++;
+    headBytes = 0;
+  }
+
+  // Bound the spool by evicting the oldest segment
+  while (headSeg - tailSeg + 1 > SPOOL_MAX_SEGMENTS) {
+    Serial.printf("[SPOOL] Full, evicting segment %lu\n", (unsigned long)tailSeg);
+    dropTailSegment();
+    stats.evicted_segments++;
+  }
+
+  if (!writer) {
+    char path[32];
+    segmentPath(headSeg, path, sizeof(path));
+    writer = LittleFS.open(path, FILE_APPEND);
+    if (!writer) {
+      Serial.println("[SPOOL] Failed to open segment for append");
+      return false;
+    }
+    headBytes = writer.size();
+  }
+
+  SpoolRecordHeader header;
+  header.magic = SPOOL_RECORD_MAGIC;
+  header.topic_len = topicLength;
+  header.payload_len = length;
+  header.crc = crc16(crc16(0xFFFF, (const uint8_t*)topic, topicLength), payload, length);
+
+  size_t written = writer.write((const uint8_t*)&header, sizeof(header));
+  written += writer.write((const uint8_t*)topic, topicLength);
+  written += writer.write(payload, length);
+  headBytes += written;
+  writerDirty = true;
+
+  if (written != recordLength) {
+    // Out of space or flash error; the partial record will fail its CRC on replay
+    Serial.println("[SPOOL] Short write while appending record");
+    return false;
+  }
+
+  stats.appended++;
+  return true;
+}
+
+enum ReplayResult {
+  REPLAY_SENT,
+  REPLAY_BLOCKED,        // Publish failed or caught up with the writer
+  REPLAY_SEGMENT_END,
+  REPLAY_CORRUPT,
+};
+
+// Reads and publishes the record at the cursor
+static ReplayResult replayOne(SpoolPublishFn publish) {
+  if (!reader) {
+    char path[32];
+    segmentPath(tailSeg, path, sizeof(path));
+    reader = LittleFS.open(path, FILE_READ);
+    if (!reader) return REPLAY_SEGMENT_END;
+    tailBytes = reader.size();
+  }
+
+  if (tailSeg == headSeg && writerDirty) {
+    // Reader shares the head segment; make appended data visible first
+    writer.flush();
+    writerDirty = false;
+  }
+
+  if (tailSeg != headSeg && tailOffset >= tailBytes) {
+    return REPLAY_SEGMENT_END;
+  }
+
+  SpoolRecordHeader header;
+  reader.seek(tailOffset);
+  int got = reader.read((uint8_t*)&header, sizeof(header));
+  if (got == 0 && tailSeg == headSeg) {
+    // Caught up with the writer; reopen next time to see newly flushed data
+    reader.close();
+    return REPLAY_BLOCKED;
+  }
+  if (got != sizeof(header) || header.magic != SPOOL_RECORD_MAGIC ||
+      header.topic_len == 0 || header.topic_len > SPOOL_MAX_TOPIC ||
+      header.payload_len > SPOOL_MAX_PAYLOAD) {
+    stats.corrupt_records++;
+    return REPLAY_CORRUPT;
+  }
+
+  if (reader.read((uint8_t*)topicBuffer, header.topic_len) != header.topic_len ||
+      reader.read(payloadBuffer, header.payload_len) != header.payload_len) {
+    stats.corrupt_records++;
+    return REPLAY_CORRUPT;
+  }
+  topicBuffer[header.topic_len] = '\0';
+
+  uint16_t crc = crc16(crc16(0xFFFF, (const uint8_t*)topicBuffer, header.topic_len),
+                       payloadBuffer, header.payload_len);
+  if (crc != header.crc) {
+    stats.corrupt_records++;
+    return REPLAY_CORRUPT;
+  }
+
+  if (!publish(topicBuffer, payloadBuffer, header.payload_len)) {
+    return REPLAY_BLOCKED;
+  }
+
+  tailOffset += sizeof(header) + header.topic_len + header.payload_len;
+  stats.replayed++;
+  drainRecords++;
+  if (++recordsSinceCursorSave >= SPOOL_CURSOR_SAVE_RECORDS) {
+    saveCursor();
+  }
+  return REPLAY_SENT;
+}
+
+static void finishDrain() {
+  if (!draining) return;
+  draining = false;
+
+  unsigned long elapsed = millis() - drainStartTime;
+  stats.last_replay_rate = elapsed > 0 ? (drainRecords * 1000UL) / elapsed : drainRecords;
+  Serial.printf("[SPOOL] Replay complete: %lu records in %lu ms (%lu msg/s)\n",
+                (unsigned long)drainRecords, elapsed, (unsigned long)stats.last_replay_rate);
+
+  // Release the drained head segment so the next outage starts clean
+  if (haveSegments) dropTailSegment();
+}
+
+void spoolService(bool online, SpoolPublishFn publish) {
+  if (!spoolReady) return;
+
+  unsigned long now = millis();
+
+  if (writerDirty && now - lastFlushTime >= SPOOL_FLUSH_INTERVAL_MS) {
+    writer.flush();
+    writerDirty = false;
+    lastFlushTime = now;
+  }
+
+  if (!online) {
+    draining = false;
+    return;
+  }
+
+  if (spoolIsEmpty()) {
+    finishDrain();
+    return;
+  }
+
+  if (now - lastReplayTime < SPOOL_REPLAY_INTERVAL_MS) return;
+  lastReplayTime = now;
+
+  if (!draining) {
+    draining = true;
+    drainStartTime = now;
+    drainRecords = 0;
+  }
+
+  unsigned long burstStart = micros();
+  int sent = 0;
+  while (sent < SPOOL_REPLAY_BURST && !spoolIsEmpty()) {
+    ReplayResult result = replayOne(publish);
+    if (result == REPLAY_BLOCKED) break;
+
+    if (result == REPLAY_CORRUPT) {
+      Serial.printf("[SPOOL] Skipping unreadable remainder of segment %lu\n", (unsigned long)tailSeg);
+      if (tailSeg == headSeg && writer) {
+        // Roll the writer off a damaged head segment before dropping it
+        writer.close();
+        writerDirty = false;
+        headBytes = 0;
+        headSeg++;
+      }
+      dropTailSegment();
+    } else if (result == REPLAY_SEGMENT_END) {
+      dropTailSegment();
+    } else {
+      sent++;
+    }
+
+    if (micros() - burstStart > SPOOL_REPLAY_BUDGET_US) break;
+  }
+}
+
+SpoolStats spoolGetStats() {
+  stats.segments = 0;
+  stats.pending_bytes = 0;
+  if (haveSegments) {
+    stats.segments = headSeg - tailSeg + 1;
+    for (uint32_t seg = tailSeg; seg <= headSeg; seg++) {
+      stats.pending_bytes += (seg == headSeg) ? headBytes : segmentSize(seg);
+    }
+    stats.pending_bytes -= min(stats.pending_bytes, tailOffset);
+  }
+  return stats;
+}
+
+void spoolPrintStatus() {
+  SpoolStats s = spoolGetStats();
+  Serial.println("\n=== Offline Spool ===");
+  Serial.printf("  Ready: %s\n", spoolReady ? "yes" : "no");
+  Serial.printf("  Segments: %lu, pending bytes: %lu\n", (unsigned long)s.segments, (unsigned long)s.pending_bytes);
+  Serial.printf("  Appended: %lu, replayed: %lu\n", (unsigned long)s.appended, (unsigned long)s.replayed);
+  Serial.printf("  Evicted segments: %lu, corrupt records: %lu\n",
+                (unsigned long)s.evicted_segments, (unsigned long)s.corrupt_records);
+  Serial.printf("  Last replay rate: %lu msg/s\n", (unsigned long)s.last_replay_rate);
+  Serial.println("=====================\n");
+}
@@ -1,8 +1,19 @@
 #include <Arduino.h>
 #include <driver/twai.h>
+#include <LavliProfiler.h>
+#include <LavliBoot.h>
+#include <LavliLog.h>
+#include <LavliCanFilter.h>
+#include <LavliCanIds.h>
+#include <LavliCanHeartbeat.h>
+#include <LavliCanIsoTp.h>
+#include <LavliCanOta.h>
 
-// Device CAN address - This should match CONTROLLER_MOTOR_ADDRESS in master (0x311)
-#define MY_CAN_ADDRESS 0x311
+// CAN node ID - see lib/LavliCAN/LavliCanIds.h
+#define MY_NODE_ID LAVLI_NODE_MOTOR
+
+#define FIRMWARE_VERSION_MAJOR 1
+#define FIRMWARE_VERSION_MINOR 0
 
 #define USE_CAN
 
@@ -10,6 +21,11 @@
 #define CAN_TX_PIN GPIO_NUM_4
 #define CAN_RX_PIN GPIO_NUM_5
 
+// loop() waits this long for a frame instead of sleeping, then handles up
+// to CAN_RX_BATCH frames so firmware updates are not held to one per pass
+#define CAN_RX_WAIT_MS 10
+#define CAN_RX_BATCH   8
+
 #define INVERTER_SERIAL Serial1  // Leonardo: Serial1 = TX1 (pin 1), RX1 (pin 0)
 #define DEBUG_SERIAL Serial      // For debugging over USB
 #define BAUD_RATE 2400
@@ -67,6 +83,23 @@ twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_
 twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
 twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
+// Multicast groups this node belongs to
+const uint8_t my_groups[] = { LAVLI_GROUP_ACTUATORS };
+
+// IDs this node listens to; everything else is rejected by the controller.
+// Stop arrives on the safety class (direct, group or broadcast), RPM/direction
+// on control, status requests on status, DISCOVER as a status broadcast and
+// firmware updates on bulk
+const uint16_t subscribed_ids[] = {
+  canRequestId(CAN_CLASS_SAFETY, MY_NODE_ID),
+  canRequestId(CAN_CLASS_CONTROL, MY_NODE_ID),
+  canRequestId(CAN_CLASS_STATUS, MY_NODE_ID),
+  canRequestId(CAN_CLASS_BULK, MY_NODE_ID),
+  canRequestId(CAN_CLASS_SAFETY, LAVLI_GROUP_ACTUATORS),
+  canRequestId(CAN_CLASS_SAFETY, LAVLI_NODE_BROADCAST),
+  canRequestId(CAN_CLASS_STATUS, LAVLI_NODE_BROADCAST),
+};
+
 // Inverter Communication Buffers
 byte txBuffer[10];
 byte rxBuffer[10];
@@ -79,8 +112,10 @@ const uint16_t aCrcTab[] = {
 
 // Function prototypes
 bool initializeCAN();
-void receiveCANMessages();
+void receiveCANMessages(TickType_t wait);
 void processReceivedMessage(twai_message_t* message);
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length);
+bool motorBusy();
 bool sendResponse(uint8_t command, uint16_t data1, uint16_t data2, uint8_t status);
 void setMotorRPM(uint16_t rpm);
 void setMotorDirection(bool clockwise);
@@ -92,115 +127,156 @@ uint16_t calcCRC16(byte* buffer, uint16_t length);
 void sendInverterCommand(byte cmd, uint16_t rpm = 0, byte acc = 0);
 bool readInverterResponse();
 void handleDeceleration();
+void checkSerialCommands();
 
+// No fixed delays: the inverter link and the bus are up within a few
+// milliseconds of setup() starting. Prints go through the async log so a
+// slow or absent USB host cannot hold up the boot.
 void setup() {
+  bootPhase("start");
   DEBUG_SERIAL.begin(115200);
-  DEBUG_SERIAL.printf("Integrated CAN Motor Controller - Address: 0x%03X\n", MY_CAN_ADDRESS);
-
-  delay(2000);
+  logBegin(DEBUG_SERIAL);
+  LOG_INFO("Integrated CAN Motor Controller - Node: 0x%02X", MY_NODE_ID);
 
-  // Initialize inverter serial communication (direct to inverter)
+  // Initialize inverter serial communication (direct to inverter). The
+  // loop starts sending it stop (0 RPM) commands right away, so there is
+  // nothing to wait for here.
   // inverterSerial.begin(2400, SERIAL_8N1, INVERTER_RX_PIN, INVERTER_TX_PIN); // 2400 baud for inverter
   // INVERTER_SERIAL.begin(BAUD_RATE); // Using default UART1 pins
   INVERTER_SERIAL.begin(BAUD_RATE, SERIAL_8N1, 44, 43);
-  DEBUG_SERIAL.println("Inverter UART initialized at 2400 baud");
+  LOG_INFO("Inverter UART initialized at %d baud", BAUD_RATE);
+  bootPhase("inverter");
 
 #ifdef USE_CAN
-  // Initialize CAN
   if (initializeCAN()) {
-    DEBUG_SERIAL.println("CAN initialized successfully");
-    DEBUG_SERIAL.println("Ready to receive motor commands...");
+    heartbeatBegin(MY_NODE_ID, LAVLI_TYPE_MOTOR, FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR,
+                   LAVLI_CAP_MOTOR | LAVLI_CAP_OTA, 1);
+    bootPhase("can");
+    bootCanReady();
+    // Updates are refused, and a finished one waits, while the motor turns
+    isoTpBeginNode(MY_NODE_ID, onBulkMessage);
+    otaBegin(motorBusy);
+    // Up on the bus: keep this firmware if it was just updated
+    otaConfirmBoot();
+    bootPhase("ota");
+    heartbeatBootReport(bootResetReason(), bootCanReadyMs(), bootSetupMs());
+    LOG_INFO("Ready: CAN at %d ms, setup done at %d ms", bootCanReadyMs(), bootSetupMs());
   } else {
-    DEBUG_SERIAL.println("CAN initialization failed");
+    LOG_ERROR("CAN initialization failed");
   }
 #endif
-
-  delay(1000);
 }
 
 void loop() {
 #ifdef USE_CAN
-  // Listen for CAN messages
-  receiveCANMessages();
+  // Wait for a CAN message instead of sleeping between passes, unless a
+  // bulk transfer has frames ready to go
+  receiveCANMessages(isoTpTxReady() ? 0 : pdMS_TO_TICKS(CAN_RX_WAIT_MS));
 #endif
 
-  // Handle deceleration if active
-  handleDeceleration();
-  
-  // Send periodic commands to maintain inverter state
-  unsigned long now = millis();
-  if (now - lastSendTime > sendInterval) {
-    lastSendTime = now;
-    sendInverterCommand(currentDirection, currentRPM);
+  {
+    PROFILE_SCOPE("loop");
+
+    // Handle deceleration if active
+    handleDeceleration();
+    
+    // Send periodic commands to maintain inverter state
+    unsigned long now = millis();
+    if (now - lastSendTime > sendInterval) {
+      lastSendTime = now;
+      sendInverterCommand(currentDirection, currentRPM);
+    }
+    
+    // Read responses from inverter
+    readInverterResponse();
+
+#ifdef USE_CAN
+    // Presence heartbeat to the master, carrying the inverter fault code
+    heartbeatService();
+
+    // Bulk transfers and firmware updates
+    isoTpService();
+    otaService();
+#endif
+
+    // "profile" / "profile_reset" / "ota" / "boot" over USB serial
+    checkSerialCommands();
   }
-  
-  // Read responses from inverter
-  readInverterResponse();
-  
+
+#ifndef USE_CAN
   delay(10);
+#endif
 }
 
 bool initializeCAN() {
+  f_config = canFilterForIds(subscribed_ids, sizeof(subscribed_ids) / sizeof(subscribed_ids[0]));
+
   // Install TWAI driver
   if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK) {
-    DEBUG_SERIAL.println("Failed to install TWAI driver");
+    LOG_ERROR("[CAN] Failed to install TWAI driver");
     return false;
   }
   
   // Start TWAI driver
   if (twai_start() != ESP_OK) {
-    DEBUG_SERIAL.println("Failed to start TWAI driver");
+    LOG_ERROR("[CAN] Failed to start TWAI driver");
     return false;
   }
   
-  DEBUG_SERIAL.println("TWAI driver installed and started");
+  LOG_INFO("[CAN] TWAI driver installed and started");
   return true;
 }
 
-void receiveCANMessages() {
+void receiveCANMessages(TickType_t wait) {
   twai_message_t message;
   
-  // Check for incoming messages (non-blocking)
-  if (twai_receive(&message, 0) == ESP_OK) {
-    // Only process messages addressed to this device
-    if (message.identifier == MY_CAN_ADDRESS) {
-      DEBUG_SERIAL.printf("Received message for my address (0x%03X): ", message.identifier);
-      
-      for (int i = 0; i < message.data_length_code; i++) {
-        DEBUG_SERIAL.printf("0x%02X ", message.data[i]);
-      }
-      DEBUG_SERIAL.println();
+  // Block for the first frame only, then take whatever else is queued
+  for (int i = 0; i < CAN_RX_BATCH && twai_receive(&message, i == 0 ? wait : 0) == ESP_OK; i++) {
+    // The acceptance filter already drops other nodes' traffic; keep the
+    // check in case the filter has to accept a superset of our IDs
+    if (canIdIsRequestForAny(message.identifier, MY_NODE_ID, my_groups, sizeof(my_groups))) {
+      LOG_CAN_RX(message);
       
       // Process the received message
       processReceivedMessage(&message);
     }
-    // Optionally log messages for other devices (for debugging)
-    else {
-      DEBUG_SERIAL.printf("Message for other device (0x%03X) - ignoring\n", message.identifier);
-    }
   }
 }
 
 void processReceivedMessage(twai_message_t* message) {
+  PROFILE_SCOPE("can_handle");
+  if (isoTpHandleFrame(message->identifier, message->data, message->data_length_code)) return;
   if (message->data_length_code < 1) {
-    DEBUG_SERIAL.println("ERROR: Message too short");
+    LOG_ERROR("Message too short");
     sendResponse(ERROR_RESPONSE, 0, 0, 0x01); // Error: Invalid message length
     return;
   }
   
   uint8_t command = message->data[0];
   
-  DEBUG_SERIAL.printf("Processing motor command 0x%02X\n", command);
+  LOG_DEBUG("Processing motor command 0x%02X", command);
+
+  // Group/broadcast frames: only the stop applies, and errors are never
+  // sent back to a group address
+  if (canIdNode(message->identifier) != MY_NODE_ID) {
+    if (command == LAVLI_CMD_STOP_ALL) {
+      stopMotor();
+      sendResponse(ACK_MOTOR_STOP, 0, 0, 0x00);
+    } else if (command == LAVLI_CMD_DISCOVER) {
+      heartbeatAnnounce();
+    }
+    return;
+  }
   
   switch (command) {
     case MOTOR_SET_RPM_CMD:
       if (message->data_length_code >= 3) {
         uint16_t rpm = (message->data[1] << 8) | message->data[2];
-        DEBUG_SERIAL.printf("Setting motor RPM to: %d\n", rpm);
+        LOG_DEBUG("Setting motor RPM to: %d", rpm);
         setMotorRPM(rpm);
         sendResponse(ACK_MOTOR_RPM, rpm, 0, 0x00); // Success
       } else {
-        DEBUG_SERIAL.println("ERROR: RPM command too short");
+        LOG_ERROR("RPM command too short");
         sendResponse(ERROR_RESPONSE, 0, 0, 0x02); // Error: Invalid parameters
       }
       break;
@@ -208,28 +284,28 @@ void processReceivedMessage(twai_message_t* message) {
     case MOTOR_SET_DIRECTION_CMD:
       if (message->data_length_code >= 2) {
         bool clockwise = message->data[1] != 0;
-        DEBUG_SERIAL.printf("Setting motor direction to: %s\n", clockwise ? "CW" : "CCW");
+        LOG_DEBUG("Setting motor direction to: %s", clockwise ? "CW" : "CCW");
         setMotorDirection(clockwise);
         sendResponse(ACK_MOTOR_DIRECTION, clockwise ? 1 : 0, 0, 0x00); // Success
       } else {
-        DEBUG_SERIAL.println("ERROR: Direction command too short");
+        LOG_ERROR("Direction command too short");
         sendResponse(ERROR_RESPONSE, 0, 0, 0x02); // Error: Invalid parameters
       }
       break;
       
     case MOTOR_STOP_CMD:
-      DEBUG_SERIAL.println("Stopping motor");
+      LOG_DEBUG("Stopping motor");
       stopMotor();
       sendResponse(ACK_MOTOR_STOP, 0, 0, 0x00); // Success
       break;
       
     case MOTOR_STATUS_CMD:
-      DEBUG_SERIAL.println("Motor status requested");
+      LOG_DEBUG("Motor status requested");
       requestMotorStatus();
       break;
       
     default:
-      DEBUG_SERIAL.printf("ERROR: Unknown motor command 0x%02X\n", command);
+      LOG_ERROR("Unknown motor command 0x%02X", command);
       sendResponse(ERROR_RESPONSE, 0, 0, 0x03); // Error: Unknown command
       break;
   }
@@ -239,7 +315,7 @@ bool sendResponse(uint8_t command, uint16_t data1, uint16_t data2, uint8_t statu
   twai_message_t response;
   
   // Configure response message
-  response.identifier = MY_CAN_ADDRESS; // Response from this device's address
+  response.identifier = canResponseId(CAN_CLASS_STATUS, MY_NODE_ID);
   response.extd = 0;           // Standard frame (11-bit ID)
   response.rtr = 0;            // Data frame, not remote request
   response.data_length_code = 6; // 6 bytes of data
@@ -254,11 +330,12 @@ bool sendResponse(uint8_t command, uint16_t data1, uint16_t data2, uint8_t statu
   
   // Send response
   if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-    DEBUG_SERIAL.printf("Response sent: Command=0x%02X, Data1=%d, Data2=%d, Status=0x%02X\n", 
-                  command, data1, data2, status);
+    LOG_CAN_TX(response);
+    LOG_DEBUG("Response sent: Command=0x%02X, Data1=%d, Data2=%d, Status=0x%02X",
+              command, data1, data2, status);
     return true;
   } else {
-    DEBUG_SERIAL.printf("Failed to send response\n");
+    LOG_ERROR("Failed to send response");
     return false;
   }
 }
@@ -277,14 +354,14 @@ void setMotorRPM(uint16_t rpm) {
     isDecelerating = true;
     lastDecelTime = millis(); // Start deceleration immediately
     
-    DEBUG_SERIAL.printf("Starting deceleration from %d to %d\n", currentRPM, targetRPM);
+    LOG_DEBUG("Starting deceleration from %d to %d", currentRPM, targetRPM);
   } else {
     // For acceleration or same speed, set immediately
     currentRPM = rpm;
     targetRPM = rpm;
     isDecelerating = false;
     
-    DEBUG_SERIAL.printf("Setting RPM directly to: %d\n", currentRPM);
+    LOG_DEBUG("Setting RPM directly to: %d", currentRPM);
     
     // Send command with current direction and new RPM
     sendInverterCommand(currentDirection, currentRPM);
@@ -294,7 +371,7 @@ void setMotorRPM(uint16_t rpm) {
 void setMotorDirection(bool clockwise) {
   currentDirection = clockwise ? CMD_CW : CMD_CCW;
   
-  DEBUG_SERIAL.printf("Setting direction to: %s\n", clockwise ? "CW" : "CCW");
+  LOG_DEBUG("Setting direction to: %s", clockwise ? "CW" : "CCW");
   
   // Send direction command with current RPM to inverter
   sendInverterCommand(currentDirection, currentRPM);
@@ -307,7 +384,7 @@ void stopMotor() {
   motorRunning = false;
   isDecelerating = false;
   
-  DEBUG_SERIAL.println("Stopping motor (RPM = 0)");
+  LOG_DEBUG("Stopping motor (RPM = 0)");
   
   // Send stop command (set RPM to 0) to inverter
   sendInverterCommand(currentDirection, 0);
@@ -320,9 +397,8 @@ void requestMotorStatus() {
   uint16_t statusData2 = (currentDirection == CMD_CW ? 0x8000 : 0x0000) | (currentRPM & 0x7FFF);
   sendResponse(MOTOR_STATUS_DATA, statusData1, statusData2, faultCode);
   
-  DEBUG_SERIAL.printf("Status sent - Actual RPM: %d, Set RPM: %d, Dir: %s, Fault: 0x%02X\n",
-                actualRPM, currentRPM, 
-                (currentDirection == CMD_CW) ? "CW" : "CCW", faultCode);
+  LOG_DEBUG("Status sent - Actual RPM: %d, Set RPM: %d, Dir: %s, Fault: 0x%02X",
+            actualRPM, currentRPM, (currentDirection == CMD_CW) ? "CW" : "CCW", faultCode);
 }
 
 void handleDeceleration() {
@@ -335,12 +411,12 @@ void handleDeceleration() {
     // Decrease RPM by step size
     if (currentRPM > targetRPM + DECEL_STEP_SIZE) {
       currentRPM -= DECEL_STEP_SIZE;
-      DEBUG_SERIAL.printf("Decelerating to: %d\n", currentRPM);
+      LOG_DEBUG("Decelerating to: %d", currentRPM);
     } else {
       // We've reached or are very close to target
       currentRPM = targetRPM;
       isDecelerating = false;
-      DEBUG_SERIAL.printf("Reached target RPM: %d\n", currentRPM);
+      LOG_DEBUG("Reached target RPM: %d", currentRPM);
     }
     
     // Send updated RPM command to inverter
@@ -362,6 +438,7 @@ uint16_t calcCRC16(byte* buffer, uint16_t length) {
 }
 
 void sendInverterCommand(byte cmd, uint16_t rpm, byte acc) {
+  PROFILE_SCOPE("inverter_tx");
   memset(txBuffer, 0, sizeof(txBuffer));
 
   txBuffer[0] = cmd;
@@ -382,40 +459,70 @@ void sendInverterCommand(byte cmd, uint16_t rpm, byte acc) {
 
   INVERTER_SERIAL.write(txBuffer, 10);
 
-  DEBUG_SERIAL.printf(">> Sent CMD 0x%02X RPM: %d\n", cmd, rpm);
+  LOG_DEBUG(">> Sent CMD 0x%02X RPM: %d", cmd, rpm);
 }
 
 bool readInverterResponse() {
+  PROFILE_SCOPE("inverter_rx");
   if (INVERTER_SERIAL.available() >= 10) {
     INVERTER_SERIAL.readBytes(rxBuffer, 10);
     
-    DEBUG_SERIAL.print("<< Inverter Response: ");
-    for (int i = 0; i < 10; i++) {
-      DEBUG_SERIAL.printf("0x%02X ", rxBuffer[i]);
-    }
-    DEBUG_SERIAL.println();
+    LOG_HEX("<< Inverter Response", rxBuffer, 10);
 
     uint16_t crcCalc = calcCRC16(rxBuffer, 8);
     uint16_t crcRecv = (rxBuffer[8] << 8) | rxBuffer[9];
 
     if (crcCalc != crcRecv) {
-      DEBUG_SERIAL.println("!! CRC mismatch");
+      LOG_ERROR("Inverter response CRC mismatch");
       return false;
     }
 
     // Extract actual RPM and fault code from response
     actualRPM = (rxBuffer[2] << 8) | rxBuffer[3];
     faultCode = rxBuffer[5];
+    heartbeatSetStatus(faultCode);
 
     if (rxBuffer[0] == 0x06) {
-      DEBUG_SERIAL.println("ACK received from inverter");
+      LOG_DEBUG("ACK received from inverter");
     } else if (rxBuffer[0] == 0x15) {
-      DEBUG_SERIAL.println("NCK received from inverter");
+      LOG_DEBUG("NCK received from inverter");
     }
 
-    DEBUG_SERIAL.printf("Actual RPM: %d, Fault Code: 0x%02X\n", actualRPM, faultCode);
+    LOG_DEBUG("Actual RPM: %d, Fault Code: 0x%02X", actualRPM, faultCode);
     
     return true;
   }
   return false;
-}
\ No newline at end of file
+}
+
+void checkSerialCommands() {
+  if (!DEBUG_SERIAL.available()) return;
+
+  String command = DEBUG_SERIAL.readStringUntil('\n');
+  command.trim();
+
+  if (command == "profile") {
+    profilerPrint(DEBUG_SERIAL);
+  } else if (command == "profile_reset") {
+    profilerReset();
+    DEBUG_SERIAL.println("Profile statistics reset");
+#ifdef USE_CAN
+  } else if (command == "ota") {
+    otaPrint(DEBUG_SERIAL);
+  } else if (command == "boot") {
+    bootPrint(DEBUG_SERIAL);
+    canFilterPrint(DEBUG_SERIAL, f_config);
+#endif
+  }
+}
+
+// Reassembled bulk payloads from the master
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length) {
+  if (otaHandleMessage(data, length)) return;
+  LOG_WARN("Unhandled bulk message 0x%02X (%d bytes)", data[0], length);
+}
+
+// A firmware update stalls the loop during flash writes and ends in a restart
+bool motorBusy() {
+  return motorRunning || currentRPM != 0 || isDecelerating;
+}
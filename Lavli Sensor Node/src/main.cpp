@@ -1,12 +1,25 @@
 #include <Arduino.h>
 #include <driver/twai.h>
+#include <LavliProfiler.h>
+#include <LavliBoot.h>
+#include <LavliLog.h>
+#include <LavliCanFilter.h>
+#include <LavliCanIds.h>
+#include <LavliCanHeartbeat.h>
+#include <LavliCanTime.h>
+#include <LavliCanIsoTp.h>
+#include <LavliCanOta.h>
+#include <esp_timer.h>
 
 // CAN pins - using valid ESP32-S3 GPIO pins
 #define CAN_TX_PIN GPIO_NUM_4
 #define CAN_RX_PIN GPIO_NUM_5
 
-// Device CAN address - Change this for each sensor device on your network
-#define MY_CAN_ADDRESS 0x124
+// CAN node ID - see lib/LavliCAN/LavliCanIds.h
+#define MY_NODE_ID LAVLI_NODE_SENSOR
+
+#define FIRMWARE_VERSION_MAJOR 1
+#define FIRMWARE_VERSION_MINOR 0
 
 // Analog pin definitions - Map analog pin numbers to GPIO pins
 #define ANALOG_PIN_0 GPIO_NUM_1   // A0
@@ -41,24 +54,34 @@
 // Response command definitions
 #define ANALOG_DATA         0x20
 #define DIGITAL_DATA        0x21
-#define ALL_ANALOG_DATA     0x22
+#define ALL_ANALOG_DATA     0x22  // Bulk: [0x22, stamp x 4, (pin, high, low) x 8]
 #define ALL_DIGITAL_DATA    0x23
 #define ERROR_RESPONSE      0xFF
 
+// How long loop() waits for a frame; replaces a fixed sleep so frames, and
+// time sync stamps, are taken as soon as they arrive. Up to CAN_RX_BATCH
+// queued frames are handled per pass.
+#define CAN_RX_WAIT_MS      10
+#define CAN_RX_BATCH        8
+
 // Function prototypes
 bool initializeCAN();
 void initializePins();
 uint16_t readAnalogPin(int pin_number);
 bool readDigitalPin(int pin_number);
-void receiveCANMessages();
+void receiveCANMessages(TickType_t wait);
 void processReceivedMessage(twai_message_t* message);
-bool sendAnalogData(uint8_t pin, uint16_t value);
-bool sendDigitalData(uint8_t pin, bool value);
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length);
+void putStamp(uint8_t* data, uint32_t stamp);
+bool sendAnalogData(uint8_t pin, uint16_t value, uint32_t stamp);
+bool sendDigitalData(uint8_t pin, bool value, uint32_t stamp);
 bool sendAllAnalogData();
 bool sendAllDigitalData();
 bool sendErrorResponse(uint8_t pin, uint8_t error_code);
 int getAnalogGPIOForPin(int pin_number);
 int getDigitalGPIOForPin(int pin_number);
+void checkSerialCommands();
+void printPinReadings();
 
 // Pin mapping arrays
 const int analog_pins[MAX_ANALOG_PINS] = {
@@ -76,30 +99,55 @@ twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_
 twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
 twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
+// Multicast groups this node belongs to
+const uint8_t my_groups[] = { LAVLI_GROUP_SENSORS };
+
+// IDs this node listens to; everything else is rejected by the controller.
+// Reads on telemetry; group snapshots on telemetry, bus-wide time sync on
+// the time class, DISCOVER on status, bulk transfers and firmware updates
+const uint16_t subscribed_ids[] = {
+  canRequestId(CAN_CLASS_TELEMETRY, MY_NODE_ID),
+  canRequestId(CAN_CLASS_BULK, MY_NODE_ID),
+  canRequestId(CAN_CLASS_TELEMETRY, LAVLI_GROUP_SENSORS),
+  canRequestId(CAN_CLASS_TIME, LAVLI_NODE_BROADCAST),
+  canRequestId(CAN_CLASS_STATUS, LAVLI_NODE_BROADCAST),
+};
+
+// Local esp_timer time at which the frame being handled was received
+int64_t last_rx_us = 0;
+
+// No fixed delays and no pin dump at boot; "pins" prints the readings on
+// demand. Prints go through the async log so a slow or absent USB host
+// cannot hold up the boot.
 void setup() {
+  bootPhase("start");
   Serial.begin(115200);
-  Serial.printf("CAN Sensor Device - Address: 0x%03X\n", MY_CAN_ADDRESS);
+  logBegin(Serial);
+  LOG_INFO("CAN Sensor Device - Node: 0x%02X", MY_NODE_ID);
   
-  delay(2000);
-  
-  // Initialize pins
   initializePins();
+  bootPhase("pins");
   
-  // Initialize CAN
   if (initializeCAN()) {
-    Serial.println("CAN initialized successfully");
-    Serial.println("Ready to respond to sensor requests...");
-    Serial.println("\nSupported commands:");
-    Serial.println("  0x03 - Read single analog pin");
-    Serial.println("  0x04 - Read single digital pin");  
-    Serial.println("  0x05 - Read all analog pins");
-    Serial.println("  0x06 - Read all digital pins");
+    heartbeatBegin(MY_NODE_ID, LAVLI_TYPE_SENSOR, FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR,
+                   LAVLI_CAP_ANALOG | LAVLI_CAP_DIGITAL | LAVLI_CAP_TIME_SYNC | LAVLI_CAP_OTA,
+                   MAX_ANALOG_PINS);
+    bootPhase("can");
+    bootCanReady();
+    isoTpBeginNode(MY_NODE_ID, onBulkMessage);
+    otaBegin(NULL);
+    // Up on the bus: keep this firmware if it was just updated
+    otaConfirmBoot();
+    bootPhase("ota");
+    heartbeatBootReport(bootResetReason(), bootCanReadyMs(), bootSetupMs());
+    LOG_INFO("Ready: CAN at %d ms, setup done at %d ms", bootCanReadyMs(), bootSetupMs());
   } else {
-    Serial.println("CAN initialization failed");
+    LOG_ERROR("CAN initialization failed");
   }
-  
-  // Test readings on startup
-  Serial.println("\nInitial sensor readings:");
+}
+
+void printPinReadings() {
+  Serial.println("\nSensor readings:");
   for (int i = 0; i < MAX_ANALOG_PINS; i++) {
     uint16_t value = readAnalogPin(i);
     Serial.printf("Analog pin %d: %d (%.2fV)\n", i, value, value * 3.3 / 4095.0);
@@ -114,50 +162,55 @@ void setup() {
 }
 
 void loop() {
-  // Continuously listen for CAN messages
-  receiveCANMessages();
-  delay(10); // Small delay to prevent overwhelming the CPU
+  // Wait for a CAN message instead of sleeping between passes, unless a
+  // bulk transfer has frames ready to go
+  receiveCANMessages(isoTpTxReady() ? 0 : pdMS_TO_TICKS(CAN_RX_WAIT_MS));
+
+  {
+    PROFILE_SCOPE("loop");
+
+    // "profile" / "profile_reset" / "time" / "isotp" / "ota" / "boot" / "pins" over USB serial
+    checkSerialCommands();
+
+    // Presence heartbeat to the master
+    heartbeatService();
+
+    // Bulk transfers and firmware updates
+    isoTpService();
+    otaService();
+  }
 }
 
 bool initializeCAN() {
+  f_config = canFilterForIds(subscribed_ids, sizeof(subscribed_ids) / sizeof(subscribed_ids[0]));
+
   // Install TWAI driver
   if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK) {
-    Serial.println("Failed to install TWAI driver");
+    LOG_ERROR("[CAN] Failed to install TWAI driver");
     return false;
   }
   
   // Start TWAI driver
   if (twai_start() != ESP_OK) {
-    Serial.println("Failed to start TWAI driver");
+    LOG_ERROR("[CAN] Failed to start TWAI driver");
     return false;
   }
   
-  Serial.println("TWAI driver installed and started");
+  LOG_INFO("[CAN] TWAI driver installed and started");
   return true;
 }
 
 void initializePins() {
-  Serial.println("Initializing sensor pins...");
-  
-  // Initialize analog pins (ESP32 analog pins don't need explicit pinMode)
-  for (int pin = 0; pin < MAX_ANALOG_PINS; pin++) {
-    int gpio_pin = getAnalogGPIOForPin(pin);
-    if (gpio_pin != -1) {
-      // Analog pins are ready by default
-      Serial.printf("Analog pin %d -> GPIO %d ready\n", pin, gpio_pin);
-    }
-  }
+  // Analog pins need no setup (ESP32 analog pins don't need explicit pinMode)
   
   // Initialize digital input pins
   for (int pin = 0; pin < MAX_DIGITAL_PINS; pin++) {
     int gpio_pin = getDigitalGPIOForPin(pin);
     if (gpio_pin != -1) {
       pinMode(gpio_pin, INPUT_PULLUP); // Use pull-up resistors
-      Serial.printf("Digital pin %d -> GPIO %d initialized as INPUT_PULLUP\n", pin, gpio_pin);
+      LOG_DEBUG("Digital pin %d -> GPIO %d initialized as INPUT_PULLUP", pin, gpio_pin);
     }
   }
-  
-  Serial.println("Pin initialization complete");
 }
 
 int getAnalogGPIOForPin(int pin_number) {
@@ -175,10 +228,11 @@ int getDigitalGPIOForPin(int pin_number) {
 }
 
 uint16_t readAnalogPin(int pin_number) {
+  PROFILE_SCOPE("adc_read");
   int gpio_pin = getAnalogGPIOForPin(pin_number);
   
   if (gpio_pin == -1) {
-    Serial.printf("ERROR: Invalid analog pin number %d\n", pin_number);
+    LOG_ERROR("Invalid analog pin number %d", pin_number);
     return 0;
   }
   
@@ -190,57 +244,67 @@ bool readDigitalPin(int pin_number) {
   int gpio_pin = getDigitalGPIOForPin(pin_number);
   
   if (gpio_pin == -1) {
-    Serial.printf("ERROR: Invalid digital pin number %d\n", pin_number);
+    LOG_ERROR("Invalid digital pin number %d", pin_number);
     return false;
   }
   
   return digitalRead(gpio_pin) == HIGH;
 }
 
-void receiveCANMessages() {
+void receiveCANMessages(TickType_t wait) {
   twai_message_t message;
   
-  // Check for incoming messages (non-blocking)
-  if (twai_receive(&message, 0) == ESP_OK) {
-    // Only process messages addressed to this device
-    if (message.identifier == MY_CAN_ADDRESS) {
-      Serial.printf("Received message for my address (0x%03X): ", message.identifier);
-      
-      for (int i = 0; i < message.data_length_code; i++) {
-        Serial.printf("0x%02X ", message.data[i]);
-      }
-      Serial.println();
+  // Block for the first frame only, then take whatever else is queued
+  for (int i = 0; i < CAN_RX_BATCH && twai_receive(&message, i == 0 ? wait : 0) == ESP_OK; i++) {
+    // Stamp first: this is the receive time used for time sync
+    last_rx_us = esp_timer_get_time();
+
+    // The acceptance filter already drops other nodes' traffic; keep the
+    // check in case the filter has to accept a superset of our IDs
+    if (canIdIsRequestForAny(message.identifier, MY_NODE_ID, my_groups, sizeof(my_groups))) {
+      LOG_CAN_RX(message);
       
       // Process the received message
       processReceivedMessage(&message);
     }
-    // Optionally log messages for other devices (for debugging)
-    else {
-      Serial.printf("Message for other device (0x%03X) - ignoring\n", message.identifier);
-    }
   }
 }
 
 void processReceivedMessage(twai_message_t* message) {
+  PROFILE_SCOPE("can_handle");
   if (message->data_length_code < 1) {
-    Serial.println("ERROR: Message too short");
+    LOG_ERROR("Message too short");
     sendErrorResponse(0, 0x01); // Error: Invalid message length
     return;
   }
   
+  if (isoTpHandleFrame(message->identifier, message->data, message->data_length_code)) return;
+  if (timeSyncHandleFrame(message->data, message->data_length_code, last_rx_us)) return;
+
   uint8_t command = message->data[0];
+  bool direct = canIdNode(message->identifier) == MY_NODE_ID;
   
-  Serial.printf("Processing command 0x%02X\n", command);
+  LOG_DEBUG("Processing command 0x%02X", command);
   
   switch (command) {
+    case LAVLI_CMD_DISCOVER:
+      heartbeatAnnounce();
+      break;
+
+    case LAVLI_CMD_SNAPSHOT:
+      LOG_DEBUG("Snapshot requested");
+      sendAllAnalogData();
+      sendAllDigitalData();
+      break;
+
     case READ_ANALOG_CMD:
       if (message->data_length_code >= 2) {
         uint8_t pin = message->data[1];
-        Serial.printf("Reading analog pin %d\n", pin);
+        LOG_DEBUG("Reading analog pin %d", pin);
         
         if (pin < MAX_ANALOG_PINS) {
           uint16_t value = readAnalogPin(pin);
-          sendAnalogData(pin, value);
+          sendAnalogData(pin, value, timeSyncSampleStamp());
         } else {
           sendErrorResponse(pin, 0x04); // Error: Invalid pin number
         }
@@ -252,11 +316,11 @@ void processReceivedMessage(twai_message_t* message) {
     case READ_DIGITAL_CMD:
       if (message->data_length_code >= 2) {
         uint8_t pin = message->data[1];
-        Serial.printf("Reading digital pin %d\n", pin);
+        LOG_DEBUG("Reading digital pin %d", pin);
         
         if (pin < MAX_DIGITAL_PINS) {
           bool value = readDigitalPin(pin);
-          sendDigitalData(pin, value);
+          sendDigitalData(pin, value, timeSyncSampleStamp());
         } else {
           sendErrorResponse(pin, 0x04); // Error: Invalid pin number
         }
@@ -266,115 +330,118 @@ void processReceivedMessage(twai_message_t* message) {
       break;
       
     case READ_ALL_ANALOG_CMD:
-      Serial.println("Reading all analog pins");
+      LOG_DEBUG("Reading all analog pins");
       sendAllAnalogData();
       break;
       
     case READ_ALL_DIGITAL_CMD:
-      Serial.println("Reading all digital pins");
+      LOG_DEBUG("Reading all digital pins");
       sendAllDigitalData();
       break;
       
     default:
-      Serial.printf("ERROR: Unknown command 0x%02X\n", command);
-      sendErrorResponse(0, 0x03); // Error: Unknown command
+      LOG_ERROR("Unknown command 0x%02X", command);
+      // Never answer a group address with an error
+      if (direct) sendErrorResponse(0, 0x03); // Error: Unknown command
       break;
   }
 }
 
-bool sendAnalogData(uint8_t pin, uint16_t value) {
+// Sample stamps are the low 32 bits of master time in us, big endian;
+// 0 until time sync has locked (see LavliCanTime.h)
+void putStamp(uint8_t* data, uint32_t stamp) {
+  data[0] = (stamp >> 24) & 0xFF;
+  data[1] = (stamp >> 16) & 0xFF;
+  data[2] = (stamp >> 8) & 0xFF;
+  data[3] = stamp & 0xFF;
+}
+
+bool sendAnalogData(uint8_t pin, uint16_t value, uint32_t stamp) {
   twai_message_t response;
   
-  response.identifier = MY_CAN_ADDRESS;
+  response.identifier = canResponseId(CAN_CLASS_TELEMETRY, MY_NODE_ID);
   response.extd = 0;
   response.rtr = 0;
-  response.data_length_code = 4;
+  response.data_length_code = 8;
   
   response.data[0] = ANALOG_DATA;
   response.data[1] = pin;
   response.data[2] = (value >> 8) & 0xFF; // High byte
   response.data[3] = value & 0xFF;        // Low byte
+  putStamp(&response.data[4], stamp);     // Acquisition time
   
   if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-    Serial.printf("Sent analog data: Pin=%d, Value=%d\n", pin, value);
+    LOG_DEBUG("Sent analog data: Pin=%d, Value=%d", pin, value);
     return true;
   } else {
-    Serial.println("Failed to send analog data");
+    LOG_ERROR("Failed to send analog data");
     return false;
   }
 }
 
-bool sendDigitalData(uint8_t pin, bool value) {
+bool sendDigitalData(uint8_t pin, bool value, uint32_t stamp) {
   twai_message_t response;
   
-  response.identifier = MY_CAN_ADDRESS;
+  response.identifier = canResponseId(CAN_CLASS_TELEMETRY, MY_NODE_ID);
   response.extd = 0;
   response.rtr = 0;
-  response.data_length_code = 3;
+  response.data_length_code = 7;
   
   response.data[0] = DIGITAL_DATA;
   response.data[1] = pin;
   response.data[2] = value ? 1 : 0;
+  putStamp(&response.data[3], stamp);     // Acquisition time
   
   if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-    Serial.printf("Sent digital data: Pin=%d, Value=%s\n", pin, value ? "HIGH" : "LOW");
+    LOG_DEBUG("Sent digital data: Pin=%d, Value=%s", pin, value ? "HIGH" : "LOW");
     return true;
   } else {
-    Serial.println("Failed to send digital data");
+    LOG_ERROR("Failed to send digital data");
     return false;
   }
 }
 
 bool sendAllAnalogData() {
-  // Send analog data in multiple messages if needed
-  // Each message can contain up to 2 analog readings (3 bytes each: pin + 2-byte value)
-  
-  for (int start_pin = 0; start_pin < MAX_ANALOG_PINS; start_pin += 2) {
-    twai_message_t response;
-    response.identifier = MY_CAN_ADDRESS;
-    response.extd = 0;
-    response.rtr = 0;
-    response.data[0] = ALL_ANALOG_DATA;
-    
-    int data_index = 1;
-    int pins_in_message = 0;
-    
-    // Pack up to 2 analog readings per message
-    for (int pin = start_pin; pin < start_pin + 2 && pin < MAX_ANALOG_PINS; pin++) {
-      uint16_t value = readAnalogPin(pin);
-      
-      response.data[data_index++] = pin;                    // Pin number
-      response.data[data_index++] = (value >> 8) & 0xFF;   // High byte
-      response.data[data_index++] = value & 0xFF;          // Low byte
-      pins_in_message++;
-    }
-    
-    response.data_length_code = data_index;
-    
-    if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-      Serial.printf("Sent batch of %d analog readings starting from pin %d\n", pins_in_message, start_pin);
-    } else {
-      Serial.printf("Failed to send analog data batch starting from pin %d\n", start_pin);
-      return false;
-    }
-    
-    delay(5); // Small delay between messages
+  PROFILE_SCOPE("send_all_analog");
+  // One bulk payload: the shared acquisition time, then 3 bytes per pin
+  // (pin + 2-byte value). The transfer layer splits it into frames.
+  uint8_t payload[1 + 4 + MAX_ANALOG_PINS * 3];
+  int data_index = 0;
+
+  payload[data_index++] = ALL_ANALOG_DATA;
+  putStamp(&payload[data_index], timeSyncSampleStamp());
+  data_index += 4;
+
+  // Read every pin up front so the whole set shares one acquisition time
+  for (int pin = 0; pin < MAX_ANALOG_PINS; pin++) {
+    uint16_t value = readAnalogPin(pin);
+
+    payload[data_index++] = pin;                    // Pin number
+    payload[data_index++] = (value >> 8) & 0xFF;   // High byte
+    payload[data_index++] = value & 0xFF;          // Low byte
+  }
+
+  if (isoTpSend(0, payload, data_index)) {
+    LOG_DEBUG("Queued %d analog readings", MAX_ANALOG_PINS);
+    return true;
+  } else {
+    LOG_ERROR("Failed to queue analog data, transfer still running");
+    return false;
   }
-  
-  return true;
 }
 
 bool sendAllDigitalData() {
   twai_message_t response;
   
-  response.identifier = MY_CAN_ADDRESS;
+  response.identifier = canResponseId(CAN_CLASS_TELEMETRY, MY_NODE_ID);
   response.extd = 0;
   response.rtr = 0;
-  response.data_length_code = 2;
+  response.data_length_code = 6;
   
   response.data[0] = ALL_DIGITAL_DATA;
   
   // Pack all digital readings into a single byte (8 bits for 8 pins)
+  uint32_t stamp = timeSyncSampleStamp();
   uint8_t digital_data = 0;
   for (int pin = 0; pin < MAX_DIGITAL_PINS; pin++) {
     if (readDigitalPin(pin)) {
@@ -383,16 +450,13 @@ bool sendAllDigitalData() {
   }
   
   response.data[1] = digital_data;
+  putStamp(&response.data[2], stamp);
   
   if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-    Serial.printf("Sent all digital data: 0b");
-    for (int i = 7; i >= 0; i--) {
-      Serial.printf("%d", (digital_data >> i) & 1);
-    }
-    Serial.println();
+    LOG_DEBUG("Sent all digital data: 0x%02X", digital_data);
     return true;
   } else {
-    Serial.println("Failed to send all digital data");
+    LOG_ERROR("Failed to send all digital data");
     return false;
   }
 }
@@ -400,7 +464,7 @@ bool sendAllDigitalData() {
 bool sendErrorResponse(uint8_t pin, uint8_t error_code) {
   twai_message_t response;
   
-  response.identifier = MY_CAN_ADDRESS;
+  response.identifier = canResponseId(CAN_CLASS_STATUS, MY_NODE_ID);
   response.extd = 0;
   response.rtr = 0;
   response.data_length_code = 3;
@@ -410,10 +474,41 @@ bool sendErrorResponse(uint8_t pin, uint8_t error_code) {
   response.data[2] = error_code;
   
   if (twai_transmit(&response, pdMS_TO_TICKS(1000)) == ESP_OK) {
-    Serial.printf("Sent error response: Pin=%d, Error=0x%02X\n", pin, error_code);
+    LOG_DEBUG("Sent error response: Pin=%d, Error=0x%02X", pin, error_code);
     return true;
   } else {
-    Serial.println("Failed to send error response");
+    LOG_ERROR("Failed to send error response");
     return false;
   }
-}
\ No newline at end of file
+}
+
+void checkSerialCommands() {
+  if (!Serial.available()) return;
+
+  String command = Serial.readStringUntil('\n');
+  command.trim();
+
+  if (command == "profile") {
+    profilerPrint(Serial);
+  } else if (command == "profile_reset") {
+    profilerReset();
+    Serial.println("Profile statistics reset");
+  } else if (command == "time") {
+    timeSyncPrint(Serial);
+  } else if (command == "isotp") {
+    isoTpPrint(Serial);
+  } else if (command == "ota") {
+    otaPrint(Serial);
+  } else if (command == "pins") {
+    printPinReadings();
+  } else if (command == "boot") {
+    bootPrint(Serial);
+    canFilterPrint(Serial, f_config);
+  }
+}
+
+// Reassembled bulk payloads from the master
+void onBulkMessage(uint8_t node, const uint8_t* data, uint16_t length) {
+  if (otaHandleMessage(data, length)) return;
+  LOG_WARN("Unhandled bulk message 0x%02X (%d bytes)", data[0], length);
+}
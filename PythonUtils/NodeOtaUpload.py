@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+
+import paho.mqtt.client as mqtt
+import argparse
+import json
+import struct
+import sys
+import time
+import zlib
+
+# Uploads a node firmware image through the master. The image goes to
+# /lavli/node_ota/data in chunks of [offset, big endian][data], the master
+# stores it on flash, checks the CRC and then streams it to the node over
+# CAN. Progress ends with a node_ota_done or node_ota_failed event.
+
+CHUNK_BYTES = 2048   # Fits the master's MQTT buffer with the topic and offset
+NODES = {'120v': 0x01, '12v': 0x02, 'motor': 0x03, 'sensor': 0x04}
+
+def parse_node(value):
+    if value.lower() in NODES:
+        return NODES[value.lower()]
+    node = int(value, 0)
+    if not 0x01 <= node < 0x70:
+        raise argparse.ArgumentTypeError("node must be a single node ID (0x01-0x6F)")
+    return node
+
+def main():
+    parser = argparse.ArgumentParser(description='Update a Lavli node over CAN through the master')
+    parser.add_argument('node', type=parse_node, help='Node ID (e.g. 0x04) or name: ' + ', '.join(NODES))
+    parser.add_argument('image', nargs='?', help='Firmware .bin (omit with --flash)')
+    parser.add_argument('--server', '-s', default='localhost', help='MQTT broker server address')
+    parser.add_argument('--port', '-p', type=int, default=1883, help='MQTT broker port (default: 1883)')
+    parser.add_argument('--username', '-u', help='Username for authentication')
+    parser.add_argument('--password', '-w', help='Password for authentication')
+    parser.add_argument('--tls', action='store_true', help='Use TLS with system CA certificates')
+    parser.add_argument('--flash', action='store_true', help='Send the image already stored on the master')
+    parser.add_argument('--timeout', type=int, default=600, help='Seconds to wait for the result (default: 600)')
+
+    args = parser.parse_args()
+    if not args.flash and not args.image:
+        parser.error('an image is required unless --flash is given')
+
+    image = b''
+    if args.image:
+        with open(args.image, 'rb') as f:
+            image = f.read()
+        if not image or image[0] != 0xE9:
+            print(f"Error: {args.image} is not an ESP32 application image")
+            sys.exit(1)
+
+    result = {}
+    def on_message(client, userdata, msg):
+        try:
+            event = json.loads(msg.payload)
+        except ValueError:
+            return
+        if event.get('event', '').startswith('node_ota'):
+            print(f"  {event['event']}: {event.get('detail', '')}")
+            if event['event'] in ('node_ota_done', 'node_ota_failed'):
+                result['event'] = event['event']
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    if args.tls:
+        client.tls_set()
+    client.on_message = on_message
+
+    print(f"Connecting to MQTT broker at {args.server}:{args.port}")
+    client.connect(args.server, args.port, 60)
+    client.subscribe('/lavli/events')
+    client.loop_start()
+
+    if args.flash:
+        control = {'node': f"0x{args.node:02X}", 'flash': True}
+    else:
+        control = {'node': f"0x{args.node:02X}", 'size': len(image), 'crc': f"0x{zlib.crc32(image):08x}"}
+    client.publish('/lavli/node_ota', json.dumps(control), qos=1).wait_for_publish(timeout=5)
+
+    if image:
+        print(f"Uploading {len(image)} bytes for node 0x{args.node:02X}, crc {control['crc']}")
+        start = time.time()
+        for offset in range(0, len(image), CHUNK_BYTES):
+            chunk = struct.pack('>I', offset) + image[offset:offset + CHUNK_BYTES]
+            info = client.publish('/lavli/node_ota/data', chunk, qos=1)
+            info.wait_for_publish(timeout=10)
+            if not info.is_published():
+                print(f"Failed to publish chunk at {offset}")
+                sys.exit(1)
+            print(f"\r  {min(offset + CHUNK_BYTES, len(image)) * 100 // len(image):3d}%", end='', flush=True)
+        print(f"\nUploaded in {time.time() - start:.1f} s, waiting for the node")
+
+    deadline = time.time() + args.timeout
+    while 'event' not in result and time.time() < deadline:
+        time.sleep(0.5)
+
+    client.loop_stop()
+    client.disconnect()
+    if result.get('event') != 'node_ota_done':
+        print('Update did not complete' if 'event' in result else 'No result before the timeout')
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+
+import paho.mqtt.client as mqtt
+import argparse
+import json
+import re
+import sys
+import time
+
+# Validates a wash/dry recipe with the same limits the master enforces and
+# publishes it to /lavli/recipe. The master stores it on flash and uses it
+# the next time that program is started.
+
+MAX_STEPS = 16
+MAX_JSON = 2048
+MAX_RPM = 1500
+MAX_PORT = 7
+MAX_MS = 0xFFFFFFFF
+
+def validate(recipe):
+    errors = []
+    name = recipe.get('name', '')
+    if not re.fullmatch(r'[A-Za-z0-9_-]{1,15}', name):
+        errors.append("'name' must be 1-15 chars of a-z, 0-9, _ or -")
+
+    steps = recipe.get('steps', [])
+    if not 1 <= len(steps) <= MAX_STEPS:
+        errors.append(f"'steps' must hold 1-{MAX_STEPS} steps")
+
+    for i, step in enumerate(steps):
+        if not 0 < step.get('ms', 0) <= MAX_MS:
+            errors.append(f"step {i}: 'ms' must be 1-{MAX_MS}")
+        if not 0 <= step.get('ramp_ms', 0) <= MAX_MS:
+            errors.append(f"step {i}: 'ramp_ms' must be 0-{MAX_MS}")
+        if not 0 <= step.get('rpm', 0) <= MAX_RPM:
+            errors.append(f"step {i}: 'rpm' must be 0-{MAX_RPM}")
+        if step.get('dir', 'cw') not in ('cw', 'ccw'):
+            errors.append(f"step {i}: 'dir' must be cw or ccw")
+        for port in step.get('outputs', []):
+            if not 1 <= port <= MAX_PORT:
+                errors.append(f"step {i}: output port {port} out of range 1-{MAX_PORT}")
+        until = step.get('until')
+        if until is not None and 'above' not in until and 'below' not in until:
+            errors.append(f"step {i}: 'until' needs 'above' or 'below'")
+    return errors
+
+def describe(recipe):
+    total = 0
+    print(f"Recipe '{recipe['name']}':")
+    for i, step in enumerate(recipe['steps']):
+        total += step['ms']
+        outputs = ','.join(str(p) for p in step.get('outputs', [])) or '-'
+        line = f"  {i + 1:2d}. {step['ms'] / 1000:7.1f} s  {step.get('rpm', 0):4d} rpm {step.get('dir', 'cw'):3s}  outputs {outputs}"
+        if step.get('ramp_ms'):
+            line += f"  ramp {step['ramp_ms']} ms"
+        if 'until' in step:
+            until = step['until']
+            bound = f">= {until['above']}" if 'above' in until else f"<= {until['below']}"
+            line += f"  until {until.get('dev')}:{until.get('pin', 0)} {bound}"
+        print(line)
+    print(f"  Max duration: {total / 60000:.1f} min")
+
+def main():
+    parser = argparse.ArgumentParser(description='Upload a wash/dry recipe to the Lavli master')
+    parser.add_argument('recipe', help='Recipe JSON file')
+    parser.add_argument('--server', '-s', default='localhost', help='MQTT broker server address')
+    parser.add_argument('--port', '-p', type=int, default=1883, help='MQTT broker port (default: 1883)')
+    parser.add_argument('--username', '-u', help='Username for authentication')
+    parser.add_argument('--password', '-w', help='Password for authentication')
+    parser.add_argument('--tls', action='store_true', help='Use TLS with system CA certificates')
+    parser.add_argument('--topic', '-t', default='/lavli/recipe', help='Recipe topic (default: /lavli/recipe)')
+    parser.add_argument('--check', action='store_true', help='Validate only, do not publish')
+
+    args = parser.parse_args()
+
+    with open(args.recipe) as f:
+        recipe = json.load(f)
+
+    errors = validate(recipe)
+    if errors:
+        for error in errors:
+            print(f"Error: {error}")
+        sys.exit(1)
+
+    payload = json.dumps(recipe, separators=(',', ':'))
+    if len(payload) > MAX_JSON:
+        print(f"Error: recipe is {len(payload)} bytes, master accepts at most {MAX_JSON}")
+        sys.exit(1)
+
+    describe(recipe)
+    if args.check:
+        return
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    if args.tls:
+        client.tls_set()
+
+    print(f"Connecting to MQTT broker at {args.server}:{args.port}")
+    client.connect(args.server, args.port, 60)
+    client.loop_start()
+
+    result = client.publish(args.topic, payload, qos=1)
+    result.wait_for_publish(timeout=5)
+    if result.is_published():
+        print(f"Published {len(payload)} bytes to {args.topic}")
+    else:
+        print("Failed to publish recipe")
+
+    time.sleep(0.5)
+    client.loop_stop()
+    client.disconnect()
+
+if __name__ == "__main__":
+    main()
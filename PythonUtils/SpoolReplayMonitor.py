@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+
+import paho.mqtt.client as mqtt
+import argparse
+import json
+import time
+
+# Watches the master's telemetry/event topics while its offline spool drains
+# and reports replay throughput and any ordering gaps. Point it at a local
+# mosquitto (and the master at the same broker) to measure replay rate.
+# Records are ordered by (boot, seq): seq restarts on every master boot and
+# boot counts boots, so records spooled before a reboot still sort first.
+
+class ReplayStats:
+    def __init__(self):
+        self.last_boot = None
+        self.last_seq = None
+        self.received = 0
+        self.gaps = 0
+        self.out_of_order = 0
+        self.restarts = 0
+        self.window_start = time.time()
+        self.window_count = 0
+        self.first_time = None
+        self.last_time = None
+
+def on_connect(client, userdata, flags, reason_code, properties):
+    if reason_code == 0:
+        print(f"Connected to MQTT broker with result code {reason_code}")
+        for topic in userdata['topics']:
+            client.subscribe(topic, qos=1)
+            print(f"Subscribed to topic: {topic}")
+    else:
+        print(f"Failed to connect to MQTT broker with result code {reason_code}")
+
+def on_message(client, userdata, msg):
+    stats = userdata['stats']
+    now = time.time()
+
+    try:
+        record = json.loads(msg.payload.decode())
+        boot = record.get('boot', 0)
+        seq = record['seq']
+    except (ValueError, KeyError):
+        print(f"Ignoring message without seq on {msg.topic}")
+        return
+
+    if stats.last_seq is not None:
+        if boot > stats.last_boot:
+            stats.restarts += 1
+            print(f"Boot {boot} after boot {stats.last_boot} (master reboot), seq {seq}")
+        elif boot < stats.last_boot:
+            stats.out_of_order += 1
+            print(f"Out of order: boot {boot} seq {seq} after boot {stats.last_boot} seq {stats.last_seq}")
+        elif seq == stats.last_seq + 1:
+            pass
+        elif seq > stats.last_seq + 1:
+            stats.gaps += 1
+            print(f"Gap: expected {stats.last_seq + 1}, got {seq} ({seq - stats.last_seq - 1} missing/evicted)")
+        else:
+            stats.out_of_order += 1
+            print(f"Out of order: {seq} after {stats.last_seq}")
+
+    stats.last_boot = boot
+    stats.last_seq = seq
+    stats.received += 1
+    stats.window_count += 1
+    if stats.first_time is None:
+        stats.first_time = now
+    stats.last_time = now
+
+    if now - stats.window_start >= userdata['interval']:
+        rate = stats.window_count / (now - stats.window_start)
+        print(f"{rate:7.1f} msg/s  total={stats.received}  last_seq={seq}  "
+              f"gaps={stats.gaps}  out_of_order={stats.out_of_order}")
+        stats.window_start = now
+        stats.window_count = 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Offline spool replay monitor')
+    parser.add_argument('--server', '-s', default='localhost', help='MQTT broker server address (default: localhost)')
+    parser.add_argument('--port', '-p', type=int, default=1883, help='MQTT broker port (default: 1883)')
+    parser.add_argument('--topic', '-t', action='append', help='Topic to watch (default: telemetry and events)')
+    parser.add_argument('--username', '-u', help='Username for authentication')
+    parser.add_argument('--password', '-w', help='Password for authentication')
+    parser.add_argument('--tls', action='store_true', help='Use TLS with system CA certificates')
+    parser.add_argument('--interval', type=float, default=1.0, help='Rate report interval in seconds (default: 1.0)')
+
+    args = parser.parse_args()
+    topics = args.topic or ['/lavli/telemetry', '/lavli/events']
+    stats = ReplayStats()
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    client.user_data_set({'topics': topics, 'stats': stats, 'interval': args.interval})
+
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+
+    client.on_connect = on_connect
+    client.on_message = on_message
+
+    try:
+        print(f"Connecting to MQTT broker at {args.server}:{args.port}")
+        if args.tls:
+            client.tls_set()
+        client.connect(args.server, args.port, 60)
+
+        print("Watching replay. Press Ctrl+C to exit...")
+        client.loop_forever()
+
+    except KeyboardInterrupt:
+        print("\nDisconnecting from MQTT broker...")
+        client.disconnect()
+        if stats.first_time is not None and stats.last_time > stats.first_time:
+            rate = (stats.received - 1) / (stats.last_time - stats.first_time)
+            print(f"Received {stats.received} messages, average {rate:.1f} msg/s")
+        print(f"Gaps: {stats.gaps}, out of order: {stats.out_of_order}, restarts: {stats.restarts}")
+    except Exception as e:
+        print(f"Error: {e}")
+
+if __name__ == "__main__":
+    main()
@@ -8,6 +8,30 @@ import threading
 import time
 from datetime import datetime
 
+# CAN ID layout from lib/LavliCAN/LavliCanIds.h: class(3) | direction(1) | node(7)
+CAN_CLASSES = {
+    "safety": 0,
+    "time": 1,
+    "control": 2,
+    "status": 3,
+    "telemetry": 4,
+    "config": 5,
+    "bulk": 6,
+}
+
+NODES = {
+    "120V output": 0x01,
+    "12V output": 0x02,
+    "motor": 0x03,
+    "sensor": 0x04,
+}
+
+GROUP_ACTUATORS = 0x70
+GROUP_SENSORS = 0x71
+
+def can_request_id(cls, node):
+    return (CAN_CLASSES[cls] << 8) | (node & 0x7F)
+
 class CANControllerGUI:
     def __init__(self, root):
         self.root = root
@@ -52,13 +76,14 @@ class CANControllerGUI:
         cmd_frame = ttk.LabelFrame(self.root, text="CAN Commands", padding="10")
         cmd_frame.pack(fill="both", expand=True, padx=10, pady=5)
         
-        # Address input
+        # Node input; each command picks its own priority class
         addr_frame = ttk.Frame(cmd_frame)
         addr_frame.pack(fill="x", pady=5)
-        ttk.Label(addr_frame, text="CAN Address:").pack(side="left")
-        self.address_var = tk.StringVar(value="0x311")
-        ttk.Entry(addr_frame, textvariable=self.address_var, width=15).pack(side="left", padx=5)
-        ttk.Label(addr_frame, text="(hex like 0x311 or decimal like 785)").pack(side="left", padx=5)
+        ttk.Label(addr_frame, text="Node:").pack(side="left")
+        self.node_var = tk.StringVar(value="0x03")
+        ttk.Entry(addr_frame, textvariable=self.node_var, width=8).pack(side="left", padx=5)
+        nodes = ", ".join(f"{name} 0x{node:02X}" for name, node in NODES.items())
+        ttk.Label(addr_frame, text=f"({nodes})").pack(side="left", padx=5)
         
         # Command buttons frame
         btn_frame = ttk.Frame(cmd_frame)
@@ -72,6 +97,7 @@ class CANControllerGUI:
         ttk.Button(motor_frame, text="Set Motor Direction", command=self.motor_direction_dialog).pack(fill="x", pady=2)
         ttk.Button(motor_frame, text="Stop Motor", command=self.motor_stop).pack(fill="x", pady=2)
         ttk.Button(motor_frame, text="Motor Status", command=self.motor_status).pack(fill="x", pady=2)
+        ttk.Button(motor_frame, text="Stop All Actuators", command=self.stop_all).pack(fill="x", pady=2)
         
         # Output commands
         output_frame = ttk.LabelFrame(btn_frame, text="Output Commands", padding="5")
@@ -88,11 +114,19 @@ class CANControllerGUI:
         ttk.Button(sensor_frame, text="Read Digital Pin", command=self.read_digital_dialog).pack(fill="x", pady=2)
         ttk.Button(sensor_frame, text="Read All Analog", command=self.read_all_analog).pack(fill="x", pady=2)
         ttk.Button(sensor_frame, text="Read All Digital", command=self.read_all_digital).pack(fill="x", pady=2)
+        ttk.Button(sensor_frame, text="Snapshot All Sensors", command=self.snapshot_all).pack(fill="x", pady=2)
         
         # Custom command frame
         custom_frame = ttk.LabelFrame(cmd_frame, text="Custom Command", padding="5")
         custom_frame.pack(fill="x", pady=10)
         
+        class_frame = ttk.Frame(custom_frame)
+        class_frame.pack(fill="x")
+        ttk.Label(class_frame, text="Class:").pack(side="left")
+        self.custom_class_var = tk.StringVar(value="control")
+        ttk.Combobox(class_frame, textvariable=self.custom_class_var, values=list(CAN_CLASSES),
+                     state="readonly", width=12).pack(side="left", padx=5)
+        
         ttk.Label(custom_frame, text="Data (comma-separated):").pack(anchor="w")
         self.custom_data_var = tk.StringVar(value="0x01, 2")
         ttk.Entry(custom_frame, textvariable=self.custom_data_var, width=50).pack(fill="x", pady=2)
@@ -183,6 +217,10 @@ class CANControllerGUI:
             self.update_connection_status(False)
             self.log_message("Disconnected from MQTT broker")
             
+    def can_address(self, cls):
+        """Frame ID for a request of the given class to the selected node"""
+        return f"0x{can_request_id(cls, int(self.node_var.get(), 0)):03X}"
+        
     def send_can_command(self, address, data_list):
         """Send a CAN command via MQTT"""
         if not self.connected:
@@ -230,7 +268,7 @@ class CANControllerGUI:
             try:
                 rpm = int(rpm_var.get())
                 if 0 <= rpm <= 1500:
-                    address = self.address_var.get()
+                    address = self.can_address("safety" if rpm == 0 else "control")
                     self.send_can_command(address, ["0x30", rpm >> 8, rpm & 0xFF])
                     dialog.destroy()
                 else:
@@ -253,7 +291,7 @@ class CANControllerGUI:
         ttk.Radiobutton(dialog, text="Counter-Clockwise", variable=direction_var, value="0").pack(pady=5)
         
         def send_direction():
-            address = self.address_var.get()
+            address = self.can_address("control")
             direction = int(direction_var.get())
             self.send_can_command(address, ["0x31", direction])
             dialog.destroy()
@@ -262,14 +300,18 @@ class CANControllerGUI:
         
     def motor_stop(self):
         """Send motor stop command"""
-        address = self.address_var.get()
+        address = self.can_address("safety")
         self.send_can_command(address, ["0x32"])
         
     def motor_status(self):
         """Request motor status"""
-        address = self.address_var.get()
+        address = self.can_address("status")
         self.send_can_command(address, ["0x33"])
         
+    def stop_all(self):
+        """Stop every actuator with one group frame"""
+        self.send_can_command(f"0x{can_request_id('safety', GROUP_ACTUATORS):03X}", ["0x08"])
+        
     def activate_port_dialog(self):
         """Dialog for activating a port"""
         dialog = tk.Toplevel(self.root)
@@ -286,7 +328,7 @@ class CANControllerGUI:
             try:
                 port = int(port_var.get())
                 if 0 <= port <= 7:
-                    address = self.address_var.get()
+                    address = self.can_address("control")
                     self.send_can_command(address, ["0x01", port])
                     dialog.destroy()
                 else:
@@ -312,7 +354,7 @@ class CANControllerGUI:
             try:
                 port = int(port_var.get())
                 if 0 <= port <= 7:
-                    address = self.address_var.get()
+                    address = self.can_address("safety")
                     self.send_can_command(address, ["0x02", port])
                     dialog.destroy()
                 else:
@@ -338,7 +380,7 @@ class CANControllerGUI:
             try:
                 pin = int(pin_var.get())
                 if 0 <= pin <= 7:
-                    address = self.address_var.get()
+                    address = self.can_address("telemetry")
                     self.send_can_command(address, ["0x03", pin])
                     dialog.destroy()
                 else:
@@ -364,7 +406,7 @@ class CANControllerGUI:
             try:
                 pin = int(pin_var.get())
                 if 0 <= pin <= 7:
-                    address = self.address_var.get()
+                    address = self.can_address("telemetry")
                     self.send_can_command(address, ["0x04", pin])
                     dialog.destroy()
                 else:
@@ -376,18 +418,22 @@ class CANControllerGUI:
         
     def read_all_analog(self):
         """Read all analog pins"""
-        address = self.address_var.get()
+        address = self.can_address("telemetry")
         self.send_can_command(address, ["0x05"])
         
     def read_all_digital(self):
         """Read all digital pins"""
-        address = self.address_var.get()
+        address = self.can_address("telemetry")
         self.send_can_command(address, ["0x06"])
         
+    def snapshot_all(self):
+        """Ask every sensor node for all inputs"""
+        self.send_can_command(f"0x{can_request_id('telemetry', GROUP_SENSORS):03X}", ["0x0A"])
+        
     def send_custom_command(self):
         """Send custom command from user input"""
         try:
-            address = self.address_var.get()
+            address = self.can_address(self.custom_class_var.get())
             data_str = self.custom_data_var.get()
             
             # Parse comma-separated data
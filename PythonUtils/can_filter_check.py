@@ -0,0 +1,305 @@
+#!/usr/bin/env python3
+
+import argparse
+import glob
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+# Checks the TWAI acceptance filter math in lib/LavliCAN/LavliCanFilter.cpp.
+#
+# Builds canFilterForIds() and canFilterAccepts() with the host compiler
+# against stub Arduino/TWAI headers, runs them over each node's subscribed_ids
+# (taken from the node's main.cpp) or over the IDs given, and compares the
+# firmware's filter and accepted set with a model re-derived here. Every
+# subscribed ID must get through and nothing beyond the best 1- or 2-pair
+# cover may. Values printed by a node at boot ("[CAN] Acceptance filter: ...")
+# can be checked against the model alone with --code/--mask/--mode.
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+CAN_LIB = os.path.join(ROOT, 'lib', 'LavliCAN')
+SOURCE = os.path.join(CAN_LIB, 'LavliCanFilter.cpp')
+
+ID_BITS = 0x7FF
+SINGLE_DONT_CARE = 0x001FFFFF
+DUAL_DONT_CARE = 0x001F001F
+SINGLE_ID_FIELD = 0xFFE00000
+DUAL_ID1_FIELD = 0xFFE00000
+DUAL_ID2_FIELD = 0x0000FFE0
+MAX_IDS = 8
+
+# Just enough of the ESP32 headers for LavliCanFilter.cpp to build on the host
+STUB_ARDUINO = r'''
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+class Print {
+public:
+  int printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written;
+  }
+};
+'''
+
+STUB_TWAI = r'''
+#pragma once
+#include <stdint.h>
+
+typedef struct {
+  uint32_t acceptance_code;
+  uint32_t acceptance_mask;
+  bool single_filter;
+} twai_filter_config_t;
+
+#define TWAI_FILTER_CONFIG_ACCEPT_ALL() {0, 0xFFFFFFFF, true}
+'''
+
+# Prints "<IDs>: <single> <code> <mask> <count>: <accepted IDs>" for each node
+# list compiled in, then for each "<n> <id>..." set read from stdin
+DRIVER = r'''
+#include <stdio.h>
+#include "LavliCanFilter.h"
+#include "LavliCanIds.h"
+
+%(nodes)s
+
+static void report(const uint16_t* ids, size_t count) {
+  twai_filter_config_t filter = canFilterForIds(ids, count);
+  for (size_t i = 0; i < count; i++) printf("%%u ", (unsigned)ids[i]);
+  printf(": %%d %%lu %%lu %%u:", filter.single_filter ? 1 : 0, (unsigned long)filter.acceptance_code,
+         (unsigned long)filter.acceptance_mask, (unsigned)canFilterAcceptedCount(filter));
+  for (uint16_t id = 0; id <= 0x7FF; id++) {
+    if (canFilterAccepts(filter, id)) printf(" %%u", (unsigned)id);
+  }
+  printf("\n");
+}
+
+int main() {
+%(reports)s
+  unsigned count;
+  while (scanf("%%u", &count) == 1) {
+    uint16_t ids[64];
+    if (count > 64) return 1;
+    for (unsigned i = 0; i < count; i++) {
+      unsigned id;
+      if (scanf("%%u", &id) != 1) return 1;
+      ids[i] = (uint16_t)id;
+    }
+    report(ids, count);
+  }
+  return 0;
+}
+'''
+
+def match_group(ids):
+    code = ids[0] & ID_BITS
+    mask = 0
+    for i in ids[1:]:
+        mask |= (i ^ code) & ID_BITS
+    return code & ~mask, mask
+
+def match_size(match):
+    return 1 << bin(match[1]).count('1')
+
+def union_size(a, b):
+    both = a[1] | b[1]
+    overlap = 0 if (a[0] ^ b[0]) & ~both & ID_BITS else 1 << bin(a[1] & b[1]).count('1')
+    return match_size(a) + match_size(b) - overlap
+
+def filter_for_ids(ids):
+    if not ids or len(ids) > MAX_IDS:
+        return 'single', 0, 0xFFFFFFFF
+
+    count = len(ids)
+    full = (1 << count) - 1
+    pick = lambda members: [ids[i] for i in range(count) if members & (1 << i)]
+
+    single = match_group(ids)
+    best_cost = match_size(single)
+    best_split = 0
+    if best_cost > count:
+        for split in range(1, full, 2):
+            cost = union_size(match_group(pick(split)), match_group(pick(full & ~split)))
+            if cost < best_cost:
+                best_cost, best_split = cost, split
+
+    if best_split == 0:
+        return 'single', single[0] << 21, (single[1] << 21) | SINGLE_DONT_CARE
+
+    first = match_group(pick(best_split))
+    second = match_group(pick(full & ~best_split))
+    code = (first[0] << 21) | (second[0] << 5)
+    mask = (first[1] << 21) | (second[1] << 5) | DUAL_DONT_CARE
+    return 'dual', code, mask
+
+def accepts(mode, code, mask, can_id):
+    care = ~mask & 0xFFFFFFFF
+    if mode == 'single':
+        return ((can_id << 21) ^ code) & care & SINGLE_ID_FIELD == 0
+    return (((can_id << 21) ^ code) & care & DUAL_ID1_FIELD == 0 or
+            ((can_id << 5) ^ code) & care & DUAL_ID2_FIELD == 0)
+
+def accepted_ids(mode, code, mask):
+    return [i for i in range(ID_BITS + 1) if accepts(mode, code, mask, i)]
+
+def best_possible(ids):
+    """Brute-force lower bound: smallest accept set over every 1- or 2-pair cover."""
+    best = match_size(match_group(ids))
+    count = len(ids)
+    for split in range(1, (1 << count) - 1):
+        a = [ids[i] for i in range(count) if split & (1 << i)]
+        b = [ids[i] for i in range(count) if not split & (1 << i)]
+        best = min(best, union_size(match_group(a), match_group(b)))
+    return best
+
+def check(ids, mode, code, mask, verbose=True):
+    accepted = accepted_ids(mode, code, mask)
+    missing = [i for i in ids if i not in accepted]
+    extra = [i for i in accepted if i not in ids]
+
+    if verbose:
+        print(f"IDs:      {' '.join(f'0x{i:03X}' for i in ids)}")
+        print(f"Filter:   {mode} code=0x{code:08X} mask=0x{mask:08X}")
+        print(f"Accepted: {len(accepted)} of 2048 IDs")
+        if extra:
+            shown = ' '.join(f'0x{i:03X}' for i in extra[:32])
+            more = f" ... (+{len(extra) - 32})" if len(extra) > 32 else ''
+            print(f"Extra:    {shown}{more}")
+        if missing:
+            print(f"MISSING:  {' '.join(f'0x{i:03X}' for i in missing)}")
+    return not missing, len(accepted)
+
+def node_lists():
+    """(name, MY_NODE_ID, subscribed_ids initialisers) for every node; one entry per board build."""
+    nodes = []
+    for path in sorted(glob.glob(os.path.join(ROOT, '*', 'src', 'main.cpp'))):
+        with open(path) as f:
+            text = f.read()
+        body = re.search(r'subscribed_ids\[\]\s*=\s*\{(.*?)\};', text, re.S)
+        if not body:
+            continue
+        name = os.path.basename(os.path.dirname(os.path.dirname(path)))
+        node_ids = re.findall(r'#define\s+MY_NODE_ID\s+(\w+)', text)
+        if not node_ids:
+            sys.exit(f"MY_NODE_ID not found in {path}")
+        for node_id in node_ids:
+            label = name if len(node_ids) == 1 else f"{name} ({node_id})"
+            nodes.append((label, node_id, body.group(1)))
+    if not nodes:
+        sys.exit(f"No subscribed_ids found under {ROOT}")
+    return nodes
+
+def run_firmware(cxx, nodes, sets):
+    """Returns (IDs, (mode, code, mask, accepted count, accepted IDs)) per node, then per set."""
+    arrays = []
+    reports = []
+    for n, (_, node_id, body) in enumerate(nodes):
+        arrays.append(f"#define MY_NODE_ID {node_id}\nstatic const uint16_t node_{n}[] = {{{body}}};\n#undef MY_NODE_ID")
+        reports.append(f"  report(node_{n}, sizeof(node_{n}) / sizeof(node_{n}[0]));")
+
+    with tempfile.TemporaryDirectory() as tmp:
+        os.makedirs(os.path.join(tmp, 'driver'))
+        for name, text in (('Arduino.h', STUB_ARDUINO), (os.path.join('driver', 'twai.h'), STUB_TWAI),
+                           ('driver.cpp', DRIVER % {'nodes': '\n'.join(arrays), 'reports': '\n'.join(reports)})):
+            with open(os.path.join(tmp, name), 'w') as f:
+                f.write(text)
+        binary = os.path.join(tmp, 'driver.bin')
+        build = [cxx, '-std=c++11', '-Wall', '-Werror', '-I', tmp, '-I', CAN_LIB,
+                 os.path.join(tmp, 'driver.cpp'), SOURCE, '-o', binary]
+        result = subprocess.run(build, capture_output=True, text=True)
+        if result.returncode != 0:
+            sys.exit(f"Build failed:\n{result.stderr}")
+        stdin = ''.join(f"{len(ids)} {' '.join(str(i) for i in ids)}\n" for ids in sets)
+        result = subprocess.run([binary], input=stdin, capture_output=True, text=True, check=True)
+
+    filters = []
+    for line in result.stdout.split('\n'):
+        if not line:
+            continue
+        ids, head, accepted = line.split(':')
+        single, code, mask, count = (int(v) for v in head.split())
+        filters.append(([int(v) for v in ids.split()],
+                        ('single' if single else 'dual', code, mask, count, [int(v) for v in accepted.split()])))
+    if len(filters) != len(nodes) + len(sets):
+        sys.exit(f"Driver printed {len(filters)} filters, expected {len(nodes) + len(sets)}")
+    return filters
+
+def compare(ids, firmware, verbose):
+    """Checks one firmware filter against the model; returns the problems found."""
+    mode, code, mask, count, accepted = firmware
+    problems = []
+    expected = filter_for_ids(ids)
+    if (mode, code, mask) != expected:
+        problems.append(f"firmware {mode} code=0x{code:08X} mask=0x{mask:08X}, "
+                        f"model {expected[0]} code=0x{expected[1]:08X} mask=0x{expected[2]:08X}")
+    if accepted != accepted_ids(mode, code, mask):
+        problems.append("canFilterAccepts() disagrees with the controller model")
+    if count != len(accepted):
+        problems.append(f"canFilterAcceptedCount() says {count}, canFilterAccepts() passes {len(accepted)}")
+    ok, _ = check(ids, mode, code, mask, verbose)
+    if not ok:
+        problems.append("subscribed IDs are filtered out")
+    if 0 < len(ids) <= MAX_IDS and len(accepted) != best_possible(ids):
+        problems.append(f"accepts {len(accepted)} IDs, best cover accepts {best_possible(ids)}")
+    return problems
+
+def parse_int(text):
+    return int(text, 0)
+
+def main():
+    parser = argparse.ArgumentParser(description='Verify the TWAI acceptance filter each node builds for its CAN IDs')
+    parser.add_argument('ids', nargs='*', type=parse_int,
+                        help='Subscribed 11-bit IDs, e.g. 0x003 0x203 (default: every node\'s subscribed_ids)')
+    parser.add_argument('--code', type=parse_int, help='Check this acceptance code instead of computing one')
+    parser.add_argument('--mask', type=parse_int, help='Acceptance mask to check with --code')
+    parser.add_argument('--mode', choices=['single', 'dual'], default='single', help='Filter mode for --code/--mask')
+    parser.add_argument('--self-test', type=int, metavar='N', help='Also check N random ID sets')
+    parser.add_argument('--seed', type=int, default=1, help='Random seed for --self-test')
+    parser.add_argument('--cxx', default=os.environ.get('CXX', 'c++'), help='Host C++ compiler (default: $CXX or c++)')
+
+    args = parser.parse_args()
+
+    if args.code is not None:
+        if args.mask is None:
+            parser.error('--code needs --mask')
+        if not args.ids:
+            parser.error('--code needs the subscribed IDs')
+        ok, _ = check(args.ids, args.mode, args.code, args.mask)
+        sys.exit(0 if ok else 1)
+
+    nodes = [] if args.ids else node_lists()
+    sets = [args.ids] if args.ids else []
+    rng = random.Random(args.seed)
+    for _ in range(args.self_test or 0):
+        sets.append(rng.sample(range(ID_BITS + 1), rng.randint(1, MAX_IDS)))
+
+    filters = run_firmware(args.cxx, nodes, sets)
+
+    labels = [label for label, _, _ in nodes] + ['IDs given' if args.ids else None] * len(sets)
+    failures = 0
+    for label, (ids, firmware) in zip(labels, filters):
+        verbose = label is not None
+        if verbose:
+            print(f"{label}:")
+        problems = compare(ids, firmware, verbose)
+        for problem in problems:
+            print(f"FAIL: ids={' '.join(f'0x{i:03X}' for i in ids)}: {problem}")
+        failures += bool(problems)
+        if verbose:
+            print()
+
+    print(f"{len(filters) - failures}/{len(filters)} ID sets match the model")
+    sys.exit(0 if not failures else 1)
+
+if __name__ == "__main__":
+    main()
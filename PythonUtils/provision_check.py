@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+
+import argparse
+import itertools
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+# Checks the master's BLE provisioning state machine in
+# "Lavli Master Node/src/provision_step.cpp".
+#
+# Builds provisionNextStep() with the host compiler, runs it over every state
+# and input combination at the interesting times (either side of each
+# timeout), and compares the result with a model re-derived here. Then checks
+# the properties the master relies on: BLE only shuts down after WiFi came up,
+# an attempt always ends, CLEAR always aborts, and a master that fell back
+# with stored credentials keeps retrying them.
+
+MASTER = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'Lavli Master Node')
+HEADER = os.path.join(MASTER, 'include', 'provision_step.h')
+SOURCE = os.path.join(MASTER, 'src', 'provision_step.cpp')
+
+STATES = ['OFF', 'ADVERTISING', 'CONNECTING', 'SHUTTING_DOWN']
+ACTIONS = ['NONE', 'REJECT', 'CONNECT_NEW', 'CONNECT_STORED', 'ABORT', 'CONNECTED', 'TIMEOUT', 'SHUTDOWN']
+INPUTS = ['connect', 'abort', 'have_ssid', 'have_stored', 'wifi_up']
+
+DRIVER = r'''
+#include <stdio.h>
+#include "provision_step.h"
+
+int main() {
+  unsigned long times[64];
+  int count = 0;
+  while (count < 64 && scanf("%lu", &times[count]) == 1) count++;
+  for (int state = PROVISION_OFF; state <= PROVISION_SHUTTING_DOWN; state++) {
+    for (int bits = 0; bits < 32; bits++) {
+      for (int t = 0; t < count; t++) {
+        ProvisionInputs in;
+        in.connectRequested = bits & 1;
+        in.abortRequested = bits & 2;
+        in.haveSsid = bits & 4;
+        in.haveStored = bits & 8;
+        in.wifiUp = bits & 16;
+        in.inStateMs = (uint32_t)times[t];
+        ProvisionStep step = provisionNextStep((ProvisionState)state, in);
+        printf("%d %d %lu %d %d\n", state, bits, times[t], (int)step.next, (int)step.action);
+      }
+    }
+  }
+  return 0;
+}
+'''
+
+def read_constants():
+    with open(HEADER) as f:
+        text = f.read()
+    constants = {}
+    for name in ('CONNECT_TIMEOUT_MS', 'SHUTDOWN_DELAY_MS', 'STORED_RETRY_MS'):
+        match = re.search(rf'#define\s+PROVISION_{name}\s+(\d+)', text)
+        if not match:
+            sys.exit(f"PROVISION_{name} not found in {HEADER}")
+        constants[name] = int(match.group(1))
+    return constants
+
+def model(state, inputs, ms, c):
+    if state == 'ADVERTISING':
+        if inputs['connect']:
+            return ('ADVERTISING', 'REJECT') if not inputs['have_ssid'] else ('CONNECTING', 'CONNECT_NEW')
+        if inputs['have_stored'] and ms >= c['STORED_RETRY_MS']:
+            return 'CONNECTING', 'CONNECT_STORED'
+        return 'ADVERTISING', 'NONE'
+    if state == 'CONNECTING':
+        if inputs['abort'] or inputs['connect']:
+            return 'ADVERTISING', 'ABORT'
+        if inputs['wifi_up']:
+            return 'SHUTTING_DOWN', 'CONNECTED'
+        if ms > c['CONNECT_TIMEOUT_MS']:
+            return 'ADVERTISING', 'TIMEOUT'
+        return 'CONNECTING', 'NONE'
+    if state == 'SHUTTING_DOWN':
+        if ms < c['SHUTDOWN_DELAY_MS']:
+            return 'SHUTTING_DOWN', 'NONE'
+        return 'OFF', 'SHUTDOWN'
+    return 'OFF', 'NONE'
+
+def sample_times(c):
+    times = {0, 0xFFFFFFFF}
+    for value in c.values():
+        times.update((value - 1, value, value + 1))
+    return sorted(times)
+
+def run_firmware(cxx, times):
+    with tempfile.TemporaryDirectory() as tmp:
+        driver = os.path.join(tmp, 'driver.cpp')
+        binary = os.path.join(tmp, 'driver')
+        with open(driver, 'w') as f:
+            f.write(DRIVER)
+        build = [cxx, '-std=c++11', '-Wall', '-Werror', '-I', os.path.dirname(HEADER), driver, SOURCE, '-o', binary]
+        result = subprocess.run(build, capture_output=True, text=True)
+        if result.returncode != 0:
+            sys.exit(f"Build failed:\n{result.stderr}")
+        result = subprocess.run([binary], input=' '.join(str(t) for t in times), capture_output=True, text=True,
+                                check=True)
+
+    table = {}
+    for line in result.stdout.split('\n'):
+        if not line:
+            continue
+        state, bits, ms, next_state, action = (int(v) for v in line.split())
+        table[(STATES[state], bits, ms)] = (STATES[next_state], ACTIONS[action])
+    return table
+
+def decode(bits):
+    return {name: bool(bits & (1 << i)) for i, name in enumerate(INPUTS)}
+
+def check_properties(table, c):
+    problems = []
+    for (state, bits, ms), (next_state, action) in table.items():
+        inputs = decode(bits)
+        where = f"{state} {'+'.join(n for n in INPUTS if inputs[n]) or '-'} at {ms} ms"
+        if next_state == 'OFF' and state != 'OFF' and state != 'SHUTTING_DOWN':
+            problems.append(f"{where}: stops without shutting down")
+        if next_state == 'SHUTTING_DOWN' and state == 'CONNECTING' and not inputs['wifi_up']:
+            problems.append(f"{where}: shuts down without WiFi")
+        if state == 'CONNECTING' and inputs['abort'] and action != 'ABORT':
+            problems.append(f"{where}: CLEAR does not abort")
+        if state == 'CONNECTING' and ms > c['CONNECT_TIMEOUT_MS'] and next_state == 'CONNECTING':
+            problems.append(f"{where}: attempt outlives the timeout")
+        if action == 'CONNECT_NEW' and not inputs['have_ssid']:
+            problems.append(f"{where}: connects without an SSID")
+        if action == 'CONNECT_STORED' and not inputs['have_stored']:
+            problems.append(f"{where}: retries credentials that do not exist")
+        if (state == 'ADVERTISING' and inputs['have_stored'] and not inputs['connect'] and
+                ms >= c['STORED_RETRY_MS'] and action != 'CONNECT_STORED'):
+            problems.append(f"{where}: fallback never retries the stored credentials")
+        if state == 'OFF' and (next_state, action) != ('OFF', 'NONE'):
+            problems.append(f"{where}: leaves OFF on its own")
+    return problems
+
+def main():
+    parser = argparse.ArgumentParser(description="Check the master's BLE provisioning state machine")
+    parser.add_argument('--cxx', default=os.environ.get('CXX', 'c++'), help='Host C++ compiler (default: $CXX or c++)')
+    parser.add_argument('--table', action='store_true', help='Print the firmware transition table')
+
+    args = parser.parse_args()
+
+    constants = read_constants()
+    times = sample_times(constants)
+    table = run_firmware(args.cxx, times)
+
+    mismatches = 0
+    for state in STATES:
+        for bits in range(1 << len(INPUTS)):
+            for ms in times:
+                got = table.get((state, bits, ms))
+                expected = model(state, decode(bits), ms, constants)
+                if got != expected:
+                    mismatches += 1
+                    print(f"MISMATCH: {state} inputs=0b{bits:05b} {ms} ms: firmware {got}, model {expected}")
+                if args.table:
+                    print(f"{state:13s} 0b{bits:05b} {ms:10d} ms -> {got[0]:13s} {got[1]}")
+
+    problems = check_properties(table, constants)
+    for problem in problems:
+        print(f"FAIL: {problem}")
+
+    print(f"{len(table)} transitions checked, {mismatches} model mismatches, {len(problems)} property failures")
+    sys.exit(0 if not mismatches and not problems else 1)
+
+if __name__ == "__main__":
+    main()
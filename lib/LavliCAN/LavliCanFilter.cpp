@@ -0,0 +1,94 @@
+#include "LavliCanFilter.h"
+
+#define CAN_ID_BITS       0x7FF
+#define SINGLE_ID_FIELD   0xFFE00000UL
+#define DUAL_ID1_FIELD    0xFFE00000UL
+#define DUAL_ID2_FIELD    0x0000FFE0UL
+
+// Smallest code/mask pair covering the IDs selected by the members bitmask
+static CanIdMatch matchGroup(const uint16_t* ids, size_t count, uint32_t members) {
+  CanIdMatch match = {0, 0};
+  bool first = true;
+  for (size_t i = 0; i < count; i++) {
+    if (!(members & (1UL << i))) continue;
+    if (first) {
+      match.code = ids[i] & CAN_ID_BITS;
+      first = false;
+    } else {
+      match.mask |= (ids[i] ^ match.code) & CAN_ID_BITS;
+    }
+  }
+  match.code &= ~match.mask;
+  return match;
+}
+
+static uint16_t matchSize(const CanIdMatch& match) {
+  return 1U << __builtin_popcount(match.mask);
+}
+
+// IDs accepted by either pair; the overlap of two pairs is itself a pair
+static uint16_t unionSize(const CanIdMatch& a, const CanIdMatch& b) {
+  uint16_t both = a.mask | b.mask;
+  uint16_t overlap = ((a.code ^ b.code) & ~both & CAN_ID_BITS) ? 0 : 1U << __builtin_popcount(a.mask & b.mask);
+  return matchSize(a) + matchSize(b) - overlap;
+}
+
+twai_filter_config_t canFilterForIds(const uint16_t* ids, size_t count) {
+  twai_filter_config_t filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+  if (count == 0 || count > CAN_FILTER_MAX_IDS) return filter;
+
+  uint32_t all = (1UL << count) - 1;
+  CanIdMatch single = matchGroup(ids, count, all);
+  uint16_t bestCost = matchSize(single);
+  uint32_t bestSplit = 0;
+
+  // Keep ID 0 in the first group so each split is only tried once
+  if (bestCost > count) {
+    for (uint32_t split = 1; split < all; split += 2) {
+      uint16_t cost = unionSize(matchGroup(ids, count, split), matchGroup(ids, count, all & ~split));
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = split;
+      }
+    }
+  }
+
+  if (bestSplit == 0) {
+    filter.acceptance_code = (uint32_t)single.code << 21;
+    filter.acceptance_mask = ((uint32_t)single.mask << 21) | CAN_FILTER_SINGLE_DONT_CARE;
+    filter.single_filter = true;
+  } else {
+    CanIdMatch first = matchGroup(ids, count, bestSplit);
+    CanIdMatch second = matchGroup(ids, count, all & ~bestSplit);
+    filter.acceptance_code = ((uint32_t)first.code << 21) | ((uint32_t)second.code << 5);
+    filter.acceptance_mask = ((uint32_t)first.mask << 21) | ((uint32_t)second.mask << 5) | CAN_FILTER_DUAL_DONT_CARE;
+    filter.single_filter = false;
+  }
+  return filter;
+}
+
+bool canFilterAccepts(const twai_filter_config_t& filter, uint16_t id) {
+  uint32_t code = filter.acceptance_code;
+  uint32_t care = ~filter.acceptance_mask;
+
+  if (filter.single_filter) {
+    return ((((uint32_t)id << 21) ^ code) & care & SINGLE_ID_FIELD) == 0;
+  }
+  return ((((uint32_t)id << 21) ^ code) & care & DUAL_ID1_FIELD) == 0 ||
+         ((((uint32_t)id << 5) ^ code) & care & DUAL_ID2_FIELD) == 0;
+}
+
+uint16_t canFilterAcceptedCount(const twai_filter_config_t& filter) {
+  uint16_t accepted = 0;
+  for (uint16_t id = 0; id <= CAN_ID_BITS; id++) {
+    if (canFilterAccepts(filter, id)) accepted++;
+  }
+  return accepted;
+}
+
+void canFilterPrint(Print& out, const twai_filter_config_t& filter) {
+  out.printf("[CAN] Acceptance filter: %s code=0x%08lX mask=0x%08lX (%u of 2048 IDs)\n",
+             filter.single_filter ? "single" : "dual",
+             (unsigned long)filter.acceptance_code, (unsigned long)filter.acceptance_mask,
+             canFilterAcceptedCount(filter));
+}
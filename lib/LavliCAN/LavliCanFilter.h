@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+#include <driver/twai.h>
+
+// TWAI acceptance filter helpers
+//
+// Builds the hardware acceptance code/mask for the set of 11-bit IDs a node
+// listens to, so frames for other nodes are dropped by the controller instead
+// of waking the node and taking RX queue slots.
+//
+// The controller can express one (single filter mode) or two (dual filter
+// mode) code/mask pairs. A pair accepts every ID that matches the code on
+// the bits the mask leaves significant, so IDs differing in N bits cost 2^N
+// accepted IDs. canFilterForIds() tries the single filter and every split of
+// the list into two groups, and keeps whichever layout accepts the fewest
+// extra IDs. PythonUtils/can_filter_check.py builds this file on the host and
+// checks it against a model for every node's subscribed_ids.
+//
+// Bit layout for standard frames (mask bit 1 = don't care):
+//   single: ID at 31:21, RTR at 20, first two data bytes at 15:0
+//   dual:   filter 1 ID at 31:21, RTR at 20, data byte 1 at 19:16 and 3:0
+//           filter 2 ID at 15:5, RTR at 4
+
+#define CAN_FILTER_MAX_IDS     8
+#define CAN_FILTER_SINGLE_DONT_CARE 0x001FFFFFUL   // RTR and data bytes
+#define CAN_FILTER_DUAL_DONT_CARE   0x001F001FUL   // RTR and data nibbles of both filters
+
+// One code/mask pair over the 11 ID bits; mask bit 1 = don't care
+struct CanIdMatch {
+  uint16_t code;
+  uint16_t mask;
+};
+
+twai_filter_config_t canFilterForIds(const uint16_t* ids, size_t count);
+// Software model of the controller, used to log what a filter lets through
+bool canFilterAccepts(const twai_filter_config_t& filter, uint16_t id);
+uint16_t canFilterAcceptedCount(const twai_filter_config_t& filter);
+void canFilterPrint(Print& out, const twai_filter_config_t& filter);
@@ -0,0 +1,87 @@
+#include "LavliCanHeartbeat.h"
+#include <driver/twai.h>
+#include <LavliLog.h>
+
+static uint8_t myNode = 0;
+static uint8_t announce[6];
+static uint8_t nodeStatus = 0;
+static unsigned long lastHeartbeat = 0;
+
+static bool sendStatusFrame(const uint8_t* data, uint8_t length) {
+  twai_message_t message;
+  message.identifier = canResponseId(CAN_CLASS_STATUS, myNode);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = length;
+  memcpy(message.data, data, length);
+
+  // Never block the loop for presence traffic; the next period retries
+  return twai_transmit(&message, 0) == ESP_OK;
+}
+
+void heartbeatBegin(uint8_t node, uint8_t type, uint8_t versionMajor, uint8_t versionMinor,
+                    uint8_t capabilities, uint8_t channels) {
+  myNode = node;
+  announce[0] = LAVLI_MSG_ANNOUNCE;
+  announce[1] = type;
+  announce[2] = versionMajor;
+  announce[3] = versionMinor;
+  announce[4] = capabilities;
+  announce[5] = channels;
+
+  if (heartbeatAnnounce()) {
+    LOG_INFO("[CAN] Announced node 0x%02X, firmware %d.%d", node, versionMajor, versionMinor);
+  } else {
+    LOG_WARN("[CAN] Announce failed, will announce again on DISCOVER");
+  }
+  lastHeartbeat = millis();
+}
+
+bool heartbeatAnnounce() {
+  return sendStatusFrame(announce, sizeof(announce));
+}
+
+bool heartbeatBootReport(uint8_t resetReason, uint32_t canReadyMs, uint32_t setupMs) {
+  if (canReadyMs > 0xFFFF) canReadyMs = 0xFFFF;
+  if (setupMs > 0xFFFF) setupMs = 0xFFFF;
+
+  uint8_t data[6] = {
+    LAVLI_MSG_BOOT,
+    resetReason,
+    (uint8_t)(canReadyMs >> 8),
+    (uint8_t)(canReadyMs & 0xFF),
+    (uint8_t)(setupMs >> 8),
+    (uint8_t)(setupMs & 0xFF),
+  };
+  return sendStatusFrame(data, sizeof(data));
+}
+
+void heartbeatService() {
+  unsigned long now = millis();
+  if (now - lastHeartbeat < HEARTBEAT_PERIOD_MS) return;
+  lastHeartbeat = now;
+
+  uint32_t uptime = now / 1000;
+  if (uptime > 0xFFFF) uptime = 0xFFFF;
+
+  uint8_t data[4] = {
+    LAVLI_MSG_HEARTBEAT,
+    nodeStatus,
+    (uint8_t)(uptime >> 8),
+    (uint8_t)(uptime & 0xFF),
+  };
+  sendStatusFrame(data, sizeof(data));
+}
+
+void heartbeatSetStatus(uint8_t status) {
+  nodeStatus = status;
+}
+
+const char* heartbeatTypeName(uint8_t type) {
+  switch (type) {
+    case LAVLI_TYPE_OUTPUT: return "output";
+    case LAVLI_TYPE_MOTOR:  return "motor";
+    case LAVLI_TYPE_SENSOR: return "sensor";
+    default:                return "unknown";
+  }
+}
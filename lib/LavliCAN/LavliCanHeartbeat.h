@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include "LavliCanIds.h"
+
+// Node announce and heartbeat
+//
+// A node announces itself once at boot with its type, firmware version and
+// capabilities, then sends a two-byte heartbeat every second. The master
+// builds its presence table from these frames and treats a node as gone
+// after a few missed heartbeats. A broadcast DISCOVER makes every node
+// announce again, so a master that boots after the nodes still learns what
+// each one is.
+//
+// Once setup() is done the node also sends a boot report with the reset
+// reason and how long it took to start (see LavliBoot.h).
+//
+// All three are status-class responses from the node:
+//
+//   ANNOUNCE  [0x50, type, version major, version minor, capabilities, channels]
+//   HEARTBEAT [0x51, status, uptime s (high), uptime s (low)]
+//   BOOT      [0x52, reset reason, CAN ready ms (2), setup done ms (2)]
+//
+// status is 0 when healthy, otherwise a node-specific fault code. Uptime
+// saturates at 65535 s; it only needs to show the master that a node rebooted.
+// The reset reason is an esp_reset_reason_t; times are from application start.
+//
+//   heartbeatBegin(MY_NODE_ID, LAVLI_TYPE_SENSOR, FIRMWARE_VERSION_MAJOR,
+//                  FIRMWARE_VERSION_MINOR, LAVLI_CAP_ANALOG | LAVLI_CAP_DIGITAL, 8);
+//   ...
+//   heartbeatService();   // from loop()
+
+#define LAVLI_MSG_ANNOUNCE     0x50
+#define LAVLI_MSG_HEARTBEAT    0x51
+#define LAVLI_MSG_BOOT         0x52
+
+#define HEARTBEAT_PERIOD_MS    1000
+
+// Node types
+#define LAVLI_TYPE_UNKNOWN     0
+#define LAVLI_TYPE_OUTPUT      1   // Switched output board
+#define LAVLI_TYPE_MOTOR       2   // Motor controller
+#define LAVLI_TYPE_SENSOR      3   // Analog/digital sensor node
+
+// Capability bits
+#define LAVLI_CAP_OUTPUTS      0x01
+#define LAVLI_CAP_MOTOR        0x02
+#define LAVLI_CAP_ANALOG       0x04
+#define LAVLI_CAP_DIGITAL      0x08
+#define LAVLI_CAP_TIME_SYNC    0x10
+#define LAVLI_CAP_OTA          0x20  // Firmware update over CAN, see LavliCanOta.h
+#define LAVLI_CAP_PWM          0x40  // Outputs take a PWM duty and soft-start ramp
+
+void heartbeatBegin(uint8_t node, uint8_t type, uint8_t versionMajor, uint8_t versionMinor,
+                    uint8_t capabilities, uint8_t channels);
+// Sends the announce frame; also the reply to LAVLI_CMD_DISCOVER
+bool heartbeatAnnounce();
+// Sends the boot report; call once at the end of setup()
+bool heartbeatBootReport(uint8_t resetReason, uint32_t canReadyMs, uint32_t setupMs);
+// Sends a heartbeat when one is due; call from loop()
+void heartbeatService();
+void heartbeatSetStatus(uint8_t status);
+const char* heartbeatTypeName(uint8_t type);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lavli CAN ID allocation
+//
+// Every 11-bit standard ID is built from three fields:
+//
+//   bit 10..8  class     priority band, lower wins arbitration
+//   bit 7      direction 0 = request from the master, 1 = response from a node
+//   bit 6..0   node      target node for requests, sender for responses
+//
+// so the priority of a frame follows from what it carries rather than from
+// which node it happens to address. A stop command to any node beats every
+// control, telemetry or bulk frame on the bus, and the master can tell a
+// node's reply from its own request by the ID alone.
+//
+// The payload keeps its existing layout (data[0] is the command/response
+// code), so nodes dispatch on the opcode and only use the ID to filter.
+
+// Priority classes, highest priority first
+#define CAN_CLASS_SAFETY     0   // Stop/disable commands
+#define CAN_CLASS_TIME       1   // Time synchronisation
+#define CAN_CLASS_CONTROL    2   // Actuator commands
+#define CAN_CLASS_STATUS     3   // Acks, status and error responses
+#define CAN_CLASS_TELEMETRY  4   // Sensor requests and readings
+#define CAN_CLASS_CONFIG     5   // Configuration reads/writes
+#define CAN_CLASS_BULK       6   // Segmented transfers (firmware, logs)
+#define CAN_CLASS_RESERVED   7
+
+#define CAN_DIR_REQUEST      0
+#define CAN_DIR_RESPONSE     1
+
+// Node IDs
+#define LAVLI_NODE_BROADCAST   0x00  // Requests addressed to every node
+#define LAVLI_NODE_OUTPUT_120V 0x01  // 120V output board (Lavli 12v Node, AC_120V_BOARD)
+#define LAVLI_NODE_OUTPUT_12V  0x02  // 12V output board (Lavli 12v Node, DC_12V_BOARD)
+#define LAVLI_NODE_MOTOR       0x03  // Motor controller (DC or AC board)
+#define LAVLI_NODE_SENSOR      0x04  // Sensor node
+#define LAVLI_NODE_GROUP_BASE  0x70  // 0x70..0x7F reserved for multicast groups
+#define LAVLI_NODE_MAX         0x7F
+
+// Multicast groups; a node subscribes to a group by adding the group's
+// request IDs to its acceptance filter
+#define LAVLI_GROUP_ACTUATORS  0x70  // Output boards and motor controllers
+#define LAVLI_GROUP_SENSORS    0x71  // Sensor nodes
+
+// Group commands (data[0]), understood by every member of the addressed
+// group. One frame reaches all members however many nodes are on the bus.
+// Members ack group commands like any other command but never send an
+// error response to a group address, so a command a member does not
+// handle costs no bus time.
+#define LAVLI_CMD_STOP_ALL     0x08  // Safety: motors stop, outputs off
+#define LAVLI_CMD_TIME_SYNC    0x09  // Time: SYNC [0x09, seq], see LavliCanTime.h
+#define LAVLI_CMD_SNAPSHOT     0x0A  // Telemetry: report every input now
+#define LAVLI_CMD_DISCOVER     0x0B  // Status, broadcast: every node announces itself
+
+#define CAN_ID_CLASS_SHIFT   8
+#define CAN_ID_DIR_SHIFT     7
+#define CAN_ID_NODE_MASK     0x7F
+
+static inline constexpr uint16_t canId(uint8_t cls, uint8_t dir, uint8_t node) {
+  return (uint16_t)(((cls & 0x07) << CAN_ID_CLASS_SHIFT) | ((dir & 0x01) << CAN_ID_DIR_SHIFT) |
+                    (node & CAN_ID_NODE_MASK));
+}
+
+// Request from the master to a node
+static inline constexpr uint16_t canRequestId(uint8_t cls, uint8_t node) {
+  return canId(cls, CAN_DIR_REQUEST, node);
+}
+
+// Response from a node to the master
+static inline constexpr uint16_t canResponseId(uint8_t cls, uint8_t node) {
+  return canId(cls, CAN_DIR_RESPONSE, node);
+}
+
+static inline constexpr uint8_t canIdClass(uint32_t id) {
+  return (id >> CAN_ID_CLASS_SHIFT) & 0x07;
+}
+
+static inline constexpr bool canIdIsResponse(uint32_t id) {
+  return (id >> CAN_ID_DIR_SHIFT) & 0x01;
+}
+
+static inline constexpr uint8_t canIdNode(uint32_t id) {
+  return id & CAN_ID_NODE_MASK;
+}
+
+// True for requests addressed to this node, in any class
+static inline constexpr bool canIdIsRequestFor(uint32_t id, uint8_t node) {
+  return !canIdIsResponse(id) && canIdNode(id) == node;
+}
+
+// True for requests addressed to this node directly, to one of its groups
+// or to every node
+static inline bool canIdIsRequestForAny(uint32_t id, uint8_t node, const uint8_t* groups, size_t groupCount) {
+  if (canIdIsResponse(id)) return false;
+  uint8_t target = canIdNode(id);
+  if (target == node || target == LAVLI_NODE_BROADCAST) return true;
+  for (size_t i = 0; i < groupCount; i++) {
+    if (target == groups[i]) return true;
+  }
+  return false;
+}
+
+static inline const char* canClassName(uint8_t cls) {
+  static const char* const names[] = {
+    "safety", "time", "control", "status", "telemetry", "config", "bulk", "reserved"
+  };
+  return names[cls & 0x07];
+}
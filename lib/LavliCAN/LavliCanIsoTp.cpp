@@ -0,0 +1,419 @@
+#include "LavliCanIsoTp.h"
+#include <driver/twai.h>
+#include <esp_timer.h>
+#include <LavliLog.h>
+
+#define PCI_SINGLE       0x0
+#define PCI_FIRST        0x1
+#define PCI_CONSECUTIVE  0x2
+#define PCI_FLOW         0x3
+
+#define FLOW_CONTINUE    0x0
+#define FLOW_WAIT        0x1
+#define FLOW_OVERFLOW    0x2
+
+enum TxState : uint8_t {
+  TX_IDLE,
+  TX_SEND_FIRST,      // First frame not yet accepted by the TX queue
+  TX_WAIT_FLOW,
+  TX_SENDING,
+};
+
+struct RxSlot {
+  bool active;
+  uint8_t node;
+  uint8_t next_seq;
+  uint8_t block_count;
+  uint16_t length;
+  uint16_t received;
+  unsigned long last_frame;
+  bool flow_pending;      // A CONTINUE the TX queue refused; resent from isoTpService()
+  uint8_t data[ISOTP_MAX_PAYLOAD];
+};
+
+struct TxSlot {
+  TxState state;
+  uint8_t node;
+  uint8_t next_seq;
+  uint8_t block_size;
+  uint8_t block_left;
+  uint8_t waits;
+  uint32_t stmin_us;
+  int64_t last_frame_us;
+  unsigned long timer;
+  uint16_t length;
+  uint16_t sent;
+  uint8_t data[ISOTP_MAX_PAYLOAD];
+};
+
+static RxSlot rxSlots[ISOTP_RX_SLOTS];
+static TxSlot txSlots[ISOTP_TX_SLOTS];
+static IsoTpReceiveFn onReceive = NULL;
+static bool isMaster = false;
+static uint8_t myNode = 0;
+
+static uint32_t rxComplete = 0;
+static uint32_t rxAborted = 0;
+static uint32_t txComplete = 0;
+static uint32_t txAborted = 0;
+static uint32_t overflows = 0;
+
+// An OVERFLOW reply the TX queue refused; there is no slot to keep it in
+static bool overflowPending = false;
+static uint8_t overflowNode = 0;
+
+static bool sendFrame(uint8_t node, const uint8_t* data, uint8_t length) {
+  twai_message_t message;
+  message.identifier = isMaster ? canRequestId(CAN_CLASS_BULK, node) : canResponseId(CAN_CLASS_BULK, node);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = length;
+  memcpy(message.data, data, length);
+  // Never block; a full queue is retried from isoTpService()
+  return twai_transmit(&message, 0) == ESP_OK;
+}
+
+static bool sendFlow(uint8_t node, uint8_t status) {
+  uint8_t frame[3] = {(uint8_t)((PCI_FLOW << 4) | status), ISOTP_BLOCK_SIZE, ISOTP_STMIN};
+  return sendFrame(node, frame, sizeof(frame));
+}
+
+static uint32_t decodeStmin(uint8_t stmin) {
+  if (stmin <= 0x7F) return (uint32_t)stmin * 1000;
+  if (stmin >= 0xF1 && stmin <= 0xF9) return (uint32_t)(stmin - 0xF0) * 100;
+  return 127000;    // Reserved values mean the longest gap
+}
+
+// A dropped flow control frame would leave the sender waiting out its
+// whole timeout, so a refused one is kept and resent from isoTpService()
+static void replyFlow(RxSlot* slot, uint8_t node, uint8_t status) {
+  bool sent = sendFlow(node, status);
+  if (status == FLOW_OVERFLOW) {
+    overflowPending = !sent;
+    overflowNode = node;
+  } else if (slot) {
+    slot->flow_pending = !sent;
+  }
+}
+
+// ---- Receive ----
+
+static RxSlot* findRx(uint8_t node) {
+  for (uint8_t i = 0; i < ISOTP_RX_SLOTS; i++) {
+    if (rxSlots[i].active && rxSlots[i].node == node) return &rxSlots[i];
+  }
+  return NULL;
+}
+
+static void handleFirst(uint8_t node, const uint8_t* data, uint8_t length) {
+  if (length < 8) return;
+  uint16_t total = ((data[0] & 0x0F) << 8) | data[1];
+  if (total < 8) return;
+
+  RxSlot* slot = findRx(node);
+  if (slot) {
+    // The sender gave up on the last transfer and started again
+    rxAborted++;
+  } else {
+    for (uint8_t i = 0; i < ISOTP_RX_SLOTS && !slot; i++) {
+      if (!rxSlots[i].active) slot = &rxSlots[i];
+    }
+  }
+
+  if (!slot || total > ISOTP_MAX_PAYLOAD) {
+    overflows++;
+    if (slot) slot->active = false;
+    LOG_WARN("[ISOTP] Cannot take %d bytes from node 0x%02X", total, node);
+    replyFlow(NULL, node, FLOW_OVERFLOW);
+    return;
+  }
+
+  slot->active = true;
+  slot->node = node;
+  slot->length = total;
+  memcpy(slot->data, &data[2], 6);
+  slot->received = 6;
+  slot->next_seq = 1;
+  slot->block_count = 0;
+  slot->last_frame = millis();
+  replyFlow(slot, node, FLOW_CONTINUE);
+}
+
+static void handleConsecutive(uint8_t node, const uint8_t* data, uint8_t length) {
+  RxSlot* slot = findRx(node);
+  if (!slot) return;
+
+  if ((data[0] & 0x0F) != slot->next_seq) {
+    LOG_WARN("[ISOTP] Sequence error from node 0x%02X, transfer dropped", node);
+    slot->active = false;
+    rxAborted++;
+    return;
+  }
+
+  // Every frame but the last is full; a short one would shift the rest
+  // of the payload, so the transfer is dropped instead
+  uint16_t chunk = slot->length - slot->received;
+  if (chunk > 7) chunk = 7;
+  if (length < chunk + 1) {
+    LOG_WARN("[ISOTP] Short frame from node 0x%02X (%d bytes), transfer dropped", node, length);
+    slot->active = false;
+    rxAborted++;
+    return;
+  }
+  memcpy(&slot->data[slot->received], &data[1], chunk);
+  slot->received += chunk;
+  slot->next_seq = (slot->next_seq + 1) & 0x0F;
+  slot->last_frame = millis();
+
+  if (slot->received >= slot->length) {
+    slot->active = false;
+    rxComplete++;
+    if (onReceive) onReceive(node, slot->data, slot->length);
+    return;
+  }
+
+  if (ISOTP_BLOCK_SIZE > 0 && ++slot->block_count >= ISOTP_BLOCK_SIZE) {
+    slot->block_count = 0;
+    replyFlow(slot, node, FLOW_CONTINUE);
+  }
+}
+
+// ---- Transmit ----
+
+static TxSlot* findTx(uint8_t node) {
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    if (txSlots[i].state != TX_IDLE && txSlots[i].node == node) return &txSlots[i];
+  }
+  return NULL;
+}
+
+static bool stminElapsed(const TxSlot& slot) {
+  return slot.stmin_us == 0 || esp_timer_get_time() - slot.last_frame_us >= slot.stmin_us;
+}
+
+// Leave room in the shared TX queue for everything else
+static bool queueHasRoom() {
+  twai_status_info_t status;
+  return twai_get_status_info(&status) != ESP_OK || status.msgs_to_tx < ISOTP_TX_QUEUE_SHARE;
+}
+
+static void pumpTx(TxSlot& slot) {
+  if (!queueHasRoom()) return;
+
+  if (slot.state == TX_SEND_FIRST) {
+    uint8_t frame[8] = {(uint8_t)((PCI_FIRST << 4) | (slot.length >> 8)), (uint8_t)(slot.length & 0xFF)};
+    memcpy(&frame[2], slot.data, 6);
+    if (!sendFrame(slot.node, frame, 8)) return;
+    slot.sent = 6;
+    slot.next_seq = 1;
+    slot.waits = 0;
+    slot.state = TX_WAIT_FLOW;
+    slot.timer = millis();
+    return;
+  }
+
+  while (slot.state == TX_SENDING && stminElapsed(slot) && queueHasRoom()) {
+    uint8_t frame[8];
+    uint16_t chunk = slot.length - slot.sent;
+    if (chunk > 7) chunk = 7;
+    frame[0] = (PCI_CONSECUTIVE << 4) | slot.next_seq;
+    memcpy(&frame[1], &slot.data[slot.sent], chunk);
+    if (!sendFrame(slot.node, frame, chunk + 1)) return;
+
+    slot.sent += chunk;
+    slot.next_seq = (slot.next_seq + 1) & 0x0F;
+    slot.last_frame_us = esp_timer_get_time();
+
+    if (slot.sent >= slot.length) {
+      slot.state = TX_IDLE;
+      txComplete++;
+      return;
+    }
+    if (slot.block_size > 0 && --slot.block_left == 0) {
+      slot.state = TX_WAIT_FLOW;
+      slot.timer = millis();
+      return;
+    }
+  }
+}
+
+static void handleFlow(uint8_t node, const uint8_t* data, uint8_t length) {
+  TxSlot* slot = findTx(node);
+  if (!slot || slot->state != TX_WAIT_FLOW || length < 3) return;
+
+  switch (data[0] & 0x0F) {
+    case FLOW_CONTINUE:
+      slot->block_size = data[1];
+      slot->block_left = data[1];
+      slot->stmin_us = decodeStmin(data[2]);
+      slot->last_frame_us = 0;
+      slot->state = TX_SENDING;
+      pumpTx(*slot);
+      break;
+
+    case FLOW_WAIT:
+      slot->timer = millis();
+      if (++slot->waits > ISOTP_MAX_WAITS) {
+        LOG_WARN("[ISOTP] Node 0x%02X kept us waiting, transfer dropped", node);
+        slot->state = TX_IDLE;
+        txAborted++;
+      }
+      break;
+
+    default:
+      LOG_WARN("[ISOTP] Node 0x%02X has no room for %d bytes", node, slot->length);
+      slot->state = TX_IDLE;
+      txAborted++;
+      break;
+  }
+}
+
+// ---- Public ----
+
+static void begin(IsoTpReceiveFn receive) {
+  memset(rxSlots, 0, sizeof(rxSlots));
+  memset(txSlots, 0, sizeof(txSlots));
+  onReceive = receive;
+}
+
+void isoTpBeginMaster(IsoTpReceiveFn receive) {
+  isMaster = true;
+  myNode = 0;
+  begin(receive);
+}
+
+void isoTpBeginNode(uint8_t node, IsoTpReceiveFn receive) {
+  isMaster = false;
+  myNode = node;
+  begin(receive);
+}
+
+bool isoTpHandleFrame(uint32_t id, const uint8_t* data, uint8_t length) {
+  if (canIdClass(id) != CAN_CLASS_BULK) return false;
+  uint8_t node = canIdNode(id);
+  if (isMaster) {
+    if (!canIdIsResponse(id) || node == LAVLI_NODE_BROADCAST || node >= LAVLI_NODE_GROUP_BASE) return false;
+  } else if (id != canRequestId(CAN_CLASS_BULK, myNode)) {
+    return false;
+  }
+  if (length < 1) return true;
+
+  switch (data[0] >> 4) {
+    case PCI_SINGLE: {
+      uint8_t size = data[0] & 0x0F;
+      if (size >= 1 && size <= 7 && size < length) {
+        rxComplete++;
+        if (onReceive) onReceive(node, &data[1], size);
+      }
+      break;
+    }
+    case PCI_FIRST:       handleFirst(node, data, length); break;
+    case PCI_CONSECUTIVE: handleConsecutive(node, data, length); break;
+    case PCI_FLOW:        handleFlow(node, data, length); break;
+  }
+  return true;
+}
+
+bool isoTpSend(uint8_t node, const uint8_t* data, uint16_t length) {
+  if (!isMaster) node = myNode;
+  if (length == 0 || length > ISOTP_MAX_PAYLOAD) return false;
+  if (findTx(node)) return false;
+
+  if (length <= 7) {
+    uint8_t frame[8] = {(uint8_t)((PCI_SINGLE << 4) | length)};
+    memcpy(&frame[1], data, length);
+    if (!sendFrame(node, frame, length + 1)) return false;
+    txComplete++;
+    return true;
+  }
+
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    TxSlot& slot = txSlots[i];
+    if (slot.state != TX_IDLE) continue;
+    slot.node = node;
+    slot.length = length;
+    slot.sent = 0;
+    memcpy(slot.data, data, length);
+    slot.state = TX_SEND_FIRST;
+    pumpTx(slot);
+    return true;
+  }
+  return false;
+}
+
+void isoTpService() {
+  unsigned long now = millis();
+
+  if (overflowPending) replyFlow(NULL, overflowNode, FLOW_OVERFLOW);
+  for (uint8_t i = 0; i < ISOTP_RX_SLOTS; i++) {
+    if (rxSlots[i].active && rxSlots[i].flow_pending) replyFlow(&rxSlots[i], rxSlots[i].node, FLOW_CONTINUE);
+  }
+
+  for (uint8_t i = 0; i < ISOTP_RX_SLOTS; i++) {
+    RxSlot& slot = rxSlots[i];
+    if (slot.active && now - slot.last_frame > ISOTP_TIMEOUT_MS) {
+      LOG_WARN("[ISOTP] Transfer from node 0x%02X timed out at %d of %d bytes", slot.node,
+               slot.received, slot.length);
+      slot.active = false;
+      rxAborted++;
+    }
+  }
+
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    TxSlot& slot = txSlots[i];
+    if (slot.state == TX_WAIT_FLOW && now - slot.timer > ISOTP_TIMEOUT_MS) {
+      LOG_WARN("[ISOTP] No flow control from node 0x%02X, transfer dropped", slot.node);
+      slot.state = TX_IDLE;
+      txAborted++;
+    } else if (slot.state == TX_SEND_FIRST || slot.state == TX_SENDING) {
+      pumpTx(slot);
+    }
+  }
+}
+
+bool isoTpTxReady() {
+  if (overflowPending) return true;
+  for (uint8_t i = 0; i < ISOTP_RX_SLOTS; i++) {
+    if (rxSlots[i].active && rxSlots[i].flow_pending) return true;
+  }
+  if (!queueHasRoom()) return false;
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    const TxSlot& slot = txSlots[i];
+    if (slot.state == TX_SEND_FIRST) return true;
+    if (slot.state == TX_SENDING && stminElapsed(slot)) return true;
+  }
+  return false;
+}
+
+bool isoTpTxIdle(uint8_t node) {
+  if (!isMaster) node = myNode;
+  if (findTx(node)) return false;
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    if (txSlots[i].state == TX_IDLE) return true;
+  }
+  return false;
+}
+
+bool isoTpBusy() {
+  for (uint8_t i = 0; i < ISOTP_RX_SLOTS; i++) {
+    if (rxSlots[i].active) return true;
+  }
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    if (txSlots[i].state != TX_IDLE) return true;
+  }
+  return false;
+}
+
+void isoTpPrint(Print& out) {
+  out.printf("[ISOTP] rx %lu complete, %lu aborted, %lu overflow; tx %lu complete, %lu aborted\n",
+             (unsigned long)rxComplete, (unsigned long)rxAborted, (unsigned long)overflows,
+             (unsigned long)txComplete, (unsigned long)txAborted);
+  for (uint8_t i = 0; i < ISOTP_RX_SLOTS; i++) {
+    const RxSlot& slot = rxSlots[i];
+    if (slot.active) out.printf("[ISOTP] rx node 0x%02X: %u/%u bytes\n", slot.node, slot.received, slot.length);
+  }
+  for (uint8_t i = 0; i < ISOTP_TX_SLOTS; i++) {
+    const TxSlot& slot = txSlots[i];
+    if (slot.state != TX_IDLE) out.printf("[ISOTP] tx node 0x%02X: %u/%u bytes\n", slot.node, slot.sent, slot.length);
+  }
+}
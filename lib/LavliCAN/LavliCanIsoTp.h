@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+#include "LavliCanIds.h"
+
+// Segmented transfers on the bulk class (ISO 15765-2 / ISO-TP framing)
+//
+// Payloads of up to ISOTP_MAX_PAYLOAD bytes between the master and one node.
+// data[0] of each frame is the protocol control byte:
+//
+//   Single     [0x0L, data x L]                      L = 1..7
+//   First      [0x1H, len low, data x 6]             length 8..4095, 12 bits
+//   Consecutive[0x2S, data x 7]                      S = sequence, 1..15, 0..
+//   Flow ctrl  [0x3F, block size, STmin]             F = 0 send, 1 wait, 2 overflow
+//
+// The master sends on canRequestId(CAN_CLASS_BULK, node) and nodes answer on
+// canResponseId(CAN_CLASS_BULK, node), so a transfer is identified by the
+// node and direction alone and the master can run one each way per node.
+//
+// The receiver paces the sender: after every ISOTP_BLOCK_SIZE consecutive
+// frames it sends another flow control frame, which keeps a burst inside the
+// default 5-frame TWAI RX queue of a node that only polls from loop(). Within
+// a block frames go out back to back, as fast as the TX queue drains, with no
+// fixed delays. Reassembly uses a fixed pool of ISOTP_RX_SLOTS buffers; a
+// first frame that does not fit gets an overflow flow control back.
+//
+// The bulk class loses arbitration to every other class, but the TWAI TX
+// queue itself is FIFO. Bulk frames therefore only take ISOTP_TX_QUEUE_SHARE
+// of its slots, so a control frame queued during a transfer waits behind at
+// most that many frames.
+//
+//   isoTpBeginNode(MY_NODE_ID, onBulkMessage);   // or isoTpBeginMaster()
+//   ...
+//   if (isoTpHandleFrame(msg.identifier, msg.data, msg.data_length_code)) return;
+//   ...
+//   isoTpService();                              // from loop()/scheduler
+
+#define ISOTP_MAX_PAYLOAD    512
+#define ISOTP_RX_SLOTS       4
+#define ISOTP_TX_SLOTS       2
+#define ISOTP_BLOCK_SIZE     4      // Consecutive frames per flow control, 0 = unlimited
+#define ISOTP_STMIN          0      // Requested gap between consecutive frames
+#define ISOTP_TIMEOUT_MS     1000   // Waiting for a flow control or consecutive frame
+#define ISOTP_MAX_WAITS      10     // Flow control WAITs accepted before aborting
+#define ISOTP_TX_QUEUE_SHARE 2      // Bulk frames allowed in the TWAI TX queue at once
+
+// A complete payload from `node` (on a node, always its own ID)
+typedef void (*IsoTpReceiveFn)(uint8_t node, const uint8_t* data, uint16_t length);
+
+void isoTpBeginMaster(IsoTpReceiveFn onReceive);
+void isoTpBeginNode(uint8_t node, IsoTpReceiveFn onReceive);
+
+// Feed every received frame; returns true if it was a bulk frame for us
+bool isoTpHandleFrame(uint32_t id, const uint8_t* data, uint8_t length);
+
+// Queues a payload for `node` (ignored on a node, which always sends to the
+// master). The data is copied. Returns false if it is too long, a transfer
+// to that node is already running or the TX pool is full.
+bool isoTpSend(uint8_t node, const uint8_t* data, uint16_t length);
+
+// Sends due consecutive frames, resends refused flow control and expires
+// stalled transfers
+void isoTpService();
+// True while a transfer or a refused flow control frame can go out now
+bool isoTpTxReady();
+// True if a new payload for `node` would be accepted by isoTpSend()
+bool isoTpTxIdle(uint8_t node);
+bool isoTpBusy();
+void isoTpPrint(Print& out);
@@ -0,0 +1,223 @@
+#include "LavliCanOta.h"
+#include "LavliCanIsoTp.h"
+#include <esp_ota_ops.h>
+#include <esp_rom_crc.h>
+#include <LavliLog.h>
+
+static OtaBusyFn isBusy = NULL;
+
+static bool active = false;
+static esp_ota_handle_t handle = 0;
+static const esp_partition_t* partition = NULL;
+static uint32_t imageSize = 0;
+static uint32_t imageCrc = 0;
+static uint32_t written = 0;
+static uint32_t runningCrc = 0;
+static unsigned long lastMessage = 0;
+
+static bool restartPending = false;
+static unsigned long restartRequested = 0;
+
+// The bulk TX share is small, so an ACK can be refused; the master waits
+// for every one, so a refused ACK is resent from otaService()
+static bool ackPending = false;
+static uint8_t ackStatus = 0;
+
+static uint32_t getU32(const uint8_t* data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static bool sendAck(uint8_t status) {
+  ackStatus = status;
+  uint8_t ack[6] = {
+    LAVLI_OTA_ACK,
+    status,
+    (uint8_t)(written >> 24),
+    (uint8_t)(written >> 16),
+    (uint8_t)(written >> 8),
+    (uint8_t)written,
+  };
+  ackPending = !isoTpSend(0, ack, sizeof(ack));
+  return !ackPending;
+}
+
+static void stopSession() {
+  if (active) esp_ota_abort(handle);
+  active = false;
+  handle = 0;
+}
+
+static void handleBegin(const uint8_t* data, uint16_t length) {
+  if (length < 9) return;
+  stopSession();
+  restartPending = false;
+  written = 0;
+
+  if (isBusy && isBusy()) {
+    LOG_WARN("[OTA] Busy, update refused");
+    sendAck(LAVLI_OTA_BUSY);
+    return;
+  }
+
+  imageSize = getU32(&data[1]);
+  imageCrc = getU32(&data[5]);
+  partition = esp_ota_get_next_update_partition(NULL);
+  if (!partition || imageSize == 0 || imageSize > partition->size) {
+    LOG_ERROR("[OTA] No partition for a %d byte image", imageSize);
+    sendAck(LAVLI_OTA_NO_PARTITION);
+    return;
+  }
+
+  // Sequential writes erase sector by sector as the image arrives instead
+  // of erasing the whole partition up front, so the loop keeps running
+  if (esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+    LOG_ERROR("[OTA] esp_ota_begin failed");
+    sendAck(LAVLI_OTA_NO_PARTITION);
+    return;
+  }
+
+  active = true;
+  runningCrc = 0;
+  lastMessage = millis();
+  LOG_INFO("[OTA] Receiving %d byte image", imageSize);
+  sendAck(LAVLI_OTA_OK);
+}
+
+static void handleBlock(const uint8_t* data, uint16_t length) {
+  if (!active) {
+    sendAck(LAVLI_OTA_NOT_STARTED);
+    return;
+  }
+  if (length <= OTA_HEADER_BYTES) return;
+  lastMessage = millis();
+
+  uint32_t offset = getU32(&data[1]);
+  uint32_t crc = getU32(&data[5]);
+  const uint8_t* block = &data[OTA_HEADER_BYTES];
+  uint16_t size = length - OTA_HEADER_BYTES;
+
+  // A retransmission of a block we already have just re-syncs the master
+  if (offset != written) {
+    sendAck(LAVLI_OTA_BAD_OFFSET);
+    return;
+  }
+  if (esp_rom_crc32_le(0, block, size) != crc || written + size > imageSize) {
+    LOG_WARN("[OTA] Bad block at offset %d", offset);
+    sendAck(LAVLI_OTA_BAD_CRC);
+    return;
+  }
+  if (esp_ota_write(handle, block, size) != ESP_OK) {
+    LOG_ERROR("[OTA] Flash write failed at offset %d", offset);
+    sendAck(LAVLI_OTA_WRITE_FAILED);
+    stopSession();
+    return;
+  }
+
+  runningCrc = esp_rom_crc32_le(runningCrc, block, size);
+  written += size;
+  sendAck(LAVLI_OTA_OK);
+}
+
+static void handleEnd() {
+  if (!active) {
+    sendAck(LAVLI_OTA_NOT_STARTED);
+    return;
+  }
+
+  if (written != imageSize || runningCrc != imageCrc) {
+    LOG_ERROR("[OTA] Image incomplete or corrupt (%d of %d bytes)", written, imageSize);
+    stopSession();
+    sendAck(LAVLI_OTA_BAD_CRC);
+    return;
+  }
+
+  // esp_ota_end() checks the image header, segments and appended hash
+  esp_err_t result = esp_ota_end(handle);
+  active = false;
+  if (result != ESP_OK || esp_ota_set_boot_partition(partition) != ESP_OK) {
+    LOG_ERROR("[OTA] Image rejected");
+    sendAck(LAVLI_OTA_VERIFY_FAILED);
+    return;
+  }
+
+  LOG_INFO("[OTA] Image verified, restarting into it");
+  sendAck(LAVLI_OTA_OK);
+  restartPending = true;
+  restartRequested = millis();
+}
+
+void otaBegin(OtaBusyFn busy) {
+  isBusy = busy;
+}
+
+bool otaHandleMessage(const uint8_t* data, uint16_t length) {
+  if (length < 1) return false;
+
+  switch (data[0]) {
+    case LAVLI_OTA_BEGIN: handleBegin(data, length); return true;
+    case LAVLI_OTA_BLOCK: handleBlock(data, length); return true;
+    case LAVLI_OTA_END:   handleEnd(); return true;
+    case LAVLI_OTA_ABORT:
+      if (active) LOG_WARN("[OTA] Aborted by master at %d bytes", written);
+      stopSession();
+      ackPending = false;
+      return true;
+    default:
+      return false;
+  }
+}
+
+void otaService() {
+  if (ackPending) sendAck(ackStatus);
+
+  if (active && millis() - lastMessage > OTA_SESSION_TIMEOUT_MS) {
+    LOG_WARN("[OTA] Master went quiet, update dropped at %d bytes", written);
+    stopSession();
+  }
+
+  // The final ACK goes out before the restart
+  if (restartPending && !ackPending && millis() - restartRequested > OTA_RESTART_DELAY_MS) {
+    // Never restart under a running motor; the new image waits until idle
+    if (isBusy && isBusy()) return;
+    ESP.restart();
+  }
+}
+
+bool otaInProgress() {
+  return active;
+}
+
+void otaConfirmBoot() {
+  esp_ota_img_states_t state;
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+    esp_ota_mark_app_valid_cancel_rollback();
+    LOG_INFO("[OTA] New firmware confirmed");
+  }
+}
+
+void otaPrint(Print& out) {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  out.printf("[OTA] Running from %s\n", running ? running->label : "?");
+  if (active) {
+    out.printf("[OTA] Receiving: %lu of %lu bytes\n", (unsigned long)written, (unsigned long)imageSize);
+  } else if (restartPending) {
+    out.println("[OTA] New image ready, restart pending");
+  } else {
+    out.println("[OTA] Idle");
+  }
+}
+
+const char* otaStatusName(uint8_t status) {
+  switch (status) {
+    case LAVLI_OTA_OK:            return "ok";
+    case LAVLI_OTA_BAD_CRC:       return "bad crc";
+    case LAVLI_OTA_BAD_OFFSET:    return "bad offset";
+    case LAVLI_OTA_WRITE_FAILED:  return "write failed";
+    case LAVLI_OTA_NO_PARTITION:  return "no partition";
+    case LAVLI_OTA_VERIFY_FAILED: return "verify failed";
+    case LAVLI_OTA_NOT_STARTED:   return "not started";
+    case LAVLI_OTA_BUSY:          return "busy";
+    default:                      return "unknown";
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include "LavliCanIds.h"
+
+// Node firmware update over CAN
+//
+// The master streams an application image to a node as bulk payloads (see
+// LavliCanIsoTp.h); the node writes it into its next OTA partition and boots
+// it once the whole image checks out. data[0] is the opcode, multi-byte
+// fields are big endian:
+//
+//   BEGIN  [0x60, size x 4, image crc32 x 4]                 master -> node
+//   BLOCK  [0x61, offset x 4, block crc32 x 4, data x n]     master -> node
+//   END    [0x62]                                             master -> node
+//   ABORT  [0x63]                                             master -> node
+//   ACK    [0x68, status, next offset x 4]                    node -> master
+//
+// Every BEGIN, BLOCK and END gets an ACK carrying the offset the node
+// expects next. The master keeps up to OTA_WINDOW blocks in flight; a block
+// that arrives out of order or with a bad CRC is answered with the offset to
+// resume from and the master goes back to it. CRCs are the standard CRC-32
+// (esp_rom_crc32_le with a 0 seed, zlib.crc32 in Python).
+//
+// END checks the image CRC, lets esp_ota_end() verify the image and selects
+// the new partition; the node restarts shortly after acking, or once it is
+// idle if it is busy (e.g. a motor is turning). The new firmware calls
+// otaConfirmBoot() once it is up on the bus, which cancels the bootloader's
+// rollback if that is enabled.
+//
+//   otaBegin(motorRunning);                        // busy check, may be NULL
+//   ...
+//   // from the isoTpBeginNode() receive callback
+//   if (otaHandleMessage(data, length)) return;
+//   ...
+//   otaService();                                  // from loop()
+
+#define LAVLI_OTA_BEGIN        0x60
+#define LAVLI_OTA_BLOCK        0x61
+#define LAVLI_OTA_END          0x62
+#define LAVLI_OTA_ABORT        0x63
+#define LAVLI_OTA_ACK          0x68
+
+// ACK status
+#define LAVLI_OTA_OK           0x00
+#define LAVLI_OTA_BAD_CRC      0x01  // Block or image CRC mismatch
+#define LAVLI_OTA_BAD_OFFSET   0x02  // Block out of order; resume from next offset
+#define LAVLI_OTA_WRITE_FAILED 0x03
+#define LAVLI_OTA_NO_PARTITION 0x04  // No OTA partition, or image too large for it
+#define LAVLI_OTA_VERIFY_FAILED 0x05 // esp_ota_end() rejected the image
+#define LAVLI_OTA_NOT_STARTED  0x06  // BLOCK or END without a BEGIN
+#define LAVLI_OTA_BUSY         0x07  // Node refuses to update right now
+
+#define OTA_HEADER_BYTES       9
+#define OTA_BLOCK_BYTES        496   // Fits a 512-byte bulk payload with the header
+#define OTA_WINDOW             4     // Blocks in flight before waiting for an ack
+#define OTA_SESSION_TIMEOUT_MS 15000 // Node drops an update the master stopped sending
+#define OTA_RESTART_DELAY_MS   250   // Lets the final ack leave before restarting
+
+// Returns true while the node must not restart or start an update
+typedef bool (*OtaBusyFn)();
+
+void otaBegin(OtaBusyFn busy);
+// Feed reassembled bulk payloads; returns true if it was an OTA message
+bool otaHandleMessage(const uint8_t* data, uint16_t length);
+void otaService();
+bool otaInProgress();
+// Marks the running image good; call once the node is up on the bus
+void otaConfirmBoot();
+void otaPrint(Print& out);
+const char* otaStatusName(uint8_t status);
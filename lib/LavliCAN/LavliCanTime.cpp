@@ -0,0 +1,174 @@
+#include "LavliCanTime.h"
+#include <driver/twai.h>
+#include <esp_timer.h>
+#include <LavliLog.h>
+
+#define TIME_SYNC_MAX_DRIFT    0.0005   // 500 ppm, far beyond any crystal
+
+// ---- Master ----
+
+static uint8_t syncSequence = 0;
+
+bool timeSyncSendRound(uint8_t target) {
+  twai_status_info_t status;
+  if (twai_get_status_info(&status) != ESP_OK || status.msgs_to_tx > 0) return false;
+
+  twai_message_t message;
+  message.identifier = canRequestId(CAN_CLASS_TIME, target);
+  message.extd = 0;
+  message.rtr = 0;
+  message.data_length_code = 2;
+  message.data[0] = LAVLI_CMD_TIME_SYNC;
+  message.data[1] = ++syncSequence;
+  if (twai_transmit(&message, 0) != ESP_OK) return false;
+
+  // msgs_to_tx drops to 0 from the TX-done interrupt, i.e. when the frame
+  // has been sent and acked; that is the instant the nodes receive it too
+  int64_t start = esp_timer_get_time();
+  int64_t sent;
+  do {
+    sent = esp_timer_get_time();
+    if (sent - start > TIME_SYNC_TX_WAIT_US) return false;
+  } while (twai_get_status_info(&status) == ESP_OK && status.msgs_to_tx > 0);
+
+  message.data_length_code = 8;
+  message.data[0] = LAVLI_CMD_TIME_FOLLOW_UP;
+  message.data[1] = syncSequence;
+  for (uint8_t i = 0; i < 6; i++) {
+    message.data[2 + i] = (sent >> (40 - 8 * i)) & 0xFF;
+  }
+  return twai_transmit(&message, 0) == ESP_OK;
+}
+
+// ---- Node ----
+
+struct SyncSample {
+  int64_t local_us;
+  int64_t offset_us;    // master - local
+};
+
+static SyncSample samples[TIME_SYNC_WINDOW];
+static uint8_t sampleCount = 0;
+static uint8_t sampleNext = 0;
+
+static uint8_t pendingSequence = 0;
+static int64_t pendingRxUs = 0;
+static bool pendingValid = false;
+
+// offset(x) = fitOffset + fitDrift * (x - fitLocal)
+static int64_t fitLocal = 0;
+static int64_t fitOffset = 0;
+static double fitDrift = 0;
+
+static uint32_t acceptedCount = 0;
+static uint32_t rejectedCount = 0;
+static uint8_t rejectRun = 0;
+static int32_t lastResidual = 0;
+
+static int64_t offsetAt(int64_t localUs) {
+  return fitOffset + (int64_t)(fitDrift * (double)(localUs - fitLocal));
+}
+
+static void refit() {
+  // Least squares over the window, relative to the newest sample so the
+  // doubles only hold small numbers
+  const SyncSample& newest = samples[(sampleNext + TIME_SYNC_WINDOW - 1) % TIME_SYNC_WINDOW];
+  double meanX = 0, meanY = 0;
+  for (uint8_t i = 0; i < sampleCount; i++) {
+    meanX += (double)(samples[i].local_us - newest.local_us);
+    meanY += (double)(samples[i].offset_us - newest.offset_us);
+  }
+  meanX /= sampleCount;
+  meanY /= sampleCount;
+
+  double sxx = 0, sxy = 0;
+  for (uint8_t i = 0; i < sampleCount; i++) {
+    double dx = (double)(samples[i].local_us - newest.local_us) - meanX;
+    double dy = (double)(samples[i].offset_us - newest.offset_us) - meanY;
+    sxx += dx * dx;
+    sxy += dx * dy;
+  }
+
+  double drift = sxx > 0 ? sxy / sxx : 0;
+  if (drift > TIME_SYNC_MAX_DRIFT) drift = TIME_SYNC_MAX_DRIFT;
+  if (drift < -TIME_SYNC_MAX_DRIFT) drift = -TIME_SYNC_MAX_DRIFT;
+
+  fitDrift = drift;
+  fitLocal = newest.local_us;
+  fitOffset = newest.offset_us + (int64_t)(meanY - drift * meanX);
+}
+
+static void addSample(int64_t localUs, int64_t masterUs) {
+  int64_t offset = masterUs - localUs;
+
+  if (sampleCount >= TIME_SYNC_MIN_SAMPLES) {
+    int64_t residual = offset - offsetAt(localUs);
+    lastResidual = (int32_t)residual;
+    if (residual > TIME_SYNC_OUTLIER_US || residual < -TIME_SYNC_OUTLIER_US) {
+      rejectedCount++;
+      if (++rejectRun < TIME_SYNC_RESET_REJECTS) return;
+      // The master's clock stepped; start over from this sample
+      LOG_WARN("[TIME] Master clock stepped, resynchronising");
+      sampleCount = 0;
+      sampleNext = 0;
+    }
+  }
+  rejectRun = 0;
+
+  samples[sampleNext] = {localUs, offset};
+  sampleNext = (sampleNext + 1) % TIME_SYNC_WINDOW;
+  if (sampleCount < TIME_SYNC_WINDOW) sampleCount++;
+  acceptedCount++;
+  refit();
+}
+
+bool timeSyncHandleFrame(const uint8_t* data, uint8_t length, int64_t rxLocalUs) {
+  if (length < 2) return false;
+
+  if (data[0] == LAVLI_CMD_TIME_SYNC) {
+    pendingSequence = data[1];
+    pendingRxUs = rxLocalUs;
+    pendingValid = true;
+    return true;
+  }
+
+  if (data[0] == LAVLI_CMD_TIME_FOLLOW_UP) {
+    // A follow-up without its SYNC (lost or filtered) is useless
+    if (length < 8 || !pendingValid || data[1] != pendingSequence) return true;
+    pendingValid = false;
+
+    int64_t masterUs = 0;
+    for (uint8_t i = 0; i < 6; i++) {
+      masterUs = (masterUs << 8) | data[2 + i];
+    }
+    addSample(pendingRxUs, masterUs);
+    return true;
+  }
+
+  return false;
+}
+
+bool timeSyncLocked() {
+  return sampleCount >= TIME_SYNC_MIN_SAMPLES;
+}
+
+int64_t timeSyncNowUs() {
+  int64_t local = esp_timer_get_time();
+  return local + offsetAt(local);
+}
+
+uint32_t timeSyncSampleStamp() {
+  if (!timeSyncLocked()) return 0;
+  uint32_t stamp = (uint32_t)timeSyncNowUs();
+  return stamp == 0 ? 1 : stamp;
+}
+
+void timeSyncPrint(Print& out) {
+  out.printf("[TIME] %s, %u samples in fit, %lu accepted, %lu rejected\n",
+             timeSyncLocked() ? "locked" : "not locked", sampleCount,
+             (unsigned long)acceptedCount, (unsigned long)rejectedCount);
+  if (timeSyncLocked()) {
+    out.printf("[TIME] Offset %lld us, drift %.2f ppm, last residual %ld us\n",
+               (long long)offsetAt(esp_timer_get_time()), fitDrift * 1e6, (long)lastResidual);
+  }
+}
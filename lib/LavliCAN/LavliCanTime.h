@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+#include "LavliCanIds.h"
+
+// Bus-wide time synchronisation
+//
+// Two-step sync in the style of gPTP: the master broadcasts a SYNC frame on
+// the time class, waits for the controller to finish sending it, stamps that
+// moment with esp_timer and broadcasts the stamp in a FOLLOW_UP. A node stamps
+// the SYNC when it takes it off the bus, so each pair gives one sample of
+// (master time - local time) that does not depend on how long the master's
+// transmit or the node's loop took, only on how quickly each side notices
+// the end of the frame.
+//
+//   SYNC       [0x09, seq]
+//   FOLLOW_UP  [0x0C, seq, master us bits 47..0, big endian]
+//
+// Nodes fit offset and drift to the last TIME_SYNC_WINDOW samples with a
+// least-squares line, so between syncs the estimate follows the crystal
+// error instead of jumping once a second. A sample that disagrees with the
+// fit by more than TIME_SYNC_OUTLIER_US (a late stamp) is dropped;
+// TIME_SYNC_RESET_REJECTS in a row mean the master's clock stepped (e.g. it
+// rebooted) and the fit starts over.
+//
+// Samples carry the low 32 bits of master time in us (wraps every ~71 min);
+// the master rebuilds the full value from its own clock. 0 means "not
+// synced", and the master falls back to its receive time.
+
+#define LAVLI_CMD_TIME_FOLLOW_UP   0x0C
+
+#define TIME_SYNC_WINDOW           8
+#define TIME_SYNC_MIN_SAMPLES      2      // Samples needed before stamping
+#define TIME_SYNC_OUTLIER_US       500
+#define TIME_SYNC_RESET_REJECTS    3
+#define TIME_SYNC_TX_WAIT_US       2000   // Longest wait for the SYNC to leave
+
+// Master: one SYNC + FOLLOW_UP round to the given node or group. Skips the
+// round (returns false) if the TX queue is busy or the SYNC is not sent in
+// time, since the stamp would then be late.
+bool timeSyncSendRound(uint8_t target);
+
+// Node: feed SYNC and FOLLOW_UP frames with the local esp_timer time at
+// which the frame was received. Returns true if the frame was a sync frame.
+bool timeSyncHandleFrame(const uint8_t* data, uint8_t length, int64_t rxLocalUs);
+bool timeSyncLocked();
+// Master time now, in us; only meaningful when timeSyncLocked()
+int64_t timeSyncNowUs();
+// Low 32 bits of master time for a sample taken now, 0 if not synced
+uint32_t timeSyncSampleStamp();
+void timeSyncPrint(Print& out);
+
+// Master: full master time for a 32-bit sample stamp taken in the past
+static inline int64_t timeSyncExpandStamp(uint32_t stamp, int64_t nowUs) {
+  return nowUs - (uint32_t)((uint32_t)nowUs - stamp);
+}
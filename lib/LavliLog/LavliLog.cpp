@@ -0,0 +1,161 @@
+#include "LavliLog.h"
+#include <atomic>
+
+// Bounded MPSC ring (Vyukov): a slot at index i is free for the producer at
+// position N when its sequence is N and holds a record for the consumer when
+// it is N + 1. Producers claim positions with a CAS, so tasks on either core
+// can log without a lock; only the drain task consumes. Sequences are stored
+// relative to the slot index so the zero-initialised ring is already valid
+// and records can be logged before logBegin().
+struct LogSlot {
+  std::atomic<uint32_t> sequence;
+  LogRecord record;
+};
+
+static LogSlot slots[LOG_RING_SIZE];
+static std::atomic<uint32_t> enqueuePos(0);
+static uint32_t dequeuePos = 0;
+static std::atomic<uint32_t> droppedCount(0);
+static uint32_t droppedReported = 0;
+static std::atomic<bool> draining(false);
+static Print* output = &Serial;
+static TaskHandle_t drainTaskHandle = NULL;
+
+static const char levelTags[] = {'-', 'E', 'W', 'I', 'D'};
+
+static inline uint32_t slotSequence(uint32_t index) {
+  return slots[index].sequence.load(std::memory_order_acquire) + index;
+}
+
+static inline void setSlotSequence(uint32_t index, uint32_t sequence) {
+  slots[index].sequence.store(sequence - index, std::memory_order_release);
+}
+
+LogRecord* logClaim() {
+  uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+  for (;;) {
+    uint32_t index = pos & (LOG_RING_SIZE - 1);
+    int32_t diff = (int32_t)(slotSequence(index) - pos);
+    if (diff == 0) {
+      if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        slots[index].record.timestamp_ms = millis();
+        return &slots[index].record;
+      }
+    } else if (diff < 0) {
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    } else {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void logCommit(LogRecord* record) {
+  uint32_t index = reinterpret_cast<LogSlot*>(reinterpret_cast<uint8_t*>(record) - offsetof(LogSlot, record)) - slots;
+  setSlotSequence(index, slotSequence(index) + 1);
+}
+
+void logFrame(uint8_t level, const char* label, uint32_t id, const uint8_t* data, uint8_t length) {
+  LogRecord* record = logClaim();
+  if (!record) return;
+
+  if (length > 8) length = 8;
+  record->level = level;
+  record->kind = LOG_KIND_FRAME;
+  record->fmt = label;
+  record->id = id;
+  record->count = length;
+  memcpy(record->bytes, data, length);
+  logCommit(record);
+}
+
+void logBytes(uint8_t level, const char* label, const uint8_t* data, size_t length) {
+  LogRecord* record = logClaim();
+  if (!record) return;
+
+  uint8_t kept = length > LOG_MAX_BYTES ? LOG_MAX_BYTES : length;
+  record->level = level;
+  record->kind = LOG_KIND_BYTES;
+  record->fmt = label;
+  record->id = length;
+  record->count = kept;
+  memcpy(record->bytes, data, kept);
+  logCommit(record);
+}
+
+static void printRecord(const LogRecord& record) {
+  char tag = record.level < sizeof(levelTags) ? levelTags[record.level] : '?';
+  output->printf("%lu %c ", (unsigned long)record.timestamp_ms, tag);
+
+  switch (record.kind) {
+    case LOG_KIND_FORMAT:
+      output->printf(record.fmt, record.args[0], record.args[1], record.args[2], record.args[3]);
+      break;
+
+    case LOG_KIND_FRAME:
+      output->printf("[CAN] %s 0x%03lX:", record.fmt, (unsigned long)record.id);
+      for (uint8_t i = 0; i < record.count; i++) {
+        output->printf(" %02X", record.bytes[i]);
+      }
+      break;
+
+    case LOG_KIND_BYTES:
+      output->printf("%s (%lu bytes):", record.fmt, (unsigned long)record.id);
+      for (uint8_t i = 0; i < record.count; i++) {
+        output->printf(" %02X", record.bytes[i]);
+      }
+      if (record.id > record.count) output->print(" ...");
+      break;
+  }
+  output->println();
+}
+
+// Prints queued records; returns false if another task is already draining
+static bool drainRing() {
+  if (draining.exchange(true, std::memory_order_acquire)) return false;
+
+  for (;;) {
+    uint32_t index = dequeuePos & (LOG_RING_SIZE - 1);
+    if (slotSequence(index) != dequeuePos + 1) break;
+
+    printRecord(slots[index].record);
+    setSlotSequence(index, dequeuePos + LOG_RING_SIZE);
+    dequeuePos++;
+  }
+
+  uint32_t dropped = droppedCount.load(std::memory_order_relaxed);
+  if (dropped != droppedReported) {
+    output->printf("[LOG] %lu records dropped\n", (unsigned long)(dropped - droppedReported));
+    droppedReported = dropped;
+  }
+
+  draining.store(false, std::memory_order_release);
+  return true;
+}
+
+static void drainTask(void* param) {
+  for (;;) {
+    drainRing();
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD_MS));
+  }
+}
+
+void logBegin(Print& out) {
+  output = &out;
+  if (drainTaskHandle) return;
+
+  if (xTaskCreate(drainTask, "log", LOG_TASK_STACK, NULL, LOG_TASK_PRIORITY, &drainTaskHandle) != pdPASS) {
+    out.println("[LOG] Failed to start drain task");
+    drainTaskHandle = NULL;
+  }
+}
+
+void logFlush() {
+  while (!drainRing()) {
+    vTaskDelay(1);
+  }
+}
+
+uint32_t logDroppedCount() {
+  return droppedCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Asynchronous logger
+//
+// Log calls copy a format pointer and up to four integer arguments (or a
+// short byte payload) into a lock-free ring and return; a low-priority task
+// formats and prints the records. A full ring drops the record and counts it
+// rather than blocking the caller, so logging never stalls CAN or MQTT work.
+//
+// Levels above LAVLI_LOG_LEVEL compile to nothing. Format strings must be
+// literals and arguments are captured as uint32_t and formatted later, so
+// only integer conversions (%d, %u, %X, %c) are supported, plus %s for
+// string literals. No floats, and no %s on buffers that may change.
+//
+//   LOG_INFO("[CAN] Port %d activated", port);
+//   LOG_CAN_RX(message);
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LAVLI_LOG_LEVEL
+#define LAVLI_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE      128   // Records, must be a power of two
+#define LOG_MAX_ARGS       4
+#define LOG_MAX_BYTES      16    // Payload bytes kept for LOG_CAN_* / LOG_HEX
+#define LOG_DRAIN_PERIOD_MS 20
+#define LOG_TASK_PRIORITY  1
+#define LOG_TASK_STACK     3072
+
+enum LogRecordKind : uint8_t {
+  LOG_KIND_FORMAT,    // fmt + args
+  LOG_KIND_FRAME,     // fmt is a label, id is a CAN identifier, bytes are the data
+  LOG_KIND_BYTES      // fmt is a label, id is the original length, bytes are the first LOG_MAX_BYTES
+};
+
+struct LogRecord {
+  uint32_t timestamp_ms;
+  const char* fmt;
+  uint32_t id;
+  uint8_t level;
+  uint8_t kind;
+  uint8_t count;      // Argument count or payload length
+  union {
+    uint32_t args[LOG_MAX_ARGS];
+    uint8_t bytes[LOG_MAX_BYTES];
+  };
+};
+
+// Starts the drain task; records logged before this are kept until the ring fills
+void logBegin(Print& out = Serial);
+// Prints everything queued so far from the calling task (e.g. before a restart)
+void logFlush();
+uint32_t logDroppedCount();
+
+// Claims a ring slot, or returns NULL (and counts a drop) when the ring is full.
+// logCommit() must follow every successful logClaim().
+LogRecord* logClaim();
+void logCommit(LogRecord* record);
+
+void logFrame(uint8_t level, const char* label, uint32_t id, const uint8_t* data, uint8_t length);
+void logBytes(uint8_t level, const char* label, const uint8_t* data, size_t length);
+
+// Integers are captured by value; pointers only make sense for literals
+inline uint32_t logArg(const char* text) { return (uint32_t)(uintptr_t)text; }
+template <typename T>
+inline uint32_t logArg(T value) { return static_cast<uint32_t>(value); }
+
+template <typename... Args>
+inline void logWrite(uint8_t level, const char* fmt, Args... args) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "log records carry at most 4 arguments");
+  LogRecord* record = logClaim();
+  if (!record) return;
+
+  record->level = level;
+  record->kind = LOG_KIND_FORMAT;
+  record->fmt = fmt;
+  record->count = sizeof...(Args);
+  uint32_t values[] = {0, logArg(args)...};
+  for (uint8_t i = 0; i < sizeof...(Args); i++) {
+    record->args[i] = values[i + 1];
+  }
+  logCommit(record);
+}
+
+#if LAVLI_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LAVLI_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LAVLI_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LAVLI_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+// Frame and payload dumps are debug output
+#define LOG_CAN_RX(msg) logFrame(LOG_LEVEL_DEBUG, "RX", (msg).identifier, (msg).data, (msg).data_length_code)
+#define LOG_CAN_TX(msg) logFrame(LOG_LEVEL_DEBUG, "TX", (msg).identifier, (msg).data, (msg).data_length_code)
+#define LOG_HEX(label, data, length) logBytes(LOG_LEVEL_DEBUG, label, data, length)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#define LOG_CAN_RX(msg) do {} while (0)
+#define LOG_CAN_TX(msg) do {} while (0)
+#define LOG_HEX(label, data, length) do {} while (0)
+#endif
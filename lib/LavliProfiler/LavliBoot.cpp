@@ -0,0 +1,64 @@
+#include "LavliBoot.h"
+#include <esp_timer.h>
+#include <esp_system.h>
+
+struct BootMark {
+  const char* name;
+  uint32_t us;
+};
+
+static BootMark marks[BOOT_MAX_PHASES];
+static uint8_t markCount = 0;
+static uint32_t canReadyUs = 0;
+
+void bootPhase(const char* name) {
+  if (markCount >= BOOT_MAX_PHASES) return;
+  marks[markCount].name = name;
+  marks[markCount].us = esp_timer_get_time();
+  markCount++;
+}
+
+void bootCanReady() {
+  if (canReadyUs == 0) canReadyUs = esp_timer_get_time();
+}
+
+uint32_t bootCanReadyMs() {
+  return canReadyUs / 1000;
+}
+
+uint32_t bootSetupMs() {
+  return markCount ? marks[markCount - 1].us / 1000 : 0;
+}
+
+uint8_t bootResetReason() {
+  return esp_reset_reason();
+}
+
+const char* bootResetReasonName(uint8_t reason) {
+  switch (reason) {
+    case ESP_RST_POWERON:   return "power on";
+    case ESP_RST_EXT:       return "reset pin";
+    case ESP_RST_SW:        return "software";
+    case ESP_RST_PANIC:     return "panic";
+    case ESP_RST_INT_WDT:   return "interrupt watchdog";
+    case ESP_RST_TASK_WDT:  return "task watchdog";
+    case ESP_RST_WDT:       return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deep sleep";
+    case ESP_RST_BROWNOUT:  return "brownout";
+    default:                return "unknown";
+  }
+}
+
+void bootPrint(Print& out) {
+  out.printf("\n=== Boot (%s reset) ===\n", bootResetReasonName(bootResetReason()));
+  uint32_t previous = 0;
+  for (uint8_t i = 0; i < markCount; i++) {
+    out.printf("  %-12s %6lu us  (at %lu ms)\n", marks[i].name, (unsigned long)(marks[i].us - previous),
+               (unsigned long)(marks[i].us / 1000));
+    previous = marks[i].us;
+  }
+  if (canReadyUs) {
+    out.printf("  CAN ready at %lu ms\n", (unsigned long)(canReadyUs / 1000));
+  }
+  out.println("=========================\n");
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Boot phase timing
+//
+// setup() marks the end of each phase; the time of every mark is taken from
+// esp_timer, which starts with the application, so the ROM and second-stage
+// bootloader (roughly 100-300 ms depending on flash settings) come on top.
+//
+//   bootPhase("pins");
+//   initializeCAN();
+//   bootPhase("can");
+//   bootCanReady();            // the node now accepts commands, e.g. STOP_ALL
+//   ...
+//   bootPhase("setup");
+//   bootPrint(Serial);         // or later, from a serial command
+//
+// Nodes report bootCanReadyMs() and the reset reason to the master in a
+// boot frame (heartbeatBootReport()), so slow or brownout restarts show up
+// without a serial cable.
+
+#define BOOT_MAX_PHASES 12
+
+void bootPhase(const char* name);
+void bootCanReady();
+// Milliseconds from application start; 0 until marked
+uint32_t bootCanReadyMs();
+uint32_t bootSetupMs();     // End of the last phase
+uint8_t bootResetReason();  // esp_reset_reason_t
+const char* bootResetReasonName(uint8_t reason);
+void bootPrint(Print& out);
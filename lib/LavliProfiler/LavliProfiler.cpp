@@ -0,0 +1,105 @@
+#include "LavliProfiler.h"
+
+static ProfilerSection sections[PROFILER_MAX_SECTIONS];
+static uint8_t sectionCount = 0;
+static uint32_t cyclesPerMicro = 0;
+static unsigned long windowStart = 0;
+
+uint8_t profilerRegister(const char* name) {
+  for (uint8_t i = 0; i < sectionCount; i++) {
+    if (strcmp(sections[i].name, name) == 0) return i;
+  }
+  if (sectionCount >= PROFILER_MAX_SECTIONS) return PROFILER_INVALID_ID;
+
+  if (cyclesPerMicro == 0) {
+    cyclesPerMicro = ESP.getCpuFreqMHz();
+    windowStart = millis();
+  }
+
+  ProfilerSection& section = sections[sectionCount];
+  memset(&section, 0, sizeof(section));
+  section.name = name;
+  section.min_cycles = UINT32_MAX;
+  return sectionCount++;
+}
+
+void profilerRecord(uint8_t id, uint32_t cycles) {
+  if (id >= sectionCount) return;
+
+  ProfilerSection& section = sections[id];
+  section.count++;
+  section.total_cycles += cycles;
+  if (cycles < section.min_cycles) section.min_cycles = cycles;
+  if (cycles > section.max_cycles) section.max_cycles = cycles;
+
+  uint32_t us = cycles / cyclesPerMicro;
+  uint8_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+  if (bucket >= PROFILER_BUCKETS) bucket = PROFILER_BUCKETS - 1;
+  section.buckets[bucket]++;
+}
+
+void profilerReset() {
+  for (uint8_t i = 0; i < sectionCount; i++) {
+    ProfilerSection& section = sections[i];
+    section.count = 0;
+    section.total_cycles = 0;
+    section.min_cycles = UINT32_MAX;
+    section.max_cycles = 0;
+    memset(section.buckets, 0, sizeof(section.buckets));
+  }
+  windowStart = millis();
+}
+
+// Upper bound (us) of the bucket holding the given percentile
+static uint32_t percentileUs(const ProfilerSection& section, uint8_t percent) {
+  if (section.count == 0) return 0;
+  uint32_t target = ((uint64_t)section.count * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < PROFILER_BUCKETS; b++) {
+    seen += section.buckets[b];
+    if (seen >= target) return 1UL << b;
+  }
+  return 1UL << (PROFILER_BUCKETS - 1);
+}
+
+void profilerPrint(Print& out) {
+  out.printf("\n=== Profile (%lu ms window, %lu MHz) ===\n", millis() - windowStart, (unsigned long)cyclesPerMicro);
+  out.println("  Section         Count     Avg us   Min us   Max us   p50<us   p99<us");
+  for (uint8_t i = 0; i < sectionCount; i++) {
+    const ProfilerSection& section = sections[i];
+    if (section.count == 0) {
+      out.printf("  %-15s 0\n", section.name);
+      continue;
+    }
+    uint32_t avg = (uint32_t)(section.total_cycles / section.count / cyclesPerMicro);
+    out.printf("  %-15s %-9lu %-8lu %-8lu %-8lu %-8lu %lu\n",
+               section.name, (unsigned long)section.count, (unsigned long)avg,
+               (unsigned long)(section.min_cycles / cyclesPerMicro),
+               (unsigned long)(section.max_cycles / cyclesPerMicro),
+               (unsigned long)percentileUs(section, 50), (unsigned long)percentileUs(section, 99));
+  }
+  out.println("================================\n");
+}
+
+size_t profilerToJson(char* buffer, size_t size) {
+  size_t used = snprintf(buffer, size, "{\"window_ms\":%lu,\"mhz\":%lu,\"sections\":[",
+                         millis() - windowStart, (unsigned long)cyclesPerMicro);
+
+  for (uint8_t i = 0; i < sectionCount && used < size; i++) {
+    const ProfilerSection& section = sections[i];
+    uint32_t avg = section.count ? (uint32_t)(section.total_cycles / section.count / cyclesPerMicro) : 0;
+    uint32_t minUs = section.count ? section.min_cycles / cyclesPerMicro : 0;
+    used += snprintf(buffer + used, size - used,
+                     "%s{\"name\":\"%s\",\"count\":%lu,\"avg_us\":%lu,\"min_us\":%lu,\"max_us\":%lu,\"hist\":[",
+                     i ? "," : "", section.name, (unsigned long)section.count, (unsigned long)avg,
+                     (unsigned long)minUs, (unsigned long)(section.max_cycles / cyclesPerMicro));
+    for (uint8_t b = 0; b < PROFILER_BUCKETS && used < size; b++) {
+      used += snprintf(buffer + used, size - used, "%s%lu", b ? "," : "", (unsigned long)section.buckets[b]);
+    }
+    if (used < size) used += snprintf(buffer + used, size - used, "]}");
+  }
+  if (used < size) used += snprintf(buffer + used, size - used, "]}");
+
+  // Truncated output is not valid JSON; report nothing rather than garbage
+  return used < size ? used : 0;
+}
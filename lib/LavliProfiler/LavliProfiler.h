@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Section profiler
+//
+// Times named code sections with the CPU cycle counter and folds each sample
+// into a fixed log2 histogram (bucket N holds samples of [2^(N-1), 2^N) us).
+// Recording is a cycle-count read, a subtraction and a few increments, so it
+// is cheap enough to leave in hot paths.
+//
+// Build with -DLAVLI_PROFILING=0 to compile every PROFILE_* macro out.
+//
+//   void receiveCANMessages() {
+//     PROFILE_SCOPE("can_rx");
+//     ...
+//   }
+
+#ifndef LAVLI_PROFILING
+#define LAVLI_PROFILING 1
+#endif
+
+#define PROFILER_MAX_SECTIONS 24
+#define PROFILER_BUCKETS      16    // <1us, <2us, <4us ... >=16ms
+#define PROFILER_INVALID_ID   0xFF
+
+struct ProfilerSection {
+  const char* name;
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t buckets[PROFILER_BUCKETS];
+};
+
+uint8_t profilerRegister(const char* name);
+void profilerRecord(uint8_t id, uint32_t cycles);
+void profilerReset();
+void profilerPrint(Print& out);
+size_t profilerToJson(char* buffer, size_t size);
+
+static inline uint32_t profilerCycles() {
+  return ESP.getCycleCount();
+}
+
+class ProfilerScope {
+ public:
+  explicit ProfilerScope(uint8_t id) : id_(id), start_(profilerCycles()) {}
+  ~ProfilerScope() { profilerRecord(id_, profilerCycles() - start_); }
+
+ private:
+  uint8_t id_;
+  uint32_t start_;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if LAVLI_PROFILING
+// Registers on first use and times the rest of the enclosing scope
+#define PROFILE_SCOPE(name) \
+  static const uint8_t PROFILE_CONCAT(_profileId, __LINE__) = profilerRegister(name); \
+  ProfilerScope PROFILE_CONCAT(_profileScope, __LINE__)(PROFILE_CONCAT(_profileId, __LINE__))
+// Times the rest of the enclosing scope against an id from PROFILE_REGISTER()
+#define PROFILE_SCOPE_ID(id) ProfilerScope PROFILE_CONCAT(_profileScope, __LINE__)(id)
+#define PROFILE_REGISTER(name) profilerRegister(name)
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_SCOPE_ID(id) do {} while (0)
+#define PROFILE_REGISTER(name) PROFILER_INVALID_ID
+#endif
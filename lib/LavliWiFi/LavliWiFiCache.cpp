@@ -0,0 +1,224 @@
+#include "LavliWiFiCache.h"
+#include <Preferences.h>
+#include <LavliLog.h>
+
+#define NVS_NAMESPACE "wifi_cache"
+
+enum WiFiCacheState {
+  WIFI_CACHE_IDLE,
+  WIFI_CACHE_FAST,        // Directed connect to the cached AP
+  WIFI_CACHE_FULL,        // Scan and DHCP
+  WIFI_CACHE_CONNECTED,
+};
+
+struct WiFiCacheEntry {
+  char ssid[33];
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+static const char* ssid = NULL;
+static const char* password = NULL;
+static WiFiCacheState state = WIFI_CACHE_IDLE;
+static WiFiCacheEntry cache;
+static bool cacheValid = false;
+
+static bool staticIp = false;
+static IPAddress fixedIp, fixedGateway, fixedSubnet, fixedDns;
+
+static WiFiConnectTimes times;
+static unsigned long attemptStart = 0;
+static unsigned long lostSince = 0;
+static volatile uint32_t associatedAt = 0;   // Set from the WiFi event task
+static volatile uint32_t gotIpAt = 0;
+static wifi_event_id_t eventId = 0;
+static bool eventRegistered = false;
+
+static void onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+    associatedAt = millis();
+  } else if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    gotIpAt = millis();
+  }
+}
+
+static void loadCache() {
+  Preferences prefs;
+  cacheValid = false;
+  if (!prefs.begin(NVS_NAMESPACE, true)) return;
+  cacheValid = prefs.getBytes("entry", &cache, sizeof(cache)) == sizeof(cache) && strcmp(cache.ssid, ssid) == 0 &&
+               cache.channel != 0;
+  prefs.end();
+}
+
+// Only writes when something changed, so a normal boot costs no flash wear
+static void saveCache() {
+  WiFiCacheEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  strlcpy(entry.ssid, ssid, sizeof(entry.ssid));
+  uint8_t* bssid = WiFi.BSSID();
+  if (bssid) memcpy(entry.bssid, bssid, sizeof(entry.bssid));
+  entry.channel = WiFi.channel();
+  entry.ip = (uint32_t)WiFi.localIP();
+  entry.gateway = (uint32_t)WiFi.gatewayIP();
+  entry.subnet = (uint32_t)WiFi.subnetMask();
+  entry.dns = (uint32_t)WiFi.dnsIP();
+
+  if (cacheValid && memcmp(&entry, &cache, sizeof(entry)) == 0) return;
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) return;
+  prefs.putBytes("entry", &entry, sizeof(entry));
+  prefs.end();
+  cache = entry;
+  cacheValid = true;
+  LOG_INFO("[WIFI] Cached access point on channel %d", entry.channel);
+}
+
+static void startAttempt(bool fast) {
+  WiFi.disconnect();
+  associatedAt = 0;
+  gotIpAt = 0;
+  attemptStart = millis();
+  times.fast = fast;
+  times.attempts++;
+  times.associated_ms = 0;
+  times.ip_ms = 0;
+
+  if (staticIp) {
+    WiFi.config(fixedIp, fixedGateway, fixedSubnet, fixedDns);
+  } else if (fast && WIFI_CACHE_REUSE_LEASE && cache.ip != 0) {
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+  } else {
+    // All zeros switches the DHCP client back on
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  }
+
+  if (fast) {
+    LOG_INFO("[WIFI] Connecting to the cached access point on channel %d", cache.channel);
+    WiFi.begin(ssid, password, cache.channel, cache.bssid);
+    state = WIFI_CACHE_FAST;
+  } else {
+    LOG_INFO("[WIFI] Scanning for the network");
+    WiFi.begin(ssid, password);
+    state = WIFI_CACHE_FULL;
+  }
+}
+
+void wifiCacheBegin(const char* networkSsid, const char* networkPassword) {
+  ssid = networkSsid;
+  password = networkPassword;
+  memset(&times, 0, sizeof(times));
+
+  // The driver's own copy of the config would cost a flash write per begin()
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  // begin() can be called again after wifiCacheEnd() or for new credentials;
+  // a second registration would see every event twice
+  if (!eventRegistered) {
+    eventId = WiFi.onEvent(onWiFiEvent);
+    eventRegistered = true;
+  }
+
+  loadCache();
+  startAttempt(cacheValid);
+}
+
+void wifiCacheSetStaticIp(const IPAddress& ip, const IPAddress& gateway, const IPAddress& subnet,
+                          const IPAddress& dns) {
+  staticIp = true;
+  fixedIp = ip;
+  fixedGateway = gateway;
+  fixedSubnet = subnet;
+  fixedDns = dns;
+}
+
+bool wifiCacheService() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+
+  switch (state) {
+    case WIFI_CACHE_IDLE:
+      return false;
+
+    case WIFI_CACHE_FAST:
+    case WIFI_CACHE_FULL:
+      if (associatedAt && !times.associated_ms) times.associated_ms = associatedAt - attemptStart;
+      if (connected) {
+        times.ip_ms = (gotIpAt ? gotIpAt : millis()) - attemptStart;
+        times.rssi = WiFi.RSSI();
+        state = WIFI_CACHE_CONNECTED;
+        LOG_INFO("[WIFI] Connected: associated in %d ms, IP in %d ms (%s)", times.associated_ms, times.ip_ms,
+                 times.fast ? "cached AP" : "scan");
+        saveCache();
+        times.attempts = 0;
+        return true;
+      }
+      if (state == WIFI_CACHE_FAST && millis() - attemptStart > WIFI_FAST_TIMEOUT_MS) {
+        LOG_WARN("[WIFI] Cached access point did not answer, scanning");
+        cacheValid = false;
+        startAttempt(false);
+      } else if (state == WIFI_CACHE_FULL && millis() - attemptStart > WIFI_FULL_TIMEOUT_MS) {
+        LOG_WARN("[WIFI] No connection after %d ms, starting over", WIFI_FULL_TIMEOUT_MS);
+        startAttempt(false);
+      }
+      return false;
+
+    case WIFI_CACHE_CONNECTED:
+      if (connected) {
+        lostSince = 0;
+        return true;
+      }
+      // Give the driver's reconnect a moment, then go through the cache again
+      if (lostSince == 0) {
+        lostSince = millis();
+        LOG_WARN("[WIFI] Connection lost");
+      } else if (millis() - lostSince > WIFI_LOST_GRACE_MS) {
+        lostSince = 0;
+        startAttempt(cacheValid);
+      }
+      return false;
+  }
+  return false;
+}
+
+WiFiConnectTimes wifiCacheTimes() {
+  return times;
+}
+
+void wifiCacheEnd() {
+  state = WIFI_CACHE_IDLE;
+  lostSince = 0;
+  if (eventRegistered) {
+    WiFi.removeEvent(eventId);
+    eventRegistered = false;
+  }
+  WiFi.disconnect();
+}
+
+void wifiCacheClear() {
+  Preferences prefs;
+  if (prefs.begin(NVS_NAMESPACE, false)) {
+    prefs.clear();
+    prefs.end();
+  }
+  cacheValid = false;
+}
+
+void wifiCachePrint(Print& out) {
+  static const char* names[] = {"idle", "connecting (cached AP)", "connecting (scan)", "connected"};
+  out.printf("\n=== WiFi: %s ===\n", names[state]);
+  if (cacheValid) {
+    out.printf("  Cached AP %02X:%02X:%02X:%02X:%02X:%02X channel %d, IP %s%s\n", cache.bssid[0], cache.bssid[1],
+               cache.bssid[2], cache.bssid[3], cache.bssid[4], cache.bssid[5], cache.channel,
+               IPAddress(cache.ip).toString().c_str(), WIFI_CACHE_REUSE_LEASE ? " (reused)" : "");
+  } else {
+    out.println("  No cached access point");
+  }
+  if (staticIp) out.printf("  Static IP %s\n", fixedIp.toString().c_str());
+  out.printf("  Last connect: %s, associated %lu ms, IP %lu ms, RSSI %d dBm\n", times.fast ? "cached AP" : "scan",
+             (unsigned long)times.associated_ms, (unsigned long)times.ip_ms, times.rssi);
+  out.println("=========================\n");
+}
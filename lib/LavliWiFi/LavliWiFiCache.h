@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Fast WiFi connect from a cached access point
+//
+// A plain WiFi.begin(ssid, password) scans every channel and then waits for
+// DHCP, which takes a few seconds on every boot. After each successful
+// connection the BSSID, channel and IP settings are cached in NVS; the next
+// connect goes straight to that access point on that channel, which skips
+// the scan and usually completes in well under a second. If it has not connected within WIFI_FAST_TIMEOUT_MS
+// (the access point moved channel, the router was replaced...) the cache
+// is dropped and a normal scan and DHCP connect follows.
+//
+// DHCP still runs on every connect. WIFI_CACHE_REUSE_LEASE 1 configures the
+// cached address statically instead and saves the DHCP exchange, but the
+// router then never sees the lease renewed and may hand the address to
+// another device once it expires. Only turn it on where the router reserves
+// the address for this MAC; a fixed address given with
+// wifiCacheSetStaticIp() is always used instead.
+//
+// Nothing blocks: wifiCacheBegin() starts the attempt and wifiCacheService()
+// moves it along from loop() or a scheduler task, retrying for as long as it
+// takes. Each attempt's phases are timed:
+//
+//   wifiCacheBegin(WIFI_SSID, WIFI_PASSWORD);
+//   ...
+//   if (wifiCacheService()) { /* connected */ }
+//   wifiCacheTimes().ip_ms;      // start of the attempt to an IP address
+
+#ifndef WIFI_CACHE_REUSE_LEASE
+#define WIFI_CACHE_REUSE_LEASE 0
+#endif
+
+#define WIFI_FAST_TIMEOUT_MS   2000    // Cached AP only; a good one answers in < 500 ms
+#define WIFI_FULL_TIMEOUT_MS   15000   // Scan + DHCP before starting over
+#define WIFI_LOST_GRACE_MS     3000    // Left to the driver's own reconnect after a drop
+
+struct WiFiConnectTimes {
+  bool fast;              // Connected through the cache
+  uint32_t attempts;      // Connects started since the last success
+  uint32_t associated_ms; // Attempt start to association, 0 while pending
+  uint32_t ip_ms;         // Attempt start to an IP address, 0 while pending
+  int8_t rssi;
+};
+
+void wifiCacheBegin(const char* ssid, const char* password);
+// Fixed address for every connect instead of DHCP or the cached lease
+void wifiCacheSetStaticIp(const IPAddress& ip, const IPAddress& gateway, const IPAddress& subnet,
+                          const IPAddress& dns);
+// Runs the connect state machine; returns true while connected
+bool wifiCacheService();
+// Timing of the last successful connect (or the one in progress)
+WiFiConnectTimes wifiCacheTimes();
+// Stops connecting (or disconnects) until the next wifiCacheBegin()
+void wifiCacheEnd();
+void wifiCacheClear();
+void wifiCachePrint(Print& out);